@@ -7,6 +7,7 @@
 
 
 #include "stm32f3xx_hal.h"
+#include "audio.h"
 
 extern I2S_HandleTypeDef hi2s3;
 
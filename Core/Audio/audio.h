@@ -0,0 +1,15 @@
+/*
+ * audio.h
+ *
+ * I2S3 audio output.
+ *
+ *  Created on: Jan 29, 2020
+ *      Author: Chris
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+void test2(void); // A triangle wave out of I2S3, over and over
+
+#endif // AUDIO_H
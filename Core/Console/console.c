@@ -3,6 +3,7 @@
 // to be called from the normal loop. Note that adding commands should
 // be done in console commands.
 
+#include <stdio.h>
 #include <string.h>  // for NULL
 #include <stdlib.h>  // for atoi and itoa (though this code implement a version of that)
 #include <stdbool.h>
@@ -26,7 +27,8 @@ uint32_t mReceivedSoFar;
 static int32_t ConsoleCommandEndline(const char receiveBuffer[],
 		const uint32_t filledLength);
 
-static uint32_t ConsoleCommandMatch(const char *name, const char *buffer);
+static int32_t ConsoleCommandFind(const sConsoleCommandTable_T commandTable[],
+		const uint32_t tableLength, const char *buffer);
 static eCommandResult_T ConsoleParamFindN(const char *buffer,
 		const uint8_t parameterNumber, uint32_t *startLocation);
 static uint32_t ConsoleResetBuffer(char receiveBuffer[],
@@ -35,28 +37,40 @@ static uint32_t ConsoleResetBuffer(char receiveBuffer[],
 static eCommandResult_T ConsoleUtilHexCharToInt(char charVal, uint8_t *pInt); // this might be replaceable with *pInt = atoi(str)
 static eCommandResult_T ConsoleUtilsIntToHexChar(uint8_t intVal, char *pChar); // this could be replaced with itoa (intVal, str, 16);
 
-// ConsoleCommandMatch
-// Look to see if the data in the buffer matches the command name given that
-// the strings are different lengths and we have parameter separators
-static uint32_t ConsoleCommandMatch(const char *name, const char *buffer) {
-	uint32_t i = 0u;
-	uint32_t result = 0u; // match
-
-	if (buffer[i] == name[i]) {
-		result = 1u;
-		i++;
+// ConsoleCommandFind
+// Binary search the command table, which is sorted by name, for the command at the
+// start of the buffer. The command ends at a parameter separator or the endline.
+// As before, a command can be shortened: if it isn't a whole name it finds the first
+// name it starts, since an exact match sorts ahead of any longer name it begins.
+static int32_t ConsoleCommandFind(const sConsoleCommandTable_T commandTable[],
+		const uint32_t tableLength, const char *buffer) {
+	uint32_t length = 0u;
+	uint32_t low = 0u;
+	uint32_t high = tableLength;
+	uint32_t middle;
+
+	while ((length < CONSOLE_COMMAND_MAX_LENGTH)
+			&& (buffer[length] != PARAMETER_SEPARATER) && (buffer[length] != LF_CHAR)
+			&& (buffer[length] != CR_CHAR) && (buffer[length] != (char) NULL_CHAR)) {
+		length++;
+	}
+	if (0u == length) {
+		return NOT_FOUND;
 	}
 
-	while ((1u == result) && (i < CONSOLE_COMMAND_MAX_COMMAND_LENGTH)
-			&& (buffer[i] != PARAMETER_SEPARATER) && (buffer[i] != LF_CHAR)
-			&& (buffer[i] != CR_CHAR) && (buffer[i] != (char) NULL_CHAR)) {
-		if (buffer[i] != name[i]) {
-			result = 0u;
+	// Find the first name that doesn't sort before the command
+	while (low < high) {
+		middle = (low + high) / 2u;
+		if (strncmp(commandTable[middle].name, buffer, length) < 0) {
+			low = middle + 1u;
+		} else {
+			high = middle;
 		}
-		i++;
 	}
-
-	return result;
+	if ((low < tableLength) && (0 == strncmp(commandTable[low].name, buffer, length))) {
+		return (int32_t) low;
+	}
+	return NOT_FOUND;
 }
 
 // ConsoleResetBuffer
@@ -99,12 +113,24 @@ static int32_t ConsoleCommandEndline(const char receiveBuffer[],
 // ConsoleInit
 // Initialize the console interface and all it depends on
 void ConsoleInit(UART_HandleTypeDef *uart) {
+	const sConsoleCommandTable_T *commandTable;
+	uint32_t tableLength;
 	uint32_t i;
 
 	ConsoleIoInit(uart);
 	ConsoleIoSendString(
 			"MIDI Thingy");
 	ConsoleIoSendString(STR_ENDLINE);
+
+	// ConsoleCommandFind needs the table in order, so point out a command added out of place
+	commandTable = ConsoleCommandsGetTable(&tableLength);
+	for (i = 1u; i < tableLength; i++) {
+		if (strcmp(commandTable[i - 1u].name, commandTable[i].name) >= 0) {
+			ConsoleIoSendString("Command table out of order at ");
+			ConsoleIoSendString(commandTable[i].name);
+			ConsoleIoSendString(STR_ENDLINE);
+		}
+	}
 	ConsoleIoSendString(CONSOLE_PROMPT);
 	mReceivedSoFar = 0u;
 
@@ -119,8 +145,8 @@ void ConsoleInit(UART_HandleTypeDef *uart) {
 // Call ConsoleProcess from a loop, it will handle commands as they become available
 void ConsoleProcess(void) {
 	const sConsoleCommandTable_T *commandTable;
+	uint32_t tableLength;
 	uint32_t received = 0;
-	uint32_t cmdIndex;
 	int32_t cmdEndline;
 	int32_t found;
 	eCommandResult_T result;
@@ -135,26 +161,17 @@ void ConsoleProcess(void) {
 			// Print a line feed.
 			printf("\n\r");
 
-			commandTable = ConsoleCommandsGetTable();
-			cmdIndex = 0u;
-			found = NOT_FOUND;
-			while (( NULL != commandTable[cmdIndex].name)
-					&& ( NOT_FOUND == found)) {
-				if (ConsoleCommandMatch(commandTable[cmdIndex].name,
-						mReceiveBuffer)) {
-					result = commandTable[cmdIndex].execute(mReceiveBuffer);
-					if (COMMAND_SUCCESS != result) {
-						ConsoleIoSendString("Error: ");
-						ConsoleIoSendString(mReceiveBuffer);
-
-						ConsoleIoSendString("Help: ");
-						ConsoleIoSendString(commandTable[cmdIndex].help);
-						ConsoleIoSendString(STR_ENDLINE);
-
-					}
-					found = cmdIndex;
-				} else {
-					cmdIndex++;
+			commandTable = ConsoleCommandsGetTable(&tableLength);
+			found = ConsoleCommandFind(commandTable, tableLength, mReceiveBuffer);
+			if (NOT_FOUND != found) {
+				result = commandTable[found].execute(mReceiveBuffer);
+				if (COMMAND_SUCCESS != result) {
+					ConsoleIoSendString("Error: ");
+					ConsoleIoSendString(mReceiveBuffer);
+
+					ConsoleIoSendString("Help: ");
+					ConsoleIoSendString(commandTable[found].help);
+					ConsoleIoSendString(STR_ENDLINE);
 
 				}
 			}
@@ -2,7 +2,7 @@
 // This is where you add commands:
 //		1. Add a protoype
 //			static eCommandResult_T ConsoleCommandVer(const char buffer[]);
-//		2. Add the command to mConsoleCommandTable
+//		2. Add the command to mConsoleCommandTable, keeping it sorted by name
 //		    {"ver", &ConsoleCommandVer, HELP("Get the version string")},
 //		3. Implement the function, using ConsoleReceiveParam<Type> to get the parameters from the buffer.
 
@@ -11,7 +11,16 @@
 #include "console.h"
 #include "consoleIo.h"
 #include "version.h"
-#include "../midi/midi.h"
+#include "../MIDI/midi.h"
+#include "midi_application.h"
+#include "log_ring.h"
+#include "../MIDI/midi_scheduler.h"
+#include "../MIDI/midi_clock.h"
+#include "../USB/usb_device.h"
+#include "../USB/usb_midi.h"
+#include "../USB/usb_cdc.h"
+#include "../Display/display.h"
+#include "../Audio/audio.h"
 
 #define IGNORE_UNUSED_VARIABLE(x)     if ( &x == &x ) {}
 
@@ -22,22 +31,52 @@ static eCommandResult_T ConsoleCommandMidiNoteOn(const char buffer[]);
 static eCommandResult_T ConsoleCommandMidiAllNotesOff(const char buffer[]);
 static eCommandResult_T ConsoleCommandMidiTestSequence(const char buffer[]);
 static eCommandResult_T ConsoleCommandMidiStats(const char buffer[]);
+static eCommandResult_T ConsoleCommandMidiLatency(const char buffer[]);
+static eCommandResult_T ConsoleCommandMidiMerge(const char buffer[]);
+static eCommandResult_T ConsoleCommandMidiSched(const char buffer[]);
+static eCommandResult_T ConsoleCommandMidiSysex(const char buffer[]);
+static eCommandResult_T ConsoleCommandMidiPanic(const char buffer[]);
+static eCommandResult_T ConsoleCommandClockStart(const char buffer[]);
+static eCommandResult_T ConsoleCommandClockStop(const char buffer[]);
+static eCommandResult_T ConsoleCommandClockContinue(const char buffer[]);
+static eCommandResult_T ConsoleCommandClockTempo(const char buffer[]);
+static eCommandResult_T ConsoleCommandClockStats(const char buffer[]);
+static eCommandResult_T ConsoleCommandSyncSource(const char buffer[]);
+static eCommandResult_T ConsoleCommandSyncStats(const char buffer[]);
+static eCommandResult_T ConsoleCommandUsbStats(const char buffer[]);
+static eCommandResult_T ConsoleCommandConsolePort(const char buffer[]);
+static eCommandResult_T ConsoleCommandLog(const char buffer[]);
 static eCommandResult_T ConsoleCommandDisplayInit(const char buffer[]);
 static eCommandResult_T ConsoleCommandAudioTest(const char buffer[]);
 
 
+// Sorted by name, in strcmp order (capitals first), for the binary search in console.c
 static const sConsoleCommandTable_T mConsoleCommandTable[] = {
 		{ ";", &ConsoleCommandComment, HELP(
 				"Comment! You do need a space after the semicolon. ") },
-		{ "help", &ConsoleCommandHelp, HELP("Lists the commands available") },
-		{ "ver", &ConsoleCommandVer, HELP("Get the version string") },
-		{ "MidiNoteOn", &ConsoleCommandMidiNoteOn, HELP("Play note with value") },
 		{ "MidiAllNotesOff", &ConsoleCommandMidiAllNotesOff, HELP("Turn off all notes") },
+		{ "MidiNoteOn", &ConsoleCommandMidiNoteOn, HELP("Play note with value") },
 		{ "MidiTestSeq", &ConsoleCommandMidiTestSequence, HELP("Play a test sequence of notes") },
-		{ "midistats", &ConsoleCommandMidiStats, HELP("Get MIDI tx/rx stats") },
-		{ "displayinit", &ConsoleCommandDisplayInit, HELP("Initialize display controller") },
 		{ "audiotest", &ConsoleCommandAudioTest, HELP("Test I2S output") },
-		CONSOLE_COMMAND_TABLE_END // must be LAST
+		{ "clockcont", &ConsoleCommandClockContinue, HELP("Send MIDI continue and resume the clock") },
+		{ "clockstart", &ConsoleCommandClockStart, HELP("Send MIDI start and run the clock from the top") },
+		{ "clockstats", &ConsoleCommandClockStats, HELP("Get MIDI clock state and jitter") },
+		{ "clockstop", &ConsoleCommandClockStop, HELP("Send MIDI stop and halt the clock") },
+		{ "clocktempo", &ConsoleCommandClockTempo, HELP("Set clock tempo in hundredths of a BPM, 12000 is 120 BPM") },
+		{ "consoleport", &ConsoleCommandConsolePort, HELP("Move the console, 0 UART, 1 USB serial; none for stats") },
+		{ "displayinit", &ConsoleCommandDisplayInit, HELP("Initialize display controller") },
+		{ "help", &ConsoleCommandHelp, HELP("Lists the commands available") },
+		{ "log", &ConsoleCommandLog, HELP("Turn the trace log off (0, the default) or on (1); none for stats") },
+		{ "midilatency", &ConsoleCommandMidiLatency, HELP("Dump and reset a port's MIDI timing histograms") },
+		{ "midimerge", &ConsoleCommandMidiMerge, HELP("Get MIDI merge per-input and routing stats") },
+		{ "midipanic", &ConsoleCommandMidiPanic, HELP("Turn off sounding notes on a port, default all ports") },
+		{ "midisched", &ConsoleCommandMidiSched, HELP("Get MIDI scheduler stats") },
+		{ "midistats", &ConsoleCommandMidiStats, HELP("Get MIDI tx/rx stats for a port, default 0") },
+		{ "midisysex", &ConsoleCommandMidiSysex, HELP("Get sysex stats for an input port, default 0") },
+		{ "syncsource", &ConsoleCommandSyncSource, HELP("Follow MIDI clock from an input port") },
+		{ "syncstats", &ConsoleCommandSyncStats, HELP("Get MIDI clock follower state and tracking error") },
+		{ "usbstats", &ConsoleCommandUsbStats, HELP("Get USB device, USB-MIDI and USB serial stats") },
+		{ "ver", &ConsoleCommandVer, HELP("Get the version string") },
 		};
 
 static eCommandResult_T ConsoleCommandComment(const char buffer[]) {
@@ -55,27 +94,66 @@ static eCommandResult_T ConsoleCommandHelp(const char buffer[]) {
 
 	tableLength = sizeof(mConsoleCommandTable)
 			/ sizeof(mConsoleCommandTable[0]);
-	for (i = 0u; i < tableLength - 1u; i++) {
+	for (i = 0u; i < tableLength; i++) {
 		ConsoleIoSendString(mConsoleCommandTable[i].name);
-#if CONSOLE_COMMAND_MAX_HELP_LENGTH > 0
+#if CONSOLE_COMMAND_HELP
 		ConsoleIoSendString(" : ");
 		ConsoleIoSendString(mConsoleCommandTable[i].help);
-#endif // CONSOLE_COMMAND_MAX_HELP_LENGTH > 0
+#endif // CONSOLE_COMMAND_HELP
 		ConsoleIoSendString(STR_ENDLINE);
 	}
 	return result;
 }
 
 static eCommandResult_T ConsoleCommandDisplayInit(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
 	test1();
+	return COMMAND_SUCCESS;
 }
 
 static eCommandResult_T ConsoleCommandAudioTest(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
 	test2();
+	return COMMAND_SUCCESS;
+}
+
+// Optional MIDI port number parameter, port 0 when it's left out
+static midi_port_t *ConsoleMidiPort(const char buffer[], uint8_t parameterNumber) {
+	int16_t portNum;
+
+	if (COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, parameterNumber, &portNum)) {
+		portNum = 0;
+	}
+	if (portNum < 0) {
+		return NULL;
+	}
+	return MIDI_Get_Port(portNum);
 }
 
 static eCommandResult_T ConsoleCommandMidiStats(const char buffer[]) {
-	MIDI_Print_Stats();
+	midi_port_t *port = ConsoleMidiPort(buffer, 1);
+
+	if (port == NULL) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	MIDI_Print_Stats(port);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandMidiLatency(const char buffer[]) {
+	midi_port_t *port = ConsoleMidiPort(buffer, 1);
+
+	if (port == NULL) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	MIDI_Print_Latency(port);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandMidiMerge(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Application_Print_Merge();
+	return COMMAND_SUCCESS;
 }
 
 static eCommandResult_T ConsoleCommandMidiNoteOn(const char buffer[]) {
@@ -84,48 +162,183 @@ static eCommandResult_T ConsoleCommandMidiNoteOn(const char buffer[]) {
 
 	result = ConsoleReceiveParamHexUint16(buffer, 1, &noteVal);
 	if (COMMAND_SUCCESS == result) {
-		MIDI_Send_NoteOnMsg(1, noteVal, 127);
+		MIDI_Send_NoteOnMsg(MIDI_Get_Port(0), 1, noteVal, 127);
 	}
 	return result;
 }
 
 static eCommandResult_T ConsoleCommandMidiAllNotesOff(const char buffer[]) {
-	uint16_t noteVal;
-	eCommandResult_T result;
-
-	MIDI_Send_AllNotesOffMsg(1);
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Send_AllNotesOffMsg(MIDI_Get_Port(0), 1);
 	return COMMAND_SUCCESS;
 }
 
+#define TEST_SEQ_NOTES 6
+#define TEST_SEQ_RUNS 10
+#define TEST_SEQ_NOTE_US 300000
+
+// Queues the whole sequence on the scheduler and returns straight away
 static eCommandResult_T ConsoleCommandMidiTestSequence(const char buffer[]) {
-	uint16_t noteVals[6];
-	uint16_t runCount = 10;
-	eCommandResult_T result;
+	int16_t noteVals[TEST_SEQ_NOTES];
+	midi_port_t *port = MIDI_Get_Port(0);
+	midi_event_t event;
+	uint32_t when;
+	uint16_t run;
+	uint8_t note_idx;
+	eCommandResult_T result = COMMAND_SUCCESS;
 
-	result = ConsoleReceiveParamInt16(buffer, 1, &noteVals[0]);
-	result |= ConsoleReceiveParamInt16(buffer, 2, &noteVals[1]);
-	result |= ConsoleReceiveParamInt16(buffer, 3, &noteVals[2]);
-	result |= ConsoleReceiveParamInt16(buffer, 4, &noteVals[3]);
-	result |= ConsoleReceiveParamInt16(buffer, 5, &noteVals[4]);
-	result |= ConsoleReceiveParamInt16(buffer, 6, &noteVals[5]);
+	for (note_idx = 0; note_idx < TEST_SEQ_NOTES; note_idx++) {
+		result |= ConsoleReceiveParamInt16(buffer, note_idx + 1, &noteVals[note_idx]);
+	}
+	if (COMMAND_SUCCESS != result) {
+		return result;
+	}
+	if ((port == NULL) || (MIDI_SCHED_POOL_SIZE - MIDI_Scheduler_Pending() < TEST_SEQ_RUNS * TEST_SEQ_NOTES * 2 + 1)) {
+		return COMMAND_ERROR;
+	}
 
-	if (COMMAND_SUCCESS == result) {
-		uint8_t note_idx = 0;
-		while (runCount--) {
-			note_idx = 0;
-			while (note_idx < 6) {
-				MIDI_Send_NoteOnMsg(1, noteVals[note_idx], 127);
-				HAL_Delay(300);
-				MIDI_Send_NoteOffMsg(1, noteVals[note_idx]);
-
-				note_idx++;
-			}
+	when = MIDI_Time_Now() + MIDI_SCHED_TICK_US;
+	for (run = 0; run < TEST_SEQ_RUNS; run++) {
+		for (note_idx = 0; note_idx < TEST_SEQ_NOTES; note_idx++) {
+			event = midi_event_make(0, MIDI_CIN_NOTE_ON, midi_compose_first_byte(1, NoteOn), noteVals[note_idx] & 0x7F, 127);
+			MIDI_Schedule_Event(port, &event, when);
+			when += TEST_SEQ_NOTE_US;
+			event = midi_event_make(0, MIDI_CIN_NOTE_OFF, midi_compose_first_byte(1, NoteOff), noteVals[note_idx] & 0x7F, 127);
+			MIDI_Schedule_Event(port, &event, when);
 		}
-		MIDI_Send_AllNotesOffMsg(1);
 	}
-	return result;
+	event = midi_event_make(0, MIDI_CIN_CC, midi_compose_first_byte(1, CC), AllNotesOff, 0);
+	MIDI_Schedule_Event(port, &event, when);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandUsbStats(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	USB_Device_Print_Stats();
+	USB_MIDI_Print_Stats();
+	USB_CDC_Print_Stats();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandConsolePort(const char buffer[]) {
+	int16_t transport;
+
+	if (COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &transport)) {
+		ConsoleIoPrintStats();
+		USB_CDC_Print_Stats();
+		return COMMAND_SUCCESS;
+	}
+	if ((transport != CONSOLE_IO_UART) && (transport != CONSOLE_IO_USB)) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	ConsoleIoSetTransport((eConsoleTransport) transport);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandLog(const char buffer[]) {
+	int16_t enable;
+
+	if (COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &enable)) {
+		LOG_Print_Stats();
+		return COMMAND_SUCCESS;
+	}
+	LOG_Set_Enabled(enable != 0);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandMidiSched(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Scheduler_Print_Stats();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandMidiPanic(const char buffer[]) {
+	int16_t portNum;
+
+	if (COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &portNum)) {
+		MIDI_Application_Panic(0xFF);
+		return COMMAND_SUCCESS;
+	}
+	if ((portNum < 0) || (portNum >= MIDI_Num_Ports())) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	MIDI_Application_Panic(1 << portNum);
+	return COMMAND_SUCCESS;
 }
 
+static eCommandResult_T ConsoleCommandMidiSysex(const char buffer[]) {
+	midi_port_t *port = ConsoleMidiPort(buffer, 1);
+	midi_sysex_t *sysex;
+
+	if (port == NULL) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	sysex = MIDI_Application_Get_Sysex(port->index);
+	if (sysex == NULL) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	MIDI_Sysex_Print_Stats(sysex);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandClockStart(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Clock_Start();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandClockStop(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Clock_Stop();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandClockContinue(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Clock_Continue();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandClockTempo(const char buffer[]) {
+	int16_t tempo;
+	eCommandResult_T result;
+
+	result = ConsoleReceiveParamInt16(buffer, 1, &tempo);
+	if (COMMAND_SUCCESS != result) {
+		return result;
+	}
+	if ((tempo < 0) || (MIDI_Clock_Set_Tempo((uint32_t)tempo) != MIDI_OK)) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandClockStats(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Clock_Print_Stats();
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandSyncSource(const char buffer[]) {
+	int16_t portNum;
+	eCommandResult_T result;
+
+	result = ConsoleReceiveParamInt16(buffer, 1, &portNum);
+	if (COMMAND_SUCCESS != result) {
+		return result;
+	}
+	if ((portNum < 0) || (portNum >= MIDI_Num_Ports())) {
+		return COMMAND_PARAMETER_ERROR;
+	}
+	MIDI_Sync_Set_Source(portNum);
+	return COMMAND_SUCCESS;
+}
+
+static eCommandResult_T ConsoleCommandSyncStats(const char buffer[]) {
+	IGNORE_UNUSED_VARIABLE(buffer);
+	MIDI_Sync_Print_Stats();
+	return COMMAND_SUCCESS;
+}
 
 static eCommandResult_T ConsoleCommandVer(const char buffer[]) {
 	eCommandResult_T result = COMMAND_SUCCESS;
@@ -137,7 +350,8 @@ static eCommandResult_T ConsoleCommandVer(const char buffer[]) {
 	return result;
 }
 
-const sConsoleCommandTable_T* ConsoleCommandsGetTable(void) {
+const sConsoleCommandTable_T* ConsoleCommandsGetTable(uint32_t *tableLength) {
+	*tableLength = sizeof(mConsoleCommandTable) / sizeof(mConsoleCommandTable[0]);
 	return (mConsoleCommandTable);
 }
 
@@ -7,31 +7,25 @@
 #include <stdint.h>
 #include "console.h"
 
-#define CONSOLE_COMMAND_MAX_COMMAND_LENGTH 10		// command only
 #define CONSOLE_COMMAND_MAX_LENGTH 256				// whole command with argument
-#define CONSOLE_COMMAND_MAX_HELP_LENGTH 64			// if this is zero, there will be no  help (XXXOPT: RAM reduction)
+#define CONSOLE_COMMAND_HELP 1						// if this is zero, there will be no help (XXXOPT: flash reduction)
 
-#if CONSOLE_COMMAND_MAX_HELP_LENGTH > 0
+#if CONSOLE_COMMAND_HELP
 #define HELP(x)  (x)
 #else
-	#define HELP(x)	  0
-#endif // CONSOLE_COMMAND_MAX_HELP_LENGTH
+	#define HELP(x)	  ""
+#endif // CONSOLE_COMMAND_HELP
 
 typedef eCommandResult_T (*ConsoleCommand_T)(const char buffer[]);
 
+// The table is sorted by name, and the help text lives out of line with the other strings
 typedef struct sConsoleCommandStruct {
 	const char *name;
 	ConsoleCommand_T execute;
-#if CONSOLE_COMMAND_MAX_HELP_LENGTH > 0
-	char help[CONSOLE_COMMAND_MAX_HELP_LENGTH];
-#else
-	uint8_t junk;
-#endif // CONSOLE_COMMAND_MAX_HELP_LENGTH 
+	const char *help;
 } sConsoleCommandTable_T;
 
-#define CONSOLE_COMMAND_TABLE_END {NULL, NULL, HELP("")}
-
-const sConsoleCommandTable_T* ConsoleCommandsGetTable(void);
+const sConsoleCommandTable_T* ConsoleCommandsGetTable(uint32_t *tableLength);
 
 #endif // CONSOLE_COMMANDS_H
 
@@ -1,22 +1,95 @@
 // Console IO is a wrapper between the actual in and output and the console code
 // In an embedded system, this might interface to a UART driver.
+//
+// Output never waits: it is queued in a ring and drained in the background, by
+// DMA on the UART or a packet at a time on the USB CDC port, whichever the
+// console is on. When the ring is full, output is dropped and counted.
+//
+// Input from the UART never waits either. A circular DMA runs into the RX ring
+// all the time, and its half, full and idle line interrupts move the ring's
+// write index up to where the DMA has got to, as on the MIDI ports. So with
+// nothing typed, a receive is just a look at the ring's two indices.
 
 #include "consoleIo.h"
 #include "stm32f3xx_hal_uart.h"
+#include "circular_buffer.h"
+#include "midi_platform.h"
+#include "../USB/usb_cdc.h"
 #include <stdio.h>
 
+#define CONSOLE_IO_TX_SIZE 4096 // Power of 2
+#define CONSOLE_IO_RX_SIZE 256  // Power of 2, a full ring at 38400 baud is 66ms of typing
+
 static UART_HandleTypeDef *con_uart;
+static eConsoleTransport con_transport = CONSOLE_IO_UART;
+
+static circular_buffer_t con_tx;
+static uint8_t con_tx_data[CONSOLE_IO_TX_SIZE];
+static uint16_t con_tx_inflight; // Bytes at the read end of the ring being sent, 0 if idle
+static eConsoleTransport con_tx_inflight_transport;
+static uint32_t con_tx_dropped;
+
+static circular_buffer_t con_rx;
+static uint8_t con_rx_data[CONSOLE_IO_RX_SIZE]; // The DMA's buffer as well as the ring's
+static uint16_t con_rx_dma_pos;  // Where the DMA had got to last time
+static uint32_t con_rx_overflows;
+static uint32_t con_uart_errors;
 
 typedef int getch_status_t;
 
 #define GOT_CHAR 1
 #define NO_CHAR_AVAILABLE 0
 
+// Hand the next contiguous run of the ring to the transport, if nothing is in flight
+static void consoleIoTxStart(void) {
+	midi_irq_state_t irq = MIDI_Platform_Lock();
+	uint8_t *region;
+	uint16_t len;
+
+	if ((con_tx_inflight == 0)
+			&& (circularBuffer_acquire_read(&con_tx, &region, &len) == eCircularBufferOk)) {
+		if (con_transport == CONSOLE_IO_USB) {
+			len = USB_CDC_Transmit(region, len);
+		} else if (HAL_UART_Transmit_DMA(con_uart, region, len) != HAL_OK) {
+			len = 0; // Busy, tried again on the next write or receive
+		}
+		con_tx_inflight = len;
+		con_tx_inflight_transport = con_transport;
+	}
+	MIDI_Platform_Unlock(irq);
+}
+
+static void consoleIoUsbTxDone(void) {
+	ConsoleIoTransmitDone(CONSOLE_IO_USB);
+}
+
+// (Re)start the receive DMA at the top of an empty ring
+static void consoleIoRxBegin(void) {
+	con_rx.read_pos = 0;
+	con_rx.write_pos = 0;
+	con_rx_dma_pos = 0;
+
+	if (HAL_UART_Receive_DMA(con_uart, con_rx_data, CONSOLE_IO_RX_SIZE) == HAL_OK) {
+		__HAL_UART_CLEAR_IDLEFLAG(con_uart);
+		__HAL_UART_ENABLE_IT(con_uart, UART_IT_IDLE);
+	}
+}
+
+// The receive interrupt moves the read index as well when input laps it, so the ring is read locked
 static getch_status_t getch_noblock(char *c) {
-	if (HAL_UART_Receive(con_uart, (uint8_t*) c, 1, 1) == HAL_OK) {
+	midi_irq_state_t irq;
+	eCircularBufferError result = eCircularBufferOk;
+	uint16_t len = 1;
+
+	if (USB_CDC_Read((uint8_t*) c, 1) != 1) {
+		irq = MIDI_Platform_Lock();
+		result = circularBuffer_read_bytes(&con_rx, (uint8_t*) c, &len);
+		MIDI_Platform_Unlock(irq);
+	}
+	if (result == eCircularBufferOk) {
 
 		// Echo
-		HAL_UART_Transmit(con_uart, (uint8_t*) c, 1, 1);
+		ConsoleIoWrite((uint8_t*) c, 1);
 		return GOT_CHAR;
 	}
 	return NO_CHAR_AVAILABLE;
@@ -25,15 +98,53 @@ static getch_status_t getch_noblock(char *c) {
 eConsoleError ConsoleIoInit(UART_HandleTypeDef *uart) {
 	// ASSERT(uart != NULL);
 	con_uart = uart;
+	circularBuffer_init(&con_tx, con_tx_data, sizeof(con_tx_data));
+	circularBuffer_init(&con_rx, con_rx_data, sizeof(con_rx_data));
+	USB_CDC_Set_Tx_Done(consoleIoUsbTxDone);
+	consoleIoRxBegin();
 	return CONSOLE_SUCCESS;
 }
 
+// Receive DMA half or full, or idle line; from the interrupt
+void ConsoleIoReceiveInterrupt(void) {
+	uint16_t dma_pos;
+	uint16_t new_bytes;
+
+	dma_pos = (CONSOLE_IO_RX_SIZE - __HAL_DMA_GET_COUNTER(con_uart->hdmarx)) & (CONSOLE_IO_RX_SIZE - 1);
+	new_bytes = (dma_pos - con_rx_dma_pos) & (CONSOLE_IO_RX_SIZE - 1);
+	if (new_bytes == 0) {
+		return;
+	}
+	con_rx_dma_pos = dma_pos;
+
+	// The DMA already put the bytes in place, only the write index has to catch up
+	if (circularBuffer_commit_write(&con_rx, new_bytes) != eCircularBufferOk) {
+		// Lapped the reader: the oldest input is gone, the ring holds the newest ring's worth
+		con_rx.write_pos += new_bytes;
+		con_rx.read_pos = con_rx.write_pos - CONSOLE_IO_RX_SIZE;
+		con_rx_overflows++;
+	}
+}
+
+// An error stops whichever DMA it hit, so start that over; from the interrupt
+void ConsoleIoUartError(void) {
+	con_uart_errors++;
+	if (con_uart->RxState == HAL_UART_STATE_READY) {
+		consoleIoRxBegin();
+	}
+	if ((con_uart->gState == HAL_UART_STATE_READY) && (con_tx_inflight != 0)
+			&& (con_tx_inflight_transport == CONSOLE_IO_UART)) {
+		ConsoleIoTransmitDone(CONSOLE_IO_UART); // What was left of it is lost
+	}
+}
+
 eConsoleError ConsoleIoReceive(uint8_t *buffer, const uint32_t bufferLength,
 		uint32_t *readLength) {
-	uint8_t i = 0;
+	uint32_t i = 0;
 	char ch;
 	getch_status_t status = GOT_CHAR;
 
+	consoleIoTxStart();
 	if (getch_noblock(&ch) == GOT_CHAR) {
 		while ((status == GOT_CHAR) && (i < bufferLength)) {
 			buffer[i] = (uint8_t) ch;
@@ -57,3 +168,67 @@ eConsoleError ConsoleIoSendString(const char *buffer) {
 	return CONSOLE_SUCCESS;
 }
 
+// Queue output, all of it or none of it, and start it going. Safe from interrupts.
+int ConsoleIoWrite(const uint8_t *data, uint32_t len) {
+	midi_irq_state_t irq;
+	eCircularBufferError result = eCircularBufferFull;
+
+	if (len <= CONSOLE_IO_TX_SIZE) {
+		irq = MIDI_Platform_Lock();
+		result = circularBuffer_write_bytes(&con_tx, data, (uint16_t) len);
+		MIDI_Platform_Unlock(irq);
+	}
+	if (result != eCircularBufferOk) {
+		con_tx_dropped += len;
+	}
+	consoleIoTxStart();
+	return (int) len;
+}
+
+// Room left in the output ring, for callers that would rather wait than be dropped
+uint32_t ConsoleIoWriteSpace(void) {
+	uint16_t queued = 0;
+
+	circularBuffer_get_length(&con_tx, &queued);
+	return CONSOLE_IO_TX_SIZE - queued;
+}
+
+// A transport has finished sending; from its interrupt
+void ConsoleIoTransmitDone(eConsoleTransport transport) {
+	if ((con_tx_inflight != 0) && (con_tx_inflight_transport == transport)) {
+		circularBuffer_commit_read(&con_tx, con_tx_inflight);
+		con_tx_inflight = 0;
+	}
+	consoleIoTxStart();
+}
+
+/*
+ * Move the console. A USB packet may never be collected if nothing on the host
+ * is reading, so one in flight is let go of here; it's already in packet
+ * memory, so the ring doesn't need it. A UART transfer always finishes.
+ */
+void ConsoleIoSetTransport(eConsoleTransport transport) {
+	midi_irq_state_t irq = MIDI_Platform_Lock();
+
+	if ((con_tx_inflight != 0) && (con_tx_inflight_transport == CONSOLE_IO_USB)) {
+		circularBuffer_commit_read(&con_tx, con_tx_inflight);
+		con_tx_inflight = 0;
+	}
+	con_transport = transport;
+	MIDI_Platform_Unlock(irq);
+	consoleIoTxStart();
+}
+
+eConsoleTransport ConsoleIoGetTransport(void) {
+	return con_transport;
+}
+
+void ConsoleIoPrintStats(void) {
+	uint16_t queued = 0;
+
+	circularBuffer_get_length(&con_tx, &queued);
+	printf("console: on %s, %u bytes queued, %lu dropped, rx overflows %lu, uart errors %lu\r\n",
+			(con_transport == CONSOLE_IO_USB) ? "usb" : "uart", queued,
+			(unsigned long) con_tx_dropped, (unsigned long) con_rx_overflows,
+			(unsigned long) con_uart_errors);
+}
@@ -10,6 +10,10 @@ typedef enum {
 	CONSOLE_SUCCESS = 0u, CONSOLE_ERROR = 1u
 } eConsoleError;
 
+typedef enum {
+	CONSOLE_IO_UART = 0u, CONSOLE_IO_USB = 1u
+} eConsoleTransport;
+
 eConsoleError ConsoleIoInit(UART_HandleTypeDef *uart);
 
 eConsoleError ConsoleIoReceive(uint8_t *buffer, const uint32_t bufferLength,
@@ -18,4 +22,17 @@ eConsoleError ConsoleIoSend(const uint8_t *buffer, const uint32_t bufferLength,
 		uint32_t *sentLength);
 eConsoleError ConsoleIoSendString(const char *buffer); // must be null terminated
 
+// Output, non-blocking, for _write and anything else that prints
+int ConsoleIoWrite(const uint8_t *data, uint32_t len);
+uint32_t ConsoleIoWriteSpace(void);
+void ConsoleIoTransmitDone(eConsoleTransport transport);
+
+// From the USART3 interrupts
+void ConsoleIoReceiveInterrupt(void);
+void ConsoleIoUartError(void);
+
+void ConsoleIoSetTransport(eConsoleTransport transport);
+eConsoleTransport ConsoleIoGetTransport(void);
+void ConsoleIoPrintStats(void);
+
 #endif // CONSOLE_IO_H
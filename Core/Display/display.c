@@ -7,6 +7,7 @@
 
 
 #include "stm32f3xx_hal.h"
+#include "display.h"
 
 // PIN Definitions for GPIOs
 #define CS_PIN GPIO_PIN_9
@@ -166,12 +167,12 @@ void ST7735_Cmd_Write(const uint8_t cmd, const uint8_t *args, uint8_t num_args)
 	HAL_GPIO_WritePin(GPIOB, CMD_DATA_PIN, GPIO_PIN_RESET);
 
 	// Send command
-	HAL_SPI_Transmit(&hspi1, &cmd, 1, 25);
+	HAL_SPI_Transmit(&hspi1, (uint8_t *)&cmd, 1, 25);
 
 	// Set data mode
 	if ((args != NULL) && (num_args > 0)) {
 		HAL_GPIO_WritePin(GPIOB, CMD_DATA_PIN, GPIO_PIN_SET);
-		HAL_SPI_Transmit(&hspi1, args, num_args, 25);
+		HAL_SPI_Transmit(&hspi1, (uint8_t *)args, num_args, 25);
 	}
 }
 
@@ -0,0 +1,24 @@
+/*
+ * display.h
+ *
+ * ST7735 TFT on SPI1.
+ *
+ *  Created on: Jan 23, 2020
+ *      Author: Chris White
+ */
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+
+void ST7735_Select(void);
+void ST7735_Deselect(void);
+void ST7735_Cmd_Write(const uint8_t cmd, const uint8_t *args, uint8_t num_args);
+void ST7735_Cmd_List_Send(const uint8_t *cmd_list);
+void ST7735_FillRectangle(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t color);
+void ST7735_FillScreen(uint16_t color);
+
+void test1(void); // Reset and initialize the controller, then clear the screen
+
+#endif // DISPLAY_H
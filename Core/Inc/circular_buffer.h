@@ -3,19 +3,26 @@
  *
  * Generic circular buffer implementation. Adapted from "Making Embedded Systems" by Elecia White
  *
+ * Single producer, single consumer: one context (e.g. an ISR or DMA completion)
+ * may write while another (e.g. the main loop) reads, with no locking. Only the
+ * producer moves write_pos and only the consumer moves read_pos.
+ *
  * 01/20/2020
  *
  * Chris White
  */
 
+#ifndef CIRCULAR_BUFFER_H
+#define CIRCULAR_BUFFER_H
+
 #include <stdint.h>
 
 // Circular buffer data structure
 typedef struct {
 	uint8_t *data;   // Memory buffer to hold the entire ring
-	uint16_t size;  // Size in bytes of buffer, power of 2
-	uint16_t read_pos; // Current read position, 0 to size - 1
-	uint16_t write_pos; // Current write position, 0 to size - 1
+	uint16_t size;  // Size in bytes of buffer, power of 2, at most 32768
+	volatile uint16_t read_pos; // Free running read index, wraps at 65536, masked with size - 1 to address data
+	volatile uint16_t write_pos; // Free running write index, write_pos - read_pos is the fill level
 } circular_buffer_t;
 
 typedef enum {
@@ -26,8 +33,16 @@ typedef enum {
 } eCircularBufferError;
 
 
+eCircularBufferError circularBuffer_init(circular_buffer_t *cb, uint8_t *data, uint16_t size);
 eCircularBufferError circularBuffer_get_length(circular_buffer_t *cb, uint16_t *length);
-eCircularBufferError circularBuffer_write_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t len);
+eCircularBufferError circularBuffer_write_bytes(circular_buffer_t *cb, const uint8_t *data, uint16_t len);
 eCircularBufferError circularBuffer_read_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t *read_len);
 
+// Zero-copy access. Acquire returns the largest contiguous region at the current
+// index, commit then releases (read) or publishes (write) the first len bytes of it.
+eCircularBufferError circularBuffer_acquire_read(circular_buffer_t *cb, uint8_t **region, uint16_t *len);
+eCircularBufferError circularBuffer_commit_read(circular_buffer_t *cb, uint16_t len);
+eCircularBufferError circularBuffer_acquire_write(circular_buffer_t *cb, uint8_t **region, uint16_t *len);
+eCircularBufferError circularBuffer_commit_write(circular_buffer_t *cb, uint16_t len);
 
+#endif // CIRCULAR_BUFFER_H
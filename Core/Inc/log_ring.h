@@ -0,0 +1,39 @@
+/*
+ * log_ring.h
+ *
+ * Deferred logging. LOG_Write() only stores a 16 byte record: the format
+ * string's address, a timestamp and two 32 bit arguments. Records go into a
+ * lock-free ring, so writing one costs a few dozen cycles and is safe from any
+ * interrupt handler. LOG_Process() does the formatting later, from the main
+ * loop, and it only takes as many records as the console has room for.
+ *
+ * Formats must be string literals, since only their address is kept, and the
+ * arguments are words, so print them with %lu, %ld or %lx. The address also
+ * identifies the message, so a host holding the ELF could decode raw records.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOG_RING_RECORDS 64 // Power of 2
+
+typedef struct {
+	const char *fmt;  // NULL until the record is complete
+	uint32_t timestamp;
+	uint32_t args[2];
+} log_record_t;
+
+void LOG_Init(void);
+void LOG_Write(const char *fmt, uint32_t arg0, uint32_t arg1);
+void LOG_Process(void);
+
+void LOG_Set_Enabled(bool enabled);
+bool LOG_Is_Enabled(void);
+void LOG_Print_Stats(void);
+
+#endif // LOG_RING_H
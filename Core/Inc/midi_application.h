@@ -11,5 +11,13 @@
 
 #include "main.h"
 #include "midi.h"
+#include "midi_merge.h"
+#include "midi_router.h"
+#include "midi_sync.h"
+#include "midi_sysex.h"
 
+MIDI_error_t MIDI_Application_Init(void);
 void MIDI_Application_Process(void);
+void MIDI_Application_Print_Merge(void);
+void MIDI_Application_Panic(uint8_t port_mask);
+midi_sysex_t *MIDI_Application_Get_Sysex(uint8_t input);
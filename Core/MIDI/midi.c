@@ -7,258 +7,835 @@
  */
 
 #include <stdbool.h>
-#include <stm32f3xx_hal.h>
+#include <stdio.h>
+#include <string.h>
 #include "midi.h"
-#include "circular_buffer.h"
-
-static struct {
-	UART_HandleTypeDef *UART_in; // UART associated with the MIDI IN port
-	UART_HandleTypeDef *UART_out; // UART associated with the MIDI OUT port
-	circular_buffer_t midi_rx_ring;
-	circular_buffer_t midi_tx_ring;
-} config;
-
-static uint8_t midi_interrupt_rx_buf[16];
-static uint8_t midi_rx_data_buf[MIDI_BUFFER_SIZE];
-static uint8_t midi_tx_data_buf[MIDI_BUFFER_SIZE];
-
-static struct {
-	bool    inited;
-	bool    last_tx_complete;
-	bool    last_rx_arm_failed;
-	uint8_t last_status;
-} state = { false, false, 0 };
-
-static struct {
-	uint16_t tx_waits;
-	uint16_t tx_done;
-	uint16_t rx_count;
-	uint16_t dequeues;
-    uint16_t enqueues;
-    uint16_t hal_errors;
-    HAL_StatusTypeDef last_hal_error;
-} stats = { 0, 0, 0, 0, 0, 0};
-
-MIDI_error_t MIDI_Init(UART_HandleTypeDef *in_uart, UART_HandleTypeDef *out_uart)
-{
-	config.UART_in = in_uart;
-	config.UART_out = out_uart;
+#include "midi_time.h"
+
+#define MIDI_RUNNING_STATUS_REFRESH_MS 500 // Default, see MIDI_Set_Running_Status()
+#define MIDI_UART_SLOTS MIDI_PLATFORM_UARTS
+
+static midi_port_t *midi_ports[MIDI_MAX_PORTS];
+static uint8_t midi_num_ports;
+
+// Ports indexed by the UART carrying their input or output, see midi_uart_slot()
+static midi_port_t *midi_rx_ports[MIDI_UART_SLOTS];
+static midi_port_t *midi_tx_ports[MIDI_UART_SLOTS];
+
+static uint8_t midi_uart_slot(const UART_HandleTypeDef *uart)
+{
+	return MIDI_Platform_UART_Index(uart);
+}
+
+/*
+ * Set up a port on a pair of UARTs, which may be the same one, and register it
+ * so the HAL callbacks for those UARTs find it. Ports are numbered in the
+ * order they are set up, and the number doubles as the cable number stamped on
+ * the port's input events.
+ */
+MIDI_error_t MIDI_Init(midi_port_t *port, UART_HandleTypeDef *in_uart, UART_HandleTypeDef *out_uart)
+{
+	uint8_t in_slot = midi_uart_slot(in_uart);
+	uint8_t out_slot = midi_uart_slot(out_uart);
+
+	if ((midi_num_ports >= MIDI_MAX_PORTS) || (in_slot >= MIDI_UART_SLOTS) || (out_slot >= MIDI_UART_SLOTS)) {
+		return MIDI_INVALID_PARAM;
+	}
+	if ((midi_rx_ports[in_slot] != NULL) || (midi_tx_ports[out_slot] != NULL)) {
+		return MIDI_INVALID_PARAM; // UART already taken by another port
+	}
+
+	memset(port, 0, sizeof(*port));
+	port->index = midi_num_ports;
+	port->config.UART_in = in_uart;
+	port->config.UART_out = out_uart;
 
 	// Create ring buffers
-	config.midi_rx_ring.data = midi_rx_data_buf;
-	config.midi_rx_ring.read_pos = 0;
-	config.midi_rx_ring.write_pos = 0;
-	config.midi_rx_ring.size = MIDI_BUFFER_SIZE;
-
-	config.midi_tx_ring.data = midi_tx_data_buf;
-	config.midi_tx_ring.read_pos = 0;
-	config.midi_tx_ring.write_pos = 0;
-	config.midi_tx_ring.size = MIDI_BUFFER_SIZE;
-
-	state.last_status = 0;
-	state.inited = true;
-	state.last_tx_complete = true;
+	circularBuffer_init(&port->rx_ring, port->rx_data, MIDI_BUFFER_SIZE);
+	circularBuffer_init(&port->tx_ring, port->tx_data, MIDI_BUFFER_SIZE);
+	circularBuffer_init(&port->rt_ring, port->rt_data, MIDI_RT_BUFFER_SIZE);
+	MIDI_Event_Queue_Init(&port->rx_events, port->rx_event_data, port->rx_event_times, MIDI_EVENT_QUEUE_SIZE);
+	MIDI_Parser_Init(&port->parser, port->index);
+	MIDI_Reset_Latency(port);
+	MIDI_Set_Running_Status(port, true, MIDI_RUNNING_STATUS_REFRESH_MS);
+
+	port->state.last_status = 0;
+	port->state.inited = true;
+	port->state.last_tx_complete = true;
+	port->state.tx_inflight = 0;
+	port->state.tx_rt = false;
+
+	midi_ports[midi_num_ports++] = port;
+	midi_rx_ports[in_slot] = port;
+	midi_tx_ports[out_slot] = port;
 	return MIDI_OK;
 }
 
+uint8_t MIDI_Num_Ports(void)
+{
+	return midi_num_ports;
+}
+
+midi_port_t *MIDI_Get_Port(uint8_t index)
+{
+	return (index < midi_num_ports) ? midi_ports[index] : NULL;
+}
+
+/*
+ * Running status on MIDI OUT
+ *
+ * Every regular message passes through midi_tx_submit(), so running status is
+ * applied there, to the stream as it will actually appear on the wire, no
+ * matter which API queued it. Channel messages set the running status, system
+ * common and sysex cancel it. Real-time bytes leave it alone, and travel on
+ * their own lane anyway.
+ *
+ * Returns how many leading bytes of the message can be left out, 0 or 1.
+ */
+static uint16_t midi_tx_elide(midi_port_t *port, const uint8_t *bytes, uint32_t now)
+{
+	if (!port->config.running_status || (bytes[0] != port->state.last_status) || (port->state.last_status == 0)) {
+		return 0;
+	}
+	// Resent now and then so a receiver that missed it, or was connected mid-stream, recovers
+	if ((uint32_t)(now - port->state.last_status_sent) >= port->config.running_status_refresh) {
+		return 0;
+	}
+	return 1;
+}
+
+// Track the status the queued bytes leave in effect, from the last status byte in them
+static void midi_tx_track_status(midi_port_t *port, const uint8_t *bytes, uint16_t len, uint16_t elided, uint32_t now)
+{
+	uint16_t i = len;
+	uint8_t byte;
+
+	while (i--) {
+		byte = bytes[i];
+		if ((byte < 0x80) || (byte >= 0xF8)) {
+			continue; // Data, or real-time which doesn't affect running status
+		}
+		if (byte >= 0xF0) {
+			port->state.last_status = 0;
+		} else if ((i != 0) || (elided == 0)) {
+			port->state.last_status = byte;
+			port->state.last_status_sent = now;
+		}
+		return;
+	}
+}
+
+/*
+ * Follow note on and off through everything queued, running status included,
+ * keeping the port's map of sounding notes. A note on with velocity 0 is a
+ * note off.
+ */
+static void midi_tx_track_notes(midi_port_t *port, const uint8_t *bytes, uint16_t len)
+{
+	uint8_t byte;
+	uint8_t channel;
+	uint16_t i;
+
+	for (i = 0; i < len; i++) {
+		byte = bytes[i];
+		if (byte >= 0xF8) {
+			continue;
+		}
+		if (byte >= 0x80) {
+			port->notes.status = (byte < 0xF0) ? byte : 0;
+			port->notes.have_note = false;
+			continue;
+		}
+		if ((port->notes.status & 0xE0) != NoteOff) {
+			continue; // Neither note on nor note off
+		}
+		if (!port->notes.have_note) {
+			port->notes.note = byte;
+			port->notes.have_note = true;
+			continue;
+		}
+		channel = port->notes.status & 0x0F;
+		if (((port->notes.status & 0xF0) == NoteOn) && (byte != 0)) {
+			port->notes.active[channel][port->notes.note >> 5] |= (1UL << (port->notes.note & 31));
+		} else {
+			port->notes.active[channel][port->notes.note >> 5] &= ~(1UL << (port->notes.note & 31));
+		}
+		port->notes.have_note = false;
+	}
+}
+
+/*
+ * Enable or disable running status on MIDI OUT. With it on, a repeated status
+ * byte is still sent at least every refresh_ms milliseconds.
+ */
+void MIDI_Set_Running_Status(midi_port_t *port, bool enable, uint16_t refresh_ms)
+{
+	midi_irq_state_t irq;
+
+	irq = MIDI_Platform_Lock();
+	port->config.running_status = enable;
+	port->config.running_status_refresh = (uint32_t)refresh_ms * (MIDI_TIME_TICKS_PER_SEC / 1000);
+	MIDI_Platform_Unlock(irq);
+}
+
 /*
  * MIDI Transmission APIs
+ *
+ * Everything that goes out is queued on the TX ring and drained by the DMA
+ * engine. Submission never blocks: a message either goes in whole or the call
+ * returns MIDI_TX_OVERFLOW and nothing is queued, so the caller decides what to
+ * do about back-pressure and a partial message never reaches the wire.
+ *
+ * The ring write and its timing mark are made with interrupts masked, so
+ * messages may be submitted from interrupt handlers as well as the main loop.
+ * rx_time is the arrival time of thru traffic, NULL for locally made messages.
  */
-MIDI_error_t MIDI_Send_RawBytes(uint8_t *data, uint16_t num_data_bytes)
+static MIDI_error_t midi_tx_submit(midi_port_t *port, const uint8_t *bytes, uint16_t len, const uint32_t *rx_time)
 {
-    HAL_StatusTypeDef tx_status;
+	midi_tx_mark_t *mark;
+	midi_irq_state_t irq;
+	uint32_t now;
+	uint16_t start;
+	uint16_t elided;
 
-	if (num_data_bytes > 0 && (data != NULL)) {
-		tx_status = HAL_UART_Transmit_IT(config.UART_out, data, num_data_bytes);
-	    if (tx_status != HAL_OK) {
-	    	return MIDI_TIMEOUT;
-	   	}
-	 }
-	return MIDI_OK;
+	if (port->state.inited == false) {
+		return MIDI_NOT_READY;
+	}
+	if ((len == 0) || (bytes == NULL)) {
+		return MIDI_OK;
+	}
+
+	irq = MIDI_Platform_Lock();
+	now = MIDI_Time_Now();
+	elided = midi_tx_elide(port, bytes, now);
+	start = port->tx_ring.write_pos;
+	if (circularBuffer_write_bytes(&port->tx_ring, &bytes[elided], len - elided) != eCircularBufferOk) {
+		MIDI_Platform_Unlock(irq);
+		port->stats.tx_overflows++;
+		return MIDI_TX_OVERFLOW;
+	}
+	midi_tx_track_status(port, bytes, len, elided, now);
+	midi_tx_track_notes(port, bytes, len);
+	port->stats.tx_elided += elided;
+
+	if ((uint8_t)(port->timing.mark_head - port->timing.mark_tail) < MIDI_TX_MARKS) {
+		mark = &port->timing.marks[port->timing.mark_head & (MIDI_TX_MARKS - 1)];
+		mark->start = start;
+		mark->end = start + len - elided;
+		mark->queued = now;
+		mark->thru = (rx_time != NULL);
+		mark->rx_time = mark->thru ? *rx_time : 0;
+		port->timing.mark_head++;
+	} else {
+		port->timing.mark_skips++;
+	}
+	MIDI_Platform_Unlock(irq);
+	port->stats.enqueues++;
+
+	return MIDI_Interrupt_Transmit_Begin(port);
+}
+
+/*
+ * Turn off every note the port has left sounding, and no others. The note
+ * offs go out as a few large submissions using running status, two bytes a
+ * note. If the TX ring fills part way, MIDI_TX_OVERFLOW is returned and the
+ * notes not yet sent stay marked, so calling again finishes the job.
+ */
+MIDI_error_t MIDI_Panic(midi_port_t *port)
+{
+	uint8_t burst[64];
+	uint8_t burst_status = 0;
+	uint16_t len = 0;
+	uint32_t bits;
+	uint8_t channel;
+	uint8_t word;
+	uint8_t note;
+	MIDI_error_t status;
+
+	if (port->state.inited == false) {
+		return MIDI_NOT_READY;
+	}
+	port->stats.panics++;
+
+	for (channel = 0; channel < 16; channel++) {
+		for (word = 0; word < 128 / 32; word++) {
+			bits = port->notes.active[channel][word];
+			while (bits != 0) {
+				note = (word << 5) | __builtin_ctz(bits);
+				bits &= bits - 1;
+
+				if (len > sizeof(burst) - 3) {
+					status = midi_tx_submit(port, burst, len, NULL);
+					if (status != MIDI_OK) {
+						return status;
+					}
+					len = 0;
+				}
+				// A status byte starts each burst and each new channel
+				if ((len == 0) || (burst_status != (NoteOff | channel))) {
+					burst_status = NoteOff | channel;
+					burst[len++] = burst_status;
+				}
+				burst[len++] = note;
+				burst[len++] = 0;
+				port->stats.panic_notes++;
+			}
+		}
+	}
+	if (len == 0) {
+		return MIDI_OK;
+	}
+	return midi_tx_submit(port, burst, len, NULL);
+}
+
+// Number of notes the port has left sounding
+uint16_t MIDI_Active_Notes(midi_port_t *port)
+{
+	uint16_t count = 0;
+	uint8_t channel;
+	uint8_t word;
+
+	for (channel = 0; channel < 16; channel++) {
+		for (word = 0; word < 128 / 32; word++) {
+			count += __builtin_popcount(port->notes.active[channel][word]);
+		}
+	}
+	return count;
+}
+
+uint16_t MIDI_Send_Free(midi_port_t *port)
+{
+	uint16_t curr_length = 0;
+
+	circularBuffer_get_length(&port->tx_ring, &curr_length);
+	return port->tx_ring.size - curr_length;
+}
+
+MIDI_error_t MIDI_Send_RawBytes(midi_port_t *port, const uint8_t *data, uint16_t num_data_bytes)
+{
+	return midi_tx_submit(port, data, num_data_bytes, NULL);
 }
 
-MIDI_error_t MIDI_Send_RawChannelMsg(uint8_t command,
+MIDI_error_t MIDI_Send_RawChannelMsg(midi_port_t *port, uint8_t command,
                           uint8_t channel,
                           uint8_t num_data_bytes,
                           uint8_t *data)
 {
-    uint8_t first;
-    HAL_StatusTypeDef tx_status;
+    uint8_t msg[3];
+    uint8_t len = 0;
 
-    first = midi_compose_first_byte(channel, command);
-
-    if (first != state.last_status)
-    {
-    	tx_status = HAL_UART_Transmit_IT(config.UART_out, &first, 1);
-    	if (tx_status != HAL_OK) {
-    		return MIDI_TIMEOUT;
-    	}
-    	state.last_status = first;
+    if ((num_data_bytes > 2) || ((num_data_bytes > 0) && (data == NULL))) {
+    	return MIDI_INVALID_PARAM;
     }
 
-    if (num_data_bytes > 0 && (data != NULL)) {
-    	tx_status = HAL_UART_Transmit_IT(config.UART_out, data, num_data_bytes);
-    	if (tx_status != HAL_OK) {
-    		return MIDI_TIMEOUT;
-    	}
+    msg[len++] = midi_compose_first_byte(channel, command);
+    while (num_data_bytes--) {
+    	msg[len++] = *data++;
     }
-    return MIDI_OK;
+
+    return midi_tx_submit(port, msg, len, NULL);
 }
 
-MIDI_error_t MIDI_Send_NoteOnMsg(uint8_t channel, uint8_t note, uint8_t vel)
+MIDI_error_t MIDI_Send_NoteOnMsg(midi_port_t *port, uint8_t channel, uint8_t note, uint8_t vel)
 {
 	uint8_t msg[2];
 
 	msg[0] = note;
 	msg[1] = vel;
 
-	return(MIDI_Send_RawChannelMsg(NoteOn, channel, 2, msg));
+	return(MIDI_Send_RawChannelMsg(port, NoteOn, channel, 2, msg));
 }
 
-MIDI_error_t MIDI_Send_NoteOffMsg(uint8_t channel, uint8_t note)
+MIDI_error_t MIDI_Send_NoteOffMsg(midi_port_t *port, uint8_t channel, uint8_t note)
 {
-	uint8_t msg[1];
+	uint8_t msg[2];
 
 	msg[0] = note;
 	msg[1] = 127;
-	return(MIDI_Send_RawChannelMsg(NoteOff, channel, 2, msg));
+	return(MIDI_Send_RawChannelMsg(port, NoteOff, channel, 2, msg));
 }
 
-MIDI_error_t MIDI_Send_CCMsg(uint8_t channel, uint8_t control, uint8_t val)
+MIDI_error_t MIDI_Send_CCMsg(midi_port_t *port, uint8_t channel, uint8_t control, uint8_t val)
 {
 	uint8_t msg[2];
 
 	msg[0] = control;
 	msg[1] = val;
-	return(MIDI_Send_RawChannelMsg(CC, channel, 2, msg));
+	return(MIDI_Send_RawChannelMsg(port, CC, channel, 2, msg));
+}
+
+MIDI_error_t MIDI_Send_AllNotesOffMsg(midi_port_t *port, uint8_t channel)
+{
+	return(MIDI_Send_CCMsg(port, channel, AllNotesOff, 0));
+}
+
+static MIDI_error_t midi_send_event(midi_port_t *port, const midi_event_t *event, const uint32_t *rx_time)
+{
+	if (event->bytes[0] >= 0xF8) {
+		return MIDI_Send_Realtime(port, event->bytes[0]);
+	}
+	return midi_tx_submit(port, event->bytes, midi_event_length(event), rx_time);
+}
+
+// Send a parsed event whole, apart from a status byte running status makes redundant
+MIDI_error_t MIDI_Send_Event(midi_port_t *port, const midi_event_t *event)
+{
+	return midi_send_event(port, event, NULL);
 }
 
-MIDI_error_t MIDI_Send_AllNotesOffMsg(uint8_t channel)
+/*
+ * Send an input event on, timed against rx_time, its arrival timestamp, for
+ * the thru latency histogram.
+ */
+MIDI_error_t MIDI_Send_Thru_Event(midi_port_t *port, const midi_event_t *event, uint32_t rx_time)
 {
-	return(MIDI_Send_CCMsg(channel, AllNotesOff, 0));
+	return midi_send_event(port, event, &rx_time);
 }
 
 
 /*
  * MIDI Reception APIs
  */
-bool MIDI_Interrupt_Is_Armed(void)
+bool MIDI_Interrupt_Is_Armed(midi_port_t *port)
 {
-	return !state.last_rx_arm_failed;
+	return !port->state.last_rx_arm_failed;
 }
 
 
-MIDI_error_t MIDI_Interrupt_Receive_Begin(void)
+/*
+ * Start (or restart) circular DMA reception into the RX ring. The DMA channel
+ * keeps running forever; half-transfer, transfer-complete and UART idle-line
+ * interrupts all land in MIDI_Interrupt_Receive(), which moves the ring's write
+ * position up to wherever the DMA has got to and parses what arrived.
+ *
+ * Restarting after an error resets the ring since the DMA starts over at offset 0,
+ * and the parser, since whatever message it was in the middle of is lost.
+ */
+MIDI_error_t MIDI_Interrupt_Receive_Begin(midi_port_t *port)
 {
-	HAL_StatusTypeDef halStatus = HAL_UART_Receive_IT(config.UART_in, midi_interrupt_rx_buf, 1);
+	HAL_StatusTypeDef halStatus;
+
+	port->rx_ring.read_pos = 0;
+	port->rx_ring.write_pos = 0;
+	port->state.rx_dma_pos = 0;
+	MIDI_Parser_Reset(&port->parser);
+
+	halStatus = MIDI_Platform_UART_Receive(port->config.UART_in, port->rx_data, MIDI_BUFFER_SIZE);
 	if (halStatus != HAL_OK) {
-		stats.hal_errors++;
-		stats.last_hal_error = halStatus;
-		state.last_rx_arm_failed = true;
+		port->stats.hal_errors++;
+		port->stats.last_hal_error = halStatus;
+		port->state.last_rx_arm_failed = true;
 		return MIDI_RX_ERROR;
 	}
-	state.last_rx_arm_failed = false;
+	port->state.last_rx_arm_failed = false;
 	return MIDI_OK;
 }
 
-MIDI_error_t MIDI_Interrupt_Receive(void)
+/*
+ * Run everything in the RX ring through the parser, in place, and queue the
+ * resulting events. Events that don't fit are dropped and counted by the queue.
+ *
+ * last_byte_time is when the newest byte in the ring finished arriving. Earlier
+ * bytes are dated back from it one byte time each, which is exact for a dense
+ * burst and the best estimate available otherwise, since the DMA keeps no
+ * per-byte times. An event is stamped with the arrival of its final byte.
+ */
+static void midi_rx_parse(midi_port_t *port, uint32_t last_byte_time)
 {
-	eCircularBufferError status;
+	midi_event_t events[MIDI_PARSER_MAX_EVENTS];
+	uint8_t num_events;
+	uint8_t *bytes;
+	uint16_t len;
+	uint16_t remaining = 0;
+	uint32_t byte_time;
+	uint16_t i;
+	uint8_t j;
+
+	circularBuffer_get_length(&port->rx_ring, &remaining);
+	while (circularBuffer_acquire_read(&port->rx_ring, &bytes, &len) == eCircularBufferOk) {
+		for (i = 0; i < len; i++) {
+			remaining--;
+			byte_time = last_byte_time - ((uint32_t)remaining * MIDI_BYTE_TIME_US);
+			if (port->timing.have_last_rx_byte) {
+				MIDI_Histogram_Add(&port->timing.rx_byte_gap, byte_time - port->timing.last_rx_byte);
+			}
+			port->timing.last_rx_byte = byte_time;
+			port->timing.have_last_rx_byte = true;
+
+			num_events = MIDI_Parser_Feed(&port->parser, bytes[i], events);
+			for (j = 0; j < num_events; j++) {
+				MIDI_Event_Queue_Push(&port->rx_events, &events[j], byte_time);
+			}
+		}
+		circularBuffer_commit_read(&port->rx_ring, len);
+	}
+}
 
-	stats.rx_count++;
+/*
+ * Called from interrupt context on DMA half/full transfer and on UART idle line.
+ * At 31250 baud at most a few hundred bytes can have arrived since the last call,
+ * and each costs one parser table lookup.
+ *
+ * line_idle says the call came from the idle line interrupt, which fires one
+ * byte time after the last byte; DMA interrupts fire as a byte completes.
+ */
+MIDI_error_t MIDI_Interrupt_Receive(midi_port_t *port, bool line_idle)
+{
+	uint32_t now = MIDI_Time_Now(); // First thing, so ISR latency doesn't skew it
+	uint16_t dma_pos;
+	uint16_t new_bytes;
 
-	if (state.inited == false) {
+	if (port->state.inited == false) {
 		return MIDI_NOT_READY;
 	}
-	status = circularBuffer_write_bytes(&config.midi_rx_ring, midi_interrupt_rx_buf, 1);
-	if (status != eCircularBufferOk) {
-		return MIDI_RX_OVERFLOW;
-	} else {
+	if (line_idle) {
+		now -= MIDI_BYTE_TIME_US;
+	}
+
+	port->stats.rx_events++;
+
+	dma_pos = (MIDI_BUFFER_SIZE - MIDI_Platform_UART_Rx_Remaining(port->config.UART_in)) & (MIDI_BUFFER_SIZE - 1);
+	new_bytes = (dma_pos - port->state.rx_dma_pos) & (MIDI_BUFFER_SIZE - 1);
+	if (new_bytes == 0) {
 		return MIDI_OK;
 	}
+	port->state.rx_dma_pos = dma_pos;
+	port->stats.rx_count += new_bytes;
+
+	/*
+	 * The DMA already put the bytes in place, only the write index has to catch
+	 * up. The ring is parsed empty on every call, so it always has room. The DMA
+	 * could only lap the parser if this interrupt were held off for a whole
+	 * ring's worth of byte times, a third of a second, and its position alone
+	 * can't show that it had.
+	 */
+	circularBuffer_commit_write(&port->rx_ring, new_bytes);
+	midi_rx_parse(port, now);
+	return MIDI_OK;
 }
 
-MIDI_error_t MIDI_Dequeue_Receive(uint8_t *bytes, uint16_t *len) {
-	eCircularBufferError status;
-	if (state.inited == false) {
+/*
+ * Take up to *num_events parsed input events, oldest first. On return
+ * *num_events holds how many were copied out. If timestamps isn't NULL it
+ * receives each event's arrival time, see midi_time.h.
+ */
+MIDI_error_t MIDI_Dequeue_Events(midi_port_t *port, midi_event_t *events, uint32_t *timestamps, uint16_t *num_events) {
+	if (port->state.inited == false) {
 			return MIDI_NOT_READY;
 	}
-	status = circularBuffer_read_bytes(&config.midi_rx_ring, bytes, len);
-	if (status != eCircularBufferOk) {
+	*num_events = MIDI_Event_Queue_Pop(&port->rx_events, events, timestamps, *num_events);
+	if (*num_events == 0) {
 		return MIDI_RX_ERROR; // Possibly just nothing left to read.
 	}
-	stats.dequeues++;
+	port->stats.dequeues++;
 
 	return MIDI_OK;
 }
 
-MIDI_error_t MIDI_Interrupt_Transmit_Begin(void)
+// Timer time the last byte arrived on the port's MIDI IN
+uint32_t MIDI_Last_Receive_Time(midi_port_t *port) {
+	return port->timing.last_rx_byte;
+}
+
+// Parsed input events waiting to be dequeued
+uint16_t MIDI_Receive_Pending(midi_port_t *port) {
+	return MIDI_Event_Queue_Length(&port->rx_events);
+}
+
+/*
+ * Look at the next input event without taking it. Pair with MIDI_Skip_Event()
+ * once the event has been dealt with.
+ */
+bool MIDI_Peek_Event(midi_port_t *port, midi_event_t *event, uint32_t *timestamp) {
+	if (port->state.inited == false) {
+		return false;
+	}
+	return MIDI_Event_Queue_Peek(&port->rx_events, event, timestamp);
+}
+
+void MIDI_Skip_Event(midi_port_t *port) {
+	MIDI_Event_Queue_Drop(&port->rx_events, 1);
+	port->stats.dequeues++;
+}
+
+/*
+ * Hand the largest contiguous run of queued bytes to the TX DMA channel, taking
+ * the real-time lane first. When the queued data wraps the end of the ring, the
+ * remainder goes out as the next transfer, chained from the completion interrupt.
+ *
+ * Call with interrupts masked: the TIM2 tick outranks the UART and DMA
+ * interrupts and may start a transfer itself.
+ */
+static MIDI_error_t midi_tx_start(midi_port_t *port)
 {
-	eCircularBufferError status;
 	HAL_StatusTypeDef halStatus;
-	uint16_t read_len = 1;
-	uint8_t byte = 0;
+	uint8_t *span_start;
+	uint16_t span = 0;
+
+	port->state.tx_rt = true;
+	if (circularBuffer_acquire_read(&port->rt_ring, &span_start, &span) != eCircularBufferOk) {
+		port->state.tx_rt = false;
+		if (circularBuffer_acquire_read(&port->tx_ring, &span_start, &span) != eCircularBufferOk) {
+			port->state.last_tx_complete = true;
+			return MIDI_OK;
+		}
+	}
 
-	if (state.inited == false) {
+	port->state.last_tx_complete = false;
+	port->state.tx_inflight = span;
+	halStatus = MIDI_Platform_UART_Transmit(port->config.UART_out, span_start, span);
+	if (halStatus != HAL_OK) {
+		port->stats.hal_errors++;
+		port->stats.last_hal_error = halStatus;
+		port->state.tx_inflight = 0;
+		port->state.last_tx_complete = true;
+		return MIDI_TX_ERROR;
+	}
+	port->stats.tx_spans++;
+	return MIDI_OK;
+}
+
+MIDI_error_t MIDI_Interrupt_Transmit_Begin(midi_port_t *port)
+{
+	MIDI_error_t status = MIDI_OK;
+	midi_irq_state_t irq;
+
+	if (port->state.inited == false) {
 			return MIDI_NOT_READY;
 	}
-	status = circularBuffer_read_bytes(&config.midi_tx_ring, &byte, &read_len);
-	if (status != eCircularBufferOk) {
-		state.last_tx_complete = true;
-		return MIDI_TX_ERROR;
+
+	irq = MIDI_Platform_Lock();
+	if (port->state.last_tx_complete) {
+		status = midi_tx_start(port);
+	} else {
+		port->stats.tx_waits++; // Will be picked up when the current transfer completes
 	}
-	state.last_tx_complete = false;
-	halStatus = HAL_UART_Transmit_IT(config.UART_in, &byte, 1);
-	if (halStatus != HAL_OK) {
-		stats.hal_errors++;
+	MIDI_Platform_Unlock(irq);
+
+	return status;
+}
+
+/*
+ * Time every message the finished transfer completed. The UART reports
+ * completion once the last stop bit is out, so a message's first byte started
+ * one byte time per byte between its start and the end of the transfer ago.
+ */
+static void midi_tx_time_marks(midi_port_t *port, uint32_t now)
+{
+	uint16_t read_pos = port->tx_ring.read_pos;
+	midi_tx_mark_t *mark;
+	uint32_t first_byte_out;
+	int32_t delta;
+
+	while (port->timing.mark_tail != port->timing.mark_head) {
+		mark = &port->timing.marks[port->timing.mark_tail & (MIDI_TX_MARKS - 1)];
+		if ((int16_t)(read_pos - mark->end) < 0) {
+			break; // Not all sent yet
+		}
+		first_byte_out = now - ((uint32_t)(uint16_t)(read_pos - mark->start) * MIDI_BYTE_TIME_US);
+
+		delta = MIDI_Time_Diff(first_byte_out, mark->queued);
+		MIDI_Histogram_Add(&port->timing.tx_residency, (delta > 0) ? delta : 0);
+		if (mark->thru) {
+			delta = MIDI_Time_Diff(first_byte_out, mark->rx_time);
+			MIDI_Histogram_Add(&port->timing.thru_latency, (delta > 0) ? delta : 0);
+		}
+		port->timing.mark_tail++;
 	}
-	return MIDI_OK;
 }
 
-MIDI_error_t MIDI_Interrupt_Transmit_End(void)
+MIDI_error_t MIDI_Interrupt_Transmit_End(midi_port_t *port)
 {
-	if (state.inited == false) {
+	uint32_t now = MIDI_Time_Now();
+
+	MIDI_error_t status;
+	midi_irq_state_t irq;
+
+	if (port->state.inited == false) {
 		return MIDI_NOT_READY;
 	}
-	stats.tx_done++;
-	MIDI_Interrupt_Transmit_Begin(); // Start handling any additional bytes that were added during tx
-	return MIDI_OK;
+
+	irq = MIDI_Platform_Lock();
+	port->stats.tx_done++;
+
+	// Bytes are only released once the DMA is done reading them
+	if (port->state.tx_rt) {
+		circularBuffer_commit_read(&port->rt_ring, port->state.tx_inflight);
+	} else {
+		circularBuffer_commit_read(&port->tx_ring, port->state.tx_inflight);
+		midi_tx_time_marks(port, now);
+	}
+	port->state.tx_inflight = 0;
+
+	status = midi_tx_start(port); // Chain the wrapped remainder and anything added during tx
+	MIDI_Platform_Unlock(irq);
+
+	return status;
+}
+
+/*
+ * Cut the regular transfer in flight short so the real-time lane goes next.
+ * Every byte the abort says was handed to the UART is already in its data or
+ * shift register and still goes out whole. MIDI allows real-time bytes
+ * between any two bytes, including in the middle of a message or sysex, so
+ * the rest of the span simply resumes after the real-time bytes.
+ *
+ * Call with interrupts masked.
+ */
+static MIDI_error_t midi_tx_preempt(midi_port_t *port)
+{
+	UART_HandleTypeDef *uart = port->config.UART_out;
+	uint16_t unsent;
+
+	if (port->state.last_tx_complete) {
+		return midi_tx_start(port);
+	}
+	if (port->state.tx_rt) {
+		return MIDI_OK; // The real-time lane is already going, it will be drained first
+	}
+	if (MIDI_Platform_UART_Tx_Remaining(uart) == 0) {
+		/*
+		 * All of it is with the UART already. The complete interrupt, which
+		 * this may have cut into part way through the HAL's handler, starts
+		 * the real-time lane next; aborting now would start a transfer under
+		 * that handler.
+		 */
+		return MIDI_OK;
+	}
+
+	if (MIDI_Platform_UART_Abort_Transmit(uart, &unsent) != HAL_OK) {
+		port->stats.hal_errors++;
+	}
+	circularBuffer_commit_read(&port->tx_ring, port->state.tx_inflight - unsent);
+	port->state.tx_inflight = 0;
+	port->stats.tx_preempts++;
+
+	return midi_tx_start(port);
 }
 
-MIDI_error_t MIDI_Enqueue_Send(uint8_t *bytes, uint16_t *len) {
-	eCircularBufferError status;
-	if (state.inited == false) {
+/*
+ * Queue a real-time byte (clock, start, continue, stop, active sensing, reset)
+ * ahead of all regular traffic. It goes out after at most the byte the UART is
+ * currently sending. Safe to call from interrupt handlers.
+ */
+MIDI_error_t MIDI_Send_Realtime(midi_port_t *port, uint8_t byte)
+{
+	MIDI_error_t status;
+	midi_irq_state_t irq;
+
+	if (port->state.inited == false) {
 		return MIDI_NOT_READY;
 	}
+	if (byte < 0xF8) {
+		return MIDI_INVALID_PARAM;
+	}
 
-	status = circularBuffer_write_bytes(&config.midi_tx_ring, bytes, *len);
-	if (status != eCircularBufferOk) {
-		return MIDI_RX_ERROR;
+	irq = MIDI_Platform_Lock();
+	if (circularBuffer_write_bytes(&port->rt_ring, &byte, 1) != eCircularBufferOk) {
+		MIDI_Platform_Unlock(irq);
+		port->stats.rt_overflows++;
+		return MIDI_TX_OVERFLOW;
 	}
+	status = midi_tx_preempt(port);
+	MIDI_Platform_Unlock(irq);
 
-	stats.enqueues++;
+	return status;
+}
 
-	if (state.last_tx_complete) {
-		state.last_tx_complete = false;
-		MIDI_Interrupt_Transmit_Begin();
-	} else {
-		stats.tx_waits++;
+MIDI_error_t MIDI_Enqueue_Send(midi_port_t *port, const uint8_t *bytes, uint16_t *len) {
+	if ((*len == 1) && (bytes != NULL) && (bytes[0] >= 0xF8)) {
+		return MIDI_Send_Realtime(port, bytes[0]);
 	}
-	return MIDI_OK;
+	return midi_tx_submit(port, bytes, *len, NULL);
+}
+
+void MIDI_Log_Error(midi_port_t *port)
+{
+	port->stats.hal_errors++;
+
+	// Reception errors in DMA mode abort the transfer, so it needs re-arming
+	if (!MIDI_Platform_UART_Rx_Running(port->config.UART_in)) {
+		port->state.last_rx_arm_failed = true;
+	}
+}
+
+/*
+ * Entry points for the HAL UART callbacks and IRQ handlers, which only know the
+ * UART. Each is a table lookup; UARTs that don't belong to a port are ignored.
+ */
+MIDI_error_t MIDI_UART_Receive(UART_HandleTypeDef *huart, bool line_idle)
+{
+	uint8_t slot = midi_uart_slot(huart);
+
+	if ((slot >= MIDI_UART_SLOTS) || (midi_rx_ports[slot] == NULL)) {
+		return MIDI_NOT_READY;
+	}
+	return MIDI_Interrupt_Receive(midi_rx_ports[slot], line_idle);
+}
+
+MIDI_error_t MIDI_UART_Transmit_End(UART_HandleTypeDef *huart)
+{
+	uint8_t slot = midi_uart_slot(huart);
+
+	if ((slot >= MIDI_UART_SLOTS) || (midi_tx_ports[slot] == NULL)) {
+		return MIDI_NOT_READY;
+	}
+	return MIDI_Interrupt_Transmit_End(midi_tx_ports[slot]);
+}
+
+void MIDI_UART_Error(UART_HandleTypeDef *huart)
+{
+	uint8_t slot = midi_uart_slot(huart);
+
+	if ((slot < MIDI_UART_SLOTS) && (midi_rx_ports[slot] != NULL)) {
+		MIDI_Log_Error(midi_rx_ports[slot]);
+	} else if ((slot < MIDI_UART_SLOTS) && (midi_tx_ports[slot] != NULL)) {
+		midi_tx_ports[slot]->stats.hal_errors++;
+	}
+}
+
+void MIDI_Print_Stats(midi_port_t *port)
+{
+	printf("rx_count: %lu\r\n", (unsigned long)port->stats.rx_count);
+	printf("rx_events: %lu\r\n", (unsigned long)port->stats.rx_events);
+	printf("rx_event_drops: %lu\r\n", (unsigned long)port->rx_events.drops);
+	printf("rx_stray_bytes: %lu\r\n", (unsigned long)port->parser.stray_bytes);
+	printf("rx_sysex_aborts: %lu\r\n", (unsigned long)port->parser.sysex_aborts);
+	printf("tx_done: %lu\r\n", (unsigned long)port->stats.tx_done);
+	printf("tx_waits: %lu\r\n", (unsigned long)port->stats.tx_waits);
+	printf("tx_spans: %lu\r\n", (unsigned long)port->stats.tx_spans);
+	printf("tx_overflows: %lu\r\n", (unsigned long)port->stats.tx_overflows);
+	printf("tx_preempts: %lu\r\n", (unsigned long)port->stats.tx_preempts);
+	printf("tx_elided: %lu\r\n", (unsigned long)port->stats.tx_elided);
+	printf("rt_overflows: %lu\r\n", (unsigned long)port->stats.rt_overflows);
+	printf("dequeues: %lu\r\n", (unsigned long)port->stats.dequeues);
+	printf("enqueues: %lu\r\n", (unsigned long)port->stats.enqueues);
+	printf("panics: %lu\r\n", (unsigned long)port->stats.panics);
+	printf("panic_notes: %lu\r\n", (unsigned long)port->stats.panic_notes);
+	printf("active_notes: %u\r\n", MIDI_Active_Notes(port));
+	printf("HAL errors: %lu\r\n", (unsigned long)port->stats.hal_errors);
+	printf("Last HAL error: %d\r\n", port->stats.last_hal_error);
 }
 
-void MIDI_Log_Error(void)
+void MIDI_Reset_Latency(midi_port_t *port)
 {
-	stats.hal_errors++;
+	midi_irq_state_t irq;
+
+	irq = MIDI_Platform_Lock();
+	MIDI_Histogram_Reset(&port->timing.thru_latency);
+	MIDI_Histogram_Reset(&port->timing.tx_residency);
+	MIDI_Histogram_Reset(&port->timing.rx_byte_gap);
+	port->timing.have_last_rx_byte = false;
+	port->timing.mark_skips = 0;
+	MIDI_Platform_Unlock(irq);
 }
 
-void MIDI_Print_Stats(void)
+// Dumps the timing histograms and starts them over
+void MIDI_Print_Latency(midi_port_t *port)
 {
-	printf("rx_count: %d\r\n", stats.rx_count);
-	printf("tx_done: %d\r\n", stats.tx_done);
-	printf("tx_waits: %d\r\n", stats.tx_waits);
-	printf("dequeues: %d\r\n", stats.dequeues);
-	printf("enqueues: %d\r\n", stats.enqueues);
-	printf("HAL errors: %d\r\n", stats.hal_errors);
-	printf("Last HAL error: %d\r\n", stats.last_hal_error);
+	MIDI_Histogram_Print("thru latency", &port->timing.thru_latency);
+	MIDI_Histogram_Print("tx residency", &port->timing.tx_residency);
+	MIDI_Histogram_Print("rx byte gap", &port->timing.rx_byte_gap);
+	printf("untimed messages: %lu\r\n", (unsigned long)port->timing.mark_skips);
+	MIDI_Reset_Latency(port);
 }
@@ -6,7 +6,23 @@
  * cwhite@logicalelegance.com
  */
 
-#define MIDI_BUFFER_SIZE 1024
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <stdbool.h>
+#include "midi_platform.h"
+#include "circular_buffer.h"
+#include "midi_event.h"
+#include "midi_event_queue.h"
+#include "midi_parser.h"
+#include "midi_stats.h"
+
+#define MIDI_BUFFER_SIZE 1024 // Power of 2, also the length of the circular RX DMA transfer
+#define MIDI_EVENT_QUEUE_SIZE 256 // Parsed input events, power of 2
+#define MIDI_RT_BUFFER_SIZE 16 // Real-time lane of MIDI OUT, power of 2
+#define MIDI_TX_MARKS 32 // Messages tracked through the TX ring for timing, power of 2
+#define MIDI_MAX_PORTS 4
+#define MIDI_MAX_INPUTS (2 * MIDI_MAX_PORTS) // Merge and router inputs: the ports, then a USB host cable for each
 
 typedef enum {
 	MIDI_OK,
@@ -15,7 +31,9 @@ typedef enum {
 	MIDI_RX_OVERFLOW,
 	MIDI_RX_ERROR,
 	MIDI_TX_ERROR,
+	MIDI_TX_OVERFLOW, // TX queue can't take the whole message, nothing was queued
 	MIDI_INVALID_PARAM,
+	MIDI_SCHEDULE_FULL, // Scheduler has no room for another pending event
 } MIDI_error_t;
 
 typedef enum {
@@ -28,31 +46,138 @@ typedef enum {
 	AllNotesOff = 0x7B,
 } midi_cc_e;
 
+// A queued message, followed through the TX ring until the DMA has sent it
+typedef struct {
+	uint16_t start;    // TX ring write position of its first byte
+	uint16_t end;      // and one past its last
+	uint32_t queued;   // When it was queued
+	uint32_t rx_time;  // When it arrived, for thru traffic
+	bool     thru;
+} midi_tx_mark_t;
+
+/*
+ * One MIDI IN/OUT pair on a UART (or two). The application allocates it, the
+ * driver owns everything inside it after MIDI_Init().
+ */
+typedef struct {
+	uint8_t index; // Port number, also the cable number of its input events
+
+	struct {
+		UART_HandleTypeDef *UART_in; // UART associated with the MIDI IN port
+		UART_HandleTypeDef *UART_out; // UART associated with the MIDI OUT port
+		bool running_status;               // Elide repeated status bytes on MIDI OUT
+		uint32_t running_status_refresh;   // Resend the status at least this often, in timer ticks
+	} config;
+
+	circular_buffer_t rx_ring;
+	circular_buffer_t tx_ring;
+	circular_buffer_t rt_ring;      // Real-time lane, always sent ahead of tx_ring
+	midi_event_queue_t rx_events;   // Parsed input, consumed by the application
+	midi_parser_t parser;
+
+	struct {
+		bool    inited;
+		bool    last_tx_complete;
+		bool    last_rx_arm_failed;
+		uint8_t last_status;      // Running status in effect on MIDI OUT, 0 if none
+		uint32_t last_status_sent; // When last_status last actually went into the TX ring
+		uint16_t rx_dma_pos; // Last DMA write offset folded into the RX ring
+		uint16_t tx_inflight; // Bytes currently owned by the TX DMA transfer
+		bool    tx_rt;       // The transfer in flight is from the real-time lane
+	} state;
+
+	struct {
+		uint32_t tx_waits;
+		uint32_t tx_done;
+		uint32_t tx_spans;
+		uint32_t tx_overflows;
+		uint32_t tx_preempts;
+		uint32_t tx_elided;
+		uint32_t rt_overflows;
+		uint32_t rx_count;
+		uint32_t rx_events;
+		uint32_t dequeues;
+		uint32_t enqueues;
+		uint32_t hal_errors;
+		uint32_t panics;
+		uint32_t panic_notes;
+		HAL_StatusTypeDef last_hal_error;
+	} stats;
+
+	// Notes left sounding by what has gone out, so a panic can turn off exactly those
+	struct {
+		uint32_t active[16][128 / 32]; // A bit per channel and note
+		uint8_t status;                // Running status as the tracker has seen it
+		uint8_t note;                  // First data byte of a note message in progress
+		bool have_note;
+	} notes;
+
+	struct {
+		midi_histogram_t thru_latency; // Input event arrival to its first byte going out
+		midi_histogram_t tx_residency; // Queued to first byte going out
+		midi_histogram_t rx_byte_gap;  // Between consecutive received bytes
+		uint32_t last_rx_byte;
+		bool     have_last_rx_byte;
+		midi_tx_mark_t marks[MIDI_TX_MARKS];
+		uint8_t  mark_head;            // Moved by submitters, with interrupts masked
+		volatile uint8_t mark_tail;    // Moved by the TX complete interrupt
+		uint32_t mark_skips;           // Messages not timed because every mark was in use
+	} timing;
+
+	// The RX ring's storage doubles as the target of a circular DMA transfer,
+	// so received bytes land in the ring without any CPU copy.
+	uint8_t rx_data[MIDI_BUFFER_SIZE];
+	uint8_t tx_data[MIDI_BUFFER_SIZE];
+	uint8_t rt_data[MIDI_RT_BUFFER_SIZE];
+	midi_event_t rx_event_data[MIDI_EVENT_QUEUE_SIZE] __attribute__((aligned(4)));
+	uint32_t rx_event_times[MIDI_EVENT_QUEUE_SIZE];
+} midi_port_t;
+
 static inline uint8_t midi_compose_first_byte(uint8_t channel, uint8_t command) {
 	return((command & 0xf0) | ((channel - 1) & 0x0f));
 }
 
-MIDI_error_t MIDI_Init(UART_HandleTypeDef *in_uart, UART_HandleTypeDef *out_uart);
-MIDI_error_t MIDI_Send_RawBytes(uint8_t *data, uint16_t num_data_bytes);
-MIDI_error_t MIDI_Send_RawChannelMsg(uint8_t command,
+MIDI_error_t MIDI_Init(midi_port_t *port, UART_HandleTypeDef *in_uart, UART_HandleTypeDef *out_uart);
+uint8_t MIDI_Num_Ports(void);
+midi_port_t *MIDI_Get_Port(uint8_t index);
+
+uint16_t MIDI_Send_Free(midi_port_t *port);
+void MIDI_Set_Running_Status(midi_port_t *port, bool enable, uint16_t refresh_ms);
+MIDI_error_t MIDI_Send_RawBytes(midi_port_t *port, const uint8_t *data, uint16_t num_data_bytes);
+MIDI_error_t MIDI_Send_RawChannelMsg(midi_port_t *port, uint8_t command,
                           uint8_t channel,
                           uint8_t num_data_bytes,
                           uint8_t * data);
-MIDI_error_t MIDI_Send_NoteOnMsg(uint8_t channel, uint8_t note, uint8_t vel);
-MIDI_error_t MIDI_Send_NoteOffMsg(uint8_t channel, uint8_t note);
-MIDI_error_t MIDI_Send_CCMsg(uint8_t channel, uint8_t control, uint8_t val);
-MIDI_error_t MIDI_Send_AllNotesOffMsg(uint8_t channel);
-
-MIDI_error_t MIDI_Interrupt_Receive(void);
-MIDI_error_t MIDI_Dequeue_Receive(uint8_t *bytes, uint16_t *len);
-MIDI_error_t MIDI_Interrupt_Receive_Begin(void);
-
-MIDI_error_t MIDI_Enqueue_Send(uint8_t *bytes, uint16_t *len);
-MIDI_error_t MIDI_Interrupt_Transmit_Begin(void);
-MIDI_error_t MIDI_Interrupt_Receive_Begin(void);
-
+MIDI_error_t MIDI_Send_NoteOnMsg(midi_port_t *port, uint8_t channel, uint8_t note, uint8_t vel);
+MIDI_error_t MIDI_Send_NoteOffMsg(midi_port_t *port, uint8_t channel, uint8_t note);
+MIDI_error_t MIDI_Send_CCMsg(midi_port_t *port, uint8_t channel, uint8_t control, uint8_t val);
+MIDI_error_t MIDI_Send_AllNotesOffMsg(midi_port_t *port, uint8_t channel);
+MIDI_error_t MIDI_Send_Event(midi_port_t *port, const midi_event_t *event);
+MIDI_error_t MIDI_Send_Thru_Event(midi_port_t *port, const midi_event_t *event, uint32_t rx_time);
+MIDI_error_t MIDI_Send_Realtime(midi_port_t *port, uint8_t byte);
+MIDI_error_t MIDI_Panic(midi_port_t *port);
+uint16_t MIDI_Active_Notes(midi_port_t *port);
 
+bool MIDI_Interrupt_Is_Armed(midi_port_t *port);
+MIDI_error_t MIDI_Interrupt_Receive(midi_port_t *port, bool line_idle);
+MIDI_error_t MIDI_Dequeue_Events(midi_port_t *port, midi_event_t *events, uint32_t *timestamps, uint16_t *num_events);
+uint16_t MIDI_Receive_Pending(midi_port_t *port);
+uint32_t MIDI_Last_Receive_Time(midi_port_t *port);
+bool MIDI_Peek_Event(midi_port_t *port, midi_event_t *event, uint32_t *timestamp);
+void MIDI_Skip_Event(midi_port_t *port);
+MIDI_error_t MIDI_Interrupt_Receive_Begin(midi_port_t *port);
 
+MIDI_error_t MIDI_Enqueue_Send(midi_port_t *port, const uint8_t *bytes, uint16_t *len);
+MIDI_error_t MIDI_Interrupt_Transmit_Begin(midi_port_t *port);
+MIDI_error_t MIDI_Interrupt_Transmit_End(midi_port_t *port);
 
+MIDI_error_t MIDI_UART_Receive(UART_HandleTypeDef *huart, bool line_idle);
+MIDI_error_t MIDI_UART_Transmit_End(UART_HandleTypeDef *huart);
+void MIDI_UART_Error(UART_HandleTypeDef *huart);
 
+void MIDI_Log_Error(midi_port_t *port);
+void MIDI_Print_Stats(midi_port_t *port);
+void MIDI_Print_Latency(midi_port_t *port);
+void MIDI_Reset_Latency(midi_port_t *port);
 
+#endif // MIDI_H
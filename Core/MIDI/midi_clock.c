@@ -0,0 +1,162 @@
+/*
+ * midi_clock.c
+ *
+ * Phase accumulator MIDI clock generator.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_clock.h"
+#include "midi_stats.h"
+
+static struct {
+	bool running;
+	uint32_t tempo;          // Hundredths of a BPM
+	uint32_t period;         // Whole microseconds per tick
+	uint32_t remainder;      // Fraction of a microsecond per tick, over tempo
+	uint32_t phase;          // Fraction carried so far, over tempo
+	uint32_t next;           // Timer time of the next tick
+	uint32_t position;       // Ticks since start, kept across stop and continue
+	struct {
+		uint32_t ticks;
+		uint32_t rt_overflows;   // Ticks a port's real-time lane had no room for
+		uint32_t catch_ups;      // Ticks sent late enough to be behind the next one
+		midi_histogram_t jitter; // Interrupt time after the tick's ideal time, in microseconds
+	} stats;
+} midi_clock;
+
+// Send a real-time byte to every port, counting the ones it didn't fit
+static void midi_clock_send(uint8_t byte)
+{
+	uint8_t i;
+
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if (MIDI_Send_Realtime(MIDI_Get_Port(i), byte) != MIDI_OK) {
+			midi_clock.stats.rt_overflows++;
+		}
+	}
+}
+
+static void midi_clock_advance(void)
+{
+	midi_clock.next += midi_clock.period;
+	midi_clock.phase += midi_clock.remainder;
+	if (midi_clock.phase >= midi_clock.tempo) {
+		midi_clock.phase -= midi_clock.tempo;
+		midi_clock.next++;
+	}
+}
+
+void MIDI_Clock_Init(void)
+{
+	memset(&midi_clock, 0, sizeof(midi_clock));
+	MIDI_Histogram_Reset(&midi_clock.stats.jitter);
+	MIDI_Clock_Set_Tempo(MIDI_CLOCK_DEFAULT_TEMPO);
+	MIDI_Time_Alarm_Stop(MIDI_TIME_ALARM_CLOCK);
+}
+
+/*
+ * Takes effect from the tick after the one already due, so a tempo change
+ * never moves a tick backwards.
+ */
+MIDI_error_t MIDI_Clock_Set_Tempo(uint32_t centibpm)
+{
+	midi_irq_state_t irq;
+
+	if ((centibpm < MIDI_CLOCK_MIN_TEMPO) || (centibpm > MIDI_CLOCK_MAX_TEMPO)) {
+		return MIDI_INVALID_PARAM;
+	}
+
+	irq = MIDI_Platform_Lock();
+	midi_clock.tempo = centibpm;
+	midi_clock.period = MIDI_CLOCK_TICK_US_SCALE / centibpm;
+	midi_clock.remainder = MIDI_CLOCK_TICK_US_SCALE % centibpm;
+	midi_clock.phase = 0;
+	MIDI_Platform_Unlock(irq);
+	return MIDI_OK;
+}
+
+uint32_t MIDI_Clock_Get_Tempo(void)
+{
+	return midi_clock.tempo;
+}
+
+bool MIDI_Clock_Is_Running(void)
+{
+	return midi_clock.running;
+}
+
+// Send the message, then start ticking a byte time later so it leads the first clock
+static void midi_clock_run(uint8_t message)
+{
+	midi_irq_state_t irq = MIDI_Platform_Lock();
+	midi_clock_send(message);
+	midi_clock.running = true;
+	midi_clock.phase = 0;
+	midi_clock.next = MIDI_Time_Now() + MIDI_BYTE_TIME_US;
+	MIDI_Time_Alarm_Set(MIDI_TIME_ALARM_CLOCK, midi_clock.next);
+	MIDI_Platform_Unlock(irq);
+}
+
+void MIDI_Clock_Start(void)
+{
+	midi_clock.position = 0;
+	midi_clock_run(0xFA);
+}
+
+void MIDI_Clock_Continue(void)
+{
+	midi_clock_run(0xFB);
+}
+
+void MIDI_Clock_Stop(void)
+{
+	midi_irq_state_t irq = MIDI_Platform_Lock();
+	MIDI_Time_Alarm_Stop(MIDI_TIME_ALARM_CLOCK);
+	midi_clock.running = false;
+	midi_clock_send(0xFC);
+	MIDI_Platform_Unlock(irq);
+}
+
+/*
+ * TIM2 channel 2 compare. Sends every tick that has come due, normally just
+ * the one, and sets the compare for the next.
+ */
+void MIDI_Clock_Timer_IRQ(void)
+{
+	uint32_t now;
+	bool late = false;
+
+	if (!midi_clock.running) {
+		MIDI_Time_Alarm_Stop(MIDI_TIME_ALARM_CLOCK);
+		return;
+	}
+
+	do {
+		now = MIDI_Time_Now();
+		while (MIDI_Time_Diff(now, midi_clock.next) >= 0) {
+			if (late) {
+				midi_clock.stats.catch_ups++;
+			}
+			midi_clock_send(0xF8);
+			MIDI_Histogram_Add(&midi_clock.stats.jitter, (uint32_t)MIDI_Time_Diff(now, midi_clock.next));
+			midi_clock.stats.ticks++;
+			midi_clock.position++;
+			midi_clock_advance();
+			late = true;
+		}
+		MIDI_Time_Alarm_Set(MIDI_TIME_ALARM_CLOCK, midi_clock.next);
+	} while (MIDI_Time_Diff(midi_clock.next, MIDI_Time_Now()) <= 0);
+}
+
+void MIDI_Clock_Print_Stats(void)
+{
+	printf("clock: %s, tempo %lu.%02lu BPM, position %lu, ticks %lu, rt overflows %lu, catch ups %lu\r\n",
+			midi_clock.running ? "running" : "stopped",
+			(unsigned long)(midi_clock.tempo / 100), (unsigned long)(midi_clock.tempo % 100),
+			(unsigned long)midi_clock.position, (unsigned long)midi_clock.stats.ticks,
+			(unsigned long)midi_clock.stats.rt_overflows, (unsigned long)midi_clock.stats.catch_ups);
+	MIDI_Histogram_Print("clock jitter", &midi_clock.stats.jitter);
+}
@@ -0,0 +1,37 @@
+/*
+ * midi_clock.h
+ *
+ * MIDI clock master. Sends 24 PPQN timing clock (0xF8) on the real-time lane
+ * of every port, timed off the TIM2 channel 2 compare interrupt. Tempo is set
+ * in hundredths of a BPM. The tick period in microseconds is rarely whole, so
+ * the fraction is carried in an accumulator from tick to tick: individual
+ * ticks are rounded to the microsecond but the clock never drifts.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_CLOCK_H
+#define MIDI_CLOCK_H
+
+#include "midi.h"
+#include "midi_time.h"
+
+#define MIDI_CLOCK_PPQN 24
+#define MIDI_CLOCK_MIN_TEMPO 2000      // 20.00 BPM
+#define MIDI_CLOCK_MAX_TEMPO 30000     // 300.00 BPM
+#define MIDI_CLOCK_DEFAULT_TEMPO 12000 // 120.00 BPM
+
+// Microseconds per clock tick is this over the tempo in hundredths of a BPM
+#define MIDI_CLOCK_TICK_US_SCALE (60UL * MIDI_TIME_TICKS_PER_SEC * 100 / MIDI_CLOCK_PPQN)
+
+void MIDI_Clock_Init(void);
+MIDI_error_t MIDI_Clock_Set_Tempo(uint32_t centibpm);
+uint32_t MIDI_Clock_Get_Tempo(void);
+bool MIDI_Clock_Is_Running(void);
+void MIDI_Clock_Start(void);
+void MIDI_Clock_Stop(void);
+void MIDI_Clock_Continue(void);
+void MIDI_Clock_Timer_IRQ(void);
+void MIDI_Clock_Print_Stats(void);
+
+#endif // MIDI_CLOCK_H
@@ -0,0 +1,63 @@
+/*
+ * midi_event.h
+ *
+ * Fixed size MIDI message events, packed the same way as USB-MIDI 1.0 event
+ * packets: a header byte carrying the cable number and code index number (CIN),
+ * followed by up to three MIDI bytes. Unused bytes are zero.
+ *
+ * Sysex is carried as a run of three-byte start/continue events closed by an
+ * end event holding the last one to three bytes, the final one being 0xF7.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_EVENT_H
+#define MIDI_EVENT_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint8_t header;   // Cable number in the high nibble, code index number in the low
+	uint8_t bytes[3]; // MIDI message bytes
+} midi_event_t;
+
+typedef enum {
+	MIDI_CIN_MISC = 0x0,         // Reserved
+	MIDI_CIN_CABLE = 0x1,        // Reserved
+	MIDI_CIN_COMMON_2 = 0x2,     // Two byte system common, MTC quarter frame and song select
+	MIDI_CIN_COMMON_3 = 0x3,     // Three byte system common, song position pointer
+	MIDI_CIN_SYSEX = 0x4,        // Sysex start or continue, three bytes
+	MIDI_CIN_SYSEX_END_1 = 0x5,  // Sysex end with one byte, or single byte system common
+	MIDI_CIN_SYSEX_END_2 = 0x6,  // Sysex end with two bytes
+	MIDI_CIN_SYSEX_END_3 = 0x7,  // Sysex end with three bytes
+	MIDI_CIN_NOTE_OFF = 0x8,
+	MIDI_CIN_NOTE_ON = 0x9,
+	MIDI_CIN_POLY_PRESSURE = 0xA,
+	MIDI_CIN_CC = 0xB,
+	MIDI_CIN_PROGRAM_CHANGE = 0xC,
+	MIDI_CIN_CHANNEL_PRESSURE = 0xD,
+	MIDI_CIN_PITCH_BEND = 0xE,
+	MIDI_CIN_SINGLE_BYTE = 0xF,  // Real-time
+} midi_cin_e;
+
+// Number of MIDI bytes carried by an event, indexed by CIN
+extern const uint8_t midi_event_cin_length[16];
+
+static inline uint8_t midi_event_cin(const midi_event_t *event) {
+	return (event->header & 0x0f);
+}
+
+static inline uint8_t midi_event_cable(const midi_event_t *event) {
+	return (event->header >> 4);
+}
+
+static inline uint8_t midi_event_length(const midi_event_t *event) {
+	return midi_event_cin_length[event->header & 0x0f];
+}
+
+static inline midi_event_t midi_event_make(uint8_t cable, uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2) {
+	midi_event_t event = { (uint8_t)((cable << 4) | (cin & 0x0f)), { b0, b1, b2 } };
+	return event;
+}
+
+#endif // MIDI_EVENT_H
@@ -0,0 +1,178 @@
+/*
+ * midi_event_queue.c
+ *
+ * Event queue between the MIDI parser and its consumers. Events are four bytes,
+ * so with word aligned storage pushing or popping one is a single word copy.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stddef.h>
+#include "midi_event_queue.h"
+
+#if defined(__arm__)
+#define MIDI_EVENT_QUEUE_BARRIER()	__asm volatile ("dmb" ::: "memory")
+#else
+#define MIDI_EVENT_QUEUE_BARRIER()	__sync_synchronize()
+#endif
+
+bool MIDI_Event_Queue_Init(midi_event_queue_t *queue, midi_event_t *storage, uint32_t *timestamps, uint16_t size)
+{
+	if ((storage == NULL) || (timestamps == NULL) || (size == 0) || (size & (size - 1)) || (size > 0x8000)) {
+		return false;
+	}
+	queue->events = storage;
+	queue->timestamps = timestamps;
+	queue->size = size;
+	queue->read_pos = 0;
+	queue->write_pos = 0;
+	queue->drops = 0;
+	return true;
+}
+
+// Consumer side only: throws away whatever is queued
+void MIDI_Event_Queue_Flush(midi_event_queue_t *queue)
+{
+	queue->read_pos = queue->write_pos;
+}
+
+uint16_t MIDI_Event_Queue_Length(const midi_event_queue_t *queue)
+{
+	return (uint16_t)(queue->write_pos - queue->read_pos);
+}
+
+bool MIDI_Event_Queue_Push(midi_event_queue_t *queue, const midi_event_t *event, uint32_t timestamp)
+{
+	uint16_t write_pos = queue->write_pos;
+	uint16_t slot;
+
+	if ((uint16_t)(write_pos - queue->read_pos) >= queue->size) {
+		queue->drops++;
+		return false;
+	}
+	slot = write_pos & (queue->size - 1);
+	queue->events[slot] = *event;
+	queue->timestamps[slot] = timestamp;
+
+	MIDI_EVENT_QUEUE_BARRIER(); // Event must land before the consumer can see it
+	queue->write_pos = write_pos + 1;
+	return true;
+}
+
+/*
+ * Copy out up to max_events in one go, returning how many were taken. The
+ * indices are read and published once per batch rather than once per event.
+ * timestamps may be NULL if the caller doesn't want them.
+ */
+uint16_t MIDI_Event_Queue_Pop(midi_event_queue_t *queue, midi_event_t *events, uint32_t *timestamps, uint16_t max_events)
+{
+	uint16_t read_pos = queue->read_pos;
+	uint16_t count = (uint16_t)(queue->write_pos - read_pos);
+	uint16_t slot;
+	uint16_t i;
+
+	if (count > max_events) {
+		count = max_events;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	MIDI_EVENT_QUEUE_BARRIER(); // Don't read events older than the write index we just saw
+
+	for (i = 0; i < count; i++) {
+		slot = (read_pos + i) & (queue->size - 1);
+		events[i] = queue->events[slot];
+		if (timestamps != NULL) {
+			timestamps[i] = queue->timestamps[slot];
+		}
+	}
+
+	MIDI_EVENT_QUEUE_BARRIER(); // Finish reading before the producer may reuse the slots
+	queue->read_pos = read_pos + count;
+	return count;
+}
+
+/*
+ * Look at the oldest event without taking it, for consumers that only commit
+ * to an event once they know where it's going. timestamp may be NULL.
+ */
+bool MIDI_Event_Queue_Peek(const midi_event_queue_t *queue, midi_event_t *event, uint32_t *timestamp)
+{
+	uint16_t read_pos = queue->read_pos;
+	uint16_t slot;
+
+	if (queue->write_pos == read_pos) {
+		return false;
+	}
+	MIDI_EVENT_QUEUE_BARRIER();
+
+	slot = read_pos & (queue->size - 1);
+	*event = queue->events[slot];
+	if (timestamp != NULL) {
+		*timestamp = queue->timestamps[slot];
+	}
+	return true;
+}
+
+// Consumer side only: release up to count events, normally ones already peeked at
+void MIDI_Event_Queue_Drop(midi_event_queue_t *queue, uint16_t count)
+{
+	uint16_t read_pos = queue->read_pos;
+	uint16_t length = (uint16_t)(queue->write_pos - read_pos);
+
+	if (count > length) {
+		count = length;
+	}
+	MIDI_EVENT_QUEUE_BARRIER(); // Finish reading before the producer may reuse the slots
+	queue->read_pos = read_pos + count;
+}
+
+/*
+ * Producer side, for filling the queue in place (a USB packet read straight out
+ * of the peripheral, say). Returns count contiguous free slots at the write
+ * position, or NULL if there aren't that many before the queue is full or the
+ * storage wraps. Nothing is visible to the consumer until the commit.
+ */
+midi_event_t *MIDI_Event_Queue_Reserve(midi_event_queue_t *queue, uint16_t count)
+{
+	uint16_t write_pos = queue->write_pos;
+	uint16_t slot = write_pos & (queue->size - 1);
+
+	if (((uint16_t)(write_pos - queue->read_pos) + count > queue->size) || (slot + count > queue->size)) {
+		return NULL;
+	}
+	return &queue->events[slot];
+}
+
+// Publish count events written into the last reservation, all stamped with timestamp
+void MIDI_Event_Queue_Commit(midi_event_queue_t *queue, uint16_t count, uint32_t timestamp)
+{
+	uint16_t write_pos = queue->write_pos;
+	uint16_t slot = write_pos & (queue->size - 1);
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		queue->timestamps[slot + i] = timestamp;
+	}
+	MIDI_EVENT_QUEUE_BARRIER(); // Events must land before the consumer can see them
+	queue->write_pos = write_pos + count;
+}
+
+/*
+ * Consumer side: the oldest events as they sit in storage, up to the wrap, for
+ * handing to something that copies them out itself. *count gets how many; let
+ * them go with MIDI_Event_Queue_Drop() once they've been used.
+ */
+const midi_event_t *MIDI_Event_Queue_Contiguous(const midi_event_queue_t *queue, uint16_t *count)
+{
+	uint16_t read_pos = queue->read_pos;
+	uint16_t slot = read_pos & (queue->size - 1);
+	uint16_t length = (uint16_t)(queue->write_pos - read_pos);
+
+	if (length > queue->size - slot) {
+		length = queue->size - slot;
+	}
+	*count = length;
+	MIDI_EVENT_QUEUE_BARRIER();
+	return &queue->events[slot];
+}
@@ -0,0 +1,42 @@
+/*
+ * midi_event_queue.h
+ *
+ * Fixed capacity queue of midi_event_t records. It sits between the receive
+ * parser and the application, so consumers deal in whole messages instead of
+ * bytes. Single producer, single consumer, with the same free running index
+ * scheme as circular_buffer_t, so an ISR may push while the main loop pops.
+ *
+ * Each event carries a 32 bit timestamp, kept in a parallel array so the event
+ * records themselves stay packed.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_EVENT_QUEUE_H
+#define MIDI_EVENT_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "midi_event.h"
+
+typedef struct {
+	midi_event_t *events;         // Storage for size events
+	uint32_t *timestamps;         // Storage for size timestamps, matching events by index
+	uint16_t size;                // Capacity in events, power of 2, at most 32768
+	volatile uint16_t read_pos;   // Free running, only moved by the consumer
+	volatile uint16_t write_pos;  // Free running, only moved by the producer
+	uint32_t drops;               // Events refused because the queue was full
+} midi_event_queue_t;
+
+bool MIDI_Event_Queue_Init(midi_event_queue_t *queue, midi_event_t *storage, uint32_t *timestamps, uint16_t size);
+void MIDI_Event_Queue_Flush(midi_event_queue_t *queue);
+uint16_t MIDI_Event_Queue_Length(const midi_event_queue_t *queue);
+bool MIDI_Event_Queue_Push(midi_event_queue_t *queue, const midi_event_t *event, uint32_t timestamp);
+uint16_t MIDI_Event_Queue_Pop(midi_event_queue_t *queue, midi_event_t *events, uint32_t *timestamps, uint16_t max_events);
+bool MIDI_Event_Queue_Peek(const midi_event_queue_t *queue, midi_event_t *event, uint32_t *timestamp);
+void MIDI_Event_Queue_Drop(midi_event_queue_t *queue, uint16_t count);
+midi_event_t *MIDI_Event_Queue_Reserve(midi_event_queue_t *queue, uint16_t count);
+void MIDI_Event_Queue_Commit(midi_event_queue_t *queue, uint16_t count, uint32_t timestamp);
+const midi_event_t *MIDI_Event_Queue_Contiguous(const midi_event_queue_t *queue, uint16_t *count);
+
+#endif // MIDI_EVENT_QUEUE_H
@@ -0,0 +1,169 @@
+/*
+ * midi_merge.c
+ *
+ * Message-atomic, round-robin merge of MIDI inputs.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_merge.h"
+#include "midi_time.h"
+
+void MIDI_Merge_Init(midi_merge_t *merge, midi_merge_sink_t sink, void *sink_context)
+{
+	memset(merge, 0, sizeof(*merge));
+	merge->sysex_owner = MIDI_MERGE_NO_OWNER;
+	merge->sink = sink;
+	merge->sink_context = sink_context;
+}
+
+// Add a queue of input events, such as a port's rx_events, merged as cable
+MIDI_error_t MIDI_Merge_Add_Input(midi_merge_t *merge, midi_event_queue_t *queue, uint8_t cable)
+{
+	midi_merge_input_t *input;
+
+	if ((queue == NULL) || (cable > 0x0F) || (merge->num_inputs >= MIDI_MERGE_MAX_INPUTS)) {
+		return MIDI_INVALID_PARAM;
+	}
+	input = &merge->inputs[merge->num_inputs++];
+	input->queue = queue;
+	input->cable = cable;
+	MIDI_Histogram_Reset(&input->wait);
+	return MIDI_OK;
+}
+
+static inline bool midi_merge_is_realtime(const midi_event_t *event)
+{
+	return (midi_event_cin(event) == MIDI_CIN_SINGLE_BYTE) && (event->bytes[0] >= 0xF8);
+}
+
+/*
+ * Give up on a sysex that has stopped arriving. A lone 0xF7 closes it on the
+ * output, and whatever is left of it on the input is dropped when it turns up.
+ */
+static MIDI_error_t midi_merge_sysex_timeout(midi_merge_t *merge, uint32_t now)
+{
+	midi_merge_input_t *input = &merge->inputs[merge->sysex_owner];
+	midi_event_t eox = midi_event_make(input->cable, MIDI_CIN_SYSEX_END_1, 0xF7, 0, 0);
+	MIDI_error_t status;
+
+	status = merge->sink(&eox, now, merge->sink_context);
+	if (status != MIDI_OK) {
+		return status;
+	}
+	input->sysex_timeouts++;
+	input->dropping_sysex = true;
+	merge->sysex_owner = MIDI_MERGE_NO_OWNER;
+	return MIDI_OK;
+}
+
+/*
+ * One turn for one input: up to MIDI_MERGE_QUANTUM events, or only its
+ * real-time events while another input holds a sysex open. Returns false if
+ * the sink pushed back and merging has to stop for now.
+ */
+static bool midi_merge_turn(midi_merge_t *merge, uint8_t index, uint32_t now)
+{
+	midi_merge_input_t *input = &merge->inputs[index];
+	midi_event_t event;
+	uint32_t timestamp;
+	int32_t wait;
+	uint16_t backlog;
+	uint8_t count;
+	uint8_t cin;
+
+	backlog = MIDI_Event_Queue_Length(input->queue);
+	if (backlog == 0) {
+		return true;
+	}
+	if (backlog > input->max_backlog) {
+		input->max_backlog = backlog;
+	}
+
+	for (count = 0; count < MIDI_MERGE_QUANTUM; count++) {
+		if (!MIDI_Event_Queue_Peek(input->queue, &event, &timestamp)) {
+			break;
+		}
+		event.header = (uint8_t)((input->cable << 4) | (event.header & 0x0F));
+		cin = midi_event_cin(&event);
+
+		// A one byte end holds F7, or a data byte if a status cut the sysex short; tune request passes
+		if (input->dropping_sysex && !midi_merge_is_realtime(&event)) {
+			if (cin != MIDI_CIN_SYSEX) {
+				input->dropping_sysex = false;
+			}
+			if ((cin == MIDI_CIN_SYSEX) || (cin == MIDI_CIN_SYSEX_END_2) || (cin == MIDI_CIN_SYSEX_END_3)
+					|| ((cin == MIDI_CIN_SYSEX_END_1) && ((event.bytes[0] == 0xF7) || (event.bytes[0] < 0x80)))) {
+				MIDI_Event_Queue_Drop(input->queue, 1);
+				continue;
+			}
+		}
+
+		if ((merge->sysex_owner != MIDI_MERGE_NO_OWNER) && (merge->sysex_owner != index)
+				&& !midi_merge_is_realtime(&event)) {
+			input->blocked_turns++;
+			break;
+		}
+
+		if (merge->sink(&event, timestamp, merge->sink_context) != MIDI_OK) {
+			return false;
+		}
+		MIDI_Event_Queue_Drop(input->queue, 1);
+		input->events++;
+		wait = MIDI_Time_Diff(now, timestamp); // Stamped after this pass started counts as no wait
+		MIDI_Histogram_Add(&input->wait, (wait > 0) ? wait : 0);
+
+		// Anything but a sysex start or continue, real-time aside, leaves sysex
+		if (!midi_merge_is_realtime(&event)) {
+			if (cin == MIDI_CIN_SYSEX) {
+				merge->sysex_owner = index;
+				merge->sysex_last = now;
+			} else if (merge->sysex_owner == index) {
+				merge->sysex_owner = MIDI_MERGE_NO_OWNER;
+			}
+		}
+	}
+	return true;
+}
+
+void MIDI_Merge_Process(midi_merge_t *merge)
+{
+	uint32_t now = MIDI_Time_Now();
+	uint8_t turns;
+
+	if (merge->num_inputs == 0) {
+		return;
+	}
+
+	if ((merge->sysex_owner != MIDI_MERGE_NO_OWNER)
+			&& (MIDI_Time_Diff(now, merge->sysex_last) > MIDI_MERGE_SYSEX_TIMEOUT_US)
+			&& (MIDI_Event_Queue_Length(merge->inputs[merge->sysex_owner].queue) == 0)) {
+		if (midi_merge_sysex_timeout(merge, now) != MIDI_OK) {
+			return;
+		}
+	}
+
+	// One full round, starting where the last call left off
+	for (turns = 0; turns < merge->num_inputs; turns++) {
+		if (!midi_merge_turn(merge, merge->next, now)) {
+			return; // Same input gets the next turn, nothing it had was lost
+		}
+		merge->next = (merge->next + 1) % merge->num_inputs;
+	}
+}
+
+void MIDI_Merge_Print_Stats(midi_merge_t *merge)
+{
+	midi_merge_input_t *input;
+	uint8_t i;
+
+	for (i = 0; i < merge->num_inputs; i++) {
+		input = &merge->inputs[i];
+		printf("input %d: events %lu, max backlog %lu, blocked turns %lu, sysex timeouts %lu\r\n",
+				input->cable, (unsigned long)input->events, (unsigned long)input->max_backlog,
+				(unsigned long)input->blocked_turns, (unsigned long)input->sysex_timeouts);
+		MIDI_Histogram_Print("  merge wait", &input->wait);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * midi_merge.h
+ *
+ * Merges several queues of parsed input, from the MIDI ports and the USB host,
+ * into a single event stream, without ever splitting a message. Each input
+ * has its own cable number, which is stamped on its events as they're merged
+ * so whatever takes the stream can tell them apart. Inputs are served round-robin, at most
+ * MIDI_MERGE_QUANTUM events each per turn, so an input waits no more than
+ * (inputs - 1) * MIDI_MERGE_QUANTUM events for its turn.
+ *
+ * Sysex is the one message spread over several events. While an input is in
+ * the middle of one, the other inputs may only pass real-time events, which
+ * MIDI allows anywhere. If the sysex stalls for MIDI_MERGE_SYSEX_TIMEOUT_US it
+ * is closed off and the rest of it from that input is dropped.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_MERGE_H
+#define MIDI_MERGE_H
+
+#include "midi.h"
+
+#define MIDI_MERGE_MAX_INPUTS MIDI_MAX_INPUTS // Inputs are numbered by cable, so at most 16
+#define MIDI_MERGE_QUANTUM 4
+#define MIDI_MERGE_SYSEX_TIMEOUT_US 500000
+
+#define MIDI_MERGE_NO_OWNER 0xFF
+
+/*
+ * Receives the merged stream. It either takes the event whole and returns
+ * MIDI_OK, or takes nothing and returns an error (typically MIDI_TX_OVERFLOW),
+ * in which case the event stays queued and merging stops until the next call.
+ */
+typedef MIDI_error_t (*midi_merge_sink_t)(const midi_event_t *event, uint32_t timestamp, void *context);
+
+typedef struct {
+	midi_event_queue_t *queue;
+	uint8_t cable;
+	bool dropping_sysex;    // Rest of a timed out sysex is being thrown away
+	uint32_t events;        // Events merged
+	uint32_t max_backlog;   // Most events seen waiting at the start of a turn
+	uint32_t blocked_turns; // Turns lost to another input's sysex
+	uint32_t sysex_timeouts;
+	midi_histogram_t wait;  // Arrival to merge time, in microseconds
+} midi_merge_input_t;
+
+typedef struct {
+	midi_merge_input_t inputs[MIDI_MERGE_MAX_INPUTS];
+	uint8_t num_inputs;
+	uint8_t next;           // Input whose turn is next
+	uint8_t sysex_owner;    // Input in the middle of a sysex, MIDI_MERGE_NO_OWNER if none
+	uint32_t sysex_last;    // When the owner last moved its sysex on
+	midi_merge_sink_t sink;
+	void *sink_context;
+} midi_merge_t;
+
+void MIDI_Merge_Init(midi_merge_t *merge, midi_merge_sink_t sink, void *sink_context);
+MIDI_error_t MIDI_Merge_Add_Input(midi_merge_t *merge, midi_event_queue_t *queue, uint8_t cable);
+void MIDI_Merge_Process(midi_merge_t *merge);
+void MIDI_Merge_Print_Stats(midi_merge_t *merge);
+
+#endif // MIDI_MERGE_H
@@ -0,0 +1,175 @@
+/*
+ * midi_parser.c
+ *
+ * Table driven MIDI 1.0 byte stream parser. Every byte value maps to an entry
+ * saying what to do with it and, for status bytes, how the finished message is
+ * packed and how many data bytes it needs. The per-byte work is one lookup and
+ * a dispatch on the action, with no searching or scanning.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stddef.h>
+#include "midi_parser.h"
+
+typedef enum {
+	PARSE_DATA = 0,
+	PARSE_STATUS,      // Channel voice or system common, starts a message
+	PARSE_SYSEX_START,
+	PARSE_SYSEX_END,
+	PARSE_REALTIME,    // Passed straight through without touching any state
+	PARSE_UNDEFINED,   // Undefined system common, cancels running status
+	PARSE_IGNORE,      // Undefined real-time, dropped
+} midi_parse_action_e;
+
+typedef struct {
+	uint8_t action;
+	uint8_t cin;    // How a complete message is packed
+	uint8_t length; // Data bytes following the status
+} midi_byte_info_t;
+
+const uint8_t midi_event_cin_length[16] = {
+	0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+};
+
+static const midi_byte_info_t midi_byte_info[256] = {
+	[0x00 ... 0x7F] = { PARSE_DATA, 0, 0 },
+	[0x80 ... 0x8F] = { PARSE_STATUS, MIDI_CIN_NOTE_OFF, 2 },
+	[0x90 ... 0x9F] = { PARSE_STATUS, MIDI_CIN_NOTE_ON, 2 },
+	[0xA0 ... 0xAF] = { PARSE_STATUS, MIDI_CIN_POLY_PRESSURE, 2 },
+	[0xB0 ... 0xBF] = { PARSE_STATUS, MIDI_CIN_CC, 2 },
+	[0xC0 ... 0xCF] = { PARSE_STATUS, MIDI_CIN_PROGRAM_CHANGE, 1 },
+	[0xD0 ... 0xDF] = { PARSE_STATUS, MIDI_CIN_CHANNEL_PRESSURE, 1 },
+	[0xE0 ... 0xEF] = { PARSE_STATUS, MIDI_CIN_PITCH_BEND, 2 },
+	[0xF0] = { PARSE_SYSEX_START, MIDI_CIN_SYSEX, 0 },
+	[0xF1] = { PARSE_STATUS, MIDI_CIN_COMMON_2, 1 },         // MTC quarter frame
+	[0xF2] = { PARSE_STATUS, MIDI_CIN_COMMON_3, 2 },         // Song position pointer
+	[0xF3] = { PARSE_STATUS, MIDI_CIN_COMMON_2, 1 },         // Song select
+	[0xF4] = { PARSE_UNDEFINED, 0, 0 },
+	[0xF5] = { PARSE_UNDEFINED, 0, 0 },
+	[0xF6] = { PARSE_STATUS, MIDI_CIN_SYSEX_END_1, 0 },      // Tune request
+	[0xF7] = { PARSE_SYSEX_END, MIDI_CIN_SYSEX_END_1, 0 },
+	[0xF8] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Clock
+	[0xF9] = { PARSE_IGNORE, 0, 0 },
+	[0xFA] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Start
+	[0xFB] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Continue
+	[0xFC] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Stop
+	[0xFD] = { PARSE_IGNORE, 0, 0 },
+	[0xFE] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Active sensing
+	[0xFF] = { PARSE_REALTIME, MIDI_CIN_SINGLE_BYTE, 0 },    // Reset
+};
+
+void MIDI_Parser_Init(midi_parser_t *parser, uint8_t cable)
+{
+	parser->cable = cable & 0x0f;
+	parser->stray_bytes = 0;
+	parser->sysex_aborts = 0;
+	MIDI_Parser_Reset(parser);
+}
+
+// Forget any partial message and running status, keeping the counters
+void MIDI_Parser_Reset(midi_parser_t *parser)
+{
+	parser->pending = midi_event_make(parser->cable, 0, 0, 0, 0);
+	parser->expected = 0;
+	parser->count = 0;
+	parser->in_sysex = 0;
+}
+
+// Close off a sysex with whatever bytes are pending, 0xF7 included if it's there
+static uint8_t midi_parser_end_sysex(midi_parser_t *parser, midi_event_t *event)
+{
+	uint8_t num_events = 0;
+
+	if (parser->count > 0) {
+		parser->pending.header = (parser->cable << 4) | (MIDI_CIN_SYSEX_END_1 + parser->count - 1);
+		*event = parser->pending;
+		num_events = 1;
+	}
+	parser->in_sysex = 0;
+	parser->count = 0;
+	return num_events;
+}
+
+uint8_t MIDI_Parser_Feed(midi_parser_t *parser, uint8_t byte, midi_event_t events[MIDI_PARSER_MAX_EVENTS])
+{
+	const midi_byte_info_t *info = &midi_byte_info[byte];
+	uint8_t num_events = 0;
+
+	switch (info->action) {
+	case PARSE_DATA:
+		if (parser->in_sysex) {
+			parser->pending.bytes[parser->count++] = byte;
+			if (parser->count == 3) {
+				events[0] = parser->pending;
+				parser->pending = midi_event_make(parser->cable, MIDI_CIN_SYSEX, 0, 0, 0);
+				parser->count = 0;
+				return 1;
+			}
+			return 0;
+		}
+		if (parser->expected == 0) {
+			parser->stray_bytes++;
+			return 0;
+		}
+		parser->pending.bytes[++parser->count] = byte;
+		if (parser->count < parser->expected) {
+			return 0;
+		}
+		events[0] = parser->pending;
+		parser->count = 0;
+		if (parser->pending.bytes[0] >= 0xF0) {
+			parser->expected = 0; // No running status for system common
+		}
+		return 1;
+
+	case PARSE_STATUS:
+		if (parser->in_sysex) {
+			parser->sysex_aborts++;
+			num_events = midi_parser_end_sysex(parser, &events[0]);
+		}
+		parser->pending = midi_event_make(parser->cable, info->cin, byte, 0, 0);
+		parser->expected = info->length;
+		parser->count = 0;
+		if (info->length == 0) {
+			events[num_events++] = parser->pending; // Tune request is complete on its own
+		}
+		return num_events;
+
+	case PARSE_SYSEX_START:
+		if (parser->in_sysex) {
+			parser->sysex_aborts++;
+			num_events = midi_parser_end_sysex(parser, &events[0]);
+		}
+		parser->pending = midi_event_make(parser->cable, MIDI_CIN_SYSEX, byte, 0, 0);
+		parser->expected = 0;
+		parser->count = 1;
+		parser->in_sysex = 1;
+		return num_events;
+
+	case PARSE_SYSEX_END:
+		parser->expected = 0;
+		if (!parser->in_sysex) {
+			parser->stray_bytes++;
+			return 0;
+		}
+		parser->pending.bytes[parser->count++] = byte;
+		return midi_parser_end_sysex(parser, &events[0]);
+
+	case PARSE_REALTIME:
+		events[0] = midi_event_make(parser->cable, MIDI_CIN_SINGLE_BYTE, byte, 0, 0);
+		return 1;
+
+	case PARSE_UNDEFINED:
+		if (parser->in_sysex) {
+			parser->sysex_aborts++;
+			num_events = midi_parser_end_sysex(parser, &events[0]);
+		}
+		parser->expected = 0;
+		parser->count = 0;
+		return num_events;
+
+	default:
+		return 0;
+	}
+}
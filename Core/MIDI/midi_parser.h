@@ -0,0 +1,36 @@
+/*
+ * midi_parser.h
+ *
+ * Incremental MIDI 1.0 byte stream parser. Turns raw bytes into fixed size
+ * midi_event_t messages one byte at a time, handling running status, real-time
+ * bytes interleaved anywhere (including inside other messages and sysex),
+ * system common messages and sysex framing.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_PARSER_H
+#define MIDI_PARSER_H
+
+#include <stdint.h>
+#include "midi_event.h"
+
+// Most events a single input byte can produce: a status byte that cuts a sysex
+// short closes it and may complete a message of its own (tune request).
+#define MIDI_PARSER_MAX_EVENTS 2
+
+typedef struct {
+	midi_event_t pending;  // Message being assembled, bytes[0] holds the status
+	uint8_t cable;         // Cable number stamped on every event
+	uint8_t expected;      // Data bytes needed to complete the pending message, 0 if no status
+	uint8_t count;         // Data bytes collected so far (bytes collected when in sysex)
+	uint8_t in_sysex;
+	uint32_t stray_bytes;  // Data bytes dropped for lack of a status
+	uint32_t sysex_aborts; // Sysex messages cut short by a status byte
+} midi_parser_t;
+
+void MIDI_Parser_Init(midi_parser_t *parser, uint8_t cable);
+void MIDI_Parser_Reset(midi_parser_t *parser);
+uint8_t MIDI_Parser_Feed(midi_parser_t *parser, uint8_t byte, midi_event_t events[MIDI_PARSER_MAX_EVENTS]);
+
+#endif // MIDI_PARSER_H
@@ -0,0 +1,126 @@
+/*
+ * midi_platform.h
+ *
+ * Everything the MIDI core needs from the chip: masking interrupts, the TIM2
+ * timebase with its compare alarms, and the UARTs' DMA. The rest of Core/MIDI
+ * reaches the hardware only through here, so bringing the core up somewhere
+ * else starts with this file. The host build in Test/ defines
+ * MIDI_PLATFORM_HOST and supplies fakes of all of it instead.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_PLATFORM_H
+#define MIDI_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t midi_irq_state_t;
+
+#define MIDI_PLATFORM_UARTS 5 // USART1-3, UART4 and UART5
+
+#if defined(MIDI_PLATFORM_HOST)
+#include "midi_platform_host.h"
+#else
+#include <stm32f3xx_hal.h>
+
+/*
+ * Mask interrupts, returning the previous state for MIDI_Platform_Unlock().
+ * Nests, so it's safe from interrupt handlers and already masked code.
+ */
+static inline midi_irq_state_t MIDI_Platform_Lock(void) {
+	midi_irq_state_t state = __get_PRIMASK();
+
+	__disable_irq();
+	return state;
+}
+
+static inline void MIDI_Platform_Unlock(midi_irq_state_t state) {
+	__set_PRIMASK(state);
+}
+
+// TIM2, free running at 1MHz over the full 32 bits
+static inline uint32_t MIDI_Platform_Timer_Now(void) {
+	return TIM2->CNT;
+}
+
+// Compare channel 1 + channel on TIM2: arm for time when, clearing any stale match
+static inline void MIDI_Platform_Alarm_Set(uint8_t channel, uint32_t when) {
+	(&TIM2->CCR1)[channel] = when;
+	TIM2->SR = (uint32_t)~(TIM_SR_CC1IF << channel);
+	TIM2->DIER |= (TIM_DIER_CC1IE << channel);
+}
+
+// Raise the compare interrupt right away
+static inline void MIDI_Platform_Alarm_Fire(uint8_t channel) {
+	TIM2->DIER |= (TIM_DIER_CC1IE << channel);
+	TIM2->EGR = (TIM_EGR_CC1G << channel);
+}
+
+static inline void MIDI_Platform_Alarm_Stop(uint8_t channel) {
+	TIM2->DIER &= ~(TIM_DIER_CC1IE << channel);
+}
+
+// Which UART it is, 0 to MIDI_PLATFORM_UARTS - 1, or MIDI_PLATFORM_UARTS if none of them
+static inline uint8_t MIDI_Platform_UART_Index(const UART_HandleTypeDef *uart) {
+	switch ((uintptr_t)uart->Instance) {
+	case USART1_BASE: return 0;
+	case USART2_BASE: return 1;
+	case USART3_BASE: return 2;
+	case UART4_BASE:  return 3;
+	case UART5_BASE:  return 4;
+	default:          return MIDI_PLATFORM_UARTS;
+	}
+}
+
+/*
+ * Start circular DMA reception into buffer, with the idle line interrupt on
+ * to catch the tail of a burst that doesn't end on a half or full boundary.
+ */
+static inline HAL_StatusTypeDef MIDI_Platform_UART_Receive(UART_HandleTypeDef *uart, uint8_t *buffer, uint16_t length) {
+	HAL_StatusTypeDef status = HAL_UART_Receive_DMA(uart, buffer, length);
+
+	if (status == HAL_OK) {
+		__HAL_UART_CLEAR_IDLEFLAG(uart);
+		__HAL_UART_ENABLE_IT(uart, UART_IT_IDLE);
+	}
+	return status;
+}
+
+// Bytes the receive DMA has left to write before it wraps back to the start of the buffer
+static inline uint16_t MIDI_Platform_UART_Rx_Remaining(UART_HandleTypeDef *uart) {
+	return __HAL_DMA_GET_COUNTER(uart->hdmarx);
+}
+
+// False once an error has stopped reception, which then needs restarting
+static inline bool MIDI_Platform_UART_Rx_Running(UART_HandleTypeDef *uart) {
+	return uart->RxState == HAL_UART_STATE_BUSY_RX;
+}
+
+static inline HAL_StatusTypeDef MIDI_Platform_UART_Transmit(UART_HandleTypeDef *uart, const uint8_t *data, uint16_t length) {
+	return HAL_UART_Transmit_DMA(uart, (uint8_t *)data, length);
+}
+
+// Bytes the transmit DMA has yet to hand to the UART; at zero only the complete interrupt is left to come
+static inline uint16_t MIDI_Platform_UART_Tx_Remaining(UART_HandleTypeDef *uart) {
+	return __HAL_DMA_GET_COUNTER(uart->hdmatx);
+}
+
+/*
+ * Stop the transmit DMA part way, setting *unsent to the bytes it hadn't yet
+ * handed to the UART. HAL_UART_AbortTransmit() stops the UART's DMA requests
+ * and then disables the channel, which leaves its count where it stopped, so
+ * the count is exact. It also returns the channel to ready, which the next
+ * transmit needs.
+ */
+static inline HAL_StatusTypeDef MIDI_Platform_UART_Abort_Transmit(UART_HandleTypeDef *uart, uint16_t *unsent) {
+	HAL_StatusTypeDef status = HAL_UART_AbortTransmit(uart);
+
+	*unsent = __HAL_DMA_GET_COUNTER(uart->hdmatx);
+	return status;
+}
+
+#endif // MIDI_PLATFORM_HOST
+
+#endif // MIDI_PLATFORM_H
@@ -0,0 +1,202 @@
+/*
+ * midi_router.c
+ *
+ * Rule compiler and table driven MIDI event router.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_router.h"
+
+#define MIDI_ROUTER_NOTE_TYPES ((1 << MIDI_ROUTER_NOTE_OFF) | (1 << MIDI_ROUTER_NOTE_ON) | (1 << MIDI_ROUTER_POLY_PRESSURE))
+#define MIDI_ROUTER_CURVE_TYPES ((1 << MIDI_ROUTER_NOTE_OFF) | (1 << MIDI_ROUTER_NOTE_ON))
+
+// Router message type, indexed by CIN
+static const uint8_t midi_router_type[16] = {
+	MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM,
+	MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM, MIDI_ROUTER_SYSTEM,
+	MIDI_ROUTER_NOTE_OFF, MIDI_ROUTER_NOTE_ON, MIDI_ROUTER_POLY_PRESSURE, MIDI_ROUTER_CC,
+	MIDI_ROUTER_PROGRAM_CHANGE, MIDI_ROUTER_CHANNEL_PRESSURE, MIDI_ROUTER_PITCH_BEND, MIDI_ROUTER_SYSTEM,
+};
+
+// Velocity curves, filled in on the first compile. Zero always maps to zero.
+static uint8_t midi_router_curves[MIDI_CURVE_COUNT][128];
+static bool midi_router_curves_ready = false;
+
+static uint8_t midi_router_isqrt(uint16_t value)
+{
+	uint16_t root = 0;
+
+	while ((uint16_t)((root + 1) * (root + 1)) <= value) {
+		root++;
+	}
+	return (uint8_t)root;
+}
+
+static void midi_router_build_curves(void)
+{
+	uint16_t v;
+	uint16_t hard;
+
+	for (v = 0; v < 128; v++) {
+		hard = (v * v) / 127;
+		midi_router_curves[MIDI_CURVE_LINEAR][v] = v;
+		midi_router_curves[MIDI_CURVE_SOFT][v] = midi_router_isqrt(v * 127);
+		midi_router_curves[MIDI_CURVE_HARD][v] = ((hard == 0) && (v != 0)) ? 1 : hard;
+		midi_router_curves[MIDI_CURVE_FIXED][v] = (v == 0) ? 0 : 100;
+	}
+	midi_router_curves_ready = true;
+}
+
+static void midi_router_apply(midi_route_side_t *side, const midi_route_rule_t *rule, uint8_t type)
+{
+	side->dest_mask |= rule->dest_mask;
+	if (type == MIDI_ROUTER_SYSTEM) {
+		return;
+	}
+	if (rule->out_channel != MIDI_ROUTER_KEEP_CHANNEL) {
+		side->status_and = 0xF0;
+		side->status_or = rule->out_channel;
+	}
+	if ((1 << type) & MIDI_ROUTER_CURVE_TYPES) {
+		side->curve = rule->curve;
+	}
+}
+
+/*
+ * Fill in the cells one rule touches. Returns MIDI_INVALID_PARAM if its note
+ * range can't share the cell's split point.
+ */
+static MIDI_error_t midi_router_compile_rule(midi_router_t *router, const midi_route_rule_t *rule)
+{
+	midi_route_cell_t *cell;
+	bool whole_range = (rule->note_low == 0) && (rule->note_high == 127);
+	uint8_t split;
+	uint8_t side;
+	uint8_t input;
+	uint8_t channel;
+	uint8_t type;
+
+	if (whole_range) {
+		split = 0;
+		side = 0;
+	} else if (rule->note_low == 0) {
+		split = rule->note_high + 1;
+		side = 0;
+	} else if (rule->note_high == 127) {
+		split = rule->note_low;
+		side = 1;
+	} else {
+		return MIDI_INVALID_PARAM;
+	}
+
+	for (input = 0; input < MIDI_MAX_INPUTS; input++) {
+		if ((rule->input_mask & (1 << input)) == 0) {
+			continue;
+		}
+		for (channel = 0; channel < MIDI_ROUTER_CHANNELS; channel++) {
+			// System messages have no channel; all 16 of their cells are kept identical
+			for (type = 0; type < MIDI_ROUTER_TYPES; type++) {
+				if ((rule->type_mask & (1 << type)) == 0) {
+					continue;
+				}
+				if ((type != MIDI_ROUTER_SYSTEM) && ((rule->channel_mask & (1 << channel)) == 0)) {
+					continue;
+				}
+				cell = &router->cells[input][channel][type];
+
+				if (whole_range || (((1 << type) & MIDI_ROUTER_NOTE_TYPES) == 0)) {
+					midi_router_apply(&cell->side[0], rule, type);
+					midi_router_apply(&cell->side[1], rule, type);
+					continue;
+				}
+				if ((cell->split != 0) && (cell->split != split)) {
+					return MIDI_INVALID_PARAM;
+				}
+				cell->split = split;
+				midi_router_apply(&cell->side[side], rule, type);
+			}
+		}
+	}
+	return MIDI_OK;
+}
+
+/*
+ * Build the lookup tables from a rule list. On error nothing is routed until
+ * a good rule list is compiled.
+ */
+MIDI_error_t MIDI_Router_Compile(midi_router_t *router, const midi_route_rule_t *rules, uint16_t num_rules)
+{
+	midi_route_cell_t *cell = &router->cells[0][0][0];
+	uint16_t num_cells = MIDI_MAX_INPUTS * MIDI_ROUTER_CHANNELS * MIDI_ROUTER_TYPES;
+	MIDI_error_t status = MIDI_OK;
+	uint16_t i;
+
+	if (!midi_router_curves_ready) {
+		midi_router_build_curves();
+	}
+
+	memset(router, 0, sizeof(*router));
+	for (i = 0; i < num_cells; i++) {
+		cell[i].side[0].status_and = 0xFF;
+		cell[i].side[1].status_and = 0xFF;
+	}
+
+	for (i = 0; i < num_rules; i++) {
+		if ((rules[i].note_low > rules[i].note_high) || (rules[i].note_high > 127)
+				|| (rules[i].curve >= MIDI_CURVE_COUNT)
+				|| ((rules[i].out_channel > 15) && (rules[i].out_channel != MIDI_ROUTER_KEEP_CHANNEL))) {
+			status = MIDI_INVALID_PARAM;
+			break;
+		}
+		status = midi_router_compile_rule(router, &rules[i]);
+		if (status != MIDI_OK) {
+			break;
+		}
+	}
+
+	if (status != MIDI_OK) {
+		for (i = 0; i < num_cells; i++) {
+			cell[i].side[0].dest_mask = 0;
+			cell[i].side[1].dest_mask = 0;
+		}
+	}
+	return status;
+}
+
+/*
+ * Route one event from the input named by its cable number. The event is
+ * rewritten in place for its destinations, and the mask of output port
+ * indices it should go to is returned, 0 if it's filtered out.
+ */
+uint8_t MIDI_Router_Route(midi_router_t *router, midi_event_t *event)
+{
+	const midi_route_cell_t *cell;
+	const midi_route_side_t *side;
+	uint8_t input = midi_event_cable(event);
+
+	if (input >= MIDI_MAX_INPUTS) {
+		router->filtered++;
+		return 0;
+	}
+
+	// Unsplit cells have split 0, so everything lands on side 1
+	cell = &router->cells[input][event->bytes[0] & 0x0F][midi_router_type[midi_event_cin(event)]];
+	side = &cell->side[event->bytes[1] >= cell->split];
+
+	if (side->dest_mask == 0) {
+		router->filtered++;
+		return 0;
+	}
+	event->bytes[0] = (event->bytes[0] & side->status_and) | side->status_or;
+	event->bytes[2] = (side->curve == MIDI_CURVE_LINEAR) ? event->bytes[2] : midi_router_curves[side->curve][event->bytes[2] & 0x7F];
+	router->routed++;
+	return side->dest_mask;
+}
+
+void MIDI_Router_Print_Stats(midi_router_t *router)
+{
+	printf("router: routed %lu, filtered %lu\r\n", (unsigned long)router->routed, (unsigned long)router->filtered);
+}
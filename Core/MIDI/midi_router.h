@@ -0,0 +1,95 @@
+/*
+ * midi_router.h
+ *
+ * Routes parsed MIDI events from input ports to output ports. Routing is set
+ * up as a list of rules, which MIDI_Router_Compile() flattens into one lookup
+ * table per input, indexed by channel and message type. Routing an event is
+ * then a table lookup, a pick between the two sides of a note split, and a
+ * rewrite of the status and velocity bytes.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_ROUTER_H
+#define MIDI_ROUTER_H
+
+#include "midi.h"
+
+#define MIDI_ROUTER_CHANNELS 16
+#define MIDI_ROUTER_TYPES 8
+#define MIDI_ROUTER_KEEP_CHANNEL 0xFF
+
+#define MIDI_ROUTER_ALL_INPUTS ((1 << MIDI_MAX_INPUTS) - 1)
+#define MIDI_ROUTER_ALL_OUTPUTS ((1 << MIDI_MAX_PORTS) - 1)
+#define MIDI_ROUTER_ALL_CHANNELS 0xFFFF
+#define MIDI_ROUTER_ALL_TYPES 0xFF
+
+#if MIDI_MAX_INPUTS > 8
+#error "A rule's input_mask has a bit for each input"
+#endif
+
+// Message types, the bits of a rule's type_mask
+typedef enum {
+	MIDI_ROUTER_NOTE_OFF = 0,
+	MIDI_ROUTER_NOTE_ON,
+	MIDI_ROUTER_POLY_PRESSURE,
+	MIDI_ROUTER_CC,
+	MIDI_ROUTER_PROGRAM_CHANGE,
+	MIDI_ROUTER_CHANNEL_PRESSURE,
+	MIDI_ROUTER_PITCH_BEND,
+	MIDI_ROUTER_SYSTEM,          // Everything without a channel: common and real-time. Sysex is streamed separately, see midi_sysex.h
+} midi_router_type_e;
+
+typedef enum {
+	MIDI_CURVE_LINEAR = 0,
+	MIDI_CURVE_SOFT,             // Boosts quiet notes
+	MIDI_CURVE_HARD,             // Needs a harder hit for the same velocity
+	MIDI_CURVE_FIXED,            // Every note at velocity 100
+	MIDI_CURVE_COUNT,
+} midi_curve_e;
+
+/*
+ * Events matching all of input_mask, channel_mask, type_mask and, for note
+ * messages, the note range go to the ports in dest_mask. Channel messages can
+ * be moved to out_channel (0-15) and note velocities passed through a curve.
+ *
+ * Rules add up: an event goes to every port any matching rule names. Where
+ * rules disagree on channel or curve, the later rule wins. Per input and
+ * channel, note ranges can split the keyboard at one point only; a rule's
+ * range has to cover all notes, or run from 0 up to the split, or from the
+ * split to 127.
+ */
+typedef struct {
+	uint8_t input_mask;
+	uint16_t channel_mask;
+	uint8_t type_mask;
+	uint8_t note_low;
+	uint8_t note_high;
+	uint8_t dest_mask;
+	uint8_t out_channel;         // MIDI_ROUTER_KEEP_CHANNEL to leave as is
+	uint8_t curve;               // midi_curve_e, note on and off only
+} midi_route_rule_t;
+
+typedef struct {
+	uint8_t dest_mask;
+	uint8_t status_and;          // Status byte is (status & status_and) | status_or
+	uint8_t status_or;
+	uint8_t curve;
+} midi_route_side_t;
+
+typedef struct {
+	uint8_t split;               // Notes below use side[0], the rest side[1]. 0 when not split.
+	midi_route_side_t side[2];
+} midi_route_cell_t;
+
+typedef struct {
+	midi_route_cell_t cells[MIDI_MAX_INPUTS][MIDI_ROUTER_CHANNELS][MIDI_ROUTER_TYPES];
+	uint32_t routed;             // Events sent on to at least one port
+	uint32_t filtered;           // Events that matched no rule
+} midi_router_t;
+
+MIDI_error_t MIDI_Router_Compile(midi_router_t *router, const midi_route_rule_t *rules, uint16_t num_rules);
+uint8_t MIDI_Router_Route(midi_router_t *router, midi_event_t *event);
+void MIDI_Router_Print_Stats(midi_router_t *router);
+
+#endif // MIDI_ROUTER_H
@@ -0,0 +1,392 @@
+/*
+ * midi_scheduler.c
+ *
+ * Timer wheel MIDI event scheduler.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_scheduler.h"
+#include "midi_stats.h"
+
+#define MIDI_SCHED_L0_BITS 8
+#define MIDI_SCHED_L1_BITS 6
+#define MIDI_SCHED_L2_BITS 6
+#define MIDI_SCHED_L0_SLOTS (1 << MIDI_SCHED_L0_BITS)
+#define MIDI_SCHED_L1_SLOTS (1 << MIDI_SCHED_L1_BITS)
+#define MIDI_SCHED_L2_SLOTS (1 << MIDI_SCHED_L2_BITS)
+#define MIDI_SCHED_L1_SHIFT MIDI_SCHED_L0_BITS
+#define MIDI_SCHED_L2_SHIFT (MIDI_SCHED_L0_BITS + MIDI_SCHED_L1_BITS)
+#define MIDI_SCHED_HORIZON (1UL << (MIDI_SCHED_L2_SHIFT + MIDI_SCHED_L2_BITS)) // In ticks
+
+// Ticks count timer microseconds >> MIDI_SCHED_TICK_SHIFT, so they wrap with it
+#define MIDI_SCHED_TICK_MASK (0xFFFFFFFFUL >> MIDI_SCHED_TICK_SHIFT)
+
+#define MIDI_SCHED_NONE 0xFFFF
+#define MIDI_SCHED_WORDS(slots) (((slots) + 31) / 32)
+
+typedef struct {
+	uint16_t next;
+	midi_event_t event;
+	midi_port_t *port;
+	uint32_t when;           // Timer microseconds
+} midi_sched_node_t;
+
+typedef struct {
+	uint16_t head;
+	uint16_t tail;
+} midi_sched_list_t;
+
+static struct {
+	midi_sched_node_t nodes[MIDI_SCHED_POOL_SIZE];
+	uint16_t free;
+	uint16_t pending;
+	uint32_t tick;           // Last tick the wheel was stepped to
+	midi_sched_list_t level0[MIDI_SCHED_L0_SLOTS];
+	midi_sched_list_t level1[MIDI_SCHED_L1_SLOTS];
+	midi_sched_list_t level2[MIDI_SCHED_L2_SLOTS];
+	midi_sched_list_t retry; // Due, but the port had no room yet
+	// A bit per slot with anything in it, to find the next tick with work to do
+	uint32_t occupied0[MIDI_SCHED_WORDS(MIDI_SCHED_L0_SLOTS)];
+	uint32_t occupied1[MIDI_SCHED_WORDS(MIDI_SCHED_L1_SLOTS)];
+	uint32_t occupied2[MIDI_SCHED_WORDS(MIDI_SCHED_L2_SLOTS)];
+	struct {
+		uint32_t posted;
+		uint32_t sent;
+		uint32_t tx_overflows;   // Times a due event found its port full, retried next tick
+		uint32_t pool_empty;     // Posts refused for lack of nodes
+		uint16_t max_pending;
+		midi_histogram_t lateness;
+	} stats;
+} midi_sched;
+
+static inline uint32_t midi_sched_tick_of(uint32_t when)
+{
+	// Round up, so nothing goes out early
+	return ((when + MIDI_SCHED_TICK_US - 1) >> MIDI_SCHED_TICK_SHIFT) & MIDI_SCHED_TICK_MASK;
+}
+
+static inline void midi_sched_occupy(uint32_t *occupied, uint32_t slot)
+{
+	occupied[slot >> 5] |= (1UL << (slot & 31));
+}
+
+static inline void midi_sched_vacate(uint32_t *occupied, uint32_t slot)
+{
+	occupied[slot >> 5] &= ~(1UL << (slot & 31));
+}
+
+/*
+ * How many slots after from the first occupied one is, going round the level
+ * once, or 0 if they're all empty. slots is a power of 2.
+ */
+static uint32_t midi_sched_find(const uint32_t *occupied, uint32_t slots, uint32_t from)
+{
+	uint32_t ahead = 1;
+	uint32_t slot;
+	uint32_t bits;
+
+	while (ahead <= slots) {
+		slot = (from + ahead) & (slots - 1);
+		bits = occupied[slot >> 5] >> (slot & 31);
+		if (bits != 0) {
+			ahead += __builtin_ctz(bits);
+			return (ahead <= slots) ? ahead : 0;
+		}
+		ahead += 32 - (slot & 31);
+	}
+	return 0;
+}
+
+static void midi_sched_append(midi_sched_list_t *list, uint16_t index)
+{
+	midi_sched.nodes[index].next = MIDI_SCHED_NONE;
+	if (list->head == MIDI_SCHED_NONE) {
+		list->head = index;
+	} else {
+		midi_sched.nodes[list->tail].next = index;
+	}
+	list->tail = index;
+}
+
+/*
+ * File a node in the slot for its time relative to the current tick, whose own
+ * slots have already been dealt with. A level 0 slot comes round again within
+ * 256 ticks; an upper level slot is cascaded when the tick reaches the start
+ * of its range, so a node goes in the lowest level where that start is still
+ * ahead and within one turn of the level. Anything already due goes in the
+ * next tick's slot, anything past the horizon in the furthest level 2 slot,
+ * from where it's refiled when that slot comes round.
+ */
+static void midi_sched_insert(uint16_t index)
+{
+	uint32_t tick = midi_sched.tick;
+	uint32_t due = midi_sched_tick_of(midi_sched.nodes[index].when);
+	uint32_t delta = (due - tick) & MIDI_SCHED_TICK_MASK;
+	uint32_t l1_start;
+	uint32_t l2_start;
+	uint32_t slot;
+
+	if ((delta == 0) || (delta > (MIDI_SCHED_TICK_MASK >> 1))) {
+		due = tick + 1;
+		delta = 1;
+	}
+	l1_start = (due & ~(uint32_t)(MIDI_SCHED_L0_SLOTS - 1));
+	l2_start = (due & ~(uint32_t)((1UL << MIDI_SCHED_L2_SHIFT) - 1));
+
+	if (delta <= MIDI_SCHED_L0_SLOTS) {
+		slot = due & (MIDI_SCHED_L0_SLOTS - 1);
+		midi_sched_append(&midi_sched.level0[slot], index);
+		midi_sched_occupy(midi_sched.occupied0, slot);
+	} else if (((l1_start - tick) & MIDI_SCHED_TICK_MASK) <= (1UL << MIDI_SCHED_L2_SHIFT)) {
+		slot = (due >> MIDI_SCHED_L1_SHIFT) & (MIDI_SCHED_L1_SLOTS - 1);
+		midi_sched_append(&midi_sched.level1[slot], index);
+		midi_sched_occupy(midi_sched.occupied1, slot);
+	} else {
+		if (((l2_start - tick) & MIDI_SCHED_TICK_MASK) > MIDI_SCHED_HORIZON) {
+			due = tick + MIDI_SCHED_HORIZON;
+		}
+		slot = (due >> MIDI_SCHED_L2_SHIFT) & (MIDI_SCHED_L2_SLOTS - 1);
+		midi_sched_append(&midi_sched.level2[slot], index);
+		midi_sched_occupy(midi_sched.occupied2, slot);
+	}
+}
+
+// Move a higher level slot's nodes down now that their range has come up
+static void midi_sched_cascade(midi_sched_list_t *list, uint32_t *occupied, uint32_t slot)
+{
+	uint16_t index = list->head;
+	uint16_t next;
+
+	list->head = MIDI_SCHED_NONE;
+	midi_sched_vacate(occupied, slot);
+	while (index != MIDI_SCHED_NONE) {
+		next = midi_sched.nodes[index].next;
+		midi_sched_insert(index);
+		index = next;
+	}
+}
+
+/*
+ * Send a list of due nodes, oldest first. One whose port has no room goes on
+ * the retry list rather than being dropped, where a lost note off would leave
+ * a note hanging. So does everything after it for the same port, blocked
+ * being a bit per port index, so each port's events still go out in order.
+ */
+static void midi_sched_expire(midi_sched_list_t *list, uint32_t now, uint32_t *blocked)
+{
+	midi_sched_node_t *node;
+	uint16_t index = list->head;
+	uint16_t next;
+	uint32_t port_bit;
+
+	list->head = MIDI_SCHED_NONE;
+	while (index != MIDI_SCHED_NONE) {
+		node = &midi_sched.nodes[index];
+		next = node->next;
+		port_bit = 1UL << node->port->index;
+
+		if (((*blocked & port_bit) != 0) || (MIDI_Send_Event(node->port, &node->event) == MIDI_TX_OVERFLOW)) {
+			*blocked |= port_bit;
+			midi_sched.stats.tx_overflows++;
+			midi_sched_append(&midi_sched.retry, index);
+			index = next;
+			continue;
+		}
+		midi_sched.stats.sent++;
+		MIDI_Histogram_Add(&midi_sched.stats.lateness, (uint32_t)MIDI_Time_Diff(now, node->when));
+
+		node->next = midi_sched.free;
+		midi_sched.free = index;
+		midi_sched.pending--;
+		index = next;
+	}
+}
+
+/*
+ * Step the wheel one tick, cascading the upper levels as their slots come up.
+ * Cascading happens before the tick moves, so nodes due on the new tick are
+ * refiled into its slot rather than the one after. Retries go ahead of the
+ * new slot's nodes, being older.
+ */
+static void midi_sched_step(uint32_t now)
+{
+	uint32_t tick = (midi_sched.tick + 1) & MIDI_SCHED_TICK_MASK;
+	midi_sched_list_t retry = midi_sched.retry;
+	uint32_t blocked = 0;
+	uint32_t slot;
+
+	if ((tick & ((1UL << MIDI_SCHED_L2_SHIFT) - 1)) == 0) {
+		slot = (tick >> MIDI_SCHED_L2_SHIFT) & (MIDI_SCHED_L2_SLOTS - 1);
+		midi_sched_cascade(&midi_sched.level2[slot], midi_sched.occupied2, slot);
+	}
+	if ((tick & (MIDI_SCHED_L0_SLOTS - 1)) == 0) {
+		slot = (tick >> MIDI_SCHED_L1_SHIFT) & (MIDI_SCHED_L1_SLOTS - 1);
+		midi_sched_cascade(&midi_sched.level1[slot], midi_sched.occupied1, slot);
+	}
+	midi_sched.tick = tick;
+
+	midi_sched.retry.head = MIDI_SCHED_NONE;
+	midi_sched_expire(&retry, now, &blocked);
+	slot = tick & (MIDI_SCHED_L0_SLOTS - 1);
+	midi_sched_vacate(midi_sched.occupied0, slot);
+	midi_sched_expire(&midi_sched.level0[slot], now, &blocked);
+}
+
+/*
+ * Ticks from the wheel's tick to the next one with anything to do: a level 0
+ * slot with nodes in, an upper level slot to cascade, or retries, which are
+ * tried every tick. 0 if there's nothing at all.
+ */
+static uint32_t midi_sched_next(void)
+{
+	uint32_t tick = midi_sched.tick;
+	uint32_t next = 0;
+	uint32_t ahead;
+
+	if (midi_sched.retry.head != MIDI_SCHED_NONE) {
+		return 1;
+	}
+	next = midi_sched_find(midi_sched.occupied0, MIDI_SCHED_L0_SLOTS, tick);
+
+	ahead = midi_sched_find(midi_sched.occupied1, MIDI_SCHED_L1_SLOTS, tick >> MIDI_SCHED_L1_SHIFT);
+	if (ahead != 0) {
+		ahead = (((tick >> MIDI_SCHED_L1_SHIFT) + ahead) << MIDI_SCHED_L1_SHIFT) - tick;
+		next = ((next == 0) || (ahead < next)) ? ahead : next;
+	}
+	ahead = midi_sched_find(midi_sched.occupied2, MIDI_SCHED_L2_SLOTS, tick >> MIDI_SCHED_L2_SHIFT);
+	if (ahead != 0) {
+		ahead = (((tick >> MIDI_SCHED_L2_SHIFT) + ahead) << MIDI_SCHED_L2_SHIFT) - tick;
+		next = ((next == 0) || (ahead < next)) ? ahead : next;
+	}
+	return next;
+}
+
+/*
+ * Bring the wheel up to now_tick, jumping over ticks with nothing to do. The
+ * jump lands just before the next tick that has work, so the step onto it
+ * cascades and expires as usual.
+ */
+static void midi_sched_advance(uint32_t now_tick, uint32_t now)
+{
+	uint32_t next;
+
+	while ((midi_sched.pending != 0) && (midi_sched.tick != now_tick)) {
+		next = midi_sched_next();
+		if ((next == 0) || (next > ((now_tick - midi_sched.tick) & MIDI_SCHED_TICK_MASK))) {
+			break;
+		}
+		midi_sched.tick = (midi_sched.tick + next - 1) & MIDI_SCHED_TICK_MASK;
+		midi_sched_step(now);
+	}
+	midi_sched.tick = now_tick;
+}
+
+/*
+ * Arm the compare for the next tick with anything to do, or stop the
+ * interrupt when there's nothing left. Returns false if that tick has already
+ * gone by.
+ */
+static bool midi_sched_arm(void)
+{
+	uint32_t alarm;
+
+	if (midi_sched.pending == 0) {
+		MIDI_Time_Alarm_Stop(MIDI_TIME_ALARM_SCHEDULER);
+		return true;
+	}
+	alarm = ((midi_sched.tick + midi_sched_next()) & MIDI_SCHED_TICK_MASK) << MIDI_SCHED_TICK_SHIFT;
+	MIDI_Time_Alarm_Set(MIDI_TIME_ALARM_SCHEDULER, alarm);
+	return MIDI_Time_Diff(alarm, MIDI_Time_Now()) > 0;
+}
+
+void MIDI_Scheduler_Init(void)
+{
+	uint16_t i;
+
+	memset(&midi_sched, 0, sizeof(midi_sched));
+	for (i = 0; i < MIDI_SCHED_POOL_SIZE; i++) {
+		midi_sched.nodes[i].next = (i + 1 < MIDI_SCHED_POOL_SIZE) ? (i + 1) : MIDI_SCHED_NONE;
+	}
+	midi_sched.free = 0;
+	memset(midi_sched.level0, 0xFF, sizeof(midi_sched.level0));
+	memset(midi_sched.level1, 0xFF, sizeof(midi_sched.level1));
+	memset(midi_sched.level2, 0xFF, sizeof(midi_sched.level2));
+	midi_sched.retry.head = MIDI_SCHED_NONE;
+	MIDI_Histogram_Reset(&midi_sched.stats.lateness);
+	MIDI_Time_Alarm_Stop(MIDI_TIME_ALARM_SCHEDULER);
+}
+
+/*
+ * Send event on port at timer time when, see midi_time.h. Times already gone
+ * by go out on the next tick. Callable from interrupts.
+ */
+MIDI_error_t MIDI_Schedule_Event(midi_port_t *port, const midi_event_t *event, uint32_t when)
+{
+	midi_irq_state_t irq;
+	midi_sched_node_t *node;
+	uint16_t index;
+
+	if (port == NULL) {
+		return MIDI_INVALID_PARAM;
+	}
+
+	irq = MIDI_Platform_Lock();
+	index = midi_sched.free;
+	if (index == MIDI_SCHED_NONE) {
+		midi_sched.stats.pool_empty++;
+		MIDI_Platform_Unlock(irq);
+		return MIDI_SCHEDULE_FULL;
+	}
+	node = &midi_sched.nodes[index];
+	midi_sched.free = node->next;
+	node->event = *event;
+	node->port = port;
+	node->when = when;
+
+	// An idle wheel is behind the clock, catch it up for free
+	if (midi_sched.pending == 0) {
+		midi_sched.tick = (MIDI_Time_Now() >> MIDI_SCHED_TICK_SHIFT) & MIDI_SCHED_TICK_MASK;
+	}
+	midi_sched_insert(index);
+	midi_sched.pending++;
+	midi_sched.stats.posted++;
+	if (midi_sched.pending > midi_sched.stats.max_pending) {
+		midi_sched.stats.max_pending = midi_sched.pending;
+	}
+	if (!midi_sched_arm()) {
+		MIDI_Time_Alarm_Fire(MIDI_TIME_ALARM_SCHEDULER); // Its tick already gone, let the interrupt catch up
+	}
+	MIDI_Platform_Unlock(irq);
+	return MIDI_OK;
+}
+
+uint16_t MIDI_Scheduler_Pending(void)
+{
+	return midi_sched.pending;
+}
+
+/*
+ * TIM2 channel 1 compare. Brings the wheel up to the current time, catching
+ * up on anything missed while interrupts were held off.
+ */
+void MIDI_Scheduler_Timer_IRQ(void)
+{
+	uint32_t now;
+
+	do {
+		now = MIDI_Time_Now();
+		midi_sched_advance((now >> MIDI_SCHED_TICK_SHIFT) & MIDI_SCHED_TICK_MASK, now);
+	} while (!midi_sched_arm());
+}
+
+void MIDI_Scheduler_Print_Stats(void)
+{
+	printf("sched: posted %lu, sent %lu, tx overflows %lu, pool empty %lu, pending %u, max pending %u\r\n",
+			(unsigned long)midi_sched.stats.posted, (unsigned long)midi_sched.stats.sent,
+			(unsigned long)midi_sched.stats.tx_overflows, (unsigned long)midi_sched.stats.pool_empty,
+			midi_sched.pending, midi_sched.stats.max_pending);
+	MIDI_Histogram_Print("sched lateness", &midi_sched.stats.lateness);
+}
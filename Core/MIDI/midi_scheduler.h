@@ -0,0 +1,36 @@
+/*
+ * midi_scheduler.h
+ *
+ * Sends MIDI events at a future time. Pending events sit in a three level
+ * hierarchical timer wheel of 128us ticks: 256 slots a tick wide, then 64
+ * slots of 256 ticks and 64 of 16384 ticks, covering a little over two
+ * minutes. Events further out are parked at the far end and refiled as it
+ * comes round; times more than half the timer's 71 minute wrap ahead read as
+ * already past. Posting and expiring are constant time. The wheel is stepped
+ * from the TIM2 channel 1 compare interrupt, which is set for the next tick
+ * with anything to do, so a long wait costs no interrupts.
+ *
+ * Events go out on the tick at or just after their time, so at most one tick
+ * late on top of whatever is already queued on the port. One whose port is
+ * full is tried again each tick until it fits, never dropped.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_SCHEDULER_H
+#define MIDI_SCHEDULER_H
+
+#include "midi.h"
+#include "midi_time.h"
+
+#define MIDI_SCHED_TICK_SHIFT 7          // 128us ticks
+#define MIDI_SCHED_TICK_US (1 << MIDI_SCHED_TICK_SHIFT)
+#define MIDI_SCHED_POOL_SIZE 256         // Events that can be pending at once
+
+void MIDI_Scheduler_Init(void);
+MIDI_error_t MIDI_Schedule_Event(midi_port_t *port, const midi_event_t *event, uint32_t when);
+uint16_t MIDI_Scheduler_Pending(void);
+void MIDI_Scheduler_Timer_IRQ(void);
+void MIDI_Scheduler_Print_Stats(void);
+
+#endif // MIDI_SCHEDULER_H
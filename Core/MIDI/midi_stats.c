@@ -0,0 +1,36 @@
+/*
+ * midi_stats.c
+ *
+ * Log2 histograms for MIDI timing measurements, values in microseconds.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_stats.h"
+
+void MIDI_Histogram_Reset(midi_histogram_t *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->min = UINT32_MAX;
+}
+
+// Only non-empty buckets are listed, as the lower bound of the range they cover
+void MIDI_Histogram_Print(const char *name, const midi_histogram_t *hist)
+{
+	uint32_t i;
+
+	if (hist->samples == 0) {
+		printf("%s: no samples\r\n", name);
+		return;
+	}
+	printf("%s: %lu samples, min %luus, max %luus\r\n", name,
+			(unsigned long)hist->samples, (unsigned long)hist->min, (unsigned long)hist->max);
+	for (i = 0; i < MIDI_HISTOGRAM_BUCKETS; i++) {
+		if (hist->buckets[i] != 0) {
+			printf("  >=%7luus: %lu\r\n", (i == 0) ? 0ul : (1ul << (i - 1)),
+					(unsigned long)hist->buckets[i]);
+		}
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * midi_stats.h
+ *
+ * Fixed size log2 histograms for MIDI timing measurements. Bucket 0 counts
+ * zero, bucket n counts values in [2^(n-1), 2^n), and the last bucket also
+ * takes everything above its range. Adding a sample is a count leading zeros
+ * and an increment, so it is cheap enough for interrupt handlers.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_STATS_H
+#define MIDI_STATS_H
+
+#include <stdint.h>
+
+#define MIDI_HISTOGRAM_BUCKETS 20 // Last bucket starts at 2^18us, about a quarter second
+
+typedef struct {
+	uint32_t buckets[MIDI_HISTOGRAM_BUCKETS];
+	uint32_t samples;
+	uint32_t min;
+	uint32_t max;
+} midi_histogram_t;
+
+static inline void MIDI_Histogram_Add(midi_histogram_t *hist, uint32_t value) {
+	uint32_t bucket = (value == 0) ? 0 : (32 - __builtin_clz(value));
+
+	if (bucket >= MIDI_HISTOGRAM_BUCKETS) {
+		bucket = MIDI_HISTOGRAM_BUCKETS - 1;
+	}
+	hist->buckets[bucket]++;
+	hist->samples++;
+	if (value < hist->min) {
+		hist->min = value;
+	}
+	if (value > hist->max) {
+		hist->max = value;
+	}
+}
+
+void MIDI_Histogram_Reset(midi_histogram_t *hist);
+void MIDI_Histogram_Print(const char *name, const midi_histogram_t *hist);
+
+#endif // MIDI_STATS_H
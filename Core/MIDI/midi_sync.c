@@ -0,0 +1,293 @@
+/*
+ * midi_sync.c
+ *
+ * Alpha-beta PLL MIDI clock follower. Runs from the main loop: feed it input
+ * events with MIDI_Sync_Input() and call MIDI_Sync_Process() regularly.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "midi_sync.h"
+#include "midi_stats.h"
+
+/*
+ * Benedict-Bordner alpha-beta pairs, beta = alpha^2 / (2 - alpha). A little
+ * under critical damping (beta = 2 - alpha - 2 sqrt(1 - alpha)), which trades
+ * a small overshoot on a tempo step for less lag following a tempo ramp.
+ */
+#define MIDI_SYNC_ACQUIRE_ALPHA 0.5f
+#define MIDI_SYNC_ACQUIRE_BETA 0.1667f
+#define MIDI_SYNC_LOCKED_ALPHA 0.15f
+#define MIDI_SYNC_LOCKED_BETA 0.0122f
+
+#define MIDI_SYNC_SPP_TICKS 6 // Song position pointer counts sixteenths
+
+static struct {
+	uint8_t source;            // Input port followed
+	midi_sync_state_e state;
+	bool running;              // Between start or continue and stop
+	bool have_tick;            // Have a first tick to measure from
+	uint16_t good_ticks;       // Ticks since (re)starting the loop
+	uint8_t outliers_in_row;
+	float period;              // Estimated microseconds per tick
+	uint32_t tick_time;        // Estimated time of the last tick, whole microseconds
+	float tick_frac;           // and the fraction, [0, 1)
+	uint32_t position;         // Clock ticks since start
+	struct {
+		uint32_t ticks;
+		uint32_t outliers;
+		uint32_t missed;         // Ticks lost on the way in, stepped over
+		uint32_t restarts;       // Loop restarted after too many outliers
+		uint32_t losses;         // Clock stopped arriving
+		midi_histogram_t error;  // Tick arrival against the loop's prediction, microseconds either way
+	} stats;
+} midi_sync;
+
+static void midi_sync_restart(uint32_t timestamp)
+{
+	midi_sync.state = MIDI_SYNC_ACQUIRING;
+	midi_sync.have_tick = true;
+	midi_sync.good_ticks = 0;
+	midi_sync.outliers_in_row = 0;
+	midi_sync.period = 0.0f;
+	midi_sync.tick_time = timestamp;
+	midi_sync.tick_frac = 0.0f;
+}
+
+// Move the tick estimate on by step microseconds, keeping the fraction separate
+static void midi_sync_advance(float step)
+{
+	float whole;
+
+	step += midi_sync.tick_frac;
+	whole = floorf(step);
+	midi_sync.tick_time += (int32_t)whole;
+	midi_sync.tick_frac = step - whole;
+}
+
+static void midi_sync_tick(uint32_t timestamp)
+{
+	float interval;
+	float error;
+	float alpha;
+	float beta;
+
+	midi_sync.stats.ticks++;
+	if (midi_sync.running) {
+		midi_sync.position++;
+	}
+
+	if (!midi_sync.have_tick) {
+		midi_sync_restart(timestamp);
+		return;
+	}
+
+	// Time since the last estimated tick
+	interval = (float)MIDI_Time_Diff(timestamp, midi_sync.tick_time) - midi_sync.tick_frac;
+
+	// The second tick gives the first period
+	if (midi_sync.period == 0.0f) {
+		if ((interval < MIDI_SYNC_MIN_PERIOD_US) || (interval > MIDI_SYNC_MAX_PERIOD_US)) {
+			midi_sync_restart(timestamp);
+			return;
+		}
+		midi_sync.period = interval;
+		midi_sync_advance(interval);
+		return;
+	}
+
+	// A tick lost on the way shows up as a double interval. Step over the gap
+	// rather than reject the tick, which would leave the loop a period behind.
+	if (fabsf(interval - 2.0f * midi_sync.period) <= (midi_sync.period * MIDI_SYNC_OUTLIER_FRACTION)) {
+		midi_sync.stats.missed++;
+		if (midi_sync.running) {
+			midi_sync.position++;
+		}
+		midi_sync_advance(midi_sync.period);
+		interval -= midi_sync.period;
+	}
+
+	error = interval - midi_sync.period;
+	MIDI_Histogram_Add(&midi_sync.stats.error, (uint32_t)fabsf(error));
+
+	if (fabsf(error) > (midi_sync.period * MIDI_SYNC_OUTLIER_FRACTION)) {
+		midi_sync.stats.outliers++;
+		if (++midi_sync.outliers_in_row >= MIDI_SYNC_MAX_OUTLIERS) {
+			midi_sync.stats.restarts++;
+			midi_sync_restart(timestamp);
+			return;
+		}
+		// Coast: assume the tick was where it should have been
+		midi_sync_advance(midi_sync.period);
+		return;
+	}
+	midi_sync.outliers_in_row = 0;
+
+	if (midi_sync.state == MIDI_SYNC_LOCKED) {
+		alpha = MIDI_SYNC_LOCKED_ALPHA;
+		beta = MIDI_SYNC_LOCKED_BETA;
+	} else {
+		alpha = MIDI_SYNC_ACQUIRE_ALPHA;
+		beta = MIDI_SYNC_ACQUIRE_BETA;
+		if (++midi_sync.good_ticks >= MIDI_SYNC_ACQUIRE_TICKS) {
+			midi_sync.state = MIDI_SYNC_LOCKED;
+		}
+	}
+
+	midi_sync_advance(midi_sync.period + alpha * error);
+	midi_sync.period += beta * error;
+	if (midi_sync.period < MIDI_SYNC_MIN_PERIOD_US) {
+		midi_sync.period = MIDI_SYNC_MIN_PERIOD_US;
+	} else if (midi_sync.period > MIDI_SYNC_MAX_PERIOD_US) {
+		midi_sync.period = MIDI_SYNC_MAX_PERIOD_US;
+	}
+}
+
+void MIDI_Sync_Init(uint8_t source_port)
+{
+	memset(&midi_sync, 0, sizeof(midi_sync));
+	midi_sync.source = source_port;
+	midi_sync.state = MIDI_SYNC_NONE;
+	MIDI_Histogram_Reset(&midi_sync.stats.error);
+}
+
+void MIDI_Sync_Set_Source(uint8_t source_port)
+{
+	if (source_port != midi_sync.source) {
+		midi_sync.source = source_port;
+		midi_sync.state = MIDI_SYNC_NONE;
+		midi_sync.have_tick = false;
+	}
+}
+
+/*
+ * Look at one parsed input event, with its arrival timestamp. Anything not
+ * from the source port, or not clock, transport or song position, is ignored.
+ */
+void MIDI_Sync_Input(const midi_event_t *event, uint32_t timestamp)
+{
+	if (midi_event_cable(event) != midi_sync.source) {
+		return;
+	}
+
+	switch (midi_event_cin(event)) {
+	case MIDI_CIN_SINGLE_BYTE:
+		switch (event->bytes[0]) {
+		case 0xF8:
+			midi_sync_tick(timestamp);
+			break;
+		case 0xFA:
+			midi_sync.position = 0;
+			midi_sync.running = true;
+			break;
+		case 0xFB:
+			midi_sync.running = true;
+			break;
+		case 0xFC:
+			midi_sync.running = false;
+			break;
+		default:
+			break;
+		}
+		break;
+	case MIDI_CIN_COMMON_3:
+		if (event->bytes[0] == 0xF2) {
+			midi_sync.position = ((uint32_t)event->bytes[1] | ((uint32_t)event->bytes[2] << 7)) * MIDI_SYNC_SPP_TICKS;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Check for the clock going away. Returns true once, on the call that notices
+ * it's been lost.
+ */
+bool MIDI_Sync_Process(uint32_t now)
+{
+	float silence;
+
+	if ((midi_sync.state == MIDI_SYNC_NONE) || (midi_sync.period == 0.0f)) {
+		return false;
+	}
+	silence = (float)MIDI_Time_Diff(now, midi_sync.tick_time);
+	if (silence < (midi_sync.period * MIDI_SYNC_LOSS_PERIODS)) {
+		return false;
+	}
+	midi_sync.state = MIDI_SYNC_NONE;
+	midi_sync.have_tick = false;
+	midi_sync.running = false;
+	midi_sync.stats.losses++;
+	return true;
+}
+
+midi_sync_state_e MIDI_Sync_Get_State(void)
+{
+	return midi_sync.state;
+}
+
+bool MIDI_Sync_Is_Running(void)
+{
+	return midi_sync.running;
+}
+
+// Estimated tempo in hundredths of a BPM, 0 with no clock
+uint32_t MIDI_Sync_Get_Tempo(void)
+{
+	if ((midi_sync.state == MIDI_SYNC_NONE) || (midi_sync.period == 0.0f)) {
+		return 0;
+	}
+	return (uint32_t)((60.0f * MIDI_TIME_TICKS_PER_SEC * 100.0f / MIDI_SYNC_PPQN) / midi_sync.period + 0.5f);
+}
+
+/*
+ * Song position at time now, in 1/MIDI_SYNC_POSITION_SCALE clock ticks. The
+ * fraction stops just short of the next tick, so position never runs ahead of
+ * the clock, and doesn't move at all while stopped.
+ */
+uint32_t MIDI_Sync_Get_Position(uint32_t now)
+{
+	uint32_t position = midi_sync.position * MIDI_SYNC_POSITION_SCALE;
+	float fraction;
+
+	if (!midi_sync.running || (midi_sync.state == MIDI_SYNC_NONE) || (midi_sync.period == 0.0f)) {
+		return position;
+	}
+	fraction = ((float)MIDI_Time_Diff(now, midi_sync.tick_time) - midi_sync.tick_frac) / midi_sync.period;
+	if (fraction < 0.0f) {
+		fraction = 0.0f;
+	} else if (fraction > 1.0f) {
+		fraction = 1.0f;
+	}
+	return position + (uint32_t)(fraction * (MIDI_SYNC_POSITION_SCALE - 1));
+}
+
+/*
+ * Estimated timer time a song position, in 1/MIDI_SYNC_POSITION_SCALE ticks,
+ * falls at if the tempo holds, for handing to MIDI_Schedule_Event(). Only
+ * meaningful with a clock.
+ */
+uint32_t MIDI_Sync_Time_At(uint32_t position)
+{
+	int32_t ahead = (int32_t)(position - midi_sync.position * MIDI_SYNC_POSITION_SCALE);
+
+	return midi_sync.tick_time + (int32_t)((float)ahead * midi_sync.period / MIDI_SYNC_POSITION_SCALE + midi_sync.tick_frac);
+}
+
+void MIDI_Sync_Print_Stats(void)
+{
+	static const char *state_names[] = { "none", "acquiring", "locked" };
+	uint32_t tempo = MIDI_Sync_Get_Tempo();
+
+	printf("sync: port %d, %s, %s, tempo %lu.%02lu BPM, position %lu\r\n", midi_sync.source,
+			state_names[midi_sync.state], midi_sync.running ? "running" : "stopped",
+			(unsigned long)(tempo / 100), (unsigned long)(tempo % 100), (unsigned long)midi_sync.position);
+	printf("ticks %lu, outliers %lu, missed %lu, restarts %lu, losses %lu\r\n", (unsigned long)midi_sync.stats.ticks,
+			(unsigned long)midi_sync.stats.outliers, (unsigned long)midi_sync.stats.missed,
+			(unsigned long)midi_sync.stats.restarts, (unsigned long)midi_sync.stats.losses);
+	MIDI_Histogram_Print("sync tick error", &midi_sync.stats.error);
+}
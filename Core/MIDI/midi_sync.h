@@ -0,0 +1,51 @@
+/*
+ * midi_sync.h
+ *
+ * MIDI clock follower. Incoming timing clock (0xF8) from one input port is run
+ * through an alpha-beta tracking loop, a second order PLL, that estimates the
+ * tick period and when each tick really fell. Arrival times are only as good
+ * as the source and the wire, so individual ticks are smoothed out and ones
+ * far from where the loop expects them are thrown out, apart from a tick that
+ * comes a period late, which means one went missing and is stepped over.
+ * Gains start wide to lock within a couple of beats, then narrow once locked.
+ *
+ * Song position is kept in clock ticks from start, continue and song position
+ * pointer, and interpolated between ticks using the estimated period.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_SYNC_H
+#define MIDI_SYNC_H
+
+#include "midi.h"
+#include "midi_time.h"
+
+#define MIDI_SYNC_PPQN 24
+#define MIDI_SYNC_POSITION_SCALE 256     // Interpolated position units per clock tick
+#define MIDI_SYNC_ACQUIRE_TICKS 48       // Ticks on the wide gains, two beats
+#define MIDI_SYNC_OUTLIER_FRACTION 0.35f // Ticks further than this many periods off are rejected
+#define MIDI_SYNC_MAX_OUTLIERS 4         // Rejected in a row before starting over
+#define MIDI_SYNC_LOSS_PERIODS 8         // Periods without a tick before the clock is lost
+#define MIDI_SYNC_MIN_PERIOD_US 5000     // 500 BPM
+#define MIDI_SYNC_MAX_PERIOD_US 150000   // 16.67 BPM
+
+typedef enum {
+	MIDI_SYNC_NONE,      // No clock
+	MIDI_SYNC_ACQUIRING, // Following, still on the wide gains
+	MIDI_SYNC_LOCKED,
+} midi_sync_state_e;
+
+void MIDI_Sync_Init(uint8_t source_port);
+void MIDI_Sync_Set_Source(uint8_t source_port);
+void MIDI_Sync_Input(const midi_event_t *event, uint32_t timestamp);
+bool MIDI_Sync_Process(uint32_t now);
+
+midi_sync_state_e MIDI_Sync_Get_State(void);
+bool MIDI_Sync_Is_Running(void);
+uint32_t MIDI_Sync_Get_Tempo(void);
+uint32_t MIDI_Sync_Get_Position(uint32_t now);
+uint32_t MIDI_Sync_Time_At(uint32_t position);
+void MIDI_Sync_Print_Stats(void);
+
+#endif // MIDI_SYNC_H
@@ -0,0 +1,135 @@
+/*
+ * midi_sysex.c
+ *
+ * Chunked sysex streaming and pass-through.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "midi_sysex.h"
+
+static void midi_sysex_deliver(midi_sysex_t *sysex)
+{
+	if (sysex->handler != NULL) {
+		sysex->handler(sysex->port_index, sysex->chunk, sysex->length, sysex->flags, sysex->handler_context);
+	}
+	sysex->stats.chunks++;
+	sysex->length = 0;
+	sysex->flags = 0;
+}
+
+void MIDI_Sysex_Init(midi_sysex_t *sysex, uint8_t port_index)
+{
+	memset(sysex, 0, sizeof(*sysex));
+	sysex->port_index = port_index;
+}
+
+void MIDI_Sysex_Set_Handler(midi_sysex_t *sysex, midi_sysex_handler_t handler, void *context)
+{
+	sysex->handler = handler;
+	sysex->handler_context = context;
+}
+
+void MIDI_Sysex_Set_Passthrough(midi_sysex_t *sysex, uint8_t dest_mask)
+{
+	sysex->passthrough_mask = dest_mask;
+}
+
+/*
+ * Whether a parsed event is part of a sysex message. Ends cut short by the
+ * parser carry data and no 0xF7; a CIN 5 event led by a status byte is a
+ * tune request instead.
+ */
+bool MIDI_Sysex_Is_Sysex(const midi_event_t *event)
+{
+	switch (midi_event_cin(event)) {
+	case MIDI_CIN_SYSEX:
+	case MIDI_CIN_SYSEX_END_2:
+	case MIDI_CIN_SYSEX_END_3:
+		return true;
+	case MIDI_CIN_SYSEX_END_1:
+		return (event->bytes[0] == 0xF7) || (event->bytes[0] < 0x80);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Take one sysex event from the input. Returns MIDI_TX_OVERFLOW, having done
+ * nothing, if a pass-through output can't take it yet.
+ */
+MIDI_error_t MIDI_Sysex_Input(midi_sysex_t *sysex, const midi_event_t *event, uint32_t timestamp)
+{
+	uint8_t length = midi_event_length(event);
+	uint8_t byte;
+	uint8_t i;
+
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if ((sysex->passthrough_mask & (1 << i)) && (MIDI_Send_Free(MIDI_Get_Port(i)) < length)) {
+			sysex->stats.stalls++;
+			return MIDI_TX_OVERFLOW;
+		}
+	}
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if (sysex->passthrough_mask & (1 << i)) {
+			MIDI_Send_Thru_Event(MIDI_Get_Port(i), event, timestamp);
+		}
+	}
+
+	for (i = 0; i < length; i++) {
+		byte = event->bytes[i];
+		if (byte == 0xF0) {
+			if (sysex->active) {
+				MIDI_Sysex_Abort(sysex);
+			}
+			sysex->active = true;
+			sysex->flags = MIDI_SYSEX_START;
+			sysex->length = 0;
+			sysex->stats.messages++;
+			continue;
+		}
+		if (!sysex->active) {
+			return MIDI_OK; // Tail of a message we never saw the start of
+		}
+		if (byte == 0xF7) {
+			sysex->flags |= MIDI_SYSEX_END;
+			sysex->active = false;
+			midi_sysex_deliver(sysex);
+			return MIDI_OK;
+		}
+		if (sysex->length == MIDI_SYSEX_CHUNK_SIZE) {
+			midi_sysex_deliver(sysex);
+		}
+		sysex->chunk[sysex->length++] = byte;
+		sysex->stats.bytes++;
+	}
+
+	// An end event without 0xF7 is the parser giving up on the message
+	if (sysex->active && (midi_event_cin(event) != MIDI_CIN_SYSEX)) {
+		MIDI_Sysex_Abort(sysex);
+	}
+	return MIDI_OK;
+}
+
+// Close off a message that was cut short, handing over what there is of it
+void MIDI_Sysex_Abort(midi_sysex_t *sysex)
+{
+	if (!sysex->active) {
+		return;
+	}
+	sysex->flags |= MIDI_SYSEX_END | MIDI_SYSEX_ABORTED;
+	sysex->active = false;
+	sysex->stats.aborts++;
+	midi_sysex_deliver(sysex);
+}
+
+void MIDI_Sysex_Print_Stats(midi_sysex_t *sysex)
+{
+	printf("sysex port %d: %s, messages %lu, bytes %lu, chunks %lu, aborts %lu, stalls %lu\r\n",
+			sysex->port_index, sysex->active ? "in message" : "idle",
+			(unsigned long)sysex->stats.messages, (unsigned long)sysex->stats.bytes,
+			(unsigned long)sysex->stats.chunks, (unsigned long)sysex->stats.aborts,
+			(unsigned long)sysex->stats.stalls);
+}
@@ -0,0 +1,57 @@
+/*
+ * midi_sysex.h
+ *
+ * Streaming sysex for one input port. A sysex message is never held whole:
+ * payload bytes are collected into a fixed chunk buffer and handed to a
+ * handler each time it fills, with flags marking the first and last chunk,
+ * so any length of dump goes through in MIDI_SYSEX_CHUNK_SIZE bytes of RAM.
+ * Chunks carry the bytes between 0xF0 and 0xF7, not the two markers.
+ *
+ * Sysex can also be passed straight through to a set of output ports. An
+ * event is only taken once every one of them has room for it; otherwise it's
+ * refused and stays queued on the input, so a dump is forwarded as fast as
+ * the slowest output takes it.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_SYSEX_H
+#define MIDI_SYSEX_H
+
+#include "midi.h"
+
+#define MIDI_SYSEX_CHUNK_SIZE 64
+
+#define MIDI_SYSEX_START   0x01 // First chunk of a message
+#define MIDI_SYSEX_END     0x02 // Last chunk of a message, possibly empty
+#define MIDI_SYSEX_ABORTED 0x04 // With END: the message was cut off before its 0xF7
+
+typedef void (*midi_sysex_handler_t)(uint8_t port_index, const uint8_t *data, uint16_t length, uint8_t flags, void *context);
+
+typedef struct {
+	uint8_t port_index;
+	bool active;              // Inside a message
+	uint8_t flags;            // Flags for the chunk being collected
+	uint16_t length;          // Bytes in chunk
+	uint8_t chunk[MIDI_SYSEX_CHUNK_SIZE];
+	midi_sysex_handler_t handler;
+	void *handler_context;
+	uint8_t passthrough_mask; // Output port indices sysex is forwarded to
+	struct {
+		uint32_t messages;
+		uint32_t bytes;
+		uint32_t chunks;
+		uint32_t aborts;
+		uint32_t stalls;      // Events refused while an output caught up
+	} stats;
+} midi_sysex_t;
+
+void MIDI_Sysex_Init(midi_sysex_t *sysex, uint8_t port_index);
+void MIDI_Sysex_Set_Handler(midi_sysex_t *sysex, midi_sysex_handler_t handler, void *context);
+void MIDI_Sysex_Set_Passthrough(midi_sysex_t *sysex, uint8_t dest_mask);
+bool MIDI_Sysex_Is_Sysex(const midi_event_t *event);
+MIDI_error_t MIDI_Sysex_Input(midi_sysex_t *sysex, const midi_event_t *event, uint32_t timestamp);
+void MIDI_Sysex_Abort(midi_sysex_t *sysex);
+void MIDI_Sysex_Print_Stats(midi_sysex_t *sysex);
+
+#endif // MIDI_SYSEX_H
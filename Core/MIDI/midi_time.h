@@ -0,0 +1,53 @@
+/*
+ * midi_time.h
+ *
+ * MIDI timebase. TIM2 is a 32 bit counter free running at 1MHz, so a
+ * timestamp is microseconds since boot and wraps about every 71 minutes.
+ * Compare timestamps by subtracting them, never with < or >.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_TIME_H
+#define MIDI_TIME_H
+
+#include <stdint.h>
+#include "midi_platform.h"
+
+#define MIDI_TIME_TICKS_PER_SEC 1000000
+
+// One byte on the wire: start bit, 8 data bits and stop bit at 31250 baud
+#define MIDI_BYTE_TIME_US 320
+
+static inline uint32_t MIDI_Time_Now(void) {
+	return MIDI_Platform_Timer_Now();
+}
+
+// Signed difference, correct across the counter wrapping
+static inline int32_t MIDI_Time_Diff(uint32_t later, uint32_t earlier) {
+	return (int32_t)(later - earlier);
+}
+
+/*
+ * Alarms are TIM2 compare interrupts, one per capture/compare channel. Call
+ * these with interrupts masked or from the TIM2 interrupt itself.
+ */
+typedef enum {
+	MIDI_TIME_ALARM_SCHEDULER = 0, // Channel 1
+	MIDI_TIME_ALARM_CLOCK = 1,     // Channel 2
+} midi_time_alarm_e;
+
+static inline void MIDI_Time_Alarm_Set(midi_time_alarm_e alarm, uint32_t when) {
+	MIDI_Platform_Alarm_Set(alarm, when);
+}
+
+// Raise the alarm interrupt right away
+static inline void MIDI_Time_Alarm_Fire(midi_time_alarm_e alarm) {
+	MIDI_Platform_Alarm_Fire(alarm);
+}
+
+static inline void MIDI_Time_Alarm_Stop(midi_time_alarm_e alarm) {
+	MIDI_Platform_Alarm_Stop(alarm);
+}
+
+#endif // MIDI_TIME_H
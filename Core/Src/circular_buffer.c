@@ -3,69 +3,203 @@
  *
  * Generic byte-oriented circular buffer implementation. Adapted from "Making Embedded Systems" by Elecia White.
  * Supports multiple-byte reads and writes.
+ *
+ * Indices run freely and are only masked when addressing the data, so a full
+ * buffer and an empty one are told apart without giving up a byte. Copies that
+ * cross the end of the buffer are split in two. Each side copies its data
+ * before publishing its index, with a barrier in between, so the other side
+ * never sees an index move ahead of the bytes it covers.
+ *
  * 01/20/2020
  *
  * Chris White
  */
 
 #include <stddef.h>
+#include <string.h>
 #include "circular_buffer.h"
 
+#if defined(__arm__)
+#define CIRCULAR_BUFFER_BARRIER()	__asm volatile ("dmb" ::: "memory")
+#else // Host builds: each barrier only orders loads and stores against one another
+#define CIRCULAR_BUFFER_BARRIER()	__atomic_thread_fence(__ATOMIC_ACQ_REL)
+#endif
+
 static inline eCircularBufferError buffer_is_valid(circular_buffer_t *cb) {
 	// Check proper initialization
-	if ((cb->data == NULL) || (cb->size == 0) || (cb->size & 0x01)) {
+	if ((cb->data == NULL) || (cb->size == 0) || (cb->size & (cb->size - 1)) || (cb->size > 0x8000)) {
 		return eCircularBufferNotValid;
 	}
 	return eCircularBufferOk;
 }
 
+eCircularBufferError circularBuffer_init(circular_buffer_t *cb, uint8_t *data, uint16_t size) {
+	cb->data = data;
+	cb->size = size;
+	cb->read_pos = 0;
+	cb->write_pos = 0;
+	return buffer_is_valid(cb);
+}
+
 eCircularBufferError circularBuffer_get_length(circular_buffer_t *cb, uint16_t *length) {
 
 	if ((buffer_is_valid(cb) == eCircularBufferOk) && (length != NULL)) {
-		*length = (cb->write_pos - cb->read_pos) & (cb->size - 1);
+		*length = (uint16_t)(cb->write_pos - cb->read_pos);
 		return eCircularBufferOk;
 	}
 	return eCircularBufferNotValid;
 }
 
-eCircularBufferError circularBuffer_write_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t len) {
-	uint16_t curr_length = 0;
-	eCircularBufferError status;
+// All or nothing: if len bytes don't fit, nothing is written
+eCircularBufferError circularBuffer_write_bytes(circular_buffer_t *cb, const uint8_t *data, uint16_t len) {
+	uint16_t write_pos;
+	uint16_t offset;
+	uint16_t first;
 
-	status = circularBuffer_get_length(cb, &curr_length);
-	if (status == eCircularBufferOk) {
-		if (curr_length == (cb->size - len)) {
-			return eCircularBufferFull; // Can't fit!
-		}
+	if (buffer_is_valid(cb) != eCircularBufferOk) {
+		return eCircularBufferNotValid;
+	}
 
-		memcpy(&cb->data[cb->write_pos], data, len);
-		cb->write_pos = (cb->write_pos + len) & (cb->size - len); // Atomic?
-		return eCircularBufferOk;
-	} else {
-		return status;
+	write_pos = cb->write_pos;
+	if (len > (uint16_t)(cb->size - (uint16_t)(write_pos - cb->read_pos))) {
+		return eCircularBufferFull; // Can't fit!
 	}
+
+	offset = write_pos & (cb->size - 1);
+	first = cb->size - offset;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(&cb->data[offset], data, first);
+	if (first < len) {
+		memcpy(&cb->data[0], &data[first], len - first);
+	}
+
+	CIRCULAR_BUFFER_BARRIER(); // Data must land before the reader can see it
+	cb->write_pos = write_pos + len;
+	return eCircularBufferOk;
 }
 
 eCircularBufferError circularBuffer_read_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t *read_len) {
-	uint16_t curr_length = 0;
-	eCircularBufferError status;
-
-	status = circularBuffer_get_length(cb, &curr_length);
-	if (status == eCircularBufferOk) {
-		if (curr_length == 0) {
-			return eCircularBufferEmpty;
-		}
-
-		if (curr_length < *read_len) { // Underflow, read as many bytes as we can
-			*read_len = curr_length;
-		}
-		memcpy(data, &cb->data[cb->read_pos], *read_len);
-		cb->read_pos = (cb->read_pos + *read_len) & (cb->size - *read_len);
-		return eCircularBufferOk;
-	} else {
-		return status;
+	uint16_t curr_length;
+	uint16_t read_pos;
+	uint16_t offset;
+	uint16_t first;
+
+	if (buffer_is_valid(cb) != eCircularBufferOk) {
+		return eCircularBufferNotValid;
 	}
+
+	read_pos = cb->read_pos;
+	curr_length = (uint16_t)(cb->write_pos - read_pos);
+	if (curr_length == 0) {
+		return eCircularBufferEmpty;
+	}
+	CIRCULAR_BUFFER_BARRIER(); // Don't read data older than the write index we just saw
+
+	if (curr_length < *read_len) { // Underflow, read as many bytes as we can
+		*read_len = curr_length;
+	}
+
+	offset = read_pos & (cb->size - 1);
+	first = cb->size - offset;
+	if (first > *read_len) {
+		first = *read_len;
+	}
+	memcpy(data, &cb->data[offset], first);
+	if (first < *read_len) {
+		memcpy(&data[first], &cb->data[0], *read_len - first);
+	}
+
+	CIRCULAR_BUFFER_BARRIER(); // Finish reading before the writer may reuse the space
+	cb->read_pos = read_pos + *read_len;
+	return eCircularBufferOk;
 }
 
+/*
+ * Zero-copy access
+ *
+ * A region handed out by acquire stays valid until it is committed, since the
+ * other side can only grow it. Neither call splits at the wrap: once the first
+ * region is committed, the next acquire returns the part at the start of the ring.
+ */
+eCircularBufferError circularBuffer_acquire_read(circular_buffer_t *cb, uint8_t **region, uint16_t *len) {
+	uint16_t curr_length;
+	uint16_t offset;
+
+	if ((buffer_is_valid(cb) != eCircularBufferOk) || (region == NULL) || (len == NULL)) {
+		return eCircularBufferNotValid;
+	}
 
+	curr_length = (uint16_t)(cb->write_pos - cb->read_pos);
+	if (curr_length == 0) {
+		*len = 0;
+		return eCircularBufferEmpty;
+	}
+	CIRCULAR_BUFFER_BARRIER(); // Don't read data older than the write index we just saw
 
+	offset = cb->read_pos & (cb->size - 1);
+	*region = &cb->data[offset];
+	*len = cb->size - offset;
+	if (*len > curr_length) {
+		*len = curr_length;
+	}
+	return eCircularBufferOk;
+}
+
+eCircularBufferError circularBuffer_commit_read(circular_buffer_t *cb, uint16_t len) {
+	uint16_t read_pos;
+
+	if (buffer_is_valid(cb) != eCircularBufferOk) {
+		return eCircularBufferNotValid;
+	}
+
+	read_pos = cb->read_pos;
+	if (len > (uint16_t)(cb->write_pos - read_pos)) {
+		return eCircularBufferNotValid; // More than was ever available
+	}
+
+	CIRCULAR_BUFFER_BARRIER(); // Finish reading before the writer may reuse the space
+	cb->read_pos = read_pos + len;
+	return eCircularBufferOk;
+}
+
+eCircularBufferError circularBuffer_acquire_write(circular_buffer_t *cb, uint8_t **region, uint16_t *len) {
+	uint16_t space;
+	uint16_t offset;
+
+	if ((buffer_is_valid(cb) != eCircularBufferOk) || (region == NULL) || (len == NULL)) {
+		return eCircularBufferNotValid;
+	}
+
+	space = cb->size - (uint16_t)(cb->write_pos - cb->read_pos);
+	if (space == 0) {
+		*len = 0;
+		return eCircularBufferFull;
+	}
+
+	offset = cb->write_pos & (cb->size - 1);
+	*region = &cb->data[offset];
+	*len = cb->size - offset;
+	if (*len > space) {
+		*len = space;
+	}
+	return eCircularBufferOk;
+}
+
+eCircularBufferError circularBuffer_commit_write(circular_buffer_t *cb, uint16_t len) {
+	uint16_t write_pos;
+
+	if (buffer_is_valid(cb) != eCircularBufferOk) {
+		return eCircularBufferNotValid;
+	}
+
+	write_pos = cb->write_pos;
+	if (len > (uint16_t)(cb->size - (uint16_t)(write_pos - cb->read_pos))) {
+		return eCircularBufferFull;
+	}
+
+	CIRCULAR_BUFFER_BARRIER(); // Data must land before the reader can see it
+	cb->write_pos = write_pos + len;
+	return eCircularBufferOk;
+}
@@ -0,0 +1,114 @@
+/*
+ * log_ring.c
+ *
+ * Deferred logging ring, see log_ring.h.
+ *
+ * Writers claim a slot by moving head on with a compare and swap, which
+ * retries rather than masking interrupts if a handler claims one in between.
+ * A slot's fmt is written last and is what marks it complete. The one reader,
+ * the main loop, stops at the first incomplete slot, and clears fmt before
+ * moving tail on to hand the slot back. A full ring drops the new record.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "log_ring.h"
+#include "midi_time.h"
+#include "../Console/consoleIo.h"
+
+#define LOG_RING_LINE_MAX 96       // Longest formatted line, timestamp included
+#define LOG_RING_PROCESS_MAX 8     // Records formatted per LOG_Process() call
+
+static struct {
+	log_record_t records[LOG_RING_RECORDS];
+	volatile uint32_t head;        // Next slot to claim, free running
+	volatile uint32_t tail;        // Next slot to format, free running
+	volatile bool enabled;
+	uint32_t drops;
+	uint32_t written;
+} log_ring;
+
+// Starts off: the trace is per event, so the console stays quiet until asked
+void LOG_Init(void)
+{
+	memset(&log_ring, 0, sizeof(log_ring));
+}
+
+// Store a record for formatting later; from anywhere, interrupts included
+void LOG_Write(const char *fmt, uint32_t arg0, uint32_t arg1)
+{
+	uint32_t now = MIDI_Time_Now();
+	uint32_t head = log_ring.head;
+	log_record_t *record;
+
+	if (!log_ring.enabled) {
+		return;
+	}
+	do {
+		if ((head - log_ring.tail) >= LOG_RING_RECORDS) {
+			__atomic_fetch_add(&log_ring.drops, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&log_ring.head, &head, head + 1, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	record = &log_ring.records[head & (LOG_RING_RECORDS - 1)];
+	record->timestamp = now;
+	record->args[0] = arg0;
+	record->args[1] = arg1;
+	__atomic_store_n(&record->fmt, fmt, __ATOMIC_RELEASE); // Arguments land before the reader can see it
+}
+
+/*
+ * Format waiting records onto the console, from the main loop. Stops early
+ * rather than have the console drop a line, so a busy console holds records
+ * back instead of losing them.
+ */
+void LOG_Process(void)
+{
+	char line[LOG_RING_LINE_MAX];
+	log_record_t *record;
+	const char *fmt;
+	uint32_t tail = log_ring.tail;
+	int len;
+	uint8_t i;
+
+	for (i = 0; (i < LOG_RING_PROCESS_MAX) && (tail != log_ring.head); i++) {
+		record = &log_ring.records[tail & (LOG_RING_RECORDS - 1)];
+		fmt = __atomic_load_n(&record->fmt, __ATOMIC_ACQUIRE);
+		if ((fmt == NULL) || (ConsoleIoWriteSpace() < LOG_RING_LINE_MAX)) {
+			break;
+		}
+		len = snprintf(line, sizeof(line), "[%10lu] ", (unsigned long)record->timestamp);
+		len += snprintf(&line[len], sizeof(line) - len, fmt,
+				(unsigned long)record->args[0], (unsigned long)record->args[1]);
+		if (len >= (int)sizeof(line)) {
+			len = sizeof(line) - 1;
+		}
+		ConsoleIoWrite((const uint8_t *)line, len);
+		log_ring.written++;
+
+		record->fmt = NULL;
+		tail++;
+		__atomic_store_n(&log_ring.tail, tail, __ATOMIC_RELEASE); // Slot is clear before writers can claim it
+	}
+}
+
+void LOG_Set_Enabled(bool enabled)
+{
+	log_ring.enabled = enabled;
+}
+
+bool LOG_Is_Enabled(void)
+{
+	return log_ring.enabled;
+}
+
+void LOG_Print_Stats(void)
+{
+	printf("log: %s, %lu waiting, written %lu, drops %lu\r\n",
+			log_ring.enabled ? "on" : "off", (unsigned long)(log_ring.head - log_ring.tail),
+			(unsigned long)log_ring.written, (unsigned long)log_ring.drops);
+}
@@ -24,7 +24,14 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "../Console/console.h"
+#include "../Console/consoleIo.h"
 #include "../MIDI/midi.h"
+#include "../MIDI/midi_scheduler.h"
+#include "../MIDI/midi_clock.h"
+#include "../USB/usb_device.h"
+#include "../Display/display.h"
+#include "midi_application.h"
+#include "log_ring.h"
 
 /* USER CODE END Includes */
 
@@ -49,19 +56,30 @@ RTC_HandleTypeDef hrtc;
 
 SPI_HandleTypeDef hspi1;
 
+TIM_HandleTypeDef htim2;
+
 UART_HandleTypeDef huart1;
 UART_HandleTypeDef huart2;
 UART_HandleTypeDef huart3;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
+DMA_HandleTypeDef hdma_usart3_rx;
+DMA_HandleTypeDef hdma_usart3_tx;
 
 PCD_HandleTypeDef hpcd_USB_FS;
 
 /* USER CODE BEGIN PV */
+midi_port_t midi_port1;
+midi_port_t midi_port2;
 
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_RTC_Init(void);
 static void MX_USART3_UART_Init(void);
 static void MX_USB_PCD_Init(void);
@@ -69,6 +87,7 @@ static void MX_USART1_UART_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_SPI1_Init(void);
 static void MX_I2S3_Init(void);
+static void MX_TIM2_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -76,24 +95,17 @@ static void MX_I2S3_Init(void);
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 int _write(int file, char *outgoing, int len) {
-   HAL_UART_Transmit(&huart3, outgoing, len, 100);
-   return len;
+   return ConsoleIoWrite((uint8_t *) outgoing, len);
 }
 
 int _read(int file, char *result, size_t len) {
-    HAL_StatusTypeDef status;
-    int retcode = 0;
-
-    if (len != 0) {
-        status = HAL_UART_Receive( &huart3, (uint8_t *) result, len, HAL_MAX_DELAY);
+    uint32_t received = 0;
 
-        if (status == HAL_OK) {
-            retcode = len;
-        } else {
-            retcode = -1;
-        }
+    // The console UART is always receiving by DMA, so wait on what it has taken in
+    while ((len != 0) && (received == 0)) {
+        ConsoleIoReceive((uint8_t *) result, len, &received);
     }
-    return( retcode);
+    return( received);
 }
 
 
@@ -116,7 +128,12 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
-  MIDI_Init(&huart1, &huart1);
+  MIDI_Init(&midi_port1, &huart1, &huart1);
+  MIDI_Init(&midi_port2, &huart2, &huart2);
+  if (MIDI_Application_Init() != MIDI_OK)
+  {
+    Error_Handler();
+  }
 
   /* USER CODE END Init */
 
@@ -129,6 +146,7 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_RTC_Init();
   MX_USART3_UART_Init();
   MX_USB_PCD_Init();
@@ -136,7 +154,11 @@ int main(void)
   MX_USART2_UART_Init();
   MX_SPI1_Init();
   MX_I2S3_Init();
+  MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
+  LOG_Init();
+  MIDI_Scheduler_Init();
+  MIDI_Clock_Init();
 
   /* USER CODE END 2 */
  
@@ -146,7 +168,8 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   test1();
   ConsoleInit(&huart3);
-  MIDI_Interrupt_Receive_Begin();
+  MIDI_Interrupt_Receive_Begin(&midi_port1);
+  MIDI_Interrupt_Receive_Begin(&midi_port2);
   while (1)
   {
     /* USER CODE END WHILE */
@@ -154,6 +177,7 @@ int main(void)
     /* USER CODE BEGIN 3 */
 	MIDI_Application_Process();
 	ConsoleProcess();
+	LOG_Process();
   }
   /* USER CODE END 3 */
 }
@@ -318,6 +342,53 @@ static void MX_SPI1_Init(void)
 
 }
 
+/**
+  * @brief TIM2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+
+  /* USER CODE BEGIN TIM2_Init 0 */
+
+  /* USER CODE END TIM2_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM2_Init 1 */
+
+  /* USER CODE END TIM2_Init 1 */
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 71;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 0xFFFFFFFF;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM2_Init 2 */
+  // Free running 1MHz timebase for MIDI timestamps, see midi_time.h
+  HAL_TIM_Base_Start(&htim2);
+
+  /* USER CODE END TIM2_Init 2 */
+
+}
+
 /**
   * @brief USART1 Initialization Function
   * @param None
@@ -369,7 +440,7 @@ static void MX_USART2_UART_Init(void)
 
   /* USER CODE END USART2_Init 1 */
   huart2.Instance = USART2;
-  huart2.Init.BaudRate = 38400;
+  huart2.Init.BaudRate = 31250;
   huart2.Init.WordLength = UART_WORDLENGTH_8B;
   huart2.Init.StopBits = UART_STOPBITS_1;
   huart2.Init.Parity = UART_PARITY_NONE;
@@ -450,11 +521,43 @@ static void MX_USB_PCD_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN USB_Init 2 */
+  USB_Device_Init(&hpcd_USB_FS);
 
   /* USER CODE END USB_Init 2 */
 
 }
 
+/** 
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void) 
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+  /* DMA1_Channel3_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+  /* DMA1_Channel4_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  /* DMA1_Channel5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -530,6 +633,20 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief Rx Half Transfer completed callbacks
+  * @param huart: uart handle
+  * @retval None
+  */
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == &huart3) {
+    ConsoleIoReceiveInterrupt();
+  } else {
+    MIDI_UART_Receive(huart, false);
+  }
+}
+
 /**
   * @brief Rx Transfer completed callbacks
   * @param huart: uart handle
@@ -537,10 +654,12 @@ static void MX_GPIO_Init(void)
   */
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
-  /* Prevent unused argument(s) compilation warning */
-  UNUSED(huart);
-  MIDI_Interrupt_Receive();
-  MIDI_Interrupt_Receive_Begin();
+  // Circular DMA, the transfer keeps running so there is nothing to re-arm
+  if (huart == &huart3) {
+    ConsoleIoReceiveInterrupt();
+  } else {
+    MIDI_UART_Receive(huart, false);
+  }
 }
 
 /**
@@ -550,18 +669,76 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
   */
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
-  /* Prevent unused argument(s) compilation warning */
-  UNUSED(huart);
-  MIDI_Interrupt_Transmit_End();
+  if (huart == &huart3) {
+    ConsoleIoTransmitDone(CONSOLE_IO_UART);
+  } else {
+    MIDI_UART_Transmit_End(huart);
+  }
 }
 
 /*
  *
  */
-HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &huart3) {
+		ConsoleIoUartError();
+	} else {
+		MIDI_UART_Error(huart);
+	}
+}
+
+/**
+  * @brief Output compare callback, the MIDI scheduler's tick on channel 1
+  *        and the MIDI clock on channel 2
+  * @param htim: timer handle
+  * @retval None
+  */
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  if (htim->Instance != TIM2) {
+    return;
+  }
+  if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) {
+    MIDI_Scheduler_Timer_IRQ();
+  } else if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2) {
+    MIDI_Clock_Timer_IRQ();
+  }
+}
+
+/**
+  * @brief USB device callbacks, all handled by the USB device core
+  * @param hpcd: PCD handle
+  * @retval None
+  */
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd)
+{
+  USB_Device_Setup(hpcd);
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+  USB_Device_Data_Out(hpcd, epnum);
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+  USB_Device_Data_In(hpcd, epnum);
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
+{
+  USB_Device_Reset(hpcd);
+}
+
+void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
+{
+  USB_Device_Suspend(hpcd);
+}
+
+void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
 {
-	UNUSED(huart);
-	MIDI_Log_Error();
+  USB_Device_Resume(hpcd);
 }
 
 /* USER CODE END 4 */
@@ -8,27 +8,204 @@
  * Chris White
  */
 
-//#define DEBUG_MIDI_TX
 #include "midi_application.h"
+#include "log_ring.h"
+#include "../USB/usb_midi.h"
 
+static midi_merge_t midi_merge;
+static midi_router_t midi_router;
+static midi_sysex_t midi_sysex[MIDI_MAX_INPUTS];
+static uint8_t midi_sensing_inputs; // Inputs that have sent active sensing, so may time out
+static uint8_t midi_panic_pending;  // Outputs with note offs still to send
+
+#define MIDI_APP_SENSING_TIMEOUT_US 300000 // Active sensing promises a byte at least this often
+
+/*
+ * Merge inputs, numbered by cable: the MIDI ports first, then a cable from the
+ * USB host for each of them, all of which the router has to have room for.
+ */
+#define MIDI_APP_USB_INPUT(cable) (MIDI_MAX_PORTS + (cable))
+#define MIDI_APP_PORT_INPUTS ((1 << MIDI_MAX_PORTS) - 1)
+
+#if MIDI_APP_USB_INPUT(USB_MIDI_CABLES) > MIDI_MAX_INPUTS
+#error "Every MIDI port and USB cable needs a merge input"
+#endif
+
+/*
+ * Everything from every port to every output, as it was before there was a
+ * router, and what the host sends on cable n out of port n. The host cables'
+ * rules are filled in by MIDI_Application_Init().
+ */
+static midi_route_rule_t midi_application_routes[1 + USB_MIDI_CABLES] = {
+	{ MIDI_APP_PORT_INPUTS, MIDI_ROUTER_ALL_CHANNELS, MIDI_ROUTER_ALL_TYPES, 0, 127,
+			MIDI_ROUTER_ALL_OUTPUTS, MIDI_ROUTER_KEEP_CHANNEL, MIDI_CURVE_LINEAR },
+};
+
+/*
+ * Merged input goes through the router to its outputs, apart from sysex which
+ * streams through its input's sysex stage. Either way, input from the ports
+ * also goes to the host over USB, unrouted, on the port's cable. An event is
+ * only taken once every output has room for it, so it's never sent to some of
+ * its destinations and not others.
+ */
+static MIDI_error_t midi_application_send(const midi_event_t *event, uint32_t timestamp, void *context)
+{
+	midi_event_t routed = *event;
+	uint8_t input = midi_event_cable(event);
+	bool from_host = (input >= MIDI_APP_USB_INPUT(0));
+	MIDI_error_t result;
+	uint8_t dest_mask;
+	uint8_t i;
+
+	(void)context;
+
+	if (input >= MIDI_MAX_INPUTS) {
+		return MIDI_INVALID_PARAM;
+	}
+	if (MIDI_Sysex_Is_Sysex(event)) {
+		result = MIDI_Sysex_Input(&midi_sysex[input], event, timestamp);
+		if ((result == MIDI_OK) && !from_host) {
+			USB_MIDI_Send_Event(event, timestamp);
+		}
+		return result;
+	}
+
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if (MIDI_Send_Free(MIDI_Get_Port(i)) < 3) {
+			return MIDI_TX_OVERFLOW;
+		}
+	}
+
+	// Anything but real-time cuts off a sysex in progress
+	if (midi_event_cin(event) != MIDI_CIN_SINGLE_BYTE) {
+		MIDI_Sysex_Abort(&midi_sysex[input]);
+	} else if ((event->bytes[0] == 0xFE) && !from_host) {
+		midi_sensing_inputs |= (1 << input);
+	}
+	MIDI_Sync_Input(event, timestamp);
+	if (!from_host) {
+		USB_MIDI_Send_Event(event, timestamp); // Every port is also a cable to the host
+	}
+
+	dest_mask = MIDI_Router_Route(&midi_router, &routed);
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if (dest_mask & (1 << i)) {
+			MIDI_Send_Thru_Event(MIDI_Get_Port(i), &routed, timestamp);
+		}
+	}
+	LOG_Write("midi: sent %02lx %06lx\r\n", dest_mask,
+			((uint32_t)routed.bytes[0] << 16) | ((uint32_t)routed.bytes[1] << 8) | routed.bytes[2]);
+	return MIDI_OK;
+}
+
+/*
+ * Every port and USB cable has to get its merge input; anything else is a
+ * mismatch between the limits in midi.h and usb_midi.h.
+ */
+MIDI_error_t MIDI_Application_Init(void)
+{
+	midi_route_rule_t *rule;
+	MIDI_error_t status;
+	uint8_t input;
+	uint8_t i;
+
+	for (i = 0; i < USB_MIDI_CABLES; i++) {
+		rule = &midi_application_routes[1 + i];
+		*rule = midi_application_routes[0];
+		rule->input_mask = 1 << MIDI_APP_USB_INPUT(i);
+		rule->dest_mask = 1 << i;
+	}
+	status = MIDI_Router_Compile(&midi_router, midi_application_routes,
+			sizeof(midi_application_routes) / sizeof(midi_application_routes[0]));
+	if (status != MIDI_OK) {
+		return status;
+	}
+	MIDI_Merge_Init(&midi_merge, midi_application_send, NULL);
+	MIDI_Sync_Init(0);
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		status = MIDI_Merge_Add_Input(&midi_merge, &MIDI_Get_Port(i)->rx_events, i);
+		if (status != MIDI_OK) {
+			return status;
+		}
+		MIDI_Sysex_Init(&midi_sysex[i], i);
+		MIDI_Sysex_Set_Passthrough(&midi_sysex[i], MIDI_ROUTER_ALL_OUTPUTS);
+	}
+	for (i = 0; i < USB_MIDI_CABLES; i++) {
+		input = MIDI_APP_USB_INPUT(i);
+		status = MIDI_Merge_Add_Input(&midi_merge, USB_MIDI_Cable_Queue(i), input);
+		if (status != MIDI_OK) {
+			return status;
+		}
+		MIDI_Sysex_Init(&midi_sysex[input], input);
+		MIDI_Sysex_Set_Passthrough(&midi_sysex[input], 1 << i);
+	}
+	return MIDI_OK;
+}
+
+/*
+ * Turn off the notes left sounding on a set of output ports. A port whose TX
+ * ring fills before it's done is finished off on later passes.
+ */
+void MIDI_Application_Panic(uint8_t port_mask)
+{
+	uint8_t i;
+
+	midi_panic_pending |= port_mask & ((1 << MIDI_Num_Ports()) - 1);
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if ((midi_panic_pending & (1 << i)) && (MIDI_Panic(MIDI_Get_Port(i)) == MIDI_OK)) {
+			midi_panic_pending &= ~(1 << i);
+		}
+	}
+}
+
+// MIDI through with all inputs merged and routed. Input arrives already parsed, so only whole messages go out.
 void MIDI_Application_Process(void)
 {
-	MIDI_error_t status = MIDI_OK;
-	uint8_t next_byte = 0;
-	uint16_t bytes_to_read = 1;
+	midi_port_t *port;
+	uint8_t panic = 0;
+	uint32_t now;
+	uint8_t i;
 
-	// Just emulate MIDI through for now
-	do {
-		if (!MIDI_Interrupt_Is_Armed()) {
-			MIDI_Interrupt_Receive_Begin();
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		port = MIDI_Get_Port(i);
+		if (!MIDI_Interrupt_Is_Armed(port)) {
+			MIDI_Interrupt_Receive_Begin(port);
 		}
+	}
+	USB_MIDI_Process();
+	MIDI_Merge_Process(&midi_merge);
 
-		status = MIDI_Dequeue_Receive(&next_byte, &bytes_to_read);
-		if (status == MIDI_OK) {
-			status = MIDI_Enqueue_Send(&next_byte, &bytes_to_read);
-#ifdef DEBUG_MIDI_TX
-			printf("Sent: %x\r\n", next_byte);
-#endif
+	// A silent input that promised active sensing, or a lost clock, may have left notes hanging
+	now = MIDI_Time_Now();
+	for (i = 0; i < MIDI_Num_Ports(); i++) {
+		if ((midi_sensing_inputs & (1 << i))
+				&& (MIDI_Time_Diff(now, MIDI_Last_Receive_Time(MIDI_Get_Port(i))) > MIDI_APP_SENSING_TIMEOUT_US)) {
+			midi_sensing_inputs &= ~(1 << i);
+			panic = MIDI_ROUTER_ALL_OUTPUTS;
 		}
-	} while (status == MIDI_OK);
+	}
+	if (MIDI_Sync_Process(now)) {
+		panic = MIDI_ROUTER_ALL_OUTPUTS;
+	}
+	if (panic || midi_panic_pending) {
+		MIDI_Application_Panic(panic);
+	}
+}
+
+void MIDI_Application_Print_Merge(void)
+{
+	MIDI_Merge_Print_Stats(&midi_merge);
+	MIDI_Router_Print_Stats(&midi_router);
+}
+
+/*
+ * Sysex stage for an input, a port or a USB cable after them, for registering
+ * a handler or changing its pass-through
+ */
+midi_sysex_t *MIDI_Application_Get_Sysex(uint8_t input)
+{
+	if ((input >= MIDI_MAX_INPUTS) || ((input < MIDI_MAX_PORTS) && (input >= MIDI_Num_Ports()))) {
+		return NULL;
+	}
+	return &midi_sysex[input];
 }
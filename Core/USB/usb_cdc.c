@@ -0,0 +1,228 @@
+/*
+ * usb_cdc.c
+ *
+ * USB CDC-ACM function on usb_device.c.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "usb_cdc.h"
+#include "midi_platform.h"
+
+// Class requests, from the CDC PSTN subclass spec
+#define USB_CDC_SET_LINE_CODING        0x20
+#define USB_CDC_GET_LINE_CODING        0x21
+#define USB_CDC_SET_CONTROL_LINE_STATE 0x22
+#define USB_CDC_SEND_BREAK             0x23
+
+#define USB_CDC_DTR 0x01
+
+#define USB_CDC_PUT(p, ...) do { const uint8_t bytes_[] = { __VA_ARGS__ }; \
+	memcpy((p), bytes_, sizeof(bytes_)); (p) += sizeof(bytes_); } while (0)
+
+static struct {
+	bool configured;
+	bool open;                  // Host has raised DTR
+	bool rx_armed;
+	uint16_t rx_length;         // Bytes in rx_packet
+	uint16_t rx_pos;            // Bytes of it already read
+	uint16_t tx_length;         // Bytes on the IN endpoint, 0 if idle
+	bool tx_busy;
+	usb_cdc_tx_done_t tx_done;
+	uint8_t line_coding[7];     // Rate, stop bits, parity, data bits, as the host set them
+	uint8_t rx_packet[USB_CDC_PACKET_SIZE];
+	struct {
+		uint32_t rx_bytes;
+		uint32_t tx_bytes;
+		uint32_t tx_packets;
+		uint32_t opens;
+	} stats;
+} usb_cdc;
+
+void USB_CDC_Init(void)
+{
+	static const uint8_t line_coding[7] = { 0x00, 0x96, 0x00, 0x00, 0, 0, 8 }; // 38400 8N1, as on the UART
+
+	memset(&usb_cdc, 0, sizeof(usb_cdc));
+	memcpy(usb_cdc.line_coding, line_coding, sizeof(line_coding));
+}
+
+// Communication and data interfaces, numbered from interface, returning their length
+uint16_t USB_CDC_Descriptor(uint8_t *buffer, uint8_t interface)
+{
+	uint8_t *p = buffer;
+
+	USB_CDC_PUT(p, 9, 0x04, interface, 0, 1, 0x02, 0x02, 0x01, 0); // Communication, ACM
+	USB_CDC_PUT(p, 5, 0x24, 0x00, 0x10, 0x01);                     // Header, CDC 1.10
+	USB_CDC_PUT(p, 5, 0x24, 0x01, 0x00, interface + 1);            // Call management, none
+	USB_CDC_PUT(p, 4, 0x24, 0x02, 0x02);                           // Line coding and control line state
+	USB_CDC_PUT(p, 5, 0x24, 0x06, interface, interface + 1);       // Union
+	USB_CDC_PUT(p, 7, 0x05, USB_CDC_EP_NOTIFY, USB_DEVICE_EP_INTERRUPT, USB_CDC_NOTIFY_SIZE, 0, 16);
+	USB_CDC_PUT(p, 9, 0x04, interface + 1, 0, 2, 0x0A, 0x00, 0x00, 0); // Data
+	USB_CDC_PUT(p, 7, 0x05, USB_CDC_EP_OUT, USB_DEVICE_EP_BULK, USB_CDC_PACKET_SIZE, 0, 0);
+	USB_CDC_PUT(p, 7, 0x05, USB_CDC_EP_IN, USB_DEVICE_EP_BULK, USB_CDC_PACKET_SIZE, 0, 0);
+	return (uint16_t)(p - buffer);
+}
+
+static void usb_cdc_rx_arm(void)
+{
+	usb_cdc.rx_length = 0;
+	usb_cdc.rx_pos = 0;
+	usb_cdc.rx_armed = true;
+	USB_Device_EP_Receive(USB_CDC_EP_OUT, usb_cdc.rx_packet, USB_CDC_PACKET_SIZE);
+}
+
+// Coming down with a packet in flight still counts as the endpoint going idle
+void USB_CDC_Configure(bool configured)
+{
+	bool was_busy = usb_cdc.tx_busy;
+
+	usb_cdc.configured = configured;
+	usb_cdc.open = false;
+	usb_cdc.rx_armed = false;
+	usb_cdc.tx_busy = false;
+	usb_cdc.tx_length = 0;
+
+	if (configured) {
+		USB_Device_EP_Open(USB_CDC_EP_NOTIFY, USB_CDC_NOTIFY_SIZE, USB_DEVICE_EP_INTERRUPT);
+		USB_Device_EP_Open(USB_CDC_EP_OUT, USB_CDC_PACKET_SIZE, USB_DEVICE_EP_BULK);
+		USB_Device_EP_Open(USB_CDC_EP_IN, USB_CDC_PACKET_SIZE, USB_DEVICE_EP_BULK);
+		usb_cdc_rx_arm();
+	} else {
+		USB_Device_EP_Close(USB_CDC_EP_NOTIFY);
+		USB_Device_EP_Close(USB_CDC_EP_OUT);
+		USB_Device_EP_Close(USB_CDC_EP_IN);
+		if (was_busy && (usb_cdc.tx_done != NULL)) {
+			usb_cdc.tx_done();
+		}
+	}
+}
+
+// Class request on one of our interfaces; false to have it stalled
+bool USB_CDC_Setup(const usb_setup_t *setup)
+{
+	switch (setup->request) {
+	case USB_CDC_SET_LINE_CODING:
+		if (setup->length != sizeof(usb_cdc.line_coding)) {
+			return false;
+		}
+		USB_Device_Control_Receive(usb_cdc.line_coding, sizeof(usb_cdc.line_coding));
+		return true;
+	case USB_CDC_GET_LINE_CODING:
+		USB_Device_Control_Send(usb_cdc.line_coding, sizeof(usb_cdc.line_coding));
+		return true;
+	case USB_CDC_SET_CONTROL_LINE_STATE:
+		if ((setup->value & USB_CDC_DTR) && !usb_cdc.open) {
+			usb_cdc.stats.opens++;
+		}
+		usb_cdc.open = (setup->value & USB_CDC_DTR) != 0;
+		USB_Device_Control_Ack();
+		return true;
+	case USB_CDC_SEND_BREAK:
+		USB_Device_Control_Ack();
+		return true;
+	default:
+		return false;
+	}
+}
+
+void USB_CDC_Data_Out(void)
+{
+	usb_cdc.rx_length = USB_Device_EP_Rx_Count(USB_CDC_EP_OUT);
+	usb_cdc.rx_pos = 0;
+	usb_cdc.rx_armed = false;
+	usb_cdc.stats.rx_bytes += usb_cdc.rx_length;
+	if (usb_cdc.rx_length == 0) {
+		usb_cdc_rx_arm();
+	}
+}
+
+/*
+ * The packet has gone. A full one might leave the host waiting for more, so
+ * if nothing follows it the transfer is closed off with a zero length packet.
+ * The done callback comes after that too, so its caller can carry on.
+ */
+void USB_CDC_Data_In(void)
+{
+	bool full = (usb_cdc.tx_length == USB_CDC_PACKET_SIZE);
+
+	usb_cdc.tx_busy = false;
+	if (usb_cdc.tx_length != 0) {
+		usb_cdc.stats.tx_packets++;
+		usb_cdc.stats.tx_bytes += usb_cdc.tx_length;
+		usb_cdc.tx_length = 0;
+	}
+	if (usb_cdc.tx_done != NULL) {
+		usb_cdc.tx_done();
+	}
+	if (full && !usb_cdc.tx_busy) {
+		usb_cdc.tx_busy = true;
+		USB_Device_EP_Transmit(USB_CDC_EP_IN, NULL, 0);
+	}
+}
+
+bool USB_CDC_Is_Open(void)
+{
+	return usb_cdc.configured && usb_cdc.open;
+}
+
+// Copy out up to max_len bytes the host has sent, re-arming once the packet is used up
+uint16_t USB_CDC_Read(uint8_t *data, uint16_t max_len)
+{
+	midi_irq_state_t irq;
+	uint16_t len;
+
+	if (!usb_cdc.configured || usb_cdc.rx_armed) {
+		return 0;
+	}
+	len = usb_cdc.rx_length - usb_cdc.rx_pos;
+	if (len > max_len) {
+		len = max_len;
+	}
+	memcpy(data, &usb_cdc.rx_packet[usb_cdc.rx_pos], len);
+	usb_cdc.rx_pos += len;
+
+	if (usb_cdc.rx_pos == usb_cdc.rx_length) {
+		irq = MIDI_Platform_Lock();
+		if (usb_cdc.configured && !usb_cdc.rx_armed) {
+			usb_cdc_rx_arm();
+		}
+		MIDI_Platform_Unlock(irq);
+	}
+	return len;
+}
+
+/*
+ * Start sending up to a packet of data, which must stay put until the done
+ * callback. Returns how many bytes were taken, 0 if the endpoint is busy or
+ * the host hasn't configured the device. Call with interrupts masked from
+ * outside the done callback.
+ */
+uint16_t USB_CDC_Transmit(const uint8_t *data, uint16_t len)
+{
+	if (!usb_cdc.configured || usb_cdc.tx_busy || (len == 0)) {
+		return 0;
+	}
+	if (len > USB_CDC_PACKET_SIZE) {
+		len = USB_CDC_PACKET_SIZE;
+	}
+	usb_cdc.tx_busy = true;
+	usb_cdc.tx_length = len;
+	USB_Device_EP_Transmit(USB_CDC_EP_IN, data, len);
+	return len;
+}
+
+void USB_CDC_Set_Tx_Done(usb_cdc_tx_done_t done)
+{
+	usb_cdc.tx_done = done;
+}
+
+void USB_CDC_Print_Stats(void)
+{
+	printf("usb cdc: %s%s, rx bytes %lu, tx bytes %lu, tx packets %lu, opens %lu\r\n",
+			usb_cdc.configured ? "configured" : "not configured", usb_cdc.open ? ", open" : "",
+			(unsigned long)usb_cdc.stats.rx_bytes, (unsigned long)usb_cdc.stats.tx_bytes,
+			(unsigned long)usb_cdc.stats.tx_packets, (unsigned long)usb_cdc.stats.opens);
+}
@@ -0,0 +1,47 @@
+/*
+ * usb_cdc.h
+ *
+ * USB CDC-ACM function, a virtual serial port for the console alongside
+ * USB-MIDI. It carries bytes and nothing else: line coding is accepted and
+ * reported back but means nothing here, and DTR only tells whether a terminal
+ * has the port open.
+ *
+ * Data from the host is read straight out of the OUT endpoint's packet
+ * buffer, which isn't re-armed until it has all been read, so a console that
+ * isn't reading holds the host off. Data to the host is sent from wherever
+ * the caller keeps it, a packet at a time, with a callback when each is gone.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "usb_device.h"
+
+#define USB_CDC_INTERFACES 2 // Communication, then data
+#define USB_CDC_EP_NOTIFY 0x82
+#define USB_CDC_EP_OUT 0x03
+#define USB_CDC_EP_IN 0x83
+#define USB_CDC_NOTIFY_SIZE 8
+#define USB_CDC_PACKET_SIZE 64
+
+// Called from the USB interrupt each time the IN endpoint goes idle
+typedef void (*usb_cdc_tx_done_t)(void);
+
+void USB_CDC_Init(void);
+uint16_t USB_CDC_Descriptor(uint8_t *buffer, uint8_t interface);
+void USB_CDC_Configure(bool configured);
+bool USB_CDC_Setup(const usb_setup_t *setup);
+void USB_CDC_Data_Out(void);
+void USB_CDC_Data_In(void);
+
+bool USB_CDC_Is_Open(void);
+uint16_t USB_CDC_Read(uint8_t *data, uint16_t max_len);
+uint16_t USB_CDC_Transmit(const uint8_t *data, uint16_t len);
+void USB_CDC_Set_Tx_Done(usb_cdc_tx_done_t done);
+void USB_CDC_Print_Stats(void);
+
+#endif // USB_CDC_H
@@ -0,0 +1,580 @@
+/*
+ * usb_device.c
+ *
+ * USB device core on the HAL PCD driver. Endpoint 0 is run as a small state
+ * machine from the PCD callbacks: a SETUP is decoded and answered with data
+ * in 64 byte packets, or its data taken in, or acknowledged, or stalled.
+ * Standard requests are handled here. USB-MIDI needs nothing class specific,
+ * so class requests go to the CDC function when they're for its interfaces
+ * and are stalled otherwise.
+ *
+ * The device is a composite: USB-MIDI on interfaces 0 and 1, CDC-ACM after
+ * it. The configuration descriptor is put together at init, from the header
+ * here and each function's interfaces behind an interface association.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "usb_device.h"
+#include "usb_midi.h"
+#include "usb_cdc.h"
+
+#define USB_DEVICE_CONFIG_MAX 256 // Room for the whole configuration descriptor
+#define USB_DEVICE_STRING_MAX 64  // Longest string descriptor, in bytes
+
+// Packet memory layout: buffer table for endpoints 0-3, then each endpoint's buffer
+#define USB_PMA_EP0_OUT 0x40
+#define USB_PMA_EP0_IN  0x80
+#define USB_PMA_EP1_OUT 0xC0
+#define USB_PMA_EP1_IN  0x100
+#define USB_PMA_EP2_IN  0x140
+#define USB_PMA_EP3_OUT 0x150
+#define USB_PMA_EP3_IN  0x190
+
+// Standard requests, descriptor types and features, from chapter 9 of the USB 2.0 spec
+#define USB_REQ_GET_STATUS        0x00
+#define USB_REQ_CLEAR_FEATURE     0x01
+#define USB_REQ_SET_FEATURE       0x03
+#define USB_REQ_SET_ADDRESS       0x05
+#define USB_REQ_GET_DESCRIPTOR    0x06
+#define USB_REQ_GET_CONFIGURATION 0x08
+#define USB_REQ_SET_CONFIGURATION 0x09
+#define USB_REQ_GET_INTERFACE     0x0A
+#define USB_REQ_SET_INTERFACE     0x0B
+
+#define USB_DESC_DEVICE        0x01
+#define USB_DESC_CONFIGURATION 0x02
+#define USB_DESC_STRING        0x03
+#define USB_DESC_INTERFACE_ASSOCIATION 0x0B
+
+#define USB_FEATURE_ENDPOINT_HALT 0x00
+
+#define USB_REQ_TYPE_MASK      0x60
+#define USB_REQ_TYPE_STANDARD  0x00
+#define USB_REQ_TYPE_CLASS     0x20
+#define USB_REQ_RECIPIENT_MASK 0x1F
+#define USB_REQ_RECIPIENT_DEVICE    0x00
+#define USB_REQ_RECIPIENT_INTERFACE 0x01
+#define USB_REQ_RECIPIENT_ENDPOINT  0x02
+
+#define USB_DEVICE_CDC_INTERFACE USB_MIDI_INTERFACES // First of the CDC function's
+#define USB_DEVICE_INTERFACES (USB_MIDI_INTERFACES + USB_CDC_INTERFACES)
+
+typedef enum {
+	USB_EP0_IDLE,
+	USB_EP0_DATA_IN,    // Sending a reply
+	USB_EP0_DATA_OUT,   // Taking in the data of a request
+	USB_EP0_STATUS_IN,  // Acknowledging a request without data
+	USB_EP0_STATUS_OUT, // Waiting for the host to acknowledge a reply
+} usb_ep0_state_e;
+
+static const uint8_t usb_device_descriptor[] = {
+	18, USB_DESC_DEVICE,
+	0x00, 0x02,           // USB 2.0
+	0xEF, 0x02, 0x01,     // Miscellaneous, interface association descriptors
+	USB_DEVICE_EP0_SIZE,
+	USB_DEVICE_VID & 0xFF, USB_DEVICE_VID >> 8,
+	USB_DEVICE_PID & 0xFF, USB_DEVICE_PID >> 8,
+	0x00, 0x01,           // Device release 1.00
+	1, 2, 3,              // Manufacturer, product and serial number strings
+	1,                    // Configurations
+};
+
+static const char * const usb_device_strings[] = {
+	NULL,                 // Language IDs
+	"Logical Elegance",
+	"midifun",
+	NULL,                 // Serial number, from the chip's unique ID
+};
+
+static struct {
+	PCD_HandleTypeDef *pcd;
+	uint8_t configuration;       // Set by the host, 0 while unconfigured
+	usb_setup_t setup;           // Request being handled on endpoint 0
+	usb_ep0_state_e ep0_state;
+	const uint8_t *ep0_data;     // Rest of the reply
+	uint16_t ep0_remaining;
+	bool ep0_zlp;                // Reply is short of what was asked and a multiple of the packet size
+	uint16_t config_length;
+	uint8_t config[USB_DEVICE_CONFIG_MAX];
+	uint8_t string[USB_DEVICE_STRING_MAX];
+	uint8_t reply[2];
+	struct {
+		uint32_t resets;
+		uint32_t setups;
+		uint32_t stalls;
+		uint32_t suspends;
+		uint32_t configurations;
+	} stats;
+} usb_device;
+
+// Interface association, grouping count interfaces from first into one function
+static uint16_t usb_device_put_iad(uint8_t *p, uint8_t first, uint8_t count,
+		uint8_t class, uint8_t subclass, uint8_t protocol)
+{
+	p[0] = 8;
+	p[1] = USB_DESC_INTERFACE_ASSOCIATION;
+	p[2] = first;
+	p[3] = count;
+	p[4] = class;
+	p[5] = subclass;
+	p[6] = protocol;
+	p[7] = 0; // No string
+	return 8;
+}
+
+// Configuration descriptor: the header, then each function's interfaces
+static void usb_device_build_config(void)
+{
+	uint8_t *config = usb_device.config;
+	uint16_t length = 9;
+
+	length += usb_device_put_iad(&config[length], 0, USB_MIDI_INTERFACES, 0x01, 0x00, 0x00);
+	length += USB_MIDI_Descriptor(&config[length], 0);
+	length += usb_device_put_iad(&config[length], USB_DEVICE_CDC_INTERFACE, USB_CDC_INTERFACES, 0x02, 0x02, 0x01);
+	length += USB_CDC_Descriptor(&config[length], USB_DEVICE_CDC_INTERFACE);
+
+	config[0] = 9;
+	config[1] = USB_DESC_CONFIGURATION;
+	config[2] = length & 0xFF;
+	config[3] = length >> 8;
+	config[4] = USB_DEVICE_INTERFACES;
+	config[5] = 1;    // Configuration value
+	config[6] = 0;    // No string
+	config[7] = 0x80; // Bus powered
+	config[8] = 50;   // 100mA
+	usb_device.config_length = length;
+}
+
+/*
+ * String descriptor index as UTF-16, returning its length, or 0 if there is
+ * no such string. The serial number is the 96 bit unique ID in hex.
+ */
+static uint16_t usb_device_build_string(uint8_t index)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t *string = usb_device.string;
+	const char *text;
+	uint16_t length = 2;
+	uint32_t uid[3];
+	uint8_t i;
+
+	if (index >= sizeof(usb_device_strings) / sizeof(usb_device_strings[0])) {
+		return 0;
+	}
+	if (index == 0) {
+		string[length++] = 0x09; // English (United States)
+		string[length++] = 0x04;
+	} else if (usb_device_strings[index] == NULL) {
+		uid[0] = HAL_GetUIDw0();
+		uid[1] = HAL_GetUIDw1();
+		uid[2] = HAL_GetUIDw2();
+		for (i = 0; i < 24; i++) {
+			string[length++] = hex[(uid[i / 8] >> (28 - 4 * (i % 8))) & 0x0F];
+			string[length++] = 0;
+		}
+	} else {
+		for (text = usb_device_strings[index]; *text && (length < USB_DEVICE_STRING_MAX); text++) {
+			string[length++] = *text;
+			string[length++] = 0;
+		}
+	}
+	string[0] = length;
+	string[1] = USB_DESC_STRING;
+	return length;
+}
+
+/*
+ * Endpoint 0
+ */
+static void usb_ep0_stall(void)
+{
+	HAL_PCD_EP_SetStall(usb_device.pcd, 0x80);
+	HAL_PCD_EP_SetStall(usb_device.pcd, 0x00);
+	usb_device.ep0_state = USB_EP0_IDLE;
+	usb_device.stats.stalls++;
+}
+
+static void usb_ep0_ack(void)
+{
+	usb_device.ep0_state = USB_EP0_STATUS_IN;
+	HAL_PCD_EP_Transmit(usb_device.pcd, 0x80, NULL, 0);
+}
+
+// Send the next packet of the reply, or on to the status stage once it's all gone
+static void usb_ep0_continue(void)
+{
+	uint16_t length = usb_device.ep0_remaining;
+
+	if (length == 0) {
+		if (!usb_device.ep0_zlp) {
+			usb_device.ep0_state = USB_EP0_STATUS_OUT;
+			HAL_PCD_EP_Receive(usb_device.pcd, 0x00, NULL, 0);
+			return;
+		}
+		usb_device.ep0_zlp = false; // Tells the host the reply ended early
+	}
+	if (length > USB_DEVICE_EP0_SIZE) {
+		length = USB_DEVICE_EP0_SIZE;
+	}
+	HAL_PCD_EP_Transmit(usb_device.pcd, 0x80, (uint8_t *)usb_device.ep0_data, length);
+	usb_device.ep0_data += length;
+	usb_device.ep0_remaining -= length;
+}
+
+// Reply with up to as much as the host asked for
+static void usb_ep0_send(const uint8_t *data, uint16_t length)
+{
+	if (length > usb_device.setup.length) {
+		length = usb_device.setup.length;
+	}
+	usb_device.ep0_data = data;
+	usb_device.ep0_remaining = length;
+	usb_device.ep0_zlp = (length < usb_device.setup.length) && ((length % USB_DEVICE_EP0_SIZE) == 0);
+	usb_device.ep0_state = USB_EP0_DATA_IN;
+	usb_ep0_continue();
+}
+
+static void usb_ep0_send_status(uint8_t low, uint8_t high)
+{
+	usb_device.reply[0] = low;
+	usb_device.reply[1] = high;
+	usb_ep0_send(usb_device.reply, 2);
+}
+
+/*
+ * Standard requests
+ */
+static void usb_device_set_configuration(uint8_t configuration)
+{
+	if (configuration == usb_device.configuration) {
+		return;
+	}
+	if (usb_device.configuration != 0) {
+		USB_MIDI_Configure(false);
+		USB_CDC_Configure(false);
+	}
+	usb_device.configuration = configuration;
+	if (configuration != 0) {
+		USB_MIDI_Configure(true);
+		USB_CDC_Configure(true);
+		usb_device.stats.configurations++;
+	}
+}
+
+static void usb_device_get_descriptor(const usb_setup_t *setup)
+{
+	uint16_t length;
+
+	switch (setup->value >> 8) {
+	case USB_DESC_DEVICE:
+		usb_ep0_send(usb_device_descriptor, sizeof(usb_device_descriptor));
+		break;
+	case USB_DESC_CONFIGURATION:
+		usb_ep0_send(usb_device.config, usb_device.config_length);
+		break;
+	case USB_DESC_STRING:
+		length = usb_device_build_string(setup->value & 0xFF);
+		if (length == 0) {
+			usb_ep0_stall();
+		} else {
+			usb_ep0_send(usb_device.string, length);
+		}
+		break;
+	default:
+		usb_ep0_stall(); // Device qualifier included, as a full speed only device
+		break;
+	}
+}
+
+static void usb_device_request(const usb_setup_t *setup)
+{
+	switch (setup->request) {
+	case USB_REQ_GET_STATUS:
+		usb_ep0_send_status(0, 0); // Bus powered, no remote wakeup
+		break;
+	case USB_REQ_SET_ADDRESS:
+		// Takes effect once the status stage is done, see the PCD driver
+		HAL_PCD_SetAddress(usb_device.pcd, setup->value & 0x7F);
+		usb_ep0_ack();
+		break;
+	case USB_REQ_GET_DESCRIPTOR:
+		usb_device_get_descriptor(setup);
+		break;
+	case USB_REQ_GET_CONFIGURATION:
+		usb_ep0_send(&usb_device.configuration, 1);
+		break;
+	case USB_REQ_SET_CONFIGURATION:
+		if (setup->value > 1) {
+			usb_ep0_stall();
+			break;
+		}
+		usb_device_set_configuration(setup->value);
+		usb_ep0_ack();
+		break;
+	default:
+		usb_ep0_stall();
+		break;
+	}
+}
+
+static void usb_interface_request(const usb_setup_t *setup)
+{
+	if ((usb_device.configuration == 0) || (setup->index >= USB_DEVICE_INTERFACES)) {
+		usb_ep0_stall();
+		return;
+	}
+	switch (setup->request) {
+	case USB_REQ_GET_STATUS:
+		usb_ep0_send_status(0, 0);
+		break;
+	case USB_REQ_GET_INTERFACE:
+		usb_device.reply[0] = 0;
+		usb_ep0_send(usb_device.reply, 1);
+		break;
+	case USB_REQ_SET_INTERFACE:
+		if (setup->value == 0) {
+			usb_ep0_ack(); // Every interface has only the one alternate setting
+		} else {
+			usb_ep0_stall();
+		}
+		break;
+	default:
+		usb_ep0_stall();
+		break;
+	}
+}
+
+static void usb_endpoint_request(const usb_setup_t *setup)
+{
+	uint8_t ep_addr = setup->index & 0x8F;
+	PCD_EPTypeDef *ep;
+
+	bool cdc = (ep_addr == USB_CDC_EP_NOTIFY) || (ep_addr == USB_CDC_EP_OUT) || (ep_addr == USB_CDC_EP_IN);
+
+	if ((ep_addr & 0x0F) != 0) {
+		if ((usb_device.configuration == 0)
+				|| (!cdc && (ep_addr != USB_MIDI_EP_OUT) && (ep_addr != USB_MIDI_EP_IN))) {
+			usb_ep0_stall();
+			return;
+		}
+	}
+	ep = (ep_addr & 0x80) ? &usb_device.pcd->IN_ep[ep_addr & 0x0F] : &usb_device.pcd->OUT_ep[ep_addr];
+
+	switch (setup->request) {
+	case USB_REQ_GET_STATUS:
+		usb_ep0_send_status((((ep_addr & 0x0F) != 0) && ep->is_stall) ? 1 : 0, 0);
+		break;
+	case USB_REQ_CLEAR_FEATURE:
+	case USB_REQ_SET_FEATURE:
+		if ((setup->value != USB_FEATURE_ENDPOINT_HALT) || ((ep_addr & 0x0F) == 0)) {
+			usb_ep0_stall();
+			break;
+		}
+		if (setup->request == USB_REQ_SET_FEATURE) {
+			HAL_PCD_EP_SetStall(usb_device.pcd, ep_addr);
+		} else {
+			// Clearing a halt resets the data toggle, and the function starts its endpoints over
+			HAL_PCD_EP_ClrStall(usb_device.pcd, ep_addr);
+			if (cdc) {
+				USB_CDC_Configure(false);
+				USB_CDC_Configure(true);
+			} else {
+				USB_MIDI_Configure(false);
+				USB_MIDI_Configure(true);
+			}
+		}
+		usb_ep0_ack();
+		break;
+	default:
+		usb_ep0_stall();
+		break;
+	}
+}
+
+// Class requests to the CDC function's interfaces; it answers through the control calls below
+static void usb_class_request(const usb_setup_t *setup)
+{
+	if ((usb_device.configuration == 0)
+			|| ((setup->request_type & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE)
+			|| (setup->index < USB_DEVICE_CDC_INTERFACE) || (setup->index >= USB_DEVICE_INTERFACES)
+			|| !USB_CDC_Setup(setup)) {
+		usb_ep0_stall();
+	}
+}
+
+/*
+ * Bring up the device on an initialised PCD handle and connect to the host.
+ */
+void USB_Device_Init(PCD_HandleTypeDef *hpcd)
+{
+	memset(&usb_device, 0, sizeof(usb_device));
+	usb_device.pcd = hpcd;
+	USB_MIDI_Init();
+	USB_CDC_Init();
+	usb_device_build_config();
+
+	HAL_PCDEx_PMAConfig(hpcd, 0x00, PCD_SNG_BUF, USB_PMA_EP0_OUT);
+	HAL_PCDEx_PMAConfig(hpcd, 0x80, PCD_SNG_BUF, USB_PMA_EP0_IN);
+	HAL_PCDEx_PMAConfig(hpcd, USB_MIDI_EP_OUT, PCD_SNG_BUF, USB_PMA_EP1_OUT);
+	HAL_PCDEx_PMAConfig(hpcd, USB_MIDI_EP_IN, PCD_SNG_BUF, USB_PMA_EP1_IN);
+	HAL_PCDEx_PMAConfig(hpcd, USB_CDC_EP_NOTIFY, PCD_SNG_BUF, USB_PMA_EP2_IN);
+	HAL_PCDEx_PMAConfig(hpcd, USB_CDC_EP_OUT, PCD_SNG_BUF, USB_PMA_EP3_OUT);
+	HAL_PCDEx_PMAConfig(hpcd, USB_CDC_EP_IN, PCD_SNG_BUF, USB_PMA_EP3_IN);
+	HAL_PCD_Start(hpcd);
+}
+
+bool USB_Device_Is_Configured(void)
+{
+	return usb_device.configuration != 0;
+}
+
+void USB_Device_EP_Open(uint8_t ep_addr, uint16_t max_packet, usb_ep_type_e type)
+{
+	HAL_PCD_EP_Open(usb_device.pcd, ep_addr, max_packet, type);
+}
+
+void USB_Device_EP_Close(uint8_t ep_addr)
+{
+	HAL_PCD_EP_Close(usb_device.pcd, ep_addr);
+}
+
+// Start sending len bytes; the driver copies them into packet memory as it goes
+void USB_Device_EP_Transmit(uint8_t ep_addr, const uint8_t *data, uint16_t len)
+{
+	HAL_PCD_EP_Transmit(usb_device.pcd, ep_addr, (uint8_t *)data, len);
+}
+
+// Arm an OUT endpoint to receive up to len bytes into buffer
+void USB_Device_EP_Receive(uint8_t ep_addr, uint8_t *buffer, uint16_t len)
+{
+	HAL_PCD_EP_Receive(usb_device.pcd, ep_addr, buffer, len);
+}
+
+uint16_t USB_Device_EP_Rx_Count(uint8_t ep_addr)
+{
+	return (uint16_t)HAL_PCD_EP_GetRxCount(usb_device.pcd, ep_addr);
+}
+
+/*
+ * Control transfers for class requests, from within a class's setup handler
+ */
+
+// Reply to the request being handled
+void USB_Device_Control_Send(const uint8_t *data, uint16_t len)
+{
+	usb_ep0_send(data, len);
+}
+
+// Take in the request's data stage into buffer, acknowledging it once it's all there
+void USB_Device_Control_Receive(uint8_t *buffer, uint16_t len)
+{
+	usb_device.ep0_state = USB_EP0_DATA_OUT;
+	HAL_PCD_EP_Receive(usb_device.pcd, 0x00, buffer, len);
+}
+
+// Acknowledge a request without data
+void USB_Device_Control_Ack(void)
+{
+	usb_ep0_ack();
+}
+
+/*
+ * PCD callbacks, all in the USB interrupt
+ */
+void USB_Device_Setup(PCD_HandleTypeDef *hpcd)
+{
+	usb_setup_t *setup = &usb_device.setup;
+
+	memcpy(setup, hpcd->Setup, sizeof(*setup));
+	usb_device.ep0_state = USB_EP0_IDLE;
+	usb_device.stats.setups++;
+
+	if ((setup->request_type & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) {
+		usb_class_request(setup);
+		return;
+	}
+	if ((setup->request_type & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_STANDARD) {
+		usb_ep0_stall();
+		return;
+	}
+	switch (setup->request_type & USB_REQ_RECIPIENT_MASK) {
+	case USB_REQ_RECIPIENT_DEVICE:
+		usb_device_request(setup);
+		break;
+	case USB_REQ_RECIPIENT_INTERFACE:
+		usb_interface_request(setup);
+		break;
+	case USB_REQ_RECIPIENT_ENDPOINT:
+		usb_endpoint_request(setup);
+		break;
+	default:
+		usb_ep0_stall();
+		break;
+	}
+}
+
+void USB_Device_Data_Out(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	(void)hpcd;
+
+	if (epnum == 0) {
+		if (usb_device.ep0_state == USB_EP0_DATA_OUT) {
+			usb_ep0_ack();
+		}
+	} else if (epnum == (USB_MIDI_EP_OUT & 0x0F)) {
+		USB_MIDI_Data_Out();
+	} else if (epnum == (USB_CDC_EP_OUT & 0x0F)) {
+		USB_CDC_Data_Out();
+	}
+}
+
+void USB_Device_Data_In(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	(void)hpcd;
+
+	if (epnum == 0) {
+		if (usb_device.ep0_state == USB_EP0_DATA_IN) {
+			usb_ep0_continue();
+		} else if (usb_device.ep0_state == USB_EP0_STATUS_IN) {
+			usb_device.ep0_state = USB_EP0_IDLE;
+		}
+	} else if (epnum == (USB_MIDI_EP_IN & 0x0F)) {
+		USB_MIDI_Data_In();
+	} else if (epnum == (USB_CDC_EP_IN & 0x0F)) {
+		USB_CDC_Data_In();
+	}
+}
+
+// Bus reset: back to the default state, with only endpoint 0 open
+void USB_Device_Reset(PCD_HandleTypeDef *hpcd)
+{
+	usb_device_set_configuration(0);
+	usb_device.ep0_state = USB_EP0_IDLE;
+	usb_device.stats.resets++;
+
+	HAL_PCD_EP_Open(hpcd, 0x00, USB_DEVICE_EP0_SIZE, EP_TYPE_CTRL);
+	HAL_PCD_EP_Open(hpcd, 0x80, USB_DEVICE_EP0_SIZE, EP_TYPE_CTRL);
+}
+
+void USB_Device_Suspend(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+	usb_device.stats.suspends++;
+}
+
+void USB_Device_Resume(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+void USB_Device_Print_Stats(void)
+{
+	printf("usb: %s, resets %lu, setups %lu, stalls %lu, suspends %lu, configurations %lu\r\n",
+			usb_device.configuration ? "configured" : "not configured",
+			(unsigned long)usb_device.stats.resets, (unsigned long)usb_device.stats.setups,
+			(unsigned long)usb_device.stats.stalls, (unsigned long)usb_device.stats.suspends,
+			(unsigned long)usb_device.stats.configurations);
+}
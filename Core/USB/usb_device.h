@@ -0,0 +1,66 @@
+/*
+ * usb_device.h
+ *
+ * USB device core on the HAL PCD driver: enumeration, the standard requests on
+ * endpoint 0 and the descriptors, for the USB-MIDI function in usb_midi.c and
+ * the CDC-ACM one in usb_cdc.c. Classes move their data through the endpoint
+ * and control calls here and never touch the PCD handle, so they can be run
+ * against a stand-in for this file.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef USB_DEVICE_H
+#define USB_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stm32f3xx_hal.h>
+
+#define USB_DEVICE_EP0_SIZE 64
+#define USB_DEVICE_VID 0x1209 // pid.codes
+#define USB_DEVICE_PID 0x0001 // pid.codes test PID, for development only
+
+// Endpoint types, as in the bmAttributes of an endpoint descriptor
+typedef enum {
+	USB_DEVICE_EP_CONTROL = 0,
+	USB_DEVICE_EP_ISOCHRONOUS = 1,
+	USB_DEVICE_EP_BULK = 2,
+	USB_DEVICE_EP_INTERRUPT = 3,
+} usb_ep_type_e;
+
+// A SETUP packet, as it arrives
+typedef struct {
+	uint8_t request_type;
+	uint8_t request;
+	uint16_t value;
+	uint16_t index;
+	uint16_t length;
+} __attribute__((packed)) usb_setup_t;
+
+void USB_Device_Init(PCD_HandleTypeDef *hpcd);
+bool USB_Device_Is_Configured(void);
+
+// Endpoint access for the classes
+void USB_Device_EP_Open(uint8_t ep_addr, uint16_t max_packet, usb_ep_type_e type);
+void USB_Device_EP_Close(uint8_t ep_addr);
+void USB_Device_EP_Transmit(uint8_t ep_addr, const uint8_t *data, uint16_t len);
+void USB_Device_EP_Receive(uint8_t ep_addr, uint8_t *buffer, uint16_t len);
+uint16_t USB_Device_EP_Rx_Count(uint8_t ep_addr);
+
+// Control transfers, for answering a class request from its setup handler
+void USB_Device_Control_Send(const uint8_t *data, uint16_t len);
+void USB_Device_Control_Receive(uint8_t *buffer, uint16_t len);
+void USB_Device_Control_Ack(void);
+
+// From the HAL PCD callbacks
+void USB_Device_Setup(PCD_HandleTypeDef *hpcd);
+void USB_Device_Data_Out(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void USB_Device_Data_In(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void USB_Device_Reset(PCD_HandleTypeDef *hpcd);
+void USB_Device_Suspend(PCD_HandleTypeDef *hpcd);
+void USB_Device_Resume(PCD_HandleTypeDef *hpcd);
+
+void USB_Device_Print_Stats(void);
+
+#endif // USB_DEVICE_H
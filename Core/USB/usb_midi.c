@@ -0,0 +1,288 @@
+/*
+ * usb_midi.c
+ *
+ * USB-MIDI 1.0 function on usb_device.c.
+ *
+ * From the host, the OUT endpoint is armed on a packet's worth of free slots
+ * reserved in the receive queue, so the PCD driver copies each packet out of
+ * the PMA directly into place. Slots a short packet leaves empty are zeroed,
+ * which reads as the reserved CIN 0 and gets skipped, and keeps the queue in
+ * whole packets so a reservation never straddles the wrap. While the queue has
+ * no room for another packet the endpoint stays unarmed and NAKs, so the host
+ * is held off rather than anything being dropped.
+ *
+ * To the host, events are queued by the main loop and handed to the IN
+ * endpoint as they sit in the queue, up to a packet at a time; the driver
+ * copies them into the PMA and they are released when the packet has gone.
+ * A host that isn't reading only costs events for the host, never MIDI thru.
+ *
+ * What the host sent is sorted by cable into small queues, which are merge
+ * inputs like the MIDI ports' own, so it's routed, and sysex from it is kept
+ * whole, exactly as for any other input. A full cable queue holds up the
+ * sorting, and so in the end the host.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "usb_midi.h"
+#include "usb_device.h"
+#include "midi_time.h"
+
+static struct {
+	bool configured;
+	bool rx_armed;
+	bool rx_waiting;               // Receive queue was too full to arm the OUT endpoint
+	midi_event_t *rx_packet;       // Reservation the OUT endpoint is armed on
+	uint16_t tx_inflight;          // Events in the packet on the IN endpoint, 0 if idle
+	midi_event_queue_t rx_events;  // From the host, sorted by USB_MIDI_Process()
+	midi_event_queue_t cable_events[USB_MIDI_CABLES]; // From the host by cable, consumed by the merge
+	midi_event_queue_t tx_events;  // To the host, consumed by the IN endpoint
+	struct {
+		uint32_t rx_packets;
+		uint32_t rx_events;
+		uint32_t rx_nak_waits;     // Times the host was held off by a full receive queue
+		uint32_t rx_unrouted;      // Events for a cable with no port behind it
+		uint32_t tx_packets;
+		uint32_t tx_events;
+		uint32_t tx_drops;         // Events lost to a full send queue
+		midi_histogram_t to_host;  // Queued to handed to the IN endpoint, in microseconds
+	} stats;
+	midi_event_t rx_event_data[USB_MIDI_QUEUE_SIZE] __attribute__((aligned(4)));
+	uint32_t rx_event_times[USB_MIDI_QUEUE_SIZE];
+	midi_event_t cable_event_data[USB_MIDI_CABLES][USB_MIDI_CABLE_QUEUE_SIZE] __attribute__((aligned(4)));
+	uint32_t cable_event_times[USB_MIDI_CABLES][USB_MIDI_CABLE_QUEUE_SIZE];
+	midi_event_t tx_event_data[USB_MIDI_QUEUE_SIZE] __attribute__((aligned(4)));
+	uint32_t tx_event_times[USB_MIDI_QUEUE_SIZE];
+} usb_midi;
+
+void USB_MIDI_Init(void)
+{
+	uint8_t c;
+
+	memset(&usb_midi, 0, sizeof(usb_midi));
+	MIDI_Event_Queue_Init(&usb_midi.rx_events, usb_midi.rx_event_data, usb_midi.rx_event_times, USB_MIDI_QUEUE_SIZE);
+	for (c = 0; c < USB_MIDI_CABLES; c++) {
+		MIDI_Event_Queue_Init(&usb_midi.cable_events[c], usb_midi.cable_event_data[c],
+				usb_midi.cable_event_times[c], USB_MIDI_CABLE_QUEUE_SIZE);
+	}
+	MIDI_Event_Queue_Init(&usb_midi.tx_events, usb_midi.tx_event_data, usb_midi.tx_event_times, USB_MIDI_QUEUE_SIZE);
+	MIDI_Histogram_Reset(&usb_midi.stats.to_host);
+}
+
+#define USB_MIDI_PUT(p, ...) do { const uint8_t bytes_[] = { __VA_ARGS__ }; \
+	memcpy((p), bytes_, sizeof(bytes_)); (p) += sizeof(bytes_); } while (0)
+
+// Jacks of cable c: host to port through the IN pair, port to host through the OUT pair
+#define USB_MIDI_JACK_IN_EMBEDDED(c)  (1 + 4 * (c))
+#define USB_MIDI_JACK_IN_EXTERNAL(c)  (2 + 4 * (c))
+#define USB_MIDI_JACK_OUT_EMBEDDED(c) (3 + 4 * (c))
+#define USB_MIDI_JACK_OUT_EXTERNAL(c) (4 + 4 * (c))
+
+/*
+ * Write the function's interface descriptors into a configuration descriptor,
+ * numbering its interfaces from interface, and return their length. Audio
+ * control comes first, as class drivers expect, with nothing in it but the
+ * pointer to the MIDI streaming interface.
+ */
+uint16_t USB_MIDI_Descriptor(uint8_t *buffer, uint8_t interface)
+{
+	uint16_t ms_length = 7 + (USB_MIDI_CABLES * 30) + 2 * (9 + 4 + USB_MIDI_CABLES);
+	uint8_t *p = buffer;
+	uint8_t c;
+
+	USB_MIDI_PUT(p, 9, 0x04, interface, 0, 0, 0x01, 0x01, 0x00, 0); // Audio control
+	USB_MIDI_PUT(p, 9, 0x24, 0x01, 0x00, 0x01, 9, 0, 1, interface + 1);
+	USB_MIDI_PUT(p, 9, 0x04, interface + 1, 0, 2, 0x01, 0x03, 0x00, 0); // MIDI streaming
+	USB_MIDI_PUT(p, 7, 0x24, 0x01, 0x00, 0x01, ms_length & 0xFF, ms_length >> 8);
+	for (c = 0; c < USB_MIDI_CABLES; c++) {
+		USB_MIDI_PUT(p, 6, 0x24, 0x02, 0x01, USB_MIDI_JACK_IN_EMBEDDED(c), 0);
+		USB_MIDI_PUT(p, 6, 0x24, 0x02, 0x02, USB_MIDI_JACK_IN_EXTERNAL(c), 0);
+		USB_MIDI_PUT(p, 9, 0x24, 0x03, 0x01, USB_MIDI_JACK_OUT_EMBEDDED(c), 1, USB_MIDI_JACK_IN_EXTERNAL(c), 1, 0);
+		USB_MIDI_PUT(p, 9, 0x24, 0x03, 0x02, USB_MIDI_JACK_OUT_EXTERNAL(c), 1, USB_MIDI_JACK_IN_EMBEDDED(c), 1, 0);
+	}
+
+	USB_MIDI_PUT(p, 9, 0x05, USB_MIDI_EP_OUT, USB_DEVICE_EP_BULK, USB_MIDI_PACKET_SIZE, 0, 0, 0, 0);
+	USB_MIDI_PUT(p, 4 + USB_MIDI_CABLES, 0x25, 0x01, USB_MIDI_CABLES);
+	for (c = 0; c < USB_MIDI_CABLES; c++) {
+		*p++ = USB_MIDI_JACK_IN_EMBEDDED(c);
+	}
+	USB_MIDI_PUT(p, 9, 0x05, USB_MIDI_EP_IN, USB_DEVICE_EP_BULK, USB_MIDI_PACKET_SIZE, 0, 0, 0, 0);
+	USB_MIDI_PUT(p, 4 + USB_MIDI_CABLES, 0x25, 0x01, USB_MIDI_CABLES);
+	for (c = 0; c < USB_MIDI_CABLES; c++) {
+		*p++ = USB_MIDI_JACK_OUT_EMBEDDED(c);
+	}
+	return (uint16_t)(p - buffer);
+}
+
+// Arm the OUT endpoint on the next packet of free slots, if there is one
+static void usb_midi_rx_arm(void)
+{
+	midi_irq_state_t irq;
+	midi_event_t *packet;
+
+	irq = MIDI_Platform_Lock();
+	if (usb_midi.configured && !usb_midi.rx_armed) {
+		packet = MIDI_Event_Queue_Reserve(&usb_midi.rx_events, USB_MIDI_PACKET_EVENTS);
+		if (packet != NULL) {
+			usb_midi.rx_packet = packet;
+			usb_midi.rx_armed = true;
+			usb_midi.rx_waiting = false;
+			USB_Device_EP_Receive(USB_MIDI_EP_OUT, (uint8_t *)packet, USB_MIDI_PACKET_SIZE);
+		} else if (!usb_midi.rx_waiting) {
+			usb_midi.rx_waiting = true;
+			usb_midi.stats.rx_nak_waits++;
+		}
+	}
+	MIDI_Platform_Unlock(irq);
+}
+
+// Put the next run of queued events on the IN endpoint, if it's idle
+static void usb_midi_tx_start(void)
+{
+	const midi_event_t *events;
+	midi_irq_state_t irq;
+	midi_event_t first;
+	uint32_t queued;
+	uint16_t count;
+
+	irq = MIDI_Platform_Lock();
+	if (usb_midi.configured && (usb_midi.tx_inflight == 0)
+			&& MIDI_Event_Queue_Peek(&usb_midi.tx_events, &first, &queued)) {
+		events = MIDI_Event_Queue_Contiguous(&usb_midi.tx_events, &count);
+		if (count > USB_MIDI_PACKET_EVENTS) {
+			count = USB_MIDI_PACKET_EVENTS;
+		}
+		usb_midi.tx_inflight = count;
+		MIDI_Histogram_Add(&usb_midi.stats.to_host, MIDI_Time_Diff(MIDI_Time_Now(), queued));
+		USB_Device_EP_Transmit(USB_MIDI_EP_IN, (const uint8_t *)events, count * sizeof(midi_event_t));
+	}
+	MIDI_Platform_Unlock(irq);
+}
+
+/*
+ * Set configuration, or reset: the endpoints are opened or closed and both
+ * directions start over. Whatever was waiting for the host is stale by then,
+ * while what the host already sent is still played out.
+ */
+void USB_MIDI_Configure(bool configured)
+{
+	if (usb_midi.tx_inflight != 0) {
+		MIDI_Event_Queue_Drop(&usb_midi.tx_events, usb_midi.tx_inflight);
+		usb_midi.tx_inflight = 0;
+	}
+	usb_midi.rx_armed = false;
+	usb_midi.rx_waiting = false;
+	usb_midi.configured = configured;
+
+	if (configured) {
+		USB_Device_EP_Open(USB_MIDI_EP_OUT, USB_MIDI_PACKET_SIZE, USB_DEVICE_EP_BULK);
+		USB_Device_EP_Open(USB_MIDI_EP_IN, USB_MIDI_PACKET_SIZE, USB_DEVICE_EP_BULK);
+		MIDI_Event_Queue_Flush(&usb_midi.tx_events);
+		usb_midi_rx_arm();
+	} else {
+		USB_Device_EP_Close(USB_MIDI_EP_OUT);
+		USB_Device_EP_Close(USB_MIDI_EP_IN);
+	}
+}
+
+// A packet from the host has landed in its reservation
+void USB_MIDI_Data_Out(void)
+{
+	uint16_t count = USB_Device_EP_Rx_Count(USB_MIDI_EP_OUT) / sizeof(midi_event_t);
+
+	if (!usb_midi.rx_armed) {
+		return;
+	}
+	if (count > USB_MIDI_PACKET_EVENTS) {
+		count = USB_MIDI_PACKET_EVENTS;
+	}
+	memset(&usb_midi.rx_packet[count], 0, (USB_MIDI_PACKET_EVENTS - count) * sizeof(midi_event_t));
+	MIDI_Event_Queue_Commit(&usb_midi.rx_events, USB_MIDI_PACKET_EVENTS, MIDI_Time_Now());
+	usb_midi.stats.rx_packets++;
+	usb_midi.stats.rx_events += count;
+
+	usb_midi.rx_armed = false;
+	usb_midi_rx_arm();
+}
+
+// The packet on the IN endpoint has gone to the host
+void USB_MIDI_Data_In(void)
+{
+	MIDI_Event_Queue_Drop(&usb_midi.tx_events, usb_midi.tx_inflight);
+	usb_midi.stats.tx_packets++;
+	usb_midi.stats.tx_events += usb_midi.tx_inflight;
+	usb_midi.tx_inflight = 0;
+	usb_midi_tx_start();
+}
+
+/*
+ * Queue an event for the host, on the cable in its header. Main loop only.
+ * Returns MIDI_NOT_READY when the host hasn't configured the device, and
+ * MIDI_TX_OVERFLOW when the event was dropped because the host isn't keeping
+ * up.
+ */
+MIDI_error_t USB_MIDI_Send_Event(const midi_event_t *event, uint32_t timestamp)
+{
+	if (!usb_midi.configured || (midi_event_cable(event) >= USB_MIDI_CABLES)) {
+		return MIDI_NOT_READY;
+	}
+	if (!MIDI_Event_Queue_Push(&usb_midi.tx_events, event, timestamp)) {
+		usb_midi.stats.tx_drops++;
+		return MIDI_TX_OVERFLOW;
+	}
+	usb_midi_tx_start();
+	return MIDI_OK;
+}
+
+/*
+ * Sort what the host sent into the cable queues, in order. A cable queue that
+ * is full holds up the rest until the merge takes from it, and the host with
+ * it once the receive queue fills.
+ */
+void USB_MIDI_Process(void)
+{
+	midi_event_queue_t *queue;
+	midi_event_t event;
+	uint32_t timestamp;
+	uint8_t cable;
+
+	while (MIDI_Event_Queue_Peek(&usb_midi.rx_events, &event, &timestamp)) {
+		if (midi_event_cin(&event) > MIDI_CIN_CABLE) {
+			cable = midi_event_cable(&event);
+			if (cable >= USB_MIDI_CABLES) {
+				usb_midi.stats.rx_unrouted++;
+			} else {
+				queue = &usb_midi.cable_events[cable];
+				if (MIDI_Event_Queue_Length(queue) >= USB_MIDI_CABLE_QUEUE_SIZE) {
+					break;
+				}
+				MIDI_Event_Queue_Push(queue, &event, timestamp);
+			}
+		}
+		MIDI_Event_Queue_Drop(&usb_midi.rx_events, 1);
+	}
+	if (usb_midi.rx_waiting) {
+		usb_midi_rx_arm();
+	}
+}
+
+// Events from the host on a cable, for adding to a merge
+midi_event_queue_t *USB_MIDI_Cable_Queue(uint8_t cable)
+{
+	return (cable < USB_MIDI_CABLES) ? &usb_midi.cable_events[cable] : NULL;
+}
+
+void USB_MIDI_Print_Stats(void)
+{
+	printf("usb midi: %s, cables %d\r\n", usb_midi.configured ? "configured" : "not configured", USB_MIDI_CABLES);
+	printf("from host: packets %lu, events %lu, queued %u, nak waits %lu, unrouted %lu\r\n",
+			(unsigned long)usb_midi.stats.rx_packets, (unsigned long)usb_midi.stats.rx_events,
+			MIDI_Event_Queue_Length(&usb_midi.rx_events),
+			(unsigned long)usb_midi.stats.rx_nak_waits, (unsigned long)usb_midi.stats.rx_unrouted);
+	printf("to host: packets %lu, events %lu, queued %u, drops %lu\r\n",
+			(unsigned long)usb_midi.stats.tx_packets, (unsigned long)usb_midi.stats.tx_events,
+			MIDI_Event_Queue_Length(&usb_midi.tx_events), (unsigned long)usb_midi.stats.tx_drops);
+	MIDI_Histogram_Print("to host", &usb_midi.stats.to_host);
+}
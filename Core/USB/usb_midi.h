@@ -0,0 +1,41 @@
+/*
+ * usb_midi.h
+ *
+ * USB-MIDI 1.0 function: a pair of bulk endpoints carrying one virtual cable
+ * per MIDI port. What comes in on port n is sent to the host on cable n. What
+ * the host sends is sorted into a queue per cable, for the application to
+ * merge with the MIDI inputs and route, by default cable n out of port n.
+ *
+ * USB-MIDI event packets are laid out exactly like midi_event_t, so packets
+ * are read out of the PMA straight into an event queue, and sent to the host
+ * straight out of one, without any byte buffering in between.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef USB_MIDI_H
+#define USB_MIDI_H
+
+#include "midi.h"
+
+#define USB_MIDI_CABLES MIDI_MAX_PORTS // One per MIDI port; those past the ports set up in main.c carry nothing
+#define USB_MIDI_INTERFACES 2 // Audio control, then MIDI streaming
+#define USB_MIDI_EP_OUT 0x01
+#define USB_MIDI_EP_IN 0x81
+#define USB_MIDI_PACKET_SIZE 64
+#define USB_MIDI_PACKET_EVENTS (USB_MIDI_PACKET_SIZE / sizeof(midi_event_t))
+#define USB_MIDI_QUEUE_SIZE 256 // Events each way, power of 2 and a whole number of packets
+#define USB_MIDI_CABLE_QUEUE_SIZE 64 // Events from the host per cable, power of 2
+
+void USB_MIDI_Init(void);
+uint16_t USB_MIDI_Descriptor(uint8_t *buffer, uint8_t interface);
+void USB_MIDI_Configure(bool configured);
+void USB_MIDI_Data_Out(void);
+void USB_MIDI_Data_In(void);
+
+MIDI_error_t USB_MIDI_Send_Event(const midi_event_t *event, uint32_t timestamp);
+void USB_MIDI_Process(void);
+midi_event_queue_t *USB_MIDI_Cable_Queue(uint8_t cable);
+void USB_MIDI_Print_Stats(void);
+
+#endif // USB_MIDI_H
@@ -23,5 +23,6 @@ Core/Display \
 Core/MIDI \
 Core/Src \
 Core/Startup \
+Core/USB \
 Drivers/STM32F3xx_HAL_Driver/Src \
 
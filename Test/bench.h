@@ -0,0 +1,40 @@
+/*
+ * bench.h
+ *
+ * Timing for the host benchmarks. On x86 the count is the time stamp counter,
+ * which runs at the nominal clock whatever the core is doing, so "cycles" are
+ * reference cycles; elsewhere it's nanoseconds. Take the best of a few runs.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycle"
+
+static inline uint64_t bench_now(void) {
+	return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+
+static inline uint64_t bench_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#define BENCH_RUNS 7
+
+// Keeps results alive so the compiler can't drop the work that made them
+static volatile uint32_t bench_sink;
+
+#endif // BENCH_H
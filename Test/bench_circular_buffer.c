@@ -0,0 +1,250 @@
+/*
+ * bench_circular_buffer.c
+ *
+ * Ring throughput at MIDI ring size, by the ways the firmware moves bytes:
+ * one at a time (how the application used to shuttle RX to TX), three byte
+ * messages, 64 byte blocks with two-segment copies, and zero-copy acquire
+ * and commit. Then a producer and consumer on two threads, in MB/s.
+ *
+ * The ring this replaced is copied in below for a baseline. Its write and
+ * read mask the position with size - len, which is only right for len 1, and
+ * it copies without splitting at the end, so it's only run one byte at a time.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "circular_buffer.h"
+
+#define RING_SIZE 1024
+#define TOTAL_BYTES (16u << 20)
+#define THREAD_BYTES (64u << 20)
+
+static circular_buffer_t cb;
+static uint8_t ring[RING_SIZE];
+static uint8_t block[64];
+
+typedef uint32_t (*pass_t)(void);
+
+// The baseline ring, as it was, on the same structure with positions kept masked.
+// Kept out of line and unspecialised so it's called like the library's.
+
+#if defined(__clang__)
+#define BASELINE_CALL __attribute__((noinline))
+#else
+#define BASELINE_CALL __attribute__((noipa))
+#endif
+
+static eCircularBufferError baseline_is_valid(circular_buffer_t *cb) {
+	if ((cb->data == NULL) || (cb->size == 0) || (cb->size & 0x01)) {
+		return eCircularBufferNotValid;
+	}
+	return eCircularBufferOk;
+}
+
+static BASELINE_CALL eCircularBufferError baseline_get_length(circular_buffer_t *cb, uint16_t *length) {
+	if ((baseline_is_valid(cb) == eCircularBufferOk) && (length != NULL)) {
+		*length = (cb->write_pos - cb->read_pos) & (cb->size - 1);
+		return eCircularBufferOk;
+	}
+	return eCircularBufferNotValid;
+}
+
+static BASELINE_CALL eCircularBufferError baseline_write_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t len) {
+	uint16_t curr_length = 0;
+	eCircularBufferError status;
+
+	status = baseline_get_length(cb, &curr_length);
+	if (status == eCircularBufferOk) {
+		if (curr_length == (cb->size - len)) {
+			return eCircularBufferFull;
+		}
+		memcpy(&cb->data[cb->write_pos], data, len);
+		cb->write_pos = (cb->write_pos + len) & (cb->size - len);
+		return eCircularBufferOk;
+	} else {
+		return status;
+	}
+}
+
+static BASELINE_CALL eCircularBufferError baseline_read_bytes(circular_buffer_t *cb, uint8_t *data, uint16_t *read_len) {
+	uint16_t curr_length = 0;
+	eCircularBufferError status;
+
+	status = baseline_get_length(cb, &curr_length);
+	if (status == eCircularBufferOk) {
+		if (curr_length == 0) {
+			return eCircularBufferEmpty;
+		}
+		if (curr_length < *read_len) {
+			*read_len = curr_length;
+		}
+		memcpy(data, &cb->data[cb->read_pos], *read_len);
+		cb->read_pos = (cb->read_pos + *read_len) & (cb->size - *read_len);
+		return eCircularBufferOk;
+	} else {
+		return status;
+	}
+}
+
+// Each pass writes a batch into the ring and reads it back out, returning the bytes moved
+
+static uint32_t pass_bytes(void)
+{
+	uint16_t len;
+	uint16_t i;
+
+	for (i = 0; i < 64; i++) {
+		circularBuffer_write_bytes(&cb, &block[i], 1);
+	}
+	for (i = 0; i < 64; i++) {
+		len = 1;
+		circularBuffer_read_bytes(&cb, &block[i], &len);
+	}
+	return 64;
+}
+
+static uint32_t pass_baseline_bytes(void)
+{
+	uint16_t len;
+	uint16_t i;
+
+	for (i = 0; i < 64; i++) {
+		baseline_write_bytes(&cb, &block[i], 1);
+	}
+	for (i = 0; i < 64; i++) {
+		len = 1;
+		baseline_read_bytes(&cb, &block[i], &len);
+	}
+	return 64;
+}
+
+static uint32_t pass_messages(void)
+{
+	uint16_t len;
+	uint16_t i;
+
+	for (i = 0; i < 63; i += 3) {
+		circularBuffer_write_bytes(&cb, &block[i], 3);
+	}
+	for (i = 0; i < 63; i += 3) {
+		len = 3;
+		circularBuffer_read_bytes(&cb, &block[i], &len);
+	}
+	return 63;
+}
+
+static uint32_t pass_blocks(void)
+{
+	uint16_t len = sizeof(block);
+
+	circularBuffer_write_bytes(&cb, block, sizeof(block) - 1); // So the copies land across the end
+	circularBuffer_read_bytes(&cb, block, &len);
+	return sizeof(block) - 1;
+}
+
+static uint32_t pass_zero_copy(void)
+{
+	uint8_t *region;
+	uint16_t len;
+	uint16_t moved = 0;
+	uint16_t i;
+
+	while (moved < sizeof(block) - 1) {
+		circularBuffer_acquire_write(&cb, &region, &len);
+		len = (len < sizeof(block) - 1 - moved) ? len : sizeof(block) - 1 - moved;
+		for (i = 0; i < len; i++) {
+			region[i] = i;
+		}
+		circularBuffer_commit_write(&cb, len);
+		moved += len;
+	}
+	while (circularBuffer_acquire_read(&cb, &region, &len) == eCircularBufferOk) {
+		bench_sink += region[len - 1];
+		circularBuffer_commit_read(&cb, len);
+	}
+	return moved;
+}
+
+static void run(const char *name, pass_t pass)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t elapsed;
+	uint32_t moved = 0;
+	int r;
+
+	for (r = 0; r < BENCH_RUNS; r++) {
+		circularBuffer_init(&cb, ring, RING_SIZE);
+		moved = 0;
+		start = bench_now();
+		while (moved < TOTAL_BYTES) {
+			moved += pass();
+		}
+		elapsed = bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	printf("%-12s %7.3f bytes/%s  %7.2f %ss/byte\n", name, (double)moved / best, BENCH_UNIT,
+			(double)best / moved, BENCH_UNIT);
+}
+
+static void *producer(void *arg)
+{
+	uint32_t sent = 0;
+
+	(void)arg;
+	while (sent < THREAD_BYTES) {
+		if (circularBuffer_write_bytes(&cb, block, sizeof(block)) == eCircularBufferOk) {
+			sent += sizeof(block);
+		} else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+// Blocks in on one thread, zero-copy out on the other
+static void run_threads(void)
+{
+	struct timespec start;
+	struct timespec end;
+	pthread_t thread;
+	uint32_t got = 0;
+	uint8_t *region;
+	uint16_t len;
+	double seconds;
+
+	circularBuffer_init(&cb, ring, RING_SIZE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&thread, NULL, producer, NULL);
+	while (got < THREAD_BYTES) {
+		if (circularBuffer_acquire_read(&cb, &region, &len) != eCircularBufferOk) {
+			sched_yield();
+			continue;
+		}
+		bench_sink += region[0];
+		circularBuffer_commit_read(&cb, len);
+		got += len;
+	}
+	pthread_join(thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%-12s %7.1f MB/s\n", "two threads", got / seconds / 1e6);
+}
+
+int main(void)
+{
+	run("bytes", pass_bytes);
+	run("bytes (old)", pass_baseline_bytes);
+	run("messages", pass_messages);
+	run("blocks", pass_blocks);
+	run("zero copy", pass_zero_copy);
+	run_threads();
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * bench_midi_parser.c
+ *
+ * Parser throughput in bytes per cycle, on a few kinds of traffic: dense
+ * notes, notes under running status with clock between them, long sysex,
+ * and a mix of everything.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "midi_parser.h"
+
+#define STREAM_SIZE (1 << 20)
+
+static uint8_t stream[STREAM_SIZE];
+
+typedef uint32_t (*fill_t)(uint8_t *bytes, uint32_t n);
+
+static uint32_t fill_notes(uint8_t *bytes, uint32_t n)
+{
+	bytes[0] = 0x90 | (n & 0x0F);
+	bytes[1] = n & 0x7F;
+	bytes[2] = (n & 1) ? 100 : 0;
+	return 3;
+}
+
+static uint32_t fill_running(uint8_t *bytes, uint32_t n)
+{
+	if (n == 0) {
+		bytes[0] = 0x90;
+		return 1;
+	}
+	if ((n % 8) == 0) {
+		bytes[0] = 0xF8;
+		return 1;
+	}
+	bytes[0] = n & 0x7F;
+	bytes[1] = (n & 1) ? 100 : 0;
+	return 2;
+}
+
+static uint32_t fill_sysex(uint8_t *bytes, uint32_t n)
+{
+	uint32_t i;
+
+	bytes[0] = 0xF0;
+	for (i = 1; i < 255; i++) {
+		bytes[i] = (n + i) & 0x7F;
+	}
+	bytes[255] = 0xF7;
+	return 256;
+}
+
+static uint32_t fill_mixed(uint8_t *bytes, uint32_t n)
+{
+	switch (rand() % 10) {
+	case 0:
+		bytes[0] = 0xF8;
+		return 1;
+	case 1:
+		bytes[0] = 0xB0 | (n & 0x0F);
+		bytes[1] = 1;
+		bytes[2] = n & 0x7F;
+		return 3;
+	case 2:
+		bytes[0] = 0xF0;
+		bytes[1] = 0x7E;
+		bytes[2] = n & 0x7F;
+		bytes[3] = 0xF7;
+		return 4;
+	case 3:
+		bytes[0] = n & 0x7F;
+		bytes[1] = 64;
+		return 2; // Running status on whatever came before
+	default:
+		return fill_notes(bytes, n);
+	}
+}
+
+static void fill(fill_t generator)
+{
+	uint32_t len = 0;
+	uint32_t n = 0;
+
+	while (len < STREAM_SIZE - 256) {
+		len += generator(&stream[len], n++);
+	}
+	while (len < STREAM_SIZE) {
+		stream[len++] = 0xFE;
+	}
+}
+
+static void run(const char *name, fill_t generator)
+{
+	midi_parser_t parser;
+	midi_event_t events[MIDI_PARSER_MAX_EVENTS];
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t elapsed;
+	uint32_t produced = 0;
+	uint32_t i;
+	int r;
+
+	srand(1);
+	fill(generator);
+	for (r = 0; r < BENCH_RUNS; r++) {
+		MIDI_Parser_Init(&parser, 0);
+		produced = 0;
+		start = bench_now();
+		for (i = 0; i < STREAM_SIZE; i++) {
+			produced += MIDI_Parser_Feed(&parser, stream[i], events);
+			bench_sink = events[0].bytes[0];
+		}
+		elapsed = bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	printf("%-10s %8u events  %6.3f bytes/%s  %6.2f %ss/byte\n", name, produced,
+			(double)STREAM_SIZE / best, BENCH_UNIT, (double)best / STREAM_SIZE, BENCH_UNIT);
+}
+
+int main(void)
+{
+	run("notes", fill_notes);
+	run("running", fill_running);
+	run("sysex", fill_sysex);
+	run("mixed", fill_mixed);
+	return 0;
+}
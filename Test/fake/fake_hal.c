@@ -0,0 +1,91 @@
+/*
+ * fake_hal.c
+ *
+ * The HAL's GPIO, SPI, I2S and tick calls on the host. Transfers are blocking
+ * on the target too, so here they're logged and over at once; the tick and
+ * HAL_Delay() run on the fake TIM2's time.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "fake_platform.h"
+#include "midi_time.h"
+
+GPIO_TypeDef Fake_GPIO[6];
+
+// Handles main.c has for the display and audio code
+SPI_HandleTypeDef hspi1;
+I2S_HandleTypeDef hi2s3;
+
+void Fake_SPI_Init(SPI_HandleTypeDef *spi, GPIO_TypeDef *pins)
+{
+	memset(spi, 0, sizeof(*spi));
+	spi->pins = pins;
+}
+
+void Fake_I2S_Init(I2S_HandleTypeDef *i2s)
+{
+	memset(i2s, 0, sizeof(*i2s));
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if (PinState != GPIO_PIN_RESET) {
+		GPIOx->ODR |= GPIO_Pin;
+	} else {
+		GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+	}
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint32_t now = MIDI_Time_Now();
+	uint16_t i;
+
+	(void)Timeout;
+	if ((pData == NULL) || (Size == 0)) {
+		return HAL_ERROR;
+	}
+	for (i = 0; i < Size; i++, hspi->wire_len++) {
+		if (hspi->wire_len < FAKE_SPI_WIRE_SIZE) {
+			hspi->wire[hspi->wire_len] = pData[i];
+			hspi->wire_pins[hspi->wire_len] = (hspi->pins != NULL) ? hspi->pins->ODR : 0;
+			hspi->wire_times[hspi->wire_len] = now;
+		}
+	}
+	hspi->transfers++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_Transmit(I2S_HandleTypeDef *hi2s, uint16_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint16_t i;
+
+	(void)Timeout;
+	if ((pData == NULL) || (Size == 0)) {
+		return HAL_ERROR;
+	}
+	for (i = 0; i < Size; i++, hi2s->wire_len++) {
+		if (hi2s->wire_len < FAKE_I2S_WIRE_SIZE) {
+			hi2s->wire[hi2s->wire_len] = pData[i];
+		}
+	}
+	hi2s->transfers++;
+	return HAL_OK;
+}
+
+// SysTick counts milliseconds
+uint32_t HAL_GetTick(void)
+{
+	return MIDI_Time_Now() / 1000;
+}
+
+// As the HAL's, which waits at least one whole tick more than asked
+void HAL_Delay(uint32_t Delay)
+{
+	if (Delay < HAL_MAX_DELAY) {
+		Delay++;
+	}
+	Fake_Time_Advance(Delay * 1000);
+}
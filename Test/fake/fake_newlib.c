@@ -0,0 +1,37 @@
+/*
+ * fake_newlib.c
+ *
+ * newlib's __itoa, which glibc doesn't have, see fake_newlib.h.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stddef.h>
+#include "fake_newlib.h"
+
+// Bases 2 to 36, with a minus sign only in base 10, as newlib does
+char *__itoa(int value, char *str, int base)
+{
+	unsigned int magnitude = (unsigned int)value;
+	char digits[33];
+	int len = 0;
+	int i = 0;
+
+	if ((base < 2) || (base > 36)) {
+		str[0] = '\0';
+		return NULL;
+	}
+	if ((base == 10) && (value < 0)) {
+		magnitude = 0u - magnitude;
+		str[i++] = '-';
+	}
+	do {
+		digits[len++] = "0123456789abcdefghijklmnopqrstuvwxyz"[magnitude % base];
+		magnitude /= base;
+	} while (magnitude != 0);
+	while (len > 0) {
+		str[i++] = digits[--len];
+	}
+	str[i] = '\0';
+	return str;
+}
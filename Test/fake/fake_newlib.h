@@ -0,0 +1,16 @@
+/*
+ * fake_newlib.h
+ *
+ * The newlib extras the firmware uses that glibc doesn't have, for the host
+ * build. Forced into the sources that use them, in place of newlib's
+ * stdlib.h declarations.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef FAKE_NEWLIB_H
+#define FAKE_NEWLIB_H
+
+char *__itoa(int value, char *str, int base);
+
+#endif // FAKE_NEWLIB_H
@@ -0,0 +1,412 @@
+/*
+ * fake_platform.c
+ *
+ * The MIDI platform on the host: a TIM2 that only counts when told to, its
+ * compare alarms, and UARTs whose DMA channels move a byte per MIDI byte time.
+ * Interrupts are delivered in time order, through the HAL's UART callbacks,
+ * which by default do what main.c's do for a MIDI port. TIM2 outranks the
+ * UARTs as on the board: alarms raised by software run as soon as nothing
+ * masks them, in the middle of a UART callback too.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "fake_platform.h"
+#include "midi_clock.h"
+#include "midi_scheduler.h"
+#include "midi_time.h"
+
+typedef struct {
+	bool armed;    // Compare interrupt enabled
+	bool matched;  // Already went off for this setting
+	bool fired;    // Raised by software, runs as soon as interrupts allow
+	uint32_t when;
+	uint32_t set_at; // A compare value already gone by only matches after the timer wraps
+	uint32_t interrupts;
+} fake_alarm_t;
+
+static uint32_t fake_now;
+static bool fake_locked;
+static bool fake_in_timer;
+static fake_latency_t fake_latency;
+static fake_alarm_t fake_alarms[FAKE_ALARMS];
+static UART_HandleTypeDef *fake_uarts[MIDI_PLATFORM_UARTS];
+
+/*
+ * How long from now until when, counting from since, or zero if a handler
+ * running late has carried time past it.
+ */
+static uint32_t fake_until(uint32_t when, uint32_t since)
+{
+	return (when - since > fake_now - since) ? when - fake_now : 0;
+}
+
+static void fake_alarm_irq(uint8_t channel)
+{
+	bool in_timer = fake_in_timer;
+
+	fake_in_timer = true;
+	fake_alarms[channel].interrupts++;
+	if (channel == MIDI_TIME_ALARM_SCHEDULER) {
+		MIDI_Scheduler_Timer_IRQ();
+	} else if (channel == MIDI_TIME_ALARM_CLOCK) {
+		MIDI_Clock_Timer_IRQ();
+	}
+	fake_in_timer = in_timer;
+}
+
+// Alarms raised by software, once nothing is masking them
+static void fake_run_fired(void)
+{
+	uint8_t channel;
+	bool again = true;
+
+	while (again && !fake_locked && !fake_in_timer) {
+		again = false;
+		for (channel = 0; channel < FAKE_ALARMS; channel++) {
+			if (fake_alarms[channel].fired) {
+				fake_alarms[channel].fired = false;
+				fake_alarm_irq(channel);
+				again = true;
+			}
+		}
+	}
+}
+
+// The byte on the wire is out: log it and hand over the next, or finish the transfer
+static void fake_uart_shifted(UART_HandleTypeDef *uart)
+{
+	if (uart->wire_len < FAKE_UART_WIRE_SIZE) {
+		uart->wire[uart->wire_len] = uart->tx_shift;
+		uart->wire_times[uart->wire_len] = fake_now;
+	}
+	uart->wire_len++;
+	uart->tx_shifting = false;
+
+	if (uart->tx_remaining > 0) {
+		uart->tx_shift = *uart->tx_data++;
+		uart->tx_remaining--;
+		uart->tx_shifting = true;
+		uart->tx_shift_done = fake_now + MIDI_BYTE_TIME_US;
+	} else if (uart->tx_busy) {
+		uart->tx_busy = false;
+		uart->gState = HAL_UART_STATE_READY;
+		HAL_UART_TxCpltCallback(uart);
+	}
+}
+
+void Fake_Platform_Reset(void)
+{
+	fake_now = 0;
+	fake_locked = false;
+	fake_in_timer = false;
+	fake_latency = NULL;
+	memset(fake_alarms, 0, sizeof(fake_alarms));
+}
+
+void Fake_Time_Set(uint32_t now)
+{
+	fake_now = now;
+}
+
+/*
+ * Move time forward, going through every alarm match and UART byte on the way
+ * in order. An alarm's handler runs its latency after the match, and time
+ * stands at that while it does.
+ */
+void Fake_Time_Advance(uint32_t us)
+{
+	uint32_t start = fake_now;
+	uint32_t end = fake_now + us;
+	uint32_t soonest;
+	uint32_t distance;
+	int8_t alarm;
+	UART_HandleTypeDef *uart;
+	uint8_t i;
+
+	for (;;) {
+		fake_run_fired();
+
+		soonest = fake_until(end, start);
+		alarm = -1;
+		uart = NULL;
+		for (i = 0; i < FAKE_ALARMS; i++) {
+			distance = fake_until(fake_alarms[i].when, fake_alarms[i].set_at);
+			if (fake_alarms[i].armed && !fake_alarms[i].matched && (distance <= soonest)) {
+				soonest = distance;
+				alarm = i;
+			}
+		}
+		for (i = 0; i < MIDI_PLATFORM_UARTS; i++) {
+			distance = (fake_uarts[i] != NULL) ? fake_until(fake_uarts[i]->tx_shift_done, start) : 0;
+			if ((fake_uarts[i] != NULL) && fake_uarts[i]->tx_shifting && (distance <= soonest)) {
+				soonest = distance;
+				alarm = -1;
+				uart = fake_uarts[i];
+			}
+		}
+
+		if (uart != NULL) {
+			fake_now += soonest;
+			fake_uart_shifted(uart);
+		} else if (alarm >= 0) {
+			fake_now += soonest;
+			fake_alarms[alarm].matched = true;
+			if (fake_latency != NULL) {
+				fake_now += fake_latency();
+			}
+			fake_alarm_irq(alarm);
+		} else {
+			break;
+		}
+	}
+	if (MIDI_Time_Diff(end, fake_now) > 0) {
+		fake_now = end;
+	}
+}
+
+void Fake_Set_Latency(fake_latency_t latency)
+{
+	fake_latency = latency;
+}
+
+bool Fake_Alarm_Armed(uint8_t channel)
+{
+	return fake_alarms[channel].armed && !fake_alarms[channel].matched;
+}
+
+uint32_t Fake_Alarm_Time(uint8_t channel)
+{
+	return fake_alarms[channel].when;
+}
+
+uint32_t Fake_Alarm_Interrupts(uint8_t channel)
+{
+	return fake_alarms[channel].interrupts;
+}
+
+bool Fake_Is_Locked(void)
+{
+	return fake_locked;
+}
+
+void Fake_UART_Init(UART_HandleTypeDef *uart, uint8_t index)
+{
+	memset(uart, 0, sizeof(*uart));
+	uart->index = index;
+	uart->gState = HAL_UART_STATE_READY;
+	uart->RxState = HAL_UART_STATE_READY;
+	uart->hdmarx = &uart->rx_dma;
+	uart->rx_dma.Parent = uart;
+	fake_uarts[index] = uart;
+}
+
+/*
+ * Bytes arriving on a UART, a byte time apart. The receive DMA stores each
+ * and raises its half and full transfer interrupts as it passes them; with
+ * reception stopped they're lost, as overruns would be.
+ */
+void Fake_UART_Rx(UART_HandleTypeDef *uart, const uint8_t *bytes, uint16_t len)
+{
+	uint16_t i;
+	bool half;
+	bool full;
+
+	for (i = 0; i < len; i++) {
+		Fake_Time_Advance(MIDI_BYTE_TIME_US);
+		if (uart->RxState != HAL_UART_STATE_BUSY_RX) {
+			continue;
+		}
+		uart->rx_buffer[uart->rx_size - uart->rx_remaining] = bytes[i];
+		uart->rx_remaining--;
+		half = (uart->rx_remaining == uart->rx_size / 2);
+		full = (uart->rx_remaining == 0);
+		if (full) {
+			uart->rx_remaining = uart->rx_size;
+		}
+		if (half || full) {
+			if (half) {
+				HAL_UART_RxHalfCpltCallback(uart);
+			} else {
+				HAL_UART_RxCpltCallback(uart);
+			}
+		}
+	}
+}
+
+// The line has gone a byte time without a start bit
+void Fake_UART_Rx_Idle(UART_HandleTypeDef *uart)
+{
+	Fake_Time_Advance(MIDI_BYTE_TIME_US);
+	if ((uart->RxState == HAL_UART_STATE_BUSY_RX) && (uart->interrupts & UART_IT_IDLE)) {
+		Fake_UART_Idle_Callback(uart);
+	}
+}
+
+// A framing or noise error, which in DMA mode stops reception
+void Fake_UART_Rx_Error(UART_HandleTypeDef *uart)
+{
+	uart->RxState = HAL_UART_STATE_READY;
+	HAL_UART_ErrorCallback(uart);
+}
+
+/*
+ * What main.c's callbacks, and stm32f3xx_it.c for an idle line, do for a MIDI
+ * port. A test with another UART on the fake, such as the console's, has its
+ * own, as main.c does.
+ */
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	MIDI_UART_Transmit_End(huart);
+}
+
+__attribute__((weak)) void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+	MIDI_UART_Receive(huart, false);
+}
+
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	MIDI_UART_Receive(huart, false);
+}
+
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	MIDI_UART_Error(huart);
+}
+
+__attribute__((weak)) void Fake_UART_Idle_Callback(UART_HandleTypeDef *huart)
+{
+	MIDI_UART_Receive(huart, true);
+}
+
+// The receive DMA runs circular until an error stops it
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if (huart->rx_start_status != HAL_OK) {
+		return huart->rx_start_status;
+	}
+	if (huart->RxState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	huart->rx_buffer = pData;
+	huart->rx_size = Size;
+	huart->rx_remaining = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+/*
+ * The DMA hands the UART a byte as soon as its data register is free: the
+ * first right away, or when the byte still going out from before an abort
+ * finishes.
+ */
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if (huart->tx_start_status != HAL_OK) {
+		return huart->tx_start_status;
+	}
+	if (huart->tx_busy || (Size == 0)) {
+		return huart->tx_busy ? HAL_BUSY : HAL_ERROR;
+	}
+	huart->tx_starts++;
+	huart->tx_busy = true;
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	huart->tx_data = pData;
+	huart->tx_remaining = Size;
+	if (!huart->tx_shifting) {
+		huart->tx_shift = *huart->tx_data++;
+		huart->tx_remaining--;
+		huart->tx_shifting = true;
+		huart->tx_shift_done = fake_now + MIDI_BYTE_TIME_US;
+	}
+	return HAL_OK;
+}
+
+midi_irq_state_t MIDI_Platform_Lock(void)
+{
+	midi_irq_state_t state = fake_locked;
+
+	fake_locked = true;
+	return state;
+}
+
+void MIDI_Platform_Unlock(midi_irq_state_t state)
+{
+	fake_locked = (state != 0);
+	fake_run_fired();
+}
+
+uint32_t MIDI_Platform_Timer_Now(void)
+{
+	return fake_now;
+}
+
+void MIDI_Platform_Alarm_Set(uint8_t channel, uint32_t when)
+{
+	fake_alarms[channel].when = when;
+	fake_alarms[channel].set_at = fake_now;
+	fake_alarms[channel].armed = true;
+	fake_alarms[channel].matched = false;
+}
+
+void MIDI_Platform_Alarm_Fire(uint8_t channel)
+{
+	fake_alarms[channel].armed = true;
+	fake_alarms[channel].fired = true;
+}
+
+void MIDI_Platform_Alarm_Stop(uint8_t channel)
+{
+	fake_alarms[channel].armed = false;
+	fake_alarms[channel].fired = false;
+}
+
+uint8_t MIDI_Platform_UART_Index(const UART_HandleTypeDef *uart)
+{
+	return (fake_uarts[uart->index] == uart) ? uart->index : MIDI_PLATFORM_UARTS;
+}
+
+// As on the target, over the HAL calls
+HAL_StatusTypeDef MIDI_Platform_UART_Receive(UART_HandleTypeDef *uart, uint8_t *buffer, uint16_t length)
+{
+	HAL_StatusTypeDef status = HAL_UART_Receive_DMA(uart, buffer, length);
+
+	if (status == HAL_OK) {
+		__HAL_UART_CLEAR_IDLEFLAG(uart);
+		__HAL_UART_ENABLE_IT(uart, UART_IT_IDLE);
+	}
+	return status;
+}
+
+uint16_t MIDI_Platform_UART_Rx_Remaining(UART_HandleTypeDef *uart)
+{
+	return __HAL_DMA_GET_COUNTER(uart->hdmarx);
+}
+
+bool MIDI_Platform_UART_Rx_Running(UART_HandleTypeDef *uart)
+{
+	return uart->RxState == HAL_UART_STATE_BUSY_RX;
+}
+
+HAL_StatusTypeDef MIDI_Platform_UART_Transmit(UART_HandleTypeDef *uart, const uint8_t *data, uint16_t length)
+{
+	return HAL_UART_Transmit_DMA(uart, (uint8_t *)data, length);
+}
+
+uint16_t MIDI_Platform_UART_Tx_Remaining(UART_HandleTypeDef *uart)
+{
+	return uart->tx_remaining;
+}
+
+HAL_StatusTypeDef MIDI_Platform_UART_Abort_Transmit(UART_HandleTypeDef *uart, uint16_t *unsent)
+{
+	uart->tx_aborts++;
+	*unsent = uart->tx_remaining;
+	uart->tx_remaining = 0;
+	uart->tx_busy = false;
+	uart->gState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
@@ -0,0 +1,45 @@
+/*
+ * fake_platform.h
+ *
+ * Test controls for the fake MIDI platform and HAL. Time stands still until
+ * Fake_Time_Advance() moves it, which on the way delivers the TIM2 compare
+ * interrupts and sends UART bytes one MIDI byte time each, in time order,
+ * calling the same entry points the firmware's interrupt handlers do. GPIO,
+ * SPI and I2S just log what they're given, and HAL_Delay() moves time on.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef FAKE_PLATFORM_H
+#define FAKE_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "midi.h"
+
+#define FAKE_ALARMS 4 // TIM2 compare channels
+
+// Interrupt latency: microseconds from an alarm's match to its handler running
+typedef uint32_t (*fake_latency_t)(void);
+
+void Fake_Platform_Reset(void);
+
+void Fake_Time_Set(uint32_t now);
+void Fake_Time_Advance(uint32_t us);
+void Fake_Set_Latency(fake_latency_t latency);
+
+bool Fake_Alarm_Armed(uint8_t channel);
+uint32_t Fake_Alarm_Time(uint8_t channel);
+uint32_t Fake_Alarm_Interrupts(uint8_t channel);
+bool Fake_Is_Locked(void);
+
+void Fake_UART_Init(UART_HandleTypeDef *uart, uint8_t index);
+void Fake_UART_Rx(UART_HandleTypeDef *uart, const uint8_t *bytes, uint16_t len);
+void Fake_UART_Rx_Idle(UART_HandleTypeDef *uart);
+void Fake_UART_Rx_Error(UART_HandleTypeDef *uart);
+void Fake_UART_Idle_Callback(UART_HandleTypeDef *uart);
+
+void Fake_SPI_Init(SPI_HandleTypeDef *spi, GPIO_TypeDef *pins);
+void Fake_I2S_Init(I2S_HandleTypeDef *i2s);
+
+#endif // FAKE_PLATFORM_H
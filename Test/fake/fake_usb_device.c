@@ -0,0 +1,153 @@
+/*
+ * fake_usb_device.c
+ *
+ * usb_device.c's endpoint calls, with the host driving the other end. There's
+ * no enumeration: a test configures the class itself.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "fake_usb_device.h"
+
+typedef struct {
+	bool open;
+	uint16_t max_packet;
+
+	uint8_t *out_buffer; // Armed for an OUT packet, NULL while the endpoint NAKs
+	uint16_t out_len;
+	uint16_t out_count;
+	fake_usb_handler_t data_out;
+
+	uint8_t in_packet[64]; // Copied as the PMA would be, the class may reuse its buffer
+	uint16_t in_len;
+	bool in_ready;
+	fake_usb_handler_t data_in;
+} fake_usb_ep_t;
+
+static fake_usb_ep_t fake_usb_eps[FAKE_USB_ENDPOINTS];
+
+void Fake_USB_Reset(void)
+{
+	memset(fake_usb_eps, 0, sizeof(fake_usb_eps));
+}
+
+void Fake_USB_Set_Handlers(uint8_t ep_num, fake_usb_handler_t data_out, fake_usb_handler_t data_in)
+{
+	fake_usb_eps[ep_num].data_out = data_out;
+	fake_usb_eps[ep_num].data_in = data_in;
+}
+
+bool Fake_USB_Is_Open(uint8_t ep_addr)
+{
+	return fake_usb_eps[ep_addr & 0x0F].open;
+}
+
+// The host sends a packet: false if the endpoint NAKed it
+bool Fake_USB_Host_Out(uint8_t ep_addr, const void *data, uint16_t len)
+{
+	fake_usb_ep_t *ep = &fake_usb_eps[ep_addr & 0x0F];
+
+	if (!ep->open || (ep->out_buffer == NULL) || (len > ep->out_len)) {
+		return false;
+	}
+	memcpy(ep->out_buffer, data, len);
+	ep->out_count = len;
+	ep->out_buffer = NULL;
+	if (ep->data_out != NULL) {
+		ep->data_out();
+	}
+	return true;
+}
+
+// The host asks for a packet: its length, or FAKE_USB_NAK if none was ready
+uint16_t Fake_USB_Host_In(uint8_t ep_addr, void *data)
+{
+	fake_usb_ep_t *ep = &fake_usb_eps[ep_addr & 0x0F];
+	uint16_t len;
+
+	if (!ep->open || !ep->in_ready) {
+		return FAKE_USB_NAK;
+	}
+	len = ep->in_len;
+	memcpy(data, ep->in_packet, len);
+	ep->in_ready = false;
+	if (ep->data_in != NULL) {
+		ep->data_in();
+	}
+	return len;
+}
+
+void USB_Device_Init(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+	Fake_USB_Reset();
+}
+
+bool USB_Device_Is_Configured(void)
+{
+	return true;
+}
+
+void USB_Device_EP_Open(uint8_t ep_addr, uint16_t max_packet, usb_ep_type_e type)
+{
+	fake_usb_ep_t *ep = &fake_usb_eps[ep_addr & 0x0F];
+
+	(void)type;
+	ep->open = true;
+	ep->max_packet = max_packet;
+	ep->out_buffer = NULL;
+	ep->in_ready = false;
+}
+
+void USB_Device_EP_Close(uint8_t ep_addr)
+{
+	fake_usb_eps[ep_addr & 0x0F].open = false;
+}
+
+void USB_Device_EP_Transmit(uint8_t ep_addr, const uint8_t *data, uint16_t len)
+{
+	fake_usb_ep_t *ep = &fake_usb_eps[ep_addr & 0x0F];
+
+	if (len > sizeof(ep->in_packet)) {
+		len = sizeof(ep->in_packet);
+	}
+	memcpy(ep->in_packet, data, len);
+	ep->in_len = len;
+	ep->in_ready = true;
+}
+
+void USB_Device_EP_Receive(uint8_t ep_addr, uint8_t *buffer, uint16_t len)
+{
+	fake_usb_ep_t *ep = &fake_usb_eps[ep_addr & 0x0F];
+
+	ep->out_buffer = buffer;
+	ep->out_len = len;
+}
+
+uint16_t USB_Device_EP_Rx_Count(uint8_t ep_addr)
+{
+	return fake_usb_eps[ep_addr & 0x0F].out_count;
+}
+
+void USB_Device_Control_Send(const uint8_t *data, uint16_t len)
+{
+	(void)data;
+	(void)len;
+}
+
+void USB_Device_Control_Receive(uint8_t *buffer, uint16_t len)
+{
+	(void)buffer;
+	(void)len;
+}
+
+void USB_Device_Control_Ack(void)
+{
+}
+
+void USB_Device_Print_Stats(void)
+{
+	printf("usb: fake device\r\n");
+}
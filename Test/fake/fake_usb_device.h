@@ -0,0 +1,31 @@
+/*
+ * fake_usb_device.h
+ *
+ * A stand-in for usb_device.c, with the host's side of the bulk endpoints, to
+ * run USB classes on the host. OUT packets land in the buffer the class last
+ * armed its endpoint with, and IN packets are collected from where it put
+ * them, each followed by the class's completion handler as on the device.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef FAKE_USB_DEVICE_H
+#define FAKE_USB_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "usb_device.h"
+
+#define FAKE_USB_ENDPOINTS 8
+#define FAKE_USB_NAK 0xFFFF
+
+typedef void (*fake_usb_handler_t)(void);
+
+void Fake_USB_Reset(void);
+void Fake_USB_Set_Handlers(uint8_t ep_num, fake_usb_handler_t data_out, fake_usb_handler_t data_in);
+bool Fake_USB_Is_Open(uint8_t ep_addr);
+
+bool Fake_USB_Host_Out(uint8_t ep_addr, const void *data, uint16_t len);
+uint16_t Fake_USB_Host_In(uint8_t ep_addr, void *data);
+
+#endif // FAKE_USB_DEVICE_H
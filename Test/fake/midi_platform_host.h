@@ -0,0 +1,32 @@
+/*
+ * midi_platform_host.h
+ *
+ * midi_platform.h for the host build, implemented by fake_platform.c. Time
+ * only moves when a test moves it, see fake_platform.h, and alarms and UART
+ * interrupts are delivered as it does.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef MIDI_PLATFORM_HOST_H
+#define MIDI_PLATFORM_HOST_H
+
+#include <stm32f3xx_hal.h>
+
+midi_irq_state_t MIDI_Platform_Lock(void);
+void MIDI_Platform_Unlock(midi_irq_state_t state);
+
+uint32_t MIDI_Platform_Timer_Now(void);
+void MIDI_Platform_Alarm_Set(uint8_t channel, uint32_t when);
+void MIDI_Platform_Alarm_Fire(uint8_t channel);
+void MIDI_Platform_Alarm_Stop(uint8_t channel);
+
+uint8_t MIDI_Platform_UART_Index(const UART_HandleTypeDef *uart);
+HAL_StatusTypeDef MIDI_Platform_UART_Receive(UART_HandleTypeDef *uart, uint8_t *buffer, uint16_t length);
+uint16_t MIDI_Platform_UART_Rx_Remaining(UART_HandleTypeDef *uart);
+bool MIDI_Platform_UART_Rx_Running(UART_HandleTypeDef *uart);
+HAL_StatusTypeDef MIDI_Platform_UART_Transmit(UART_HandleTypeDef *uart, const uint8_t *data, uint16_t length);
+uint16_t MIDI_Platform_UART_Tx_Remaining(UART_HandleTypeDef *uart);
+HAL_StatusTypeDef MIDI_Platform_UART_Abort_Transmit(UART_HandleTypeDef *uart, uint16_t *unsent);
+
+#endif // MIDI_PLATFORM_HOST_H
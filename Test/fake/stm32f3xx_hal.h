@@ -0,0 +1,155 @@
+/*
+ * stm32f3xx_hal.h
+ *
+ * Host stand-in for the HAL header: the types, macros and calls the firmware
+ * outside the HAL uses, and no more. The UARTs are simulated by
+ * fake_platform.c, and GPIO, SPI, I2S and the tick by fake_hal.c; nothing
+ * here talks to hardware.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef FAKE_STM32F3XX_HAL_H
+#define FAKE_STM32F3XX_HAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FAKE_UART_WIRE_SIZE 65536 // Bytes of transmitted traffic kept, with their times
+#define FAKE_SPI_WIRE_SIZE 65536
+#define FAKE_I2S_WIRE_SIZE 4096   // Samples
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03,
+} HAL_StatusTypeDef;
+
+// GPIO ports A to F, only keeping what was last written to their pins
+typedef struct {
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef Fake_GPIO[6];
+#define GPIOA (&Fake_GPIO[0])
+#define GPIOB (&Fake_GPIO[1])
+#define GPIOC (&Fake_GPIO[2])
+#define GPIOD (&Fake_GPIO[3])
+#define GPIOE (&Fake_GPIO[4])
+#define GPIOF (&Fake_GPIO[5])
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+/*
+ * A blocking SPI master. Each byte sent is logged with the time and the pins
+ * of one GPIO port as it went, like a logic analyser on the chip select and
+ * data/command lines.
+ */
+typedef struct {
+	GPIO_TypeDef *pins;                  // Port sampled with each byte, or NULL
+	uint8_t wire[FAKE_SPI_WIRE_SIZE];
+	uint16_t wire_pins[FAKE_SPI_WIRE_SIZE];
+	uint32_t wire_times[FAKE_SPI_WIRE_SIZE];
+	uint32_t wire_len;                   // Bytes sent, including any past the end of wire[]
+	uint32_t transfers;
+} SPI_HandleTypeDef;
+
+// A blocking I2S transmitter, logging the samples it's given
+typedef struct {
+	uint16_t wire[FAKE_I2S_WIRE_SIZE];
+	uint32_t wire_len;                   // Samples sent, including any past the end of wire[]
+	uint32_t transfers;
+} I2S_HandleTypeDef;
+
+// UART states as the HAL keeps them, gState for transmit and RxState for receive
+#define HAL_UART_STATE_READY 0x20U
+#define HAL_UART_STATE_BUSY_TX 0x21U
+#define HAL_UART_STATE_BUSY_RX 0x22U
+
+#define UART_IT_IDLE 0x0010U
+
+// Only the receive channel's count is read, through its parent UART
+typedef struct {
+	void *Parent;
+} DMA_HandleTypeDef;
+
+/*
+ * A UART with a DMA channel each way. The receive channel runs circular into
+ * the buffer it's started on, counting rx_remaining down like CNDTR. The
+ * transmit side sends a byte every MIDI byte time as fake time advances, and
+ * logs each one on the wire with the time its stop bit finished.
+ */
+typedef struct {
+	uint8_t index;                       // Which UART, as MIDI_Platform_UART_Index() reports it
+	uint32_t gState;
+	uint32_t RxState;
+	uint32_t interrupts;                 // UART_IT_ sources enabled
+	DMA_HandleTypeDef *hdmarx;
+	DMA_HandleTypeDef rx_dma;
+
+	uint8_t *rx_buffer;
+	uint16_t rx_size;
+	uint16_t rx_remaining;               // Receive DMA count register
+	HAL_StatusTypeDef rx_start_status;   // What starting reception returns, to test failures
+
+	const uint8_t *tx_data;              // Next byte for the transmit DMA to hand over
+	uint16_t tx_remaining;               // Transmit DMA count register
+	bool tx_busy;                        // A transfer is in flight, until its last byte is out
+	bool tx_shifting;                    // A byte is on the wire
+	uint8_t tx_shift;                    // and which
+	uint32_t tx_shift_done;              // When it finishes
+	HAL_StatusTypeDef tx_start_status;
+	uint32_t tx_starts;
+	uint32_t tx_aborts;
+
+	uint8_t wire[FAKE_UART_WIRE_SIZE];
+	uint32_t wire_times[FAKE_UART_WIRE_SIZE];
+	uint32_t wire_len;                   // Bytes sent, including any past the end of wire[]
+} UART_HandleTypeDef;
+
+typedef struct {
+	uint8_t unused;
+} PCD_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(hdma) (((UART_HandleTypeDef *)(hdma)->Parent)->rx_remaining)
+#define __HAL_UART_ENABLE_IT(huart, it) ((huart)->interrupts |= (it))
+#define __HAL_UART_CLEAR_IDLEFLAG(huart) ((void)(huart))
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2S_Transmit(I2S_HandleTypeDef *hi2s, uint16_t *pData, uint16_t Size, uint32_t Timeout);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+#endif // FAKE_STM32F3XX_HAL_H
@@ -0,0 +1,15 @@
+/*
+ * stm32f3xx_hal_uart.h
+ *
+ * Host stand-in for the HAL's UART header, for code that includes it by name.
+ * Everything is in the fake stm32f3xx_hal.h.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef FAKE_STM32F3XX_HAL_UART_H
+#define FAKE_STM32F3XX_HAL_UART_H
+
+#include "stm32f3xx_hal.h"
+
+#endif // FAKE_STM32F3XX_HAL_UART_H
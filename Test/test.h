@@ -0,0 +1,40 @@
+/*
+ * test.h
+ *
+ * Just enough of a test framework for the host tests: CHECK() reports a
+ * failure and carries on, and TEST_END() is main's return value.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	long long a_ = (long long)(a), b_ = (long long)(b); \
+	if (a_ != b_) { \
+		printf("%s:%d: failed: %s == %s (%lld, %lld)\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+		test_failures++; \
+	} \
+} while (0)
+
+#define TEST_RUN(test) do { \
+	int failures_ = test_failures; \
+	test(); \
+	printf("%s %s\n", (test_failures == failures_) ? "pass" : "FAIL", #test); \
+} while (0)
+
+#define TEST_END() (test_failures ? 1 : 0)
+
+#endif // TEST_H
@@ -0,0 +1,39 @@
+/*
+ * test_audio.c
+ *
+ * The audio test tone on the fake I2S3: the same triangle wave, a cycle per
+ * transfer, a thousand times over.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include "test.h"
+#include "fake_platform.h"
+#include "audio.h"
+
+#define WAVE_SAMPLES 441
+
+extern I2S_HandleTypeDef hi2s3;
+
+static void test_wave(void)
+{
+	uint32_t i;
+
+	Fake_I2S_Init(&hi2s3);
+	test2();
+
+	CHECK_EQ(hi2s3.transfers, 1000);
+	CHECK_EQ(hi2s3.wire_len, 1000 * WAVE_SAMPLES);
+	for (i = 0; i < WAVE_SAMPLES; i++) {
+		CHECK_EQ(hi2s3.wire[i], ((i < WAVE_SAMPLES / 2) ? i : WAVE_SAMPLES - i) * 295);
+		CHECK_EQ(hi2s3.wire[WAVE_SAMPLES + i], hi2s3.wire[i]);
+	}
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+
+	TEST_RUN(test_wave);
+	return TEST_END();
+}
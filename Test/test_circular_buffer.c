@@ -0,0 +1,280 @@
+/*
+ * test_circular_buffer.c
+ *
+ * The SPSC byte ring: full versus empty, all or nothing writes, copies split
+ * at the end of the buffer, the free running indices wrapping, the zero-copy
+ * calls, a long random run against a simple model, and a producer and
+ * consumer on two threads.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "circular_buffer.h"
+
+#define SIZE 64
+
+static circular_buffer_t cb;
+static uint8_t data[SIZE];
+
+static void test_init(void)
+{
+	CHECK_EQ(circularBuffer_init(&cb, data, 48), eCircularBufferNotValid);
+	CHECK_EQ(circularBuffer_init(&cb, NULL, 64), eCircularBufferNotValid);
+	CHECK_EQ(circularBuffer_init(&cb, data, 0), eCircularBufferNotValid);
+	CHECK_EQ(circularBuffer_init(&cb, data, SIZE), eCircularBufferOk);
+}
+
+// Every byte of the ring is usable, and a write that doesn't fit changes nothing
+static void test_full_and_empty(void)
+{
+	uint8_t in[SIZE + 1];
+	uint8_t out[SIZE + 1];
+	uint16_t len;
+	uint16_t i;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = i;
+	}
+	circularBuffer_init(&cb, data, SIZE);
+	len = 1;
+	CHECK_EQ(circularBuffer_read_bytes(&cb, out, &len), eCircularBufferEmpty);
+	CHECK_EQ(circularBuffer_write_bytes(&cb, in, SIZE + 1), eCircularBufferFull);
+	CHECK_EQ(circularBuffer_write_bytes(&cb, in, SIZE - 1), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_write_bytes(&cb, in, 2), eCircularBufferFull);
+	CHECK_EQ(circularBuffer_write_bytes(&cb, &in[SIZE - 1], 1), eCircularBufferOk);
+	circularBuffer_get_length(&cb, &len);
+	CHECK_EQ(len, SIZE);
+	CHECK_EQ(circularBuffer_write_bytes(&cb, in, 1), eCircularBufferFull);
+
+	len = sizeof(out);
+	CHECK_EQ(circularBuffer_read_bytes(&cb, out, &len), eCircularBufferOk);
+	CHECK_EQ(len, SIZE); // Clipped to what was there
+	CHECK(memcmp(in, out, SIZE) == 0);
+	circularBuffer_get_length(&cb, &len);
+	CHECK_EQ(len, 0);
+}
+
+// A copy across the end of the buffer goes in two pieces, to the right places
+static void test_two_segment_copy(void)
+{
+	const uint8_t in[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	uint8_t out[10];
+	uint16_t len = sizeof(out);
+	uint8_t guard[SIZE];
+
+	circularBuffer_init(&cb, data, SIZE);
+	cb.read_pos = cb.write_pos = SIZE - 3;
+	memset(data, 0xAA, sizeof(data));
+	CHECK_EQ(circularBuffer_write_bytes(&cb, in, sizeof(in)), eCircularBufferOk);
+	CHECK(memcmp(&data[SIZE - 3], in, 3) == 0);
+	CHECK(memcmp(data, &in[3], 7) == 0);
+	memset(guard, 0xAA, sizeof(guard));
+	CHECK(memcmp(&data[7], guard, SIZE - 10) == 0); // Nothing else touched
+
+	CHECK_EQ(circularBuffer_read_bytes(&cb, out, &len), eCircularBufferOk);
+	CHECK_EQ(len, sizeof(in));
+	CHECK(memcmp(in, out, sizeof(in)) == 0);
+	CHECK_EQ(cb.read_pos, SIZE + 7);
+}
+
+// The indices run over 65536 many times without the ring noticing
+static void test_index_wrap(void)
+{
+	uint8_t in[37];
+	uint8_t out[37];
+	uint16_t len;
+	uint32_t n;
+	uint16_t i;
+
+	circularBuffer_init(&cb, data, SIZE);
+	cb.read_pos = cb.write_pos = 0xFFF0;
+	for (n = 0; n < 10000; n++) {
+		for (i = 0; i < sizeof(in); i++) {
+			in[i] = n + i;
+		}
+		CHECK_EQ(circularBuffer_write_bytes(&cb, in, sizeof(in)), eCircularBufferOk);
+		circularBuffer_get_length(&cb, &len);
+		CHECK_EQ(len, sizeof(in));
+		len = sizeof(out);
+		CHECK_EQ(circularBuffer_read_bytes(&cb, out, &len), eCircularBufferOk);
+		CHECK_EQ(len, sizeof(in));
+		if (memcmp(in, out, sizeof(in)) != 0) {
+			CHECK(memcmp(in, out, sizeof(in)) == 0);
+			break;
+		}
+	}
+}
+
+// Acquire stops at the end of the buffer; the rest comes after the commit
+static void test_acquire_commit(void)
+{
+	uint8_t *region;
+	uint16_t len;
+
+	circularBuffer_init(&cb, data, SIZE);
+	cb.read_pos = cb.write_pos = SIZE - 4;
+
+	CHECK_EQ(circularBuffer_acquire_write(&cb, &region, &len), eCircularBufferOk);
+	CHECK(region == &data[SIZE - 4]);
+	CHECK_EQ(len, 4);
+	memcpy(region, "abcd", 4);
+	CHECK_EQ(circularBuffer_commit_write(&cb, 4), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_acquire_write(&cb, &region, &len), eCircularBufferOk);
+	CHECK(region == data);
+	CHECK_EQ(len, SIZE - 4);
+	memcpy(region, "ef", 2);
+	CHECK_EQ(circularBuffer_commit_write(&cb, 2), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_commit_write(&cb, SIZE - 5), eCircularBufferFull);
+
+	CHECK_EQ(circularBuffer_acquire_read(&cb, &region, &len), eCircularBufferOk);
+	CHECK_EQ(len, 4);
+	CHECK(memcmp(region, "abcd", 4) == 0);
+	CHECK_EQ(circularBuffer_commit_read(&cb, 7), eCircularBufferNotValid); // Only 6 in the ring
+	CHECK_EQ(circularBuffer_commit_read(&cb, 3), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_acquire_read(&cb, &region, &len), eCircularBufferOk);
+	CHECK_EQ(len, 1);
+	CHECK_EQ(*region, 'd');
+	CHECK_EQ(circularBuffer_commit_read(&cb, 1), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_acquire_read(&cb, &region, &len), eCircularBufferOk);
+	CHECK(region == data);
+	CHECK_EQ(len, 2);
+	CHECK_EQ(circularBuffer_commit_read(&cb, 3), eCircularBufferNotValid);
+	CHECK_EQ(circularBuffer_commit_read(&cb, 2), eCircularBufferOk);
+	CHECK_EQ(circularBuffer_acquire_read(&cb, &region, &len), eCircularBufferEmpty);
+	CHECK_EQ(len, 0);
+}
+
+// Random reads and writes of random sizes, every way in and out, against a plain FIFO
+static void test_random(void)
+{
+	static uint8_t model[1 << 20];
+	uint32_t model_in = 0;
+	uint32_t model_out = 0;
+	uint8_t buffer[SIZE + 8];
+	uint8_t *region;
+	uint16_t len;
+	uint16_t want;
+	uint16_t i;
+	uint32_t n;
+	eCircularBufferError result;
+
+	srand(5);
+	circularBuffer_init(&cb, data, SIZE);
+	for (n = 0; (n < 200000) && (model_in < sizeof(model) - sizeof(buffer)); n++) {
+		want = rand() % (SIZE + 8);
+		switch (rand() % 4) {
+		case 0:
+			for (i = 0; i < want; i++) {
+				buffer[i] = rand();
+			}
+			result = circularBuffer_write_bytes(&cb, buffer, want);
+			CHECK_EQ(result, (want <= SIZE - (model_in - model_out)) ? eCircularBufferOk : eCircularBufferFull);
+			if (result == eCircularBufferOk) {
+				memcpy(&model[model_in], buffer, want);
+				model_in += want;
+			}
+			break;
+		case 1:
+			if (circularBuffer_acquire_write(&cb, &region, &len) == eCircularBufferOk) {
+				want = (want < len) ? want : len;
+				for (i = 0; i < want; i++) {
+					region[i] = model[model_in++] = rand();
+				}
+				circularBuffer_commit_write(&cb, want);
+			}
+			break;
+		case 2:
+			len = want;
+			if (circularBuffer_read_bytes(&cb, buffer, &len) == eCircularBufferOk) {
+				CHECK(memcmp(buffer, &model[model_out], len) == 0);
+				model_out += len;
+			}
+			break;
+		default:
+			if (circularBuffer_acquire_read(&cb, &region, &len) == eCircularBufferOk) {
+				want = (want < len) ? want : len;
+				CHECK(memcmp(region, &model[model_out], want) == 0);
+				model_out += want;
+				circularBuffer_commit_read(&cb, want);
+			}
+			break;
+		}
+		circularBuffer_get_length(&cb, &len);
+		if (len != model_in - model_out) {
+			CHECK_EQ(len, model_in - model_out);
+			break;
+		}
+	}
+}
+
+#define THREAD_BYTES (1u << 20)
+
+static void *producer(void *arg)
+{
+	uint32_t sent = 0;
+	uint8_t chunk[23];
+	uint16_t len;
+	uint16_t i;
+
+	(void)arg;
+	while (sent < THREAD_BYTES) {
+		len = 1 + (sent % sizeof(chunk));
+		if (len > THREAD_BYTES - sent) {
+			len = THREAD_BYTES - sent;
+		}
+		for (i = 0; i < len; i++) {
+			chunk[i] = (sent + i) * 7;
+		}
+		if (circularBuffer_write_bytes(&cb, chunk, len) == eCircularBufferOk) {
+			sent += len;
+		} else {
+			sched_yield(); // Let the consumer in, there may be only one core
+		}
+	}
+	return NULL;
+}
+
+// The consumer sees every byte the producer sent, in order, never stale ones
+static void test_threads(void)
+{
+	pthread_t thread;
+	uint32_t got = 0;
+	uint32_t errors = 0;
+	uint8_t *region;
+	uint16_t len;
+	uint16_t i;
+
+	circularBuffer_init(&cb, data, SIZE);
+	pthread_create(&thread, NULL, producer, NULL);
+	while (got < THREAD_BYTES) {
+		if (circularBuffer_acquire_read(&cb, &region, &len) != eCircularBufferOk) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < len; i++) {
+			errors += (region[i] != (uint8_t)((got + i) * 7));
+		}
+		got += len;
+		circularBuffer_commit_read(&cb, len);
+	}
+	pthread_join(thread, NULL);
+	CHECK_EQ(errors, 0);
+	CHECK_EQ(got, THREAD_BYTES);
+}
+
+int main(void)
+{
+	TEST_RUN(test_init);
+	TEST_RUN(test_full_and_empty);
+	TEST_RUN(test_two_segment_copy);
+	TEST_RUN(test_index_wrap);
+	TEST_RUN(test_acquire_commit);
+	TEST_RUN(test_random);
+	TEST_RUN(test_threads);
+	return TEST_END();
+}
@@ -0,0 +1,278 @@
+/*
+ * test_console.c
+ *
+ * The console on the fake USART3, wired up as main.c does: commands typed in
+ * found, run and answered with the prompt after, parameters parsed, input
+ * pasted faster than it's read keeping the newest ring's worth, output queued
+ * and sent in order or dropped whole, and reception started over after a line
+ * error.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "console.h"
+#include "consoleIo.h"
+#include "consoleCommands.h"
+#include "log_ring.h"
+#include "midi_time.h"
+#include "version.h"
+
+#define CONSOLE_UART_INDEX 2 // USART3
+
+static UART_HandleTypeDef uart;
+static FILE *console_out;
+
+// main.c's callbacks, with the console on its UART and MIDI on the rest
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &uart) {
+		ConsoleIoTransmitDone(CONSOLE_IO_UART);
+	} else {
+		MIDI_UART_Transmit_End(huart);
+	}
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &uart) {
+		ConsoleIoReceiveInterrupt();
+	} else {
+		MIDI_UART_Receive(huart, false);
+	}
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	HAL_UART_RxHalfCpltCallback(huart);
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &uart) {
+		ConsoleIoUartError();
+	} else {
+		MIDI_UART_Error(huart);
+	}
+}
+
+void Fake_UART_Idle_Callback(UART_HandleTypeDef *huart)
+{
+	if (huart == &uart) {
+		ConsoleIoReceiveInterrupt();
+	} else {
+		MIDI_UART_Receive(huart, true);
+	}
+}
+
+// main.c's _write: printing goes into the console's output ring
+static ssize_t console_write(void *cookie, const char *buf, size_t size)
+{
+	(void)cookie;
+	return ConsoleIoWrite((const uint8_t *)buf, size);
+}
+
+// Run the console with stdout on it, keeping the test's own output apart
+static void console_process(void)
+{
+	FILE *out = stdout;
+
+	stdout = console_out;
+	ConsoleProcess();
+	fflush(stdout);
+	stdout = out;
+}
+
+// Type a line, with the idle line interrupt after it
+static void type(const char *text)
+{
+	Fake_UART_Rx(&uart, (const uint8_t *)text, strlen(text));
+	Fake_UART_Rx_Idle(&uart);
+}
+
+// Let the transmitter run dry
+static void drain(void)
+{
+	while (uart.tx_busy || uart.tx_shifting) {
+		Fake_Time_Advance(MIDI_BYTE_TIME_US);
+	}
+}
+
+// Type a command and return what came back, echo included, as a string
+static const char *command(const char *text)
+{
+	static char reply[FAKE_UART_WIRE_SIZE + 1];
+
+	drain();
+	uart.wire_len = 0;
+	type(text);
+	console_process();
+	drain();
+	memcpy(reply, uart.wire, uart.wire_len);
+	reply[uart.wire_len] = '\0';
+	return reply;
+}
+
+static void test_banner(void)
+{
+	FILE *out = stdout;
+
+	uart.wire_len = 0;
+	stdout = console_out;
+	ConsoleInit(&uart);
+	fflush(stdout);
+	stdout = out;
+	drain();
+	CHECK_EQ(uart.wire_len, strlen("MIDI Thingy\r\n> ")); // Nothing about the table being out of order
+	CHECK(memcmp(uart.wire, "MIDI Thingy\r\n> ", uart.wire_len) == 0);
+}
+
+// A command is echoed as typed, answered, and followed by the prompt
+static void test_ver(void)
+{
+	CHECK(strcmp(command("ver\r"), "ver\r\n\r" VERSION_STRING "\r\n> ") == 0);
+}
+
+// Commands are found by name or the start of one; others are turned away
+static void test_find(void)
+{
+	const sConsoleCommandTable_T *table;
+	const char *reply;
+	const char *at;
+	uint32_t length;
+	uint32_t i;
+
+	table = ConsoleCommandsGetTable(&length);
+	reply = command("he\r");
+	at = reply;
+	for (i = 0; i < length; i++) {
+		at = strstr(at, table[i].name);
+		CHECK(at != NULL);
+		if (at == NULL) {
+			break;
+		}
+	}
+
+	reply = command("bogus\r");
+	CHECK(strstr(reply, "Command not found.\r\n> ") != NULL);
+
+	reply = command("midipanic 9\r"); // No such port
+	CHECK(strstr(reply, "Error: midipanic 9") != NULL);
+	CHECK(strstr(reply, "Help: ") != NULL);
+}
+
+static void test_params(void)
+{
+	char buffer[CONSOLE_COMMAND_MAX_LENGTH] = "tempo -12 7 1aF\r";
+	int16_t value = 0;
+	uint16_t hex = 0;
+
+	CHECK_EQ(ConsoleReceiveParamInt16(buffer, 1, &value), COMMAND_SUCCESS);
+	CHECK_EQ(value, -12);
+	CHECK_EQ(ConsoleReceiveParamInt16(buffer, 2, &value), COMMAND_SUCCESS);
+	CHECK_EQ(value, 7);
+	CHECK_EQ(ConsoleReceiveParamHexUint16(buffer, 3, &hex), COMMAND_SUCCESS);
+	CHECK_EQ(hex, 0x1AF);
+	CHECK(ConsoleReceiveParamInt16(buffer, 4, &value) != COMMAND_SUCCESS);
+}
+
+// The trace log starts off, and the log command turns it on and off
+static void test_log(void)
+{
+	CHECK(!LOG_Is_Enabled());
+	command("log 1\r");
+	CHECK(LOG_Is_Enabled());
+	CHECK(strstr(command("log\r"), "log: on") != NULL);
+	command("log 0\r");
+	CHECK(!LOG_Is_Enabled());
+}
+
+/*
+ * More pasted than the ring holds before the main loop gets to it: the ring
+ * keeps the newest input, in order, without replaying any of the old.
+ */
+static void test_rx_overflow(void)
+{
+	static uint8_t pasted[300];
+	uint8_t got[sizeof(pasted)];
+	uint32_t received = 0;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(pasted); i++) {
+		pasted[i] = 'a' + (i % 26);
+	}
+	Fake_UART_Rx(&uart, pasted, sizeof(pasted));
+	Fake_UART_Rx_Idle(&uart);
+
+	CHECK_EQ(ConsoleIoReceive(got, sizeof(got), &received), CONSOLE_SUCCESS);
+	CHECK_EQ(received, 256);
+	CHECK(memcmp(got, &pasted[sizeof(pasted) - received], received) == 0);
+	received = 0;
+	ConsoleIoReceive(got, sizeof(got), &received);
+	CHECK_EQ(received, 0);
+
+	CHECK(strstr(command("consoleport\r"), "rx overflows 1") != NULL);
+}
+
+/*
+ * Output goes out in order, across the ring's wrap; what doesn't fit is
+ * dropped whole and counted.
+ */
+static void test_tx(void)
+{
+	static uint8_t text[3000];
+	uint32_t i;
+
+	for (i = 0; i < sizeof(text); i++) {
+		text[i] = ' ' + (i % 95);
+	}
+	for (i = 0; i < 2; i++) {
+		drain();
+		uart.wire_len = 0;
+		ConsoleIoWrite(text, sizeof(text));
+		drain();
+		CHECK_EQ(uart.wire_len, sizeof(text));
+		CHECK(memcmp(uart.wire, text, sizeof(text)) == 0);
+	}
+
+	uart.wire_len = 0;
+	ConsoleIoWrite(text, sizeof(text));
+	ConsoleIoWrite(text, sizeof(text));
+	drain();
+	CHECK_EQ(uart.wire_len, sizeof(text));
+	CHECK(strstr(command("consoleport\r"), "3000 dropped") != NULL);
+}
+
+// A line error stops reception; it's started again and typing carries on
+static void test_uart_error(void)
+{
+	Fake_UART_Rx_Error(&uart);
+	CHECK_EQ(uart.RxState, HAL_UART_STATE_BUSY_RX);
+	CHECK(strcmp(command("ver\r"), "ver\r\n\r" VERSION_STRING "\r\n> ") == 0);
+	CHECK(strstr(command("consoleport\r"), "uart errors 1") != NULL);
+}
+
+int main(void)
+{
+	cookie_io_functions_t console_io = { .write = console_write };
+
+	console_out = fopencookie(NULL, "w", console_io);
+	setvbuf(console_out, NULL, _IONBF, 0);
+	Fake_Platform_Reset();
+	Fake_UART_Init(&uart, CONSOLE_UART_INDEX);
+	LOG_Init();
+
+	TEST_RUN(test_banner);
+	TEST_RUN(test_ver);
+	TEST_RUN(test_find);
+	TEST_RUN(test_params);
+	TEST_RUN(test_log);
+	TEST_RUN(test_rx_overflow);
+	TEST_RUN(test_tx);
+	TEST_RUN(test_uart_error);
+	return TEST_END();
+}
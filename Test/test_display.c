@@ -0,0 +1,116 @@
+/*
+ * test_display.c
+ *
+ * The ST7735 on the fake SPI1: the controller reset, sent its init lists as
+ * commands and arguments with the data/command line right and the delays
+ * between them kept, then cleared; and rectangles clipped to the screen.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "display.h"
+#include "midi_time.h"
+
+#define CS_PIN GPIO_PIN_9
+#define CMD_DATA_PIN GPIO_PIN_8
+#define RST_PIN GPIO_PIN_12
+
+extern SPI_HandleTypeDef hspi1;
+
+// The commands on the wire from offset, each a byte sent with data/command low
+static uint32_t commands(uint32_t offset, uint8_t *cmds, uint32_t max)
+{
+	uint32_t count = 0;
+
+	for (; (offset < hspi1.wire_len) && (count < max); offset++) {
+		CHECK((hspi1.wire_pins[offset] & CS_PIN) == 0);
+		if ((hspi1.wire_pins[offset] & CMD_DATA_PIN) == 0) {
+			cmds[count++] = hspi1.wire[offset];
+		}
+	}
+	return count;
+}
+
+// Where the nth byte sent with data/command low is
+static uint32_t find_command(uint32_t n)
+{
+	uint32_t offset;
+
+	for (offset = 0; offset < hspi1.wire_len; offset++) {
+		if (((hspi1.wire_pins[offset] & CMD_DATA_PIN) == 0) && (n-- == 0)) {
+			break;
+		}
+	}
+	return offset;
+}
+
+static void test_init(void)
+{
+	const uint8_t expect[] = {
+		0x01, 0x11, 0xB1, 0xB2, 0xB3, 0xB4, 0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0x20, 0x36, 0x3A, // Init1
+		0x2A, 0x2B,                                                                                // Init2
+		0xE0, 0xE1, 0x13, 0x29,                                                                    // Init3
+		0x2A, 0x2B, 0x2C,                                                                          // Clear
+	};
+	uint8_t cmds[64];
+	uint32_t start = MIDI_Time_Now();
+	uint32_t pixels;
+	uint32_t i;
+
+	Fake_SPI_Init(&hspi1, GPIOB);
+	test1();
+
+	CHECK(GPIOF->ODR & RST_PIN);                 // Out of reset
+	CHECK(GPIOB->ODR & CS_PIN);                  // and deselected after
+	CHECK_EQ(commands(0, cmds, sizeof(cmds)), sizeof(expect));
+	CHECK(memcmp(cmds, expect, sizeof(expect)) == 0);
+
+	// Reset held 100ms, 200ms to come out; then 150ms after SWRESET and 500ms after SLPOUT
+	CHECK(hspi1.wire_times[find_command(0)] - start >= 400000);
+	CHECK(hspi1.wire_times[find_command(1)] - hspi1.wire_times[find_command(0)] >= 150000);
+	CHECK(hspi1.wire_times[find_command(2)] - hspi1.wire_times[find_command(1)] >= 500000);
+
+	// The whole screen in black, as data
+	pixels = hspi1.wire_len - (find_command(sizeof(expect) - 1) + 1);
+	CHECK_EQ(pixels, 128 * 160 * 2);
+	for (i = hspi1.wire_len - pixels; i < hspi1.wire_len; i++) {
+		if ((hspi1.wire[i] != 0) || ((hspi1.wire_pins[i] & CMD_DATA_PIN) == 0)) {
+			break;
+		}
+	}
+	CHECK_EQ(i, hspi1.wire_len);
+}
+
+// A rectangle over the bottom right corner is cut off at the screen's edge
+static void test_clip(void)
+{
+	const uint8_t window[] = { 0x2A, 0x00, 120, 0x00, 127, 0x2B, 0x00, 150, 0x00, 159, 0x2C };
+	uint32_t i;
+
+	Fake_SPI_Init(&hspi1, GPIOB);
+	ST7735_FillRectangle(120, 150, 20, 20, 0xF800);
+
+	CHECK_EQ(hspi1.wire_len, sizeof(window) + 8 * 10 * 2);
+	CHECK(memcmp(hspi1.wire, window, sizeof(window)) == 0);
+	for (i = sizeof(window); i < hspi1.wire_len; i += 2) {
+		CHECK((hspi1.wire[i] == 0xF8) && (hspi1.wire[i + 1] == 0x00));
+	}
+	CHECK(GPIOB->ODR & CS_PIN);
+
+	// Off the screen altogether, nothing is sent
+	Fake_SPI_Init(&hspi1, GPIOB);
+	ST7735_FillRectangle(128, 0, 1, 1, 0);
+	CHECK_EQ(hspi1.wire_len, 0);
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+
+	TEST_RUN(test_init);
+	TEST_RUN(test_clip);
+	return TEST_END();
+}
@@ -0,0 +1,302 @@
+/*
+ * test_midi_clock.c
+ *
+ * The clock master against the fake TIM2: how late each clock byte starts on
+ * the wire with both ports flooded with notes and the timer interrupt running
+ * late by a random amount, no drift over a long run at an awkward tempo, the
+ * 0.01 BPM steps, catching up after a long stall, and start, stop and
+ * continue.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "midi_clock.h"
+
+#define PORTS 2
+#define MAX_LATENCY_US 20
+
+static UART_HandleTypeDef uarts[PORTS];
+static midi_port_t ports[PORTS];
+static uint32_t wire_seen[PORTS]; // Wire bytes already looked at
+
+static uint32_t random_latency(void)
+{
+	return rand() % MAX_LATENCY_US;
+}
+
+static void forget_wire(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < PORTS; i++) {
+		uarts[i].wire_len = 0;
+		wire_seen[i] = 0;
+	}
+}
+
+// Let everything queued go out and start the wire logs over
+static void settle(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < PORTS; i++) {
+		while (uarts[i].tx_busy || uarts[i].tx_shifting) {
+			Fake_Time_Advance(MIDI_BYTE_TIME_US);
+		}
+	}
+	Fake_Time_Advance(10000);
+	forget_wire();
+}
+
+// Keep the regular lane of every port full
+static void flood(void)
+{
+	static uint8_t note;
+	uint8_t i;
+
+	for (i = 0; i < PORTS; i++) {
+		while (MIDI_Send_Free(&ports[i]) > 16) {
+			MIDI_Send_NoteOnMsg(&ports[i], 1, note++ & 0x7F, 64);
+		}
+	}
+}
+
+/*
+ * The next byte from a port's wire log matching byte, returning when it
+ * finished, or false if there's none yet.
+ */
+static bool next_on_wire(uint8_t port, uint8_t byte, uint32_t *when)
+{
+	UART_HandleTypeDef *uart = &uarts[port];
+
+	while (wire_seen[port] < uart->wire_len) {
+		if (uart->wire[wire_seen[port]++] == byte) {
+			*when = uart->wire_times[wire_seen[port] - 1];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Every clock byte starts on the wire within a byte time of its ideal time,
+ * plus the interrupt's latency, on every port, however busy the port is.
+ * Ideal times are exact: the start time plus a byte time plus n whole periods
+ * worked out in rational arithmetic.
+ */
+static void test_jitter(void)
+{
+	const uint32_t tempo = 17777; // 177.77 BPM
+	uint32_t start;
+	uint32_t when;
+	uint64_t ideal;
+	int32_t late;
+	int32_t most = 0;
+	int32_t least = INT32_MAX;
+	uint64_t total = 0;
+	uint32_t ticks[PORTS] = { 0 };
+	uint32_t step;
+	uint8_t i;
+
+	settle();
+	srand(16);
+	Fake_Set_Latency(random_latency);
+	CHECK_EQ(MIDI_Clock_Set_Tempo(tempo), MIDI_OK);
+	flood();
+	start = MIDI_Time_Now();
+	MIDI_Clock_Start();
+
+	for (step = 0; step < 20000; step++) {
+		flood();
+		Fake_Time_Advance(1000 + rand() % 100);
+		for (i = 0; i < PORTS; i++) {
+			while (next_on_wire(i, 0xF8, &when)) {
+				ideal = start + MIDI_BYTE_TIME_US
+						+ ((uint64_t)ticks[i] * MIDI_CLOCK_TICK_US_SCALE) / tempo;
+				late = MIDI_Time_Diff(when - MIDI_BYTE_TIME_US, (uint32_t)ideal);
+				most = (late > most) ? late : most;
+				least = (late < least) ? late : least;
+				total += late;
+				ticks[i]++;
+			}
+		}
+		forget_wire();
+	}
+	MIDI_Clock_Stop();
+	Fake_Set_Latency(NULL);
+
+	printf("  %u ticks, clock byte start after ideal: min %d, mean %.1f, max %d us\n", ticks[0],
+			least, (double)total / (ticks[0] + ticks[1]), most);
+	CHECK_EQ(ticks[0], ticks[1]);
+	CHECK(ticks[0] > 20 * 177.77 * MIDI_CLOCK_PPQN / 60 - 2);
+	CHECK(least >= 0);
+	CHECK(most < MIDI_BYTE_TIME_US + MAX_LATENCY_US);
+}
+
+/*
+ * At a tempo whose period is far from whole, each tick stays within a
+ * microsecond of its exact time for an hour, so nothing accumulates.
+ */
+static void test_no_drift(void)
+{
+	const uint32_t tempo = 12345; // 123.45 BPM, 20251.1138... us a tick
+	uint32_t start;
+	uint32_t when;
+	uint64_t exact_x_tempo;
+	int64_t error;
+	int64_t worst = 0;
+	uint32_t ticks = 0;
+	uint32_t minute;
+
+	settle();
+	CHECK_EQ(MIDI_Clock_Set_Tempo(tempo), MIDI_OK);
+	start = MIDI_Time_Now();
+	MIDI_Clock_Start();
+	for (minute = 0; minute < 60; minute++) {
+		Fake_Time_Advance(60 * MIDI_TIME_TICKS_PER_SEC);
+		while (next_on_wire(0, 0xF8, &when)) {
+			// Compared in units of 1/tempo us, so there's no rounding at all
+			exact_x_tempo = (uint64_t)(start + 2 * MIDI_BYTE_TIME_US) * tempo
+					+ (uint64_t)ticks * MIDI_CLOCK_TICK_US_SCALE;
+			error = (int64_t)((uint64_t)when * tempo) - (int64_t)exact_x_tempo;
+			worst = (llabs(error) > worst) ? llabs(error) : worst;
+			ticks++;
+		}
+		forget_wire();
+	}
+	MIDI_Clock_Stop();
+
+	CHECK_EQ(ticks, 60 * tempo * MIDI_CLOCK_PPQN / 100); // Exactly 177768, the last due at the end
+	CHECK(worst < tempo); // Under a microsecond
+}
+
+// Tempos a hundredth of a BPM apart give the tick rates they should
+static void test_precision(void)
+{
+	uint32_t tempo;
+	uint32_t first = 0;
+	uint32_t last = 0;
+	uint32_t when;
+	uint32_t ticks;
+	double period;
+	double expect;
+
+	for (tempo = 12000; tempo <= 12003; tempo++) {
+		settle();
+		CHECK_EQ(MIDI_Clock_Set_Tempo(tempo), MIDI_OK);
+		CHECK_EQ(MIDI_Clock_Get_Tempo(), tempo);
+		MIDI_Clock_Start();
+		Fake_Time_Advance(600 * MIDI_TIME_TICKS_PER_SEC);
+		MIDI_Clock_Stop();
+		for (ticks = 0; next_on_wire(0, 0xF8, &when); ticks++) {
+			first = (ticks == 0) ? when : first;
+			last = when;
+		}
+		period = (double)(last - first) / (ticks - 1);
+		expect = (double)MIDI_CLOCK_TICK_US_SCALE / tempo;
+		CHECK(period > expect - 0.001);
+		CHECK(period < expect + 0.001);
+	}
+	CHECK_EQ(MIDI_Clock_Set_Tempo(MIDI_CLOCK_MIN_TEMPO - 1), MIDI_INVALID_PARAM);
+	CHECK_EQ(MIDI_Clock_Set_Tempo(MIDI_CLOCK_MAX_TEMPO + 1), MIDI_INVALID_PARAM);
+	CHECK_EQ(MIDI_Clock_Get_Tempo(), 12003);
+}
+
+static uint32_t stall_once(void)
+{
+	static bool stalled;
+
+	if (!stalled) {
+		stalled = true;
+		return 30000;
+	}
+	return 0;
+}
+
+// An interrupt held off for several periods sends every tick it missed at once
+static void test_catch_up(void)
+{
+	UART_HandleTypeDef *uart = &uarts[0];
+	uint32_t when;
+	uint32_t ticks = 0;
+	uint8_t i;
+
+	settle();
+	MIDI_Clock_Set_Tempo(MIDI_CLOCK_MAX_TEMPO); // 8333us a tick
+	MIDI_Clock_Start();
+	Fake_Set_Latency(stall_once);
+	Fake_Time_Advance(MIDI_TIME_TICKS_PER_SEC);
+	Fake_Set_Latency(NULL);
+	MIDI_Clock_Stop();
+	Fake_Time_Advance(10 * MIDI_BYTE_TIME_US);
+
+	while (next_on_wire(0, 0xF8, &when)) {
+		ticks++;
+	}
+	CHECK_EQ(ticks, 120); // 300 BPM for a second, the first tick a byte time in
+
+	// The first interrupt, 30ms late, sent the four ticks due by then back to back
+	CHECK_EQ(uart->wire[1], 0xF8);
+	CHECK_EQ(uart->wire_times[1] - uart->wire_times[0], 30000 + MIDI_BYTE_TIME_US);
+	for (i = 2; i <= 4; i++) {
+		CHECK_EQ(uart->wire[i], 0xF8);
+		CHECK_EQ(uart->wire_times[i] - uart->wire_times[i - 1], MIDI_BYTE_TIME_US);
+	}
+	CHECK(uart->wire_times[5] - uart->wire_times[4] > MIDI_BYTE_TIME_US);
+}
+
+static void test_start_stop_continue(void)
+{
+	UART_HandleTypeDef *uart = &uarts[0];
+	uint32_t when = 0;
+	uint32_t start_at = 0;
+
+	settle();
+	MIDI_Clock_Set_Tempo(12000); // 20833us a tick
+	MIDI_Clock_Start();
+	CHECK(MIDI_Clock_Is_Running());
+	Fake_Time_Advance(3 * 20833 + 1000);
+	CHECK(next_on_wire(0, 0xFA, &start_at));
+	CHECK(next_on_wire(0, 0xF8, &when));
+	CHECK_EQ(when - start_at, MIDI_BYTE_TIME_US); // Start leads the first clock by a byte
+	CHECK_EQ(uart->wire_len, 5);
+
+	MIDI_Clock_Stop();
+	CHECK(!MIDI_Clock_Is_Running());
+	Fake_Time_Advance(10 * 20833);
+	CHECK_EQ(uart->wire_len, 6);
+	CHECK_EQ(uart->wire[5], 0xFC);
+	CHECK(!Fake_Alarm_Armed(MIDI_TIME_ALARM_CLOCK));
+
+	MIDI_Clock_Continue();
+	Fake_Time_Advance(2 * 20833 + 1000);
+	CHECK_EQ(uart->wire_len, 10); // Continue and three clocks
+	CHECK_EQ(uart->wire[6], 0xFB);
+	CHECK_EQ(uart->wire[7], 0xF8);
+	CHECK_EQ(uart->wire_times[7] - uart->wire_times[6], MIDI_BYTE_TIME_US);
+	MIDI_Clock_Stop();
+}
+
+int main(void)
+{
+	uint8_t i;
+
+	Fake_Platform_Reset();
+	for (i = 0; i < PORTS; i++) {
+		Fake_UART_Init(&uarts[i], i);
+		CHECK_EQ(MIDI_Init(&ports[i], &uarts[i], &uarts[i]), MIDI_OK);
+		MIDI_Set_Running_Status(&ports[i], false, 0);
+	}
+	MIDI_Clock_Init();
+
+	TEST_RUN(test_start_stop_continue);
+	TEST_RUN(test_jitter);
+	TEST_RUN(test_no_drift);
+	TEST_RUN(test_precision);
+	TEST_RUN(test_catch_up);
+	return TEST_END();
+}
@@ -0,0 +1,374 @@
+/*
+ * test_midi_merge.c
+ *
+ * The input merge under load: round-robin fairness with every input
+ * saturated, the sink pushing back, sysex kept whole with only real-time
+ * cutting in, the sysex timeout closing a stalled sysex with F7 and dropping
+ * its remains, the wait each event had, and a long random replay of all of
+ * it together.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "midi_merge.h"
+#include "midi_time.h"
+
+#define INPUTS 3
+#define QUEUE_SIZE 256
+#define MAX_OUT (1 << 18)
+
+static midi_merge_t merge;
+static midi_event_queue_t queues[INPUTS];
+static midi_event_t queue_events[INPUTS][QUEUE_SIZE];
+static uint32_t queue_times[INPUTS][QUEUE_SIZE];
+static midi_parser_t parsers[INPUTS];
+
+static midi_event_t out[MAX_OUT];
+static uint32_t num_out;
+static int32_t sink_budget; // Events the sink takes before pushing back, negative for no limit
+
+static MIDI_error_t sink(const midi_event_t *event, uint32_t timestamp, void *context)
+{
+	(void)timestamp;
+	(void)context;
+	if ((sink_budget == 0) || (num_out >= MAX_OUT)) {
+		return MIDI_TX_OVERFLOW;
+	}
+	if (sink_budget > 0) {
+		sink_budget--;
+	}
+	out[num_out++] = *event;
+	return MIDI_OK;
+}
+
+static void setup(void)
+{
+	uint8_t i;
+
+	Fake_Platform_Reset();
+	Fake_Time_Set(1000);
+	MIDI_Merge_Init(&merge, sink, NULL);
+	for (i = 0; i < INPUTS; i++) {
+		MIDI_Event_Queue_Init(&queues[i], queue_events[i], queue_times[i], QUEUE_SIZE);
+		MIDI_Parser_Init(&parsers[i], 0); // The merge stamps the cable
+		CHECK_EQ(MIDI_Merge_Add_Input(&merge, &queues[i], 5 + i), MIDI_OK);
+	}
+	num_out = 0;
+	sink_budget = -1;
+}
+
+static uint8_t cable(uint32_t index)
+{
+	return midi_event_cable(&out[index]) - 5;
+}
+
+static bool is_realtime(const midi_event_t *event)
+{
+	return (midi_event_cin(event) == MIDI_CIN_SINGLE_BYTE) && (event->bytes[0] >= 0xF8);
+}
+
+// Bytes arriving on an input, parsed into its queue as the port would
+static void input_bytes(uint8_t input, const uint8_t *bytes, uint16_t len)
+{
+	midi_event_t events[MIDI_PARSER_MAX_EVENTS];
+	uint8_t count;
+	uint8_t i;
+
+	while (len--) {
+		count = MIDI_Parser_Feed(&parsers[input], *bytes++, events);
+		for (i = 0; i < count; i++) {
+			CHECK(MIDI_Event_Queue_Push(&queues[input], &events[i], MIDI_Time_Now()));
+		}
+	}
+}
+
+#define INPUT(input, ...) do { const uint8_t bytes_[] = { __VA_ARGS__ }; \
+	input_bytes(input, bytes_, sizeof(bytes_)); } while (0)
+
+/*
+ * Between an input's sysex start and its end, nothing from the other inputs
+ * but real-time. Returns false at the first event that breaks that.
+ */
+static bool sysex_atomic(void)
+{
+	uint8_t owner = MIDI_MERGE_NO_OWNER;
+	uint32_t i;
+
+	for (i = 0; i < num_out; i++) {
+		if (is_realtime(&out[i])) {
+			continue;
+		}
+		if ((owner != MIDI_MERGE_NO_OWNER) && (owner != cable(i))) {
+			printf("event %u from input %u inside input %u's sysex\n", i, cable(i), owner);
+			return false;
+		}
+		owner = (midi_event_cin(&out[i]) == MIDI_CIN_SYSEX) ? cable(i) : MIDI_MERGE_NO_OWNER;
+	}
+	return true;
+}
+
+// Every input saturated: strict turns of MIDI_MERGE_QUANTUM events each
+static void test_fairness(void)
+{
+	uint32_t i;
+	uint8_t input;
+
+	setup();
+	for (i = 0; i < 60; i++) {
+		for (input = 0; input < INPUTS; input++) {
+			INPUT(input, 0x90, i, 1 + input);
+		}
+	}
+	while (num_out < 60 * INPUTS) {
+		MIDI_Merge_Process(&merge);
+	}
+	for (i = 0; i < num_out; i++) {
+		CHECK_EQ(cable(i), (i / MIDI_MERGE_QUANTUM) % INPUTS);
+		CHECK_EQ(out[i].bytes[1], (i / (MIDI_MERGE_QUANTUM * INPUTS)) * MIDI_MERGE_QUANTUM + i % MIDI_MERGE_QUANTUM);
+		CHECK_EQ(out[i].bytes[2], 1 + cable(i));
+	}
+	for (input = 0; input < INPUTS; input++) {
+		CHECK_EQ(merge.inputs[input].events, 60);
+		CHECK_EQ(merge.inputs[input].max_backlog, 60);
+	}
+}
+
+// A sink that takes a few at a time loses nothing and keeps the order
+static void test_pushback(void)
+{
+	uint32_t i;
+	uint8_t input;
+	uint8_t next[INPUTS] = { 0 };
+
+	setup();
+	for (i = 0; i < 50; i++) {
+		for (input = 0; input < INPUTS; input++) {
+			INPUT(input, 0xB0, i, input);
+		}
+	}
+	while (num_out < 50 * INPUTS) {
+		sink_budget = 1 + (num_out % 7);
+		MIDI_Merge_Process(&merge);
+	}
+	for (i = 0; i < num_out; i++) {
+		CHECK_EQ(out[i].bytes[1], next[cable(i)]++);
+	}
+	for (input = 0; input < INPUTS; input++) {
+		CHECK_EQ(MIDI_Event_Queue_Length(&queues[input]), 0);
+	}
+}
+
+/*
+ * How long events waited to be merged; one the receive interrupt stamped
+ * after the pass started waited no time, not four thousand seconds.
+ */
+static void test_wait(void)
+{
+	const midi_event_t event = midi_event_make(0, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+
+	setup();
+	CHECK(MIDI_Event_Queue_Push(&queues[0], &event, MIDI_Time_Now() - 300));
+	CHECK(MIDI_Event_Queue_Push(&queues[0], &event, MIDI_Time_Now() + 20));
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(num_out, 2);
+	CHECK_EQ(merge.inputs[0].wait.samples, 2);
+	CHECK_EQ(merge.inputs[0].wait.min, 0);
+	CHECK_EQ(merge.inputs[0].wait.max, 300);
+}
+
+// Another input's sysex holds the others back, apart from their clocks
+static void test_sysex_atomic(void)
+{
+	uint32_t i;
+	uint32_t clocks = 0;
+	uint32_t start = 0;
+	uint32_t end = 0;
+
+	setup();
+	INPUT(0, 0xF0, 0x7D);
+	for (i = 0; i < 40; i++) {
+		INPUT(0, i & 0x7F, 0xF8);
+		INPUT(1, 0x90, i, 100, 0xF8);
+		INPUT(2, 0xF8, 0xB2, 7, i);
+	}
+	INPUT(0, 0xF7, 0x90, 1, 1);
+	MIDI_Merge_Process(&merge);
+	MIDI_Merge_Process(&merge);
+
+	CHECK(merge.sysex_owner == 0);
+	while (num_out < 40 * 5 + 14 + 1) {
+		MIDI_Merge_Process(&merge);
+	}
+	CHECK(sysex_atomic());
+	for (i = 0; i < num_out; i++) {
+		if ((cable(i) == 0) && (midi_event_cin(&out[i]) == MIDI_CIN_SYSEX) && (start == 0)) {
+			start = i + 1;
+		}
+		if ((cable(i) == 0) && (midi_event_cin(&out[i]) >= MIDI_CIN_SYSEX_END_1)
+				&& (midi_event_cin(&out[i]) <= MIDI_CIN_SYSEX_END_3) && (end == 0)) {
+			end = i;
+		}
+		if ((start != 0) && (end == 0) && (cable(i) != 0)) {
+			CHECK(is_realtime(&out[i]));
+			clocks++;
+		}
+	}
+	CHECK(end > start);
+	CHECK(clocks > 0);
+	CHECK(merge.inputs[1].blocked_turns > 0);
+	CHECK(merge.sysex_owner == MIDI_MERGE_NO_OWNER);
+}
+
+/*
+ * A sysex that stops arriving is closed with a lone F7 after the timeout, the
+ * others go again, and whatever of it turns up later is dropped.
+ */
+static void test_sysex_timeout(void)
+{
+	uint32_t i;
+	uint32_t before;
+
+	setup();
+	INPUT(0, 0xF0, 1, 2, 3, 4, 5);
+	INPUT(1, 0x90, 60, 100);
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(num_out, 2);
+	CHECK(merge.sysex_owner == 0);
+
+	Fake_Time_Advance(MIDI_MERGE_SYSEX_TIMEOUT_US);
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(num_out, 2); // Not yet
+	CHECK_EQ(MIDI_Event_Queue_Length(&queues[1]), 1);
+
+	Fake_Time_Advance(1000);
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(num_out, 4);
+	CHECK_EQ(out[2].header, (5 << 4) | MIDI_CIN_SYSEX_END_1);
+	CHECK_EQ(out[2].bytes[0], 0xF7);
+	CHECK_EQ(out[3].header, (6 << 4) | MIDI_CIN_NOTE_ON);
+	CHECK_EQ(merge.inputs[0].sysex_timeouts, 1);
+
+	// The rest of it, with a clock in the middle, then a note
+	INPUT(0, 6, 7, 0xF8, 8, 9, 10, 0xF7, 0x80, 60, 0);
+	before = num_out;
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(num_out - before, 2);
+	CHECK(is_realtime(&out[before]));
+	CHECK_EQ(out[before + 1].header, (5 << 4) | MIDI_CIN_NOTE_OFF);
+
+	// Cut short by a status instead of an F7, its leftover byte goes too
+	INPUT(0, 0xF0, 1, 2, 3);
+	MIDI_Merge_Process(&merge);
+	Fake_Time_Advance(MIDI_MERGE_SYSEX_TIMEOUT_US + 1000);
+	MIDI_Merge_Process(&merge);
+	CHECK_EQ(merge.inputs[0].sysex_timeouts, 2);
+	INPUT(0, 0x90, 61, 100);
+	before = num_out;
+	MIDI_Merge_Process(&merge);
+	for (i = before; i < num_out; i++) {
+		CHECK(midi_event_cin(&out[i]) == MIDI_CIN_NOTE_ON);
+	}
+	CHECK_EQ(num_out - before, 1);
+}
+
+/*
+ * Random traffic on every input, parsed as it arrives, merged in small steps
+ * through a sink that sometimes pushes back. Each input's events come out
+ * complete and in order, and sysex is never interleaved.
+ */
+static void test_replay(void)
+{
+	static midi_event_t expect[INPUTS][MAX_OUT / INPUTS];
+	uint32_t expected[INPUTS] = { 0 };
+	uint32_t matched[INPUTS] = { 0 };
+	uint8_t bytes[64];
+	uint16_t len;
+	uint16_t j;
+	uint32_t step;
+	uint32_t i;
+	uint8_t input;
+	uint16_t before;
+	midi_event_t event;
+
+	setup();
+	srand(13);
+	for (step = 0; step < 20000; step++) {
+		input = rand() % INPUTS;
+		len = 0;
+		switch (rand() % 8) {
+		case 0:
+			bytes[len++] = 0xF0;
+			for (j = rand() % 40; j > 0; j--) {
+				bytes[len++] = rand() & 0x7F;
+				if ((rand() % 10) == 0) {
+					bytes[len++] = 0xF8;
+				}
+			}
+			bytes[len++] = 0xF7;
+			break;
+		case 1:
+			bytes[len++] = 0xF8;
+			break;
+		default:
+			bytes[len++] = 0x90 | (rand() & 0x0F);
+			bytes[len++] = rand() & 0x7F;
+			bytes[len++] = rand() & 0x7F;
+			break;
+		}
+		if (MIDI_Event_Queue_Length(&queues[input]) + len > QUEUE_SIZE) {
+			step--;
+			sink_budget = -1;
+			MIDI_Merge_Process(&merge);
+			continue;
+		}
+		before = MIDI_Event_Queue_Length(&queues[input]);
+		input_bytes(input, bytes, len);
+		for (j = before; j < MIDI_Event_Queue_Length(&queues[input]); j++) {
+			event = queues[input].events[(queues[input].read_pos + j) & (QUEUE_SIZE - 1)];
+			expect[input][expected[input]++] = event;
+		}
+		Fake_Time_Advance(rand() % 400);
+		if ((rand() % 3) == 0) {
+			sink_budget = (rand() % 4 == 0) ? 0 : rand() % 20;
+			MIDI_Merge_Process(&merge);
+		}
+	}
+	sink_budget = -1;
+	for (i = 0; (i < 1000) && (MIDI_Event_Queue_Length(&queues[0]) + MIDI_Event_Queue_Length(&queues[1])
+			+ MIDI_Event_Queue_Length(&queues[2]) > 0); i++) {
+		MIDI_Merge_Process(&merge);
+	}
+
+	CHECK(sysex_atomic());
+	for (i = 0; i < num_out; i++) {
+		input = cable(i);
+		event = out[i];
+		event.header &= 0x0F;
+		if ((matched[input] >= expected[input])
+				|| (memcmp(&event, &expect[input][matched[input]], sizeof(event)) != 0)) {
+			printf("event %u from input %u out of order\n", i, input);
+			test_failures++;
+			break;
+		}
+		matched[input]++;
+	}
+	for (input = 0; input < INPUTS; input++) {
+		CHECK_EQ(matched[input], expected[input]);
+		CHECK_EQ(merge.inputs[input].sysex_timeouts, 0);
+	}
+}
+
+int main(void)
+{
+	TEST_RUN(test_fairness);
+	TEST_RUN(test_pushback);
+	TEST_RUN(test_wait);
+	TEST_RUN(test_sysex_atomic);
+	TEST_RUN(test_sysex_timeout);
+	TEST_RUN(test_replay);
+	return TEST_END();
+}
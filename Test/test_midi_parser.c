@@ -0,0 +1,227 @@
+/*
+ * test_midi_parser.c
+ *
+ * The byte stream parser: every kind of message, running status, real-time
+ * bytes anywhere, sysex framing into CIN 4 to 7, and what happens to bytes
+ * that don't fit.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "test.h"
+#include "midi_parser.h"
+
+#define MAX_EVENTS 64
+
+static midi_parser_t parser;
+static midi_event_t got[MAX_EVENTS];
+static uint16_t num_got;
+
+static void feed(const uint8_t *bytes, uint16_t len)
+{
+	midi_event_t events[MIDI_PARSER_MAX_EVENTS];
+	uint8_t count;
+	uint8_t i;
+
+	num_got = 0;
+	while (len--) {
+		count = MIDI_Parser_Feed(&parser, *bytes++, events);
+		for (i = 0; (i < count) && (num_got < MAX_EVENTS); i++) {
+			got[num_got++] = events[i];
+		}
+	}
+}
+
+#define FEED(...) do { const uint8_t bytes_[] = { __VA_ARGS__ }; feed(bytes_, sizeof(bytes_)); } while (0)
+
+static void check_event(uint16_t index, uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+	midi_event_t expect = midi_event_make(3, cin, b0, b1, b2);
+
+	CHECK(index < num_got);
+	if (memcmp(&got[index], &expect, sizeof(expect)) != 0) {
+		printf("event %u: got %02x %02x %02x %02x, expected %02x %02x %02x %02x\n", index,
+				got[index].header, got[index].bytes[0], got[index].bytes[1], got[index].bytes[2],
+				expect.header, expect.bytes[0], expect.bytes[1], expect.bytes[2]);
+		test_failures++;
+	}
+}
+
+static void setup(void)
+{
+	MIDI_Parser_Init(&parser, 3);
+}
+
+static void test_channel_messages(void)
+{
+	setup();
+	FEED(0x81, 60, 0, 0x92, 61, 100, 0xA3, 62, 5, 0xB4, 7, 90, 0xC5, 12, 0xD6, 40, 0xE7, 0x00, 0x40);
+	CHECK_EQ(num_got, 7);
+	check_event(0, MIDI_CIN_NOTE_OFF, 0x81, 60, 0);
+	check_event(1, MIDI_CIN_NOTE_ON, 0x92, 61, 100);
+	check_event(2, MIDI_CIN_POLY_PRESSURE, 0xA3, 62, 5);
+	check_event(3, MIDI_CIN_CC, 0xB4, 7, 90);
+	check_event(4, MIDI_CIN_PROGRAM_CHANGE, 0xC5, 12, 0);
+	check_event(5, MIDI_CIN_CHANNEL_PRESSURE, 0xD6, 40, 0);
+	check_event(6, MIDI_CIN_PITCH_BEND, 0xE7, 0x00, 0x40);
+}
+
+static void test_running_status(void)
+{
+	setup();
+	FEED(0x90, 60, 100, 62, 101, 64, 0, 0xC0, 1, 2, 3);
+	CHECK_EQ(num_got, 6);
+	check_event(1, MIDI_CIN_NOTE_ON, 0x90, 62, 101);
+	check_event(2, MIDI_CIN_NOTE_ON, 0x90, 64, 0);
+	check_event(4, MIDI_CIN_PROGRAM_CHANGE, 0xC0, 2, 0);
+	check_event(5, MIDI_CIN_PROGRAM_CHANGE, 0xC0, 3, 0);
+}
+
+// Real-time bytes come out as they arrive and leave what they interrupt alone
+static void test_realtime_inside(void)
+{
+	setup();
+	FEED(0x90, 0xF8, 60, 0xFA, 100, 0xFE, 62, 0xFC, 101);
+	CHECK_EQ(num_got, 6);
+	check_event(0, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	check_event(1, MIDI_CIN_SINGLE_BYTE, 0xFA, 0, 0);
+	check_event(2, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+	check_event(3, MIDI_CIN_SINGLE_BYTE, 0xFE, 0, 0);
+	check_event(4, MIDI_CIN_SINGLE_BYTE, 0xFC, 0, 0);
+	check_event(5, MIDI_CIN_NOTE_ON, 0x90, 62, 101);
+
+	FEED(0xF0, 1, 0xF8, 2, 3, 0xFF, 0xF7);
+	CHECK_EQ(num_got, 4);
+	check_event(0, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	check_event(1, MIDI_CIN_SYSEX, 0xF0, 1, 2);
+	check_event(2, MIDI_CIN_SINGLE_BYTE, 0xFF, 0, 0);
+	check_event(3, MIDI_CIN_SYSEX_END_2, 3, 0xF7, 0);
+}
+
+// Undefined real-time bytes are dropped without disturbing anything
+static void test_undefined_realtime(void)
+{
+	setup();
+	FEED(0x90, 60, 0xF9, 100, 0xFD, 61, 1);
+	CHECK_EQ(num_got, 2);
+	check_event(0, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+	check_event(1, MIDI_CIN_NOTE_ON, 0x90, 61, 1);
+}
+
+static void test_system_common(void)
+{
+	setup();
+	FEED(0xF1, 0x23, 0xF2, 0x10, 0x20, 0xF3, 5, 0xF6);
+	CHECK_EQ(num_got, 4);
+	check_event(0, MIDI_CIN_COMMON_2, 0xF1, 0x23, 0);
+	check_event(1, MIDI_CIN_COMMON_3, 0xF2, 0x10, 0x20);
+	check_event(2, MIDI_CIN_COMMON_2, 0xF3, 5, 0);
+	check_event(3, MIDI_CIN_SYSEX_END_1, 0xF6, 0, 0);
+
+	// No running status after system common
+	FEED(0xF3, 5, 6, 7);
+	CHECK_EQ(num_got, 1);
+	CHECK_EQ(parser.stray_bytes, 2);
+
+	// System common cancels a channel running status
+	setup();
+	FEED(0x90, 60, 100, 0xF6, 61, 100);
+	CHECK_EQ(num_got, 2);
+	CHECK_EQ(parser.stray_bytes, 2);
+}
+
+// Every sysex length packs into start/continue events and the right end CIN
+static void test_sysex_lengths(void)
+{
+	uint8_t bytes[16];
+	uint8_t len;
+	uint8_t i;
+	uint8_t last;
+
+	for (len = 2; len <= sizeof(bytes); len++) {
+		setup();
+		bytes[0] = 0xF0;
+		for (i = 1; i < len - 1; i++) {
+			bytes[i] = i;
+		}
+		bytes[len - 1] = 0xF7;
+		feed(bytes, len);
+
+		CHECK_EQ(num_got, (len + 2) / 3);
+		for (i = 0; i + 1 < num_got; i++) {
+			check_event(i, MIDI_CIN_SYSEX, bytes[3 * i], bytes[3 * i + 1], bytes[3 * i + 2]);
+		}
+		last = len - 3 * (num_got - 1);
+		check_event(num_got - 1, MIDI_CIN_SYSEX_END_1 + last - 1, bytes[3 * i],
+				(last > 1) ? bytes[3 * i + 1] : 0, (last > 2) ? bytes[3 * i + 2] : 0);
+	}
+}
+
+// A status byte in a sysex closes it with what it had, without an F7
+static void test_sysex_cut_short(void)
+{
+	setup();
+	FEED(0xF0, 1, 2, 3, 4, 0x90, 60, 100);
+	CHECK_EQ(num_got, 3);
+	check_event(0, MIDI_CIN_SYSEX, 0xF0, 1, 2);
+	check_event(1, MIDI_CIN_SYSEX_END_2, 3, 4, 0);
+	check_event(2, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+	CHECK_EQ(parser.sysex_aborts, 1);
+
+	// Tune request both closes the sysex and is a message of its own
+	FEED(0xF0, 1, 2, 3, 0xF6);
+	CHECK_EQ(num_got, 3);
+	check_event(0, MIDI_CIN_SYSEX, 0xF0, 1, 2);
+	check_event(1, MIDI_CIN_SYSEX_END_1, 3, 0, 0);
+	check_event(2, MIDI_CIN_SYSEX_END_1, 0xF6, 0, 0);
+
+	// Cut on a whole event there's nothing left to close it with; the status alone ends it
+	FEED(0xF0, 1, 2, 0x90, 60, 100);
+	CHECK_EQ(num_got, 2);
+	check_event(0, MIDI_CIN_SYSEX, 0xF0, 1, 2);
+	check_event(1, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+
+	// So does a new sysex, and an undefined status
+	FEED(0xF0, 1, 0xF0, 2, 0xF4, 3);
+	CHECK_EQ(num_got, 2);
+	check_event(0, MIDI_CIN_SYSEX_END_2, 0xF0, 1, 0);
+	check_event(1, MIDI_CIN_SYSEX_END_2, 0xF0, 2, 0);
+	CHECK_EQ(parser.sysex_aborts, 5);
+}
+
+static void test_stray_bytes(void)
+{
+	setup();
+	FEED(1, 2, 0xF7, 0x90, 60, 100, 0xF5, 61, 100);
+	CHECK_EQ(num_got, 1);
+	CHECK_EQ(parser.stray_bytes, 5);
+}
+
+// A reset drops the message in progress and running status
+static void test_reset(void)
+{
+	setup();
+	FEED(0x90, 60);
+	MIDI_Parser_Reset(&parser);
+	FEED(100, 0xF0, 1);
+	MIDI_Parser_Reset(&parser);
+	FEED(2, 0xF7, 0x80, 1, 2);
+	CHECK_EQ(num_got, 1);
+	check_event(0, MIDI_CIN_NOTE_OFF, 0x80, 1, 2);
+	CHECK_EQ(parser.stray_bytes, 3);
+}
+
+int main(void)
+{
+	TEST_RUN(test_channel_messages);
+	TEST_RUN(test_running_status);
+	TEST_RUN(test_realtime_inside);
+	TEST_RUN(test_undefined_realtime);
+	TEST_RUN(test_system_common);
+	TEST_RUN(test_sysex_lengths);
+	TEST_RUN(test_sysex_cut_short);
+	TEST_RUN(test_stray_bytes);
+	TEST_RUN(test_reset);
+	return TEST_END();
+}
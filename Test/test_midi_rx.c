@@ -0,0 +1,200 @@
+/*
+ * test_midi_rx.c
+ *
+ * MIDI IN through the circular receive DMA: the ring's write index following
+ * the DMA through half, full and idle line interrupts in any mix, every byte
+ * parsed exactly once across the wrap, event times, and restarting after an
+ * error.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "midi_time.h"
+
+static UART_HandleTypeDef uart;
+static midi_port_t port;
+
+/*
+ * The input is an endless run of note ons, sent a byte at a time so bursts
+ * can end part way through a message.
+ */
+static uint32_t sent_bytes;   // Of the run, put on the line so far
+static uint32_t got_messages; // Taken back out as events
+
+static void note_on(uint32_t n, uint8_t *bytes)
+{
+	bytes[0] = 0x90 | (n & 0x0F);
+	bytes[1] = n & 0x7F;
+	bytes[2] = ((n * 7) % 127) + 1;
+}
+
+// Take every queued event, checking it's the next note on in sequence
+static void collect(void)
+{
+	midi_event_t events[32];
+	uint32_t times[32];
+	uint16_t count;
+	uint8_t expect[3];
+	uint16_t i;
+
+	do {
+		count = 32;
+		MIDI_Dequeue_Events(&port, events, times, &count);
+		for (i = 0; i < count; i++) {
+			note_on(got_messages, expect);
+			CHECK_EQ(events[i].header, (port.index << 4) | MIDI_CIN_NOTE_ON);
+			CHECK(memcmp(events[i].bytes, expect, 3) == 0);
+			got_messages++;
+		}
+	} while (count > 0);
+}
+
+static void send_bytes(uint32_t count)
+{
+	uint8_t bytes[3];
+
+	while (count--) {
+		note_on(sent_bytes / 3, bytes);
+		Fake_UART_Rx(&uart, &bytes[sent_bytes % 3], 1);
+		sent_bytes++;
+	}
+}
+
+// Finish the message in progress, then send whole ones
+static void send(uint16_t messages)
+{
+	send_bytes(((3 - (sent_bytes % 3)) % 3) + 3 * messages);
+}
+
+// Where the DMA has written to, and the ring's write index, agree after every interrupt
+static void check_caught_up(void)
+{
+	uint16_t dma_pos = (MIDI_BUFFER_SIZE - uart.rx_remaining) & (MIDI_BUFFER_SIZE - 1);
+
+	CHECK_EQ(port.state.rx_dma_pos, dma_pos);
+	CHECK_EQ(port.rx_ring.write_pos & (MIDI_BUFFER_SIZE - 1), dma_pos);
+	CHECK_EQ(port.rx_ring.read_pos, port.rx_ring.write_pos);
+}
+
+// A short message is only picked up by the idle line, and dated by its last byte
+static void test_idle(void)
+{
+	midi_event_t event;
+	uint32_t time;
+	uint32_t last_byte;
+
+	send(1);
+	last_byte = MIDI_Time_Now();
+	CHECK_EQ(MIDI_Receive_Pending(&port), 0);
+	Fake_UART_Rx_Idle(&uart);
+	CHECK_EQ(MIDI_Receive_Pending(&port), 1);
+	CHECK(MIDI_Peek_Event(&port, &event, &time));
+	CHECK_EQ(time, last_byte);
+	collect();
+	check_caught_up();
+}
+
+/*
+ * A burst ending exactly on the half way mark, after an idle line has already
+ * folded in part of it: the half transfer interrupt takes just the rest.
+ */
+static void test_idle_then_half(void)
+{
+	uint16_t to_half = (MIDI_BUFFER_SIZE / 2 - port.state.rx_dma_pos) & (MIDI_BUFFER_SIZE - 1);
+	uint32_t count = port.stats.rx_count;
+
+	send_bytes(5);
+	Fake_UART_Rx_Idle(&uart);
+	check_caught_up();
+	send_bytes(to_half - 5);
+	CHECK_EQ(uart.rx_remaining, MIDI_BUFFER_SIZE / 2);
+	CHECK_EQ(port.stats.rx_count - count, to_half);
+	check_caught_up();
+	send(0);
+	Fake_UART_Rx_Idle(&uart);
+	collect();
+	CHECK_EQ(got_messages * 3, sent_bytes);
+}
+
+/*
+ * Several laps of the ring, with idle gaps after bursts of every length so the
+ * idle, half and full interrupts land everywhere relative to each other and
+ * to message boundaries.
+ */
+static void test_laps(void)
+{
+	uint32_t count = port.stats.rx_count;
+	uint32_t start = sent_bytes;
+	uint16_t burst;
+
+	for (burst = 1; sent_bytes - start < 6 * MIDI_BUFFER_SIZE; burst = (burst % 181) + 1) {
+		send_bytes(burst);
+		Fake_UART_Rx_Idle(&uart);
+		check_caught_up();
+		collect();
+	}
+	send(0);
+	Fake_UART_Rx_Idle(&uart);
+	collect();
+	CHECK_EQ(port.stats.rx_count - count, sent_bytes - start);
+	CHECK_EQ(got_messages * 3, sent_bytes);
+	CHECK_EQ(port.rx_events.drops, 0);
+}
+
+// Events in a dense burst are dated a byte time per byte back from its end
+static void test_burst_times(void)
+{
+	midi_event_t events[8];
+	uint32_t times[8];
+	uint16_t count = 8;
+	uint32_t end;
+	uint16_t i;
+
+	send(8);
+	end = MIDI_Time_Now();
+	Fake_UART_Rx_Idle(&uart);
+	MIDI_Dequeue_Events(&port, events, times, &count);
+	CHECK_EQ(count, 8);
+	for (i = 0; i < count; i++) {
+		CHECK_EQ(times[i], end - (7 - i) * 3 * MIDI_BYTE_TIME_US);
+	}
+	got_messages += count;
+}
+
+// An error stops the DMA; the next arm starts the ring over, and the parser with it
+static void test_error_restart(void)
+{
+	uint8_t partial[] = { 0x90, 60 };
+
+	Fake_UART_Rx(&uart, partial, sizeof(partial));
+	Fake_UART_Rx_Error(&uart);
+	CHECK(!MIDI_Interrupt_Is_Armed(&port));
+
+	CHECK_EQ(MIDI_Interrupt_Receive_Begin(&port), MIDI_OK);
+	CHECK(MIDI_Interrupt_Is_Armed(&port));
+	CHECK_EQ(uart.rx_remaining, MIDI_BUFFER_SIZE);
+	send(5);
+	Fake_UART_Rx_Idle(&uart);
+	collect();
+	CHECK_EQ(got_messages * 3, sent_bytes);
+	check_caught_up();
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+	Fake_Time_Set(0xFFFF0000); // So the timer wraps during the test
+	Fake_UART_Init(&uart, 1);
+	CHECK_EQ(MIDI_Init(&port, &uart, &uart), MIDI_OK);
+	CHECK_EQ(MIDI_Interrupt_Receive_Begin(&port), MIDI_OK);
+
+	TEST_RUN(test_idle);
+	TEST_RUN(test_idle_then_half);
+	TEST_RUN(test_laps);
+	TEST_RUN(test_burst_times);
+	TEST_RUN(test_error_restart);
+	return TEST_END();
+}
@@ -0,0 +1,204 @@
+/*
+ * test_midi_scheduler.c
+ *
+ * The timer wheel against the fake TIM2: events from milliseconds to past the
+ * horizon ahead going out on their tick, in order, with the interrupt only
+ * running when there's something to do; events due on a full port held back
+ * and retried rather than dropped; times already gone, the timer wrapping,
+ * and the pool running out.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <stdlib.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "midi_scheduler.h"
+
+#define EVENTS 200
+
+static UART_HandleTypeDef uart;
+static midi_port_t port;
+static uint32_t due[1 << 14]; // By event number
+
+// A note on carrying its number, to tell it apart on the wire
+static MIDI_error_t schedule(uint32_t n, uint32_t when)
+{
+	midi_event_t event = midi_event_make(0, MIDI_CIN_NOTE_ON, 0x90, n & 0x7F, (n >> 7) & 0x7F);
+
+	due[n] = when;
+	return MIDI_Schedule_Event(&port, &event, when);
+}
+
+// Run time on until everything pending has gone out on the wire
+static void run_out(uint32_t step)
+{
+	while ((MIDI_Scheduler_Pending() > 0) || uart.tx_busy || uart.tx_shifting) {
+		Fake_Time_Advance(step);
+	}
+}
+
+/*
+ * Notes numbered from first on the wire from offset, in order, each started
+ * at or after its time and within a tick and slack of it. Returns where they
+ * end.
+ */
+static uint32_t check_wire(uint32_t offset, uint32_t first, uint32_t count, uint32_t slack)
+{
+	uint32_t n;
+	int32_t late;
+
+	for (n = first; n < first + count; n++, offset += 3) {
+		CHECK_EQ(uart.wire[offset], 0x90);
+		CHECK_EQ(uart.wire[offset + 1] | (uart.wire[offset + 2] << 7), n);
+		late = MIDI_Time_Diff(uart.wire_times[offset] - MIDI_BYTE_TIME_US, due[n]);
+		CHECK(late >= 0);
+		CHECK(late < (int32_t)(MIDI_SCHED_TICK_US + slack));
+	}
+	return offset;
+}
+
+/*
+ * Events milliseconds to minutes ahead, some past the wheel's horizon, each
+ * out on the tick after its time. The interrupt is only taken for ticks with
+ * something due or to cascade, never for every tick.
+ */
+static void test_times(void)
+{
+	uint32_t start = MIDI_Time_Now();
+	uint32_t interrupts = Fake_Alarm_Interrupts(MIDI_TIME_ALARM_SCHEDULER);
+	uint32_t when = start;
+	uint32_t n;
+
+	srand(15);
+	uart.wire_len = 0;
+	for (n = 0; n < EVENTS; n++) {
+		if (n < 100) {
+			when += 2000 + rand() % 3000; // Level 0 and 1
+		} else if (n < EVENTS - 2) {
+			when += 1000000 + rand() % 1000000; // Level 2
+		} else {
+			when += 100 * MIDI_TIME_TICKS_PER_SEC; // Past the horizon
+		}
+		CHECK_EQ(schedule(n, when), MIDI_OK);
+	}
+	CHECK_EQ(MIDI_Scheduler_Pending(), EVENTS);
+	run_out(MIDI_TIME_TICKS_PER_SEC);
+
+	check_wire(0, 0, EVENTS, 0);
+	CHECK_EQ(uart.wire_len, 3 * EVENTS);
+	interrupts = Fake_Alarm_Interrupts(MIDI_TIME_ALARM_SCHEDULER) - interrupts;
+	printf("  %u events over %u s, %u interrupts\n", EVENTS, MIDI_Time_Diff(when, start) / MIDI_TIME_TICKS_PER_SEC,
+			interrupts);
+	CHECK(interrupts < 3 * EVENTS);
+	CHECK(!Fake_Alarm_Armed(MIDI_TIME_ALARM_SCHEDULER));
+}
+
+// A lone event a minute ahead costs a handful of interrupts
+static void test_sparse(void)
+{
+	uint32_t interrupts = Fake_Alarm_Interrupts(MIDI_TIME_ALARM_SCHEDULER);
+
+	uart.wire_len = 0;
+	CHECK_EQ(schedule(0, MIDI_Time_Now() + 60 * MIDI_TIME_TICKS_PER_SEC), MIDI_OK);
+	run_out(MIDI_TIME_TICKS_PER_SEC);
+	check_wire(0, 0, 1, 0);
+	CHECK(Fake_Alarm_Interrupts(MIDI_TIME_ALARM_SCHEDULER) - interrupts <= 3);
+}
+
+/*
+ * With the port's ring nearly full of a sysex, events falling due don't fit:
+ * they wait and go out after it in order, with none lost.
+ */
+static void test_full_port(void)
+{
+	static uint8_t sysex[MIDI_BUFFER_SIZE];
+	uint16_t len = MIDI_Send_Free(&port) - 2;
+	uint32_t when = MIDI_Time_Now() + 1000;
+	uint32_t n;
+	uint16_t i;
+
+	uart.wire_len = 0;
+	sysex[0] = 0xF0;
+	for (i = 1; i < len - 1; i++) {
+		sysex[i] = i & 0x7F;
+	}
+	sysex[len - 1] = 0xF7;
+	CHECK_EQ(MIDI_Send_RawBytes(&port, sysex, len), MIDI_OK);
+	for (n = 0; n < 100; n++) {
+		CHECK_EQ(schedule(n, when + (n / 10) * 50), MIDI_OK);
+	}
+	run_out(1000);
+
+	CHECK_EQ(uart.wire_len, len + 3 * 100);
+	for (n = 0; n < 100; n++) {
+		CHECK_EQ(uart.wire[len + 3 * n], 0x90);
+		CHECK_EQ(uart.wire[len + 3 * n + 1] | (uart.wire[len + 3 * n + 2] << 7), n);
+	}
+}
+
+// Times already gone go out on the next tick
+static void test_past(void)
+{
+	uint32_t now = MIDI_Time_Now();
+
+	uart.wire_len = 0;
+	CHECK_EQ(schedule(0, now - 5000), MIDI_OK);
+	CHECK_EQ(schedule(1, now - 100 * MIDI_TIME_TICKS_PER_SEC), MIDI_OK);
+	run_out(MIDI_SCHED_TICK_US);
+	CHECK_EQ(uart.wire_len, 6);
+	CHECK(uart.wire_times[0] - now <= MIDI_SCHED_TICK_US + MIDI_BYTE_TIME_US);
+}
+
+// Across the timer wrapping, times keep their order
+static void test_wrap(void)
+{
+	uint32_t when;
+	uint32_t n;
+
+	run_out(MIDI_TIME_TICKS_PER_SEC);
+	Fake_Time_Set(0xFFFFFFFF - 3 * MIDI_TIME_TICKS_PER_SEC);
+	uart.wire_len = 0;
+	when = MIDI_Time_Now();
+	for (n = 0; n < 50; n++) {
+		when += 100000 + rand() % 50000;
+		CHECK_EQ(schedule(n, when), MIDI_OK);
+	}
+	run_out(MIDI_TIME_TICKS_PER_SEC);
+	check_wire(0, 0, 50, 0);
+}
+
+// The pool holds so many; the next is refused until one has gone
+static void test_pool(void)
+{
+	uint32_t when = MIDI_Time_Now() + 10000;
+	uint32_t n;
+
+	uart.wire_len = 0;
+	for (n = 0; n < MIDI_SCHED_POOL_SIZE; n++) {
+		CHECK_EQ(schedule(n, when + n * 1000), MIDI_OK);
+	}
+	CHECK_EQ(schedule(n, when), MIDI_SCHEDULE_FULL);
+	Fake_Time_Advance(10000 + MIDI_SCHED_TICK_US);
+	CHECK_EQ(schedule(n, when + n * 1000), MIDI_OK);
+	run_out(MIDI_TIME_TICKS_PER_SEC);
+	check_wire(0, 0, MIDI_SCHED_POOL_SIZE + 1, 0);
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+	Fake_Time_Set(0x12345678);
+	Fake_UART_Init(&uart, 0);
+	CHECK_EQ(MIDI_Init(&port, &uart, &uart), MIDI_OK);
+	MIDI_Set_Running_Status(&port, false, 0);
+	MIDI_Scheduler_Init();
+
+	TEST_RUN(test_times);
+	TEST_RUN(test_sparse);
+	TEST_RUN(test_full_port);
+	TEST_RUN(test_past);
+	TEST_RUN(test_wrap);
+	TEST_RUN(test_pool);
+	return TEST_END();
+}
@@ -0,0 +1,305 @@
+/*
+ * test_midi_sync.c
+ *
+ * The clock follower fed jittered tick streams: how soon it locks and how
+ * closely it tracks each tick's true time and the tempo once it has, its
+ * response to a tempo step, stepping over a lost tick, riding out stray ticks
+ * and giving up on a source that stops. Tracking error is printed along the
+ * way as well as checked.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "test.h"
+#include "midi_sync.h"
+
+#define SOURCE 2
+#define TICK_US_SCALE (60.0 * MIDI_TIME_TICKS_PER_SEC / MIDI_SYNC_PPQN) // Over BPM
+
+/*
+ * The clock being followed: ticks at exact times, arriving up to jitter_us
+ * either side of them. Starts just short of the timer wrapping.
+ */
+typedef struct {
+	double period;    // Microseconds per tick
+	double time;      // True time of the last tick
+	uint32_t ticks;   // Since start
+	uint32_t jitter_us;
+} source_t;
+
+typedef struct {
+	double sum_squares;
+	int32_t worst;
+	uint32_t count;
+} tracking_t;
+
+static void source_start(source_t *source, double bpm, uint32_t jitter_us)
+{
+	midi_event_t start = midi_event_make(SOURCE, MIDI_CIN_SINGLE_BYTE, 0xFA, 0, 0);
+
+	MIDI_Sync_Init(SOURCE);
+	source->period = TICK_US_SCALE / bpm;
+	source->time = 0xFFF00000u;
+	source->ticks = 0;
+	source->jitter_us = jitter_us;
+	MIDI_Sync_Input(&start, (uint32_t)source->time);
+}
+
+static uint32_t source_arrival(const source_t *source)
+{
+	int32_t jitter = 0;
+
+	if (source->jitter_us > 0) {
+		jitter = (rand() % (2 * source->jitter_us + 1)) - (int32_t)source->jitter_us;
+	}
+	return (uint32_t)(uint64_t)llround(source->time) + jitter;
+}
+
+// The next tick goes by, arriving or lost on the way; returns when it arrived
+static uint32_t source_tick(source_t *source, bool arrives)
+{
+	midi_event_t clock = midi_event_make(SOURCE, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	uint32_t arrival;
+
+	source->time += source->period;
+	source->ticks++;
+	arrival = source_arrival(source);
+	if (arrives) {
+		MIDI_Sync_Input(&clock, arrival);
+	}
+	return arrival;
+}
+
+// How far the follower's idea of when the last tick fell is from the truth
+static int32_t phase_error(const source_t *source)
+{
+	uint32_t estimate = MIDI_Sync_Time_At(source->ticks * MIDI_SYNC_POSITION_SCALE);
+
+	return MIDI_Time_Diff(estimate, (uint32_t)(uint64_t)llround(source->time));
+}
+
+static double tempo_error(const source_t *source)
+{
+	return MIDI_Sync_Get_Tempo() / 100.0 - TICK_US_SCALE / source->period;
+}
+
+static void tracking_add(tracking_t *tracking, int32_t error)
+{
+	tracking->sum_squares += (double)error * error;
+	tracking->worst = (abs(error) > tracking->worst) ? abs(error) : tracking->worst;
+	tracking->count++;
+}
+
+static double tracking_rms(const tracking_t *tracking)
+{
+	return sqrt(tracking->sum_squares / tracking->count);
+}
+
+/*
+ * From cold at tempos across the range, with jitter of a few percent of a
+ * period: the tempo within 1% after two beats, locked after the two ticks
+ * that measure the first period and two beats more, and once locked each
+ * tick placed closer to its true time than it arrived.
+ */
+static void test_lock(void)
+{
+	static const double tempos[] = { 30.0, 97.3, 120.0, 174.0, 300.0 };
+	source_t source;
+	tracking_t tracking;
+	tracking_t arrivals;
+	double bpm;
+	uint32_t arrival;
+	uint32_t i;
+	uint32_t t;
+
+	srand(17);
+	for (i = 0; i < sizeof(tempos) / sizeof(tempos[0]); i++) {
+		bpm = tempos[i];
+		source_start(&source, bpm, (uint32_t)(TICK_US_SCALE / bpm * 0.04));
+		for (t = 0; t < 2 * MIDI_SYNC_PPQN; t++) {
+			source_tick(&source, true);
+		}
+		CHECK(fabs(tempo_error(&source)) < bpm * 0.01);
+		source_tick(&source, true);
+		source_tick(&source, true);
+		CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_LOCKED);
+
+		tracking = (tracking_t){ 0 };
+		arrivals = (tracking_t){ 0 };
+		for (t = 0; t < 100 * MIDI_SYNC_PPQN; t++) {
+			arrival = source_tick(&source, true);
+			tracking_add(&arrivals, MIDI_Time_Diff(arrival, (uint32_t)(uint64_t)llround(source.time)));
+			tracking_add(&tracking, phase_error(&source));
+		}
+		printf("  %6.2f BPM, +-%u us jitter: tempo %+.3f BPM, tick error rms %.0f max %d us, arrivals rms %.0f\n",
+				bpm, source.jitter_us, tempo_error(&source), tracking_rms(&tracking), tracking.worst,
+				tracking_rms(&arrivals));
+		CHECK(tracking_rms(&tracking) < 0.75 * tracking_rms(&arrivals));
+		CHECK(fabs(tempo_error(&source)) < bpm * 0.002);
+		CHECK_EQ(MIDI_Sync_Get_Position(MIDI_Sync_Time_At(source.ticks * MIDI_SYNC_POSITION_SCALE)),
+				source.ticks * MIDI_SYNC_POSITION_SCALE);
+	}
+}
+
+/*
+ * Locked at 120, the source jumps to 132 BPM: the tempo is within 0.5 BPM in
+ * a few beats, without ever swinging far past.
+ */
+static void test_step(void)
+{
+	source_t source;
+	double most = 0.0;
+	uint32_t settled = 0;
+	uint32_t t;
+
+	srand(17);
+	source_start(&source, 120.0, 200);
+	for (t = 0; t < 8 * MIDI_SYNC_PPQN; t++) {
+		source_tick(&source, true);
+	}
+	source.period = TICK_US_SCALE / 132.0;
+	for (t = 1; t <= 16 * MIDI_SYNC_PPQN; t++) {
+		source_tick(&source, true);
+		most = (tempo_error(&source) > most) ? tempo_error(&source) : most;
+		if (fabs(tempo_error(&source)) >= 0.5) {
+			settled = t;
+		}
+	}
+	printf("  120 -> 132 BPM: within 0.5 BPM after %u ticks, overshoot %.2f BPM\n", settled, most);
+	CHECK(settled < 4 * MIDI_SYNC_PPQN);
+	CHECK(most < 3.0);
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_LOCKED);
+}
+
+// A tick lost on the way is counted in the position and doesn't upset the loop
+static void test_missed_tick(void)
+{
+	source_t source;
+	uint32_t tempo;
+	uint32_t t;
+
+	srand(17);
+	source_start(&source, 120.0, 200);
+	for (t = 0; t < 8 * MIDI_SYNC_PPQN; t++) {
+		source_tick(&source, true);
+	}
+	tempo = MIDI_Sync_Get_Tempo();
+	source_tick(&source, false);
+	source_tick(&source, true);
+	CHECK(abs(phase_error(&source)) < 500);
+	CHECK(abs((int32_t)(MIDI_Sync_Get_Tempo() - tempo)) < 50);
+	CHECK_EQ(MIDI_Sync_Get_Position(MIDI_Sync_Time_At(source.ticks * MIDI_SYNC_POSITION_SCALE)) / MIDI_SYNC_POSITION_SCALE,
+			source.ticks);
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_LOCKED);
+}
+
+/*
+ * Ticks delayed by half a period, one at a time, are thrown out and the loop
+ * carries on as if they'd been on time. A run of them, a source that has
+ * really moved, starts the loop over.
+ */
+static void test_outliers(void)
+{
+	midi_event_t clock = midi_event_make(SOURCE, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	source_t source;
+	tracking_t tracking = { 0 };
+	uint32_t t;
+
+	srand(17);
+	source_start(&source, 120.0, 200);
+	for (t = 0; t < 8 * MIDI_SYNC_PPQN; t++) {
+		source_tick(&source, true);
+	}
+	for (t = 0; t < 40 * MIDI_SYNC_PPQN; t++) {
+		if ((t % 7) == 3) {
+			source.time += source.period;
+			source.ticks++;
+			MIDI_Sync_Input(&clock, source_arrival(&source) + (uint32_t)(source.period / 2));
+		} else {
+			source_tick(&source, true);
+		}
+		tracking_add(&tracking, phase_error(&source));
+	}
+	printf("  one tick in 7 half a period late: tempo %+.3f BPM, tick error rms %.0f max %d us\n",
+			tempo_error(&source), tracking_rms(&tracking), tracking.worst);
+	CHECK(fabs(tempo_error(&source)) < 0.2);
+	CHECK(tracking.worst < (int32_t)(source.period / 10));
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_LOCKED);
+
+	// The source shifts by half a period for good
+	source.time += source.period / 2;
+	for (t = 0; t < MIDI_SYNC_MAX_OUTLIERS; t++) {
+		source_tick(&source, true);
+	}
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_ACQUIRING);
+	for (t = 0; t < MIDI_SYNC_ACQUIRE_TICKS + 1; t++) {
+		source_tick(&source, true);
+	}
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_LOCKED);
+	CHECK(fabs(tempo_error(&source)) < 1.2);
+}
+
+// Silence for the loss time drops the clock once, and the next tick starts over
+static void test_loss(void)
+{
+	source_t source;
+	uint32_t last = 0;
+	uint32_t t;
+
+	source_start(&source, 120.0, 0);
+	for (t = 0; t < 4 * MIDI_SYNC_PPQN; t++) {
+		last = source_tick(&source, true);
+	}
+	CHECK(MIDI_Sync_Is_Running());
+	CHECK(!MIDI_Sync_Process(last + (uint32_t)(source.period * (MIDI_SYNC_LOSS_PERIODS - 1))));
+	CHECK(MIDI_Sync_Process(last + (uint32_t)(source.period * (MIDI_SYNC_LOSS_PERIODS + 1))));
+	CHECK(!MIDI_Sync_Process(last + (uint32_t)(source.period * (MIDI_SYNC_LOSS_PERIODS + 2))));
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_NONE);
+	CHECK_EQ(MIDI_Sync_Get_Tempo(), 0);
+	CHECK(!MIDI_Sync_Is_Running());
+
+	source.time += source.period * 20;
+	source_tick(&source, true);
+	CHECK_EQ(MIDI_Sync_Get_State(), MIDI_SYNC_ACQUIRING);
+}
+
+// Song position pointer and stop; other ports' clocks are ignored
+static void test_position(void)
+{
+	midi_event_t spp = midi_event_make(SOURCE, MIDI_CIN_COMMON_3, 0xF2, 0x10, 0x01);
+	midi_event_t stop = midi_event_make(SOURCE, MIDI_CIN_SINGLE_BYTE, 0xFC, 0, 0);
+	midi_event_t other = midi_event_make(SOURCE + 1, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	source_t source;
+	uint32_t at;
+	uint32_t t;
+
+	source_start(&source, 120.0, 0);
+	for (t = 0; t < 4 * MIDI_SYNC_PPQN; t++) {
+		source_tick(&source, true);
+	}
+	at = source_tick(&source, true);
+	MIDI_Sync_Input(&other, at + 10);
+	CHECK_EQ(MIDI_Sync_Get_Position(at), source.ticks * MIDI_SYNC_POSITION_SCALE);
+	CHECK_EQ(MIDI_Sync_Get_Position(at + (uint32_t)(source.period / 2)),
+			source.ticks * MIDI_SYNC_POSITION_SCALE + (MIDI_SYNC_POSITION_SCALE - 1) / 2);
+
+	MIDI_Sync_Input(&stop, at + 100);
+	CHECK(!MIDI_Sync_Is_Running());
+	MIDI_Sync_Input(&spp, at + 200);
+	CHECK_EQ(MIDI_Sync_Get_Position(at + 5000), (0x10 + (0x01 << 7)) * 6 * MIDI_SYNC_POSITION_SCALE);
+	source_tick(&source, true);
+	CHECK_EQ(MIDI_Sync_Get_Position(at + 5000), (0x10 + (0x01 << 7)) * 6 * MIDI_SYNC_POSITION_SCALE);
+}
+
+int main(void)
+{
+	TEST_RUN(test_lock);
+	TEST_RUN(test_step);
+	TEST_RUN(test_missed_tick);
+	TEST_RUN(test_outliers);
+	TEST_RUN(test_loss);
+	TEST_RUN(test_position);
+	return TEST_END();
+}
@@ -0,0 +1,196 @@
+/*
+ * test_midi_tx.c
+ *
+ * MIDI OUT through the TX ring and DMA: byte timing, transfers split at the
+ * ring's wrap, running status, and the real-time lane cutting in on a
+ * transfer part way.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "midi_time.h"
+
+static UART_HandleTypeDef uart;
+static midi_port_t port;
+static bool tick_at_tx_end;
+
+// main.c's, with the option of the TIM2 tick cutting in before it gets going
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (tick_at_tx_end) {
+		tick_at_tx_end = false;
+		MIDI_Send_Realtime(&port, 0xF8);
+	}
+	MIDI_UART_Transmit_End(huart);
+}
+
+// Let the transmitter run dry, and forget what it sent
+static void drain(void)
+{
+	while (uart.tx_busy || uart.tx_shifting) {
+		Fake_Time_Advance(MIDI_BYTE_TIME_US);
+	}
+	Fake_Time_Advance(10000);
+	uart.wire_len = 0;
+}
+
+static void test_back_to_back(void)
+{
+	const uint8_t expect[] = { 0x90, 60, 100, 0x91, 62, 101, 0xB0, 7, 90 };
+	uint32_t i;
+
+	drain();
+	MIDI_Set_Running_Status(&port, false, 0);
+	CHECK_EQ(MIDI_Send_NoteOnMsg(&port, 1, 60, 100), MIDI_OK);
+	CHECK_EQ(MIDI_Send_NoteOnMsg(&port, 2, 62, 101), MIDI_OK);
+	CHECK_EQ(MIDI_Send_CCMsg(&port, 1, 7, 90), MIDI_OK);
+	Fake_Time_Advance(sizeof(expect) * MIDI_BYTE_TIME_US);
+
+	CHECK_EQ(uart.wire_len, sizeof(expect));
+	CHECK(memcmp(uart.wire, expect, sizeof(expect)) == 0);
+	for (i = 1; i < uart.wire_len; i++) {
+		CHECK_EQ(uart.wire_times[i] - uart.wire_times[i - 1], MIDI_BYTE_TIME_US);
+	}
+	CHECK(port.state.last_tx_complete);
+}
+
+// Let what's queued go out, keeping it on the wire
+static void finish(void)
+{
+	while (uart.tx_busy || uart.tx_shifting) {
+		Fake_Time_Advance(MIDI_BYTE_TIME_US);
+	}
+}
+
+// Messages queued across the end of the ring go out as two transfers, in order
+static void test_wrap(void)
+{
+	static uint8_t sent[3 * MIDI_BUFFER_SIZE];
+	uint8_t message[100];
+	uint32_t spans = port.stats.tx_spans;
+	uint32_t len = 0;
+	uint16_t i;
+
+	drain();
+	while (len + sizeof(message) <= sizeof(sent)) {
+		message[0] = 0xF0;
+		for (i = 1; i < sizeof(message) - 1; i++) {
+			message[i] = (len + i) & 0x7F;
+		}
+		message[sizeof(message) - 1] = 0xF7;
+		if (MIDI_Send_RawBytes(&port, message, sizeof(message)) == MIDI_OK) {
+			memcpy(&sent[len], message, sizeof(message));
+			len += sizeof(message);
+		} else {
+			Fake_Time_Advance(sizeof(message) * MIDI_BYTE_TIME_US);
+		}
+	}
+	finish();
+
+	CHECK_EQ(uart.wire_len, len);
+	CHECK(memcmp(uart.wire, sent, len) == 0);
+	CHECK(port.stats.tx_spans - spans > len / MIDI_BUFFER_SIZE);
+	CHECK(port.tx_ring.read_pos == port.tx_ring.write_pos);
+}
+
+static void test_running_status(void)
+{
+	const uint8_t expect[] = { 0x90, 60, 100, 62, 101, 0x80, 60, 127, 0x90, 64, 100 };
+
+	drain();
+	MIDI_Set_Running_Status(&port, true, 500);
+	MIDI_Send_NoteOnMsg(&port, 1, 60, 100);
+	MIDI_Send_NoteOnMsg(&port, 1, 62, 101);
+	MIDI_Send_NoteOffMsg(&port, 1, 60);
+	finish();
+	Fake_Time_Advance(500000); // Status refreshed after this long
+	MIDI_Send_NoteOnMsg(&port, 1, 64, 100);
+	finish();
+
+	CHECK_EQ(uart.wire_len, sizeof(expect));
+	CHECK(memcmp(uart.wire, expect, sizeof(expect)) == 0);
+	MIDI_Set_Running_Status(&port, false, 0);
+	MIDI_Send_NoteOffMsg(&port, 1, 62);
+	MIDI_Send_NoteOffMsg(&port, 1, 64);
+}
+
+/*
+ * A clock byte cuts into a long sysex after at most the byte being sent, the
+ * sysex carries on whole after it, and the port keeps working after that.
+ */
+static void test_realtime_preempt(void)
+{
+	uint8_t sysex[200];
+	uint32_t preempts = port.stats.tx_preempts;
+	uint32_t at;
+	uint32_t i;
+
+	drain();
+	sysex[0] = 0xF0;
+	for (i = 1; i < sizeof(sysex) - 1; i++) {
+		sysex[i] = i & 0x7F;
+	}
+	sysex[sizeof(sysex) - 1] = 0xF7;
+	CHECK_EQ(MIDI_Send_RawBytes(&port, sysex, sizeof(sysex)), MIDI_OK);
+
+	Fake_Time_Advance(10 * MIDI_BYTE_TIME_US + 100);
+	at = uart.wire_len;
+	CHECK_EQ(MIDI_Send_Realtime(&port, 0xF8), MIDI_OK);
+	CHECK_EQ(port.stats.tx_preempts - preempts, 1);
+	finish();
+
+	CHECK_EQ(uart.wire_len, sizeof(sysex) + 1);
+	CHECK_EQ(uart.wire[at + 1], 0xF8);
+	CHECK(memcmp(uart.wire, sysex, at + 1) == 0);
+	CHECK(memcmp(&uart.wire[at + 2], &sysex[at + 1], sizeof(sysex) - at - 1) == 0);
+	CHECK(port.state.last_tx_complete);
+
+	// Still going
+	uart.wire_len = 0;
+	CHECK_EQ(MIDI_Send_NoteOnMsg(&port, 1, 60, 100), MIDI_OK);
+	Fake_Time_Advance(3 * MIDI_BYTE_TIME_US);
+	CHECK_EQ(uart.wire_len, 3);
+	CHECK_EQ(uart.wire[0], 0x90);
+}
+
+/*
+ * The TIM2 tick outranks the UART: a clock byte sent once a transfer is all
+ * out, but before its complete interrupt has run, leaves the transfer alone
+ * and goes out first when that interrupt starts the next.
+ */
+static void test_realtime_at_end(void)
+{
+	const uint8_t expect[] = { 0x90, 60, 100, 0xF8, 0x91, 62, 101 };
+	uint32_t aborts = uart.tx_aborts;
+	uint32_t errors = port.stats.hal_errors;
+
+	drain();
+	MIDI_Set_Running_Status(&port, false, 0);
+	CHECK_EQ(MIDI_Send_NoteOnMsg(&port, 1, 60, 100), MIDI_OK);
+	tick_at_tx_end = true;
+	CHECK_EQ(MIDI_Send_NoteOnMsg(&port, 2, 62, 101), MIDI_OK);
+	finish();
+
+	CHECK_EQ(uart.wire_len, sizeof(expect));
+	CHECK(memcmp(uart.wire, expect, sizeof(expect)) == 0);
+	CHECK_EQ(uart.tx_aborts, aborts);
+	CHECK_EQ(port.stats.hal_errors, errors);
+	CHECK(port.state.last_tx_complete);
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+	Fake_UART_Init(&uart, 0);
+	CHECK_EQ(MIDI_Init(&port, &uart, &uart), MIDI_OK);
+
+	TEST_RUN(test_back_to_back);
+	TEST_RUN(test_wrap);
+	TEST_RUN(test_running_status);
+	TEST_RUN(test_realtime_preempt);
+	TEST_RUN(test_realtime_at_end);
+	return TEST_END();
+}
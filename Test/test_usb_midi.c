@@ -0,0 +1,375 @@
+/*
+ * test_usb_midi.c
+ *
+ * The USB-MIDI function against the fake PCD, with a MIDI port on a fake
+ * UART behind it: sysex off the wire going to the host as CIN 4 to 7 event
+ * packets and coming back the other way as the same bytes, sorting by cable,
+ * the OUT endpoint holding the host off with NAKs rather than dropping
+ * anything as its queue fills and wraps, and the IN side's packets.
+ *
+ * cwhite@logicalelegance.com
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fake_platform.h"
+#include "fake_usb_device.h"
+#include "midi_time.h"
+#include "usb_midi.h"
+
+#define MAX_EVENTS 1024
+
+static UART_HandleTypeDef uart;
+static midi_port_t port;
+
+// Every packet the host can read, until the endpoint NAKs
+static uint16_t host_read(midi_event_t *events, uint16_t max)
+{
+	uint8_t packet[USB_MIDI_PACKET_SIZE];
+	uint16_t count = 0;
+	uint16_t len;
+
+	while ((len = Fake_USB_Host_In(USB_MIDI_EP_IN, packet)) != FAKE_USB_NAK) {
+		CHECK(len > 0);
+		CHECK((len % sizeof(midi_event_t)) == 0);
+		CHECK(count + len / sizeof(midi_event_t) <= max);
+		memcpy(&events[count], packet, len);
+		count += len / sizeof(midi_event_t);
+	}
+	return count;
+}
+
+static bool host_send(const midi_event_t *events, uint16_t count)
+{
+	return Fake_USB_Host_Out(USB_MIDI_EP_OUT, events, count * sizeof(midi_event_t));
+}
+
+/*
+ * A sysex as the USB-MIDI spec packs it: three bytes at a time under CIN 4,
+ * and the last one, two or three under CIN 5, 6 or 7.
+ */
+static uint16_t sysex_events(uint8_t cable, const uint8_t *bytes, uint16_t len, midi_event_t *events)
+{
+	static const uint8_t end_cin[] = { 0, MIDI_CIN_SYSEX_END_1, MIDI_CIN_SYSEX_END_2, MIDI_CIN_SYSEX_END_3 };
+	uint16_t count = 0;
+	uint16_t left;
+	uint8_t group[3];
+
+	while (len > 0) {
+		left = (len > 3) ? 3 : len;
+		memset(group, 0, sizeof(group));
+		memcpy(group, bytes, left);
+		events[count++] = midi_event_make(cable, (len > 3) ? MIDI_CIN_SYSEX : end_cin[left],
+				group[0], group[1], group[2]);
+		bytes += left;
+		len -= left;
+	}
+	return count;
+}
+
+// A run of note ons numbered from first, to follow through queues
+static void numbered(uint8_t cable, uint32_t first, uint16_t count, midi_event_t *events)
+{
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		events[i] = midi_event_make(cable, MIDI_CIN_NOTE_ON, 0x90, (first + i) & 0x7F, ((first + i) >> 7) & 0x7F);
+	}
+}
+
+static uint32_t number_of(const midi_event_t *event)
+{
+	return event->bytes[1] | ((uint32_t)event->bytes[2] << 7);
+}
+
+/*
+ * Sysex of every length from two bytes up, one cut into by a clock, in off
+ * the wire and out to the host on the port's cable packed as the spec says.
+ */
+static void test_sysex_to_host(void)
+{
+	const uint8_t cut[] = { 0xF0, 0x01, 0x02, 0xF8, 0x03, 0xF7 };
+	uint8_t bytes[16];
+	midi_event_t expect[MAX_EVENTS];
+	midi_event_t sent[MAX_EVENTS];
+	midi_event_t events[32];
+	uint32_t times[32];
+	uint16_t expected = 0;
+	uint16_t count;
+	uint16_t len;
+	uint16_t i;
+
+	for (len = 2; len <= sizeof(bytes); len++) {
+		bytes[0] = 0xF0;
+		for (i = 1; i < len - 1; i++) {
+			bytes[i] = (len * 16 + i) & 0x7F;
+		}
+		bytes[len - 1] = 0xF7;
+		Fake_UART_Rx(&uart, bytes, len);
+		expected += sysex_events(port.index, bytes, len, &expect[expected]);
+	}
+	Fake_UART_Rx(&uart, cut, sizeof(cut));
+	expect[expected++] = midi_event_make(port.index, MIDI_CIN_SYSEX, 0xF0, 0x01, 0x02);
+	expect[expected++] = midi_event_make(port.index, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0);
+	expect[expected++] = midi_event_make(port.index, MIDI_CIN_SYSEX_END_2, 0x03, 0xF7, 0);
+	Fake_UART_Rx_Idle(&uart);
+
+	do {
+		count = 32;
+		MIDI_Dequeue_Events(&port, events, times, &count);
+		for (i = 0; i < count; i++) {
+			CHECK_EQ(USB_MIDI_Send_Event(&events[i], times[i]), MIDI_OK);
+		}
+	} while (count > 0);
+
+	CHECK_EQ(host_read(sent, MAX_EVENTS), expected);
+	CHECK(memcmp(sent, expect, expected * sizeof(midi_event_t)) == 0);
+}
+
+/*
+ * Sysex from the host, split every way the spec allows and in a short packet,
+ * goes out of the port as the bytes it stands for.
+ */
+static void test_sysex_from_host(void)
+{
+	const midi_event_t packet[] = {
+		midi_event_make(0, MIDI_CIN_SYSEX, 0xF0, 0x01, 0x02),
+		midi_event_make(0, MIDI_CIN_SYSEX, 0x03, 0x04, 0x05),
+		midi_event_make(0, MIDI_CIN_SYSEX_END_1, 0xF7, 0, 0),
+		midi_event_make(0, MIDI_CIN_SYSEX, 0xF0, 0x11, 0x12),
+		midi_event_make(0, MIDI_CIN_SYSEX_END_2, 0x13, 0xF7, 0),
+		midi_event_make(0, MIDI_CIN_SYSEX, 0xF0, 0x21, 0x22),
+		midi_event_make(0, MIDI_CIN_SYSEX_END_3, 0x23, 0x24, 0xF7),
+		midi_event_make(0, MIDI_CIN_SYSEX_END_2, 0xF0, 0xF7, 0),
+		midi_event_make(0, MIDI_CIN_SYSEX_END_3, 0xF0, 0x7E, 0xF7),
+		midi_event_make(0, MIDI_CIN_NOTE_ON, 0x92, 60, 100),
+	};
+	const uint8_t expect[] = {
+		0xF0, 0x01, 0x02, 0x03, 0x04, 0x05, 0xF7,
+		0xF0, 0x11, 0x12, 0x13, 0xF7,
+		0xF0, 0x21, 0x22, 0x23, 0x24, 0xF7,
+		0xF0, 0xF7,
+		0xF0, 0x7E, 0xF7,
+		0x92, 60, 100,
+	};
+	midi_event_t events[USB_MIDI_PACKET_EVENTS];
+	uint32_t times[USB_MIDI_PACKET_EVENTS];
+	uint32_t landed;
+	uint16_t count;
+	uint16_t i;
+
+	Fake_Time_Advance(10000);
+	uart.wire_len = 0;
+	landed = MIDI_Time_Now();
+	CHECK(host_send(packet, sizeof(packet) / sizeof(packet[0])));
+	Fake_Time_Advance(1000);
+	USB_MIDI_Process();
+
+	// The slots the short packet left empty are skipped
+	count = MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(0), events, times, USB_MIDI_PACKET_EVENTS);
+	CHECK_EQ(count, sizeof(packet) / sizeof(packet[0]));
+	CHECK(memcmp(events, packet, sizeof(packet)) == 0);
+	for (i = 0; i < count; i++) {
+		CHECK_EQ(times[i], landed);
+		CHECK_EQ(MIDI_Send_Event(&port, &events[i]), MIDI_OK);
+	}
+	Fake_Time_Advance((sizeof(expect) + 1) * MIDI_BYTE_TIME_US);
+	CHECK_EQ(uart.wire_len, sizeof(expect));
+	CHECK(memcmp(uart.wire, expect, sizeof(expect)) == 0);
+}
+
+// Events go to their cable's queue in order; reserved CINs and cables with no port are dropped
+static void test_cables(void)
+{
+	const midi_event_t packet[] = {
+		midi_event_make(0, MIDI_CIN_NOTE_ON, 0x90, 1, 1),
+		midi_event_make(1, MIDI_CIN_NOTE_ON, 0x90, 2, 2),
+		midi_event_make(USB_MIDI_CABLES, MIDI_CIN_NOTE_ON, 0x90, 3, 3),
+		midi_event_make(1, MIDI_CIN_MISC, 0x90, 4, 4),
+		midi_event_make(0, MIDI_CIN_CABLE, 0x90, 5, 5),
+		midi_event_make(1, MIDI_CIN_CC, 0xB0, 6, 6),
+		midi_event_make(0, MIDI_CIN_SINGLE_BYTE, 0xF8, 0, 0),
+	};
+	midi_event_t events[USB_MIDI_PACKET_EVENTS];
+	uint32_t times[USB_MIDI_PACKET_EVENTS];
+
+	CHECK(host_send(packet, sizeof(packet) / sizeof(packet[0])));
+	USB_MIDI_Process();
+	CHECK_EQ(MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(0), events, times, USB_MIDI_PACKET_EVENTS), 2);
+	CHECK(memcmp(&events[0], &packet[0], sizeof(midi_event_t)) == 0);
+	CHECK(memcmp(&events[1], &packet[6], sizeof(midi_event_t)) == 0);
+	CHECK_EQ(MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(1), events, times, USB_MIDI_PACKET_EVENTS), 2);
+	CHECK(memcmp(&events[0], &packet[1], sizeof(midi_event_t)) == 0);
+	CHECK(memcmp(&events[1], &packet[5], sizeof(midi_event_t)) == 0);
+	CHECK(USB_MIDI_Cable_Queue(USB_MIDI_CABLES) == NULL);
+}
+
+/*
+ * Nobody taking from the cable queue: the receive queue fills a packet at a
+ * time and then the host is NAKed. Taking from it again lets the host back
+ * in, with the next packet on the far side of the wrap. Then laps of packets
+ * of every length with the cable queue emptied at odd moments, and every
+ * event arrives once, in order.
+ */
+static void test_nak_and_wrap(void)
+{
+	midi_event_t packet[USB_MIDI_PACKET_EVENTS];
+	midi_event_t events[64];
+	uint32_t times[64];
+	uint32_t sent = 0;
+	uint32_t got = 0;
+	uint32_t naks = 0;
+	uint16_t packets = 0;
+	uint16_t count;
+	uint16_t len;
+	uint16_t i;
+	uint32_t round;
+
+	// Full packets until the host is held off
+	numbered(0, sent, USB_MIDI_PACKET_EVENTS, packet);
+	while (host_send(packet, USB_MIDI_PACKET_EVENTS)) {
+		sent += USB_MIDI_PACKET_EVENTS;
+		packets++;
+		numbered(0, sent, USB_MIDI_PACKET_EVENTS, packet);
+	}
+	CHECK_EQ(packets, USB_MIDI_QUEUE_SIZE / USB_MIDI_PACKET_EVENTS);
+
+	// Sorting fills the cable queue, which frees that many packets and no more
+	USB_MIDI_Process();
+	CHECK_EQ(MIDI_Event_Queue_Length(USB_MIDI_Cable_Queue(0)), USB_MIDI_CABLE_QUEUE_SIZE);
+	for (packets = 0; host_send(packet, USB_MIDI_PACKET_EVENTS); packets++) {
+		sent += USB_MIDI_PACKET_EVENTS;
+		numbered(0, sent, USB_MIDI_PACKET_EVENTS, packet);
+	}
+	CHECK_EQ(packets, USB_MIDI_CABLE_QUEUE_SIZE / USB_MIDI_PACKET_EVENTS);
+	USB_MIDI_Process();
+	CHECK(!host_send(packet, USB_MIDI_PACKET_EVENTS));
+
+	// Taking a packet's worth lets one more in
+	count = MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(0), events, times, USB_MIDI_PACKET_EVENTS);
+	for (i = 0; i < count; i++) {
+		CHECK_EQ(number_of(&events[i]), got++);
+	}
+	USB_MIDI_Process();
+	CHECK(host_send(packet, USB_MIDI_PACKET_EVENTS));
+	sent += USB_MIDI_PACKET_EVENTS;
+	CHECK(!host_send(packet, USB_MIDI_PACKET_EVENTS));
+
+	for (round = 0; round < 4000; round++) {
+		len = (round % USB_MIDI_PACKET_EVENTS) + 1;
+		numbered(0, sent, len, packet);
+		if (host_send(packet, len)) {
+			sent += len;
+		} else {
+			naks++;
+		}
+		if ((round % 3) == 0) {
+			USB_MIDI_Process();
+			count = MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(0), events, times, (round % 37) + 1);
+			for (i = 0; i < count; i++) {
+				CHECK_EQ(number_of(&events[i]), got++ & 0x3FFF);
+			}
+		}
+	}
+	do {
+		USB_MIDI_Process();
+		count = MIDI_Event_Queue_Pop(USB_MIDI_Cable_Queue(0), events, times, 64);
+		for (i = 0; i < count; i++) {
+			CHECK_EQ(number_of(&events[i]), got++ & 0x3FFF);
+		}
+	} while (count > 0);
+	printf("  %u events from the host, %u NAKs\n", sent, naks);
+	CHECK_EQ(got, sent);
+	CHECK(naks > 0);
+	CHECK(sent > 10 * USB_MIDI_QUEUE_SIZE);
+}
+
+/*
+ * To a host that isn't reading, events queue up to the queue's size and
+ * then are refused. Once it reads they come in full packets, shorter only
+ * where the queue wraps, all in order.
+ */
+static void test_to_host(void)
+{
+	midi_event_t event;
+	midi_event_t events[MAX_EVENTS];
+	uint8_t packet[USB_MIDI_PACKET_SIZE];
+	uint32_t sent = 0;
+	uint16_t count;
+	uint16_t len;
+	uint16_t short_packets = 0;
+	uint16_t i;
+
+	// Start part way round, so the queue wraps under a full one
+	for (i = 0; i < 10; i++) {
+		numbered(1, sent++, 1, &event);
+		CHECK_EQ(USB_MIDI_Send_Event(&event, MIDI_Time_Now()), MIDI_OK);
+	}
+	CHECK_EQ(host_read(events, MAX_EVENTS), 10);
+
+	for (;;) {
+		numbered(1, sent, 1, &event);
+		if (USB_MIDI_Send_Event(&event, MIDI_Time_Now()) != MIDI_OK) {
+			break;
+		}
+		sent++;
+	}
+	CHECK_EQ(sent - 10, USB_MIDI_QUEUE_SIZE);
+
+	count = 0;
+	while ((len = Fake_USB_Host_In(USB_MIDI_EP_IN, packet)) != FAKE_USB_NAK) {
+		CHECK(len <= USB_MIDI_PACKET_SIZE);
+		short_packets += (len < USB_MIDI_PACKET_SIZE);
+		memcpy(&events[count], packet, len);
+		count += len / sizeof(midi_event_t);
+	}
+	CHECK_EQ(count, USB_MIDI_QUEUE_SIZE);
+	CHECK_EQ(short_packets, 2); // Up to the wrap, and what's left after it
+	for (i = 0; i < count; i++) {
+		CHECK_EQ(midi_event_cable(&events[i]), 1);
+		CHECK_EQ(number_of(&events[i]), 10 + i);
+	}
+}
+
+// Unconfigured, nothing goes to the host; configured again, what was waiting is gone
+static void test_configure(void)
+{
+	midi_event_t event = midi_event_make(0, MIDI_CIN_NOTE_ON, 0x90, 60, 100);
+	midi_event_t events[MAX_EVENTS];
+
+	CHECK_EQ(USB_MIDI_Send_Event(&event, 0), MIDI_OK);
+	USB_MIDI_Configure(false);
+	CHECK(!Fake_USB_Is_Open(USB_MIDI_EP_OUT));
+	CHECK(!Fake_USB_Is_Open(USB_MIDI_EP_IN));
+	CHECK_EQ(USB_MIDI_Send_Event(&event, 0), MIDI_NOT_READY);
+	CHECK(!host_send(&event, 1));
+
+	USB_MIDI_Configure(true);
+	CHECK(Fake_USB_Is_Open(USB_MIDI_EP_IN));
+	CHECK_EQ(host_read(events, MAX_EVENTS), 0);
+	CHECK(host_send(&event, 1));
+	event.header = (USB_MIDI_CABLES << 4) | MIDI_CIN_NOTE_ON;
+	CHECK_EQ(USB_MIDI_Send_Event(&event, 0), MIDI_NOT_READY);
+}
+
+int main(void)
+{
+	Fake_Platform_Reset();
+	Fake_UART_Init(&uart, 0);
+	CHECK_EQ(MIDI_Init(&port, &uart, &uart), MIDI_OK);
+	MIDI_Set_Running_Status(&port, false, 0);
+	CHECK_EQ(MIDI_Interrupt_Receive_Begin(&port), MIDI_OK);
+
+	Fake_USB_Reset();
+	Fake_USB_Set_Handlers(USB_MIDI_EP_OUT & 0x0F, USB_MIDI_Data_Out, USB_MIDI_Data_In);
+	USB_MIDI_Init();
+	USB_MIDI_Configure(true);
+
+	TEST_RUN(test_sysex_to_host);
+	TEST_RUN(test_sysex_from_host);
+	TEST_RUN(test_cables);
+	TEST_RUN(test_nak_and_wrap);
+	TEST_RUN(test_to_host);
+	TEST_RUN(test_configure);
+	return TEST_END();
+}